@@ -39,7 +39,9 @@ public:
             DataSourceBase *source,
             MetaDataBase &meta,
             const Vector<uint64_t> &offset_vector,
-            int64_t frame_duration_us);
+            bool offset_vector_complete,
+            int64_t frame_duration_us,
+            off64_t stream_size);
 
     virtual status_t start(MetaDataBase *params = NULL);
     virtual status_t stop();
@@ -54,6 +56,8 @@ protected:
 
 private:
     static const size_t kMaxFrameSize;
+    static const size_t kMaxFramesIndexedOnSeek;
+    static const size_t kMaxResyncBytes;
     DataSourceBase *mDataSource;
     MetaDataBase mMeta;
 
@@ -62,8 +66,17 @@ private:
     bool mStarted;
     MediaBufferGroup *mGroup;
 
+    // Offsets of the frames from the start of the stream, extended as frames are read in
+    // sequence. mCurrentFrame is the index of the frame at mOffset, or -1 after seeking
+    // past the indexed frames, in which case the position is only an estimate.
     Vector<uint64_t> mOffsetVector;
+    bool mOffsetVectorComplete;
+    int64_t mCurrentFrame;
     int64_t mFrameDurationUs;
+    off64_t mStreamSize;
+
+    status_t extendOffsetVector(int64_t frame, size_t maxFrames);
+    off64_t resync(off64_t offset);
 
     AACSource(const AACSource &);
     AACSource &operator=(const AACSource &);
@@ -71,6 +84,9 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// About 20s at 48kHz, the rest of the stream is indexed as it is read.
+static const off64_t kMaxFramesIndexedAtOpen = 1000;
+
 // Returns the sample rate based on the sampling frequency index
 uint32_t get_sample_rate(const uint8_t sf_index)
 {
@@ -136,7 +152,9 @@ AACExtractor::AACExtractor(
         DataSourceBase *source, off64_t offset)
     : mDataSource(source),
       mInitCheck(NO_INIT),
-      mFrameDurationUs(0) {
+      mOffsetVectorComplete(false),
+      mFrameDurationUs(0),
+      mStreamSize(-1) {
 
     uint8_t profile, sf_index, channel, header[2];
     if (mDataSource->readAt(offset + 2, &header, 2) < 2) {
@@ -158,7 +176,16 @@ AACExtractor::AACExtractor(
     int64_t duration = 0;
 
     if (mDataSource->getSize(&streamSize) == OK) {
-         while (offset < streamSize) {
+        // Only index the first frames: walking a multi-hour stream frame by frame takes
+        // seconds. The rest of the index is built as the stream is read, and the duration
+        // is estimated from the average size of the frames indexed so far.
+        const off64_t firstOffset = offset;
+        mOffsetVectorComplete = true;
+        while (offset < streamSize) {
+            if (numFrames == kMaxFramesIndexedAtOpen) {
+                mOffsetVectorComplete = false;
+                break;
+            }
             if ((frameSize = getAdtsFrameLength(source, offset, NULL)) == 0) {
                 ALOGW("prematured AAC stream (%lld vs %lld)",
                         (long long)offset, (long long)streamSize);
@@ -171,6 +198,13 @@ AACExtractor::AACExtractor(
             numFrames ++;
         }
 
+        if (!mOffsetVectorComplete) {
+            numFrames = (streamSize - firstOffset) * numFrames / (offset - firstOffset);
+            ALOGV("estimated %lld frames from the first %zu",
+                    (long long)numFrames, mOffsetVector.size());
+        }
+        mStreamSize = streamSize;
+
         // Round up and get the duration
         mFrameDurationUs = (1024 * 1000000ll + (sr - 1)) / sr;
         duration = numFrames * mFrameDurationUs;
@@ -201,7 +235,8 @@ MediaTrack *AACExtractor::getTrack(size_t index) {
         return NULL;
     }
 
-    return new AACSource(mDataSource, mMeta, mOffsetVector, mFrameDurationUs);
+    return new AACSource(mDataSource, mMeta, mOffsetVector, mOffsetVectorComplete,
+            mFrameDurationUs, mStreamSize);
 }
 
 status_t AACExtractor::getTrackMetaData(MetaDataBase &meta, size_t index, uint32_t /* flags */) {
@@ -217,12 +252,18 @@ status_t AACExtractor::getTrackMetaData(MetaDataBase &meta, size_t index, uint32
 
 // 8192 = 2^13, 13bit AAC frame size (in bytes)
 const size_t AACSource::kMaxFrameSize = 8192;
+// Seeking up to this many frames past the index extends it (about 20s at 48kHz),
+// seeking further estimates the offset and resyncs there.
+const size_t AACSource::kMaxFramesIndexedOnSeek = 1000;
+const size_t AACSource::kMaxResyncBytes = 4 * kMaxFrameSize;
 
 AACSource::AACSource(
         DataSourceBase *source,
         MetaDataBase &meta,
         const Vector<uint64_t> &offset_vector,
-        int64_t frame_duration_us)
+        bool offset_vector_complete,
+        int64_t frame_duration_us,
+        off64_t stream_size)
     : mDataSource(source),
       mMeta(meta),
       mOffset(0),
@@ -230,7 +271,10 @@ AACSource::AACSource(
       mStarted(false),
       mGroup(NULL),
       mOffsetVector(offset_vector),
-      mFrameDurationUs(frame_duration_us) {
+      mOffsetVectorComplete(offset_vector_complete),
+      mCurrentFrame(0),
+      mFrameDurationUs(frame_duration_us),
+      mStreamSize(stream_size) {
 }
 
 AACSource::~AACSource() {
@@ -248,6 +292,7 @@ status_t AACSource::start(MetaDataBase * /* params */) {
         mOffset = mOffsetVector.itemAt(0);
     }
 
+    mCurrentFrame = 0;
     mCurrentTimeUs = 0;
     mGroup = new MediaBufferGroup;
     mGroup->add_buffer(MediaBufferBase::Create(kMaxFrameSize));
@@ -271,6 +316,52 @@ status_t AACSource::getFormat(MetaDataBase &meta) {
     return OK;
 }
 
+// Indexes the frames following the last indexed one, up to 'frame' included and at most
+// maxFrames of them.
+status_t AACSource::extendOffsetVector(int64_t frame, size_t maxFrames) {
+    if (mOffsetVector.empty()) {
+        return ERROR_END_OF_STREAM;
+    }
+    off64_t offset = mOffsetVector.top();
+    size_t frameSize = getAdtsFrameLength(mDataSource, offset, NULL);
+    for (size_t i = 0; frameSize != 0 && i < maxFrames
+            && (int64_t)mOffsetVector.size() <= frame; ++i) {
+        offset += frameSize;
+        if ((frameSize = getAdtsFrameLength(mDataSource, offset, NULL)) == 0) {
+            break;
+        }
+        mOffsetVector.push(offset);
+    }
+    if (frameSize == 0) {
+        mOffsetVectorComplete = true;
+    }
+    return (int64_t)mOffsetVector.size() > frame ? OK : ERROR_END_OF_STREAM;
+}
+
+// Returns the offset of the first ADTS header at or after 'offset' that is followed by
+// another one, or -1 if there is none within kMaxResyncBytes.
+off64_t AACSource::resync(off64_t offset) {
+    uint8_t buffer[1024];
+    for (off64_t base = offset; base < offset + (off64_t)kMaxResyncBytes;
+            base += sizeof(buffer) - 1) {
+        ssize_t n = mDataSource->readAt(base, buffer, sizeof(buffer));
+        if (n < 2) {
+            return -1;
+        }
+        for (ssize_t i = 0; i + 1 < n; ++i) {
+            if (buffer[i] != 0xff || (buffer[i + 1] & 0xf6) != 0xf0) {
+                continue;
+            }
+            size_t frameSize = getAdtsFrameLength(mDataSource, base + i, NULL);
+            if (frameSize != 0 && (base + i + (off64_t)frameSize == mStreamSize
+                    || getAdtsFrameLength(mDataSource, base + i + frameSize, NULL) != 0)) {
+                return base + i;
+            }
+        }
+    }
+    return -1;
+}
+
 status_t AACSource::read(
         MediaBufferBase **out, const ReadOptions *options) {
     *out = NULL;
@@ -280,18 +371,45 @@ status_t AACSource::read(
     if (options && options->getSeekTo(&seekTimeUs, &mode)) {
         if (mFrameDurationUs > 0) {
             int64_t seekFrame = seekTimeUs / mFrameDurationUs;
-            if (seekFrame < 0 || seekFrame >= (int64_t)mOffsetVector.size()) {
+            if (seekFrame >= (int64_t)mOffsetVector.size() && !mOffsetVectorComplete
+                    && (size_t)(seekFrame - mOffsetVector.size()) < kMaxFramesIndexedOnSeek) {
+                extendOffsetVector(seekFrame, kMaxFramesIndexedOnSeek);
+            }
+            if (seekFrame < 0 || (seekFrame >= (int64_t)mOffsetVector.size()
+                    && (mOffsetVectorComplete || mOffsetVector.size() < 2))) {
                 android_errorWriteLog(0x534e4554, "70239507");
                 return ERROR_MALFORMED;
             }
             mCurrentTimeUs = seekFrame * mFrameDurationUs;
 
-            mOffset = mOffsetVector.itemAt(seekFrame);
+            if (seekFrame < (int64_t)mOffsetVector.size()) {
+                mCurrentFrame = seekFrame;
+                mOffset = mOffsetVector.itemAt(seekFrame);
+            } else {
+                // Not indexed yet: estimate the offset from the average frame size so far,
+                // then look for the next frame from there. The timestamps that follow are
+                // as accurate as that estimate.
+                size_t lastFrame = mOffsetVector.size() - 1;
+                double averageFrameSize =
+                        (double)(mOffsetVector.top() - mOffsetVector.itemAt(0)) / lastFrame;
+                off64_t offset = mOffsetVector.top()
+                        + (off64_t)((seekFrame - lastFrame) * averageFrameSize);
+                if ((offset = resync(offset)) < 0) {
+                    return ERROR_END_OF_STREAM;
+                }
+                ALOGV("seek to unindexed frame %lld, estimated at offset %lld",
+                        (long long)seekFrame, (long long)offset);
+                mCurrentFrame = -1;
+                mOffset = offset;
+            }
         }
     }
 
     size_t frameSize, frameSizeWithoutHeader, headerSize;
     if ((frameSize = getAdtsFrameLength(mDataSource, mOffset, &headerSize)) == 0) {
+        if (mCurrentFrame == (int64_t)mOffsetVector.size()) {
+            mOffsetVectorComplete = true;
+        }
         return ERROR_END_OF_STREAM;
     }
 
@@ -314,6 +432,12 @@ status_t AACSource::read(
     buffer->meta_data().setInt64(kKeyTime, mCurrentTimeUs);
     buffer->meta_data().setInt32(kKeyIsSyncFrame, 1);
 
+    if (mCurrentFrame >= 0) {
+        if (mCurrentFrame == (int64_t)mOffsetVector.size() && !mOffsetVectorComplete) {
+            mOffsetVector.push(mOffset);
+        }
+        mCurrentFrame++;
+    }
     mOffset += frameSize;
     mCurrentTimeUs += mFrameDurationUs;
 
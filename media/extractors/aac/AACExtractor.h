@@ -47,8 +47,11 @@ private:
     MetaDataBase mMeta;
     status_t mInitCheck;
 
+    // Offsets of the first frames only, the sources extend it as they read; see AACSource.
     Vector<uint64_t> mOffsetVector;
+    bool mOffsetVectorComplete;
     int64_t mFrameDurationUs;
+    off64_t mStreamSize;
 
     AACExtractor(const AACExtractor &);
     AACExtractor &operator=(const AACExtractor &);
@@ -37,8 +37,9 @@ public:
             DataSourceBase *source,
             MetaDataBase &meta,
             bool isWide,
-            const off64_t *offset_table,
-            size_t offset_table_length);
+            const Vector<off64_t> &offset_table,
+            bool offset_table_complete,
+            off64_t stream_size);
 
     virtual status_t start(MetaDataBase *params = NULL);
     virtual status_t stop();
@@ -61,8 +62,16 @@ private:
     bool mStarted;
     MediaBufferGroup *mGroup;
 
-    off64_t mOffsetTable[OFFSET_TABLE_LEN];
-    size_t mOffsetTableLength;
+    // Offsets of every 50th frame, extended as frames are read in sequence. mCurrentFrame
+    // is the index of the frame at mOffset, or -1 after seeking past the table, in which
+    // case the position is only an estimate.
+    Vector<off64_t> mOffsetTable;
+    bool mOffsetTableComplete;
+    int64_t mCurrentFrame;
+    off64_t mStreamSize;
+
+    status_t extendOffsetTable(size_t index);
+    off64_t resync(off64_t offset);
 
     AMRSource(const AMRSource &);
     AMRSource &operator=(const AMRSource &);
@@ -70,6 +79,21 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static const size_t kFramesPerTableEntry = 50;  // 1s
+// Only this many frames (1min) are walked at open time, the rest of the offset table is
+// built as the stream is read.
+static const size_t kMaxFramesScannedAtOpen = 3000;
+// Seeking up to this many frames past the offset table extends it, seeking further
+// estimates the offset and resyncs there.
+static const size_t kMaxFramesScannedOnSeek = 3000;
+// A resync point is only accepted if this many valid frames follow back to back.
+static const size_t kResyncFrames = 8;
+static const size_t kMaxResyncBytes = 4096;
+
+static bool isLegalFrameType(bool isWide, unsigned FT) {
+    return !(FT > 15 || (isWide && FT > 9 && FT < 14) || (!isWide && FT > 11 && FT < 15));
+}
+
 static size_t getFrameSize(bool isWide, unsigned FT) {
     static const size_t kFrameSizeNB[16] = {
         95, 103, 118, 134, 148, 159, 204, 244,
@@ -85,7 +109,7 @@ static size_t getFrameSize(bool isWide, unsigned FT) {
         0 // no data
     };
 
-    if (FT > 15 || (isWide && FT > 9 && FT < 14) || (!isWide && FT > 11 && FT < 15)) {
+    if (!isLegalFrameType(isWide, FT)) {
         ALOGE("illegal AMR frame type %d", FT);
         return 0;
     }
@@ -147,7 +171,8 @@ static bool SniffAMR(
 AMRExtractor::AMRExtractor(DataSourceBase *source)
     : mDataSource(source),
       mInitCheck(NO_INIT),
-      mOffsetTableLength(0) {
+      mOffsetTableComplete(false),
+      mStreamSize(-1) {
     float confidence;
     if (!SniffAMR(mDataSource, &mIsWide, &confidence)) {
         return;
@@ -160,24 +185,29 @@ AMRExtractor::AMRExtractor(DataSourceBase *source)
     mMeta.setInt32(kKeyChannelCount, 1);
     mMeta.setInt32(kKeySampleRate, mIsWide ? 16000 : 8000);
 
-    off64_t offset = mIsWide ? 9 : 6;
+    const off64_t headerSize = mIsWide ? 9 : 6;
+    off64_t offset = headerSize;
     off64_t streamSize;
     size_t frameSize, numFrames = 0;
     int64_t duration = 0;
 
     if (mDataSource->getSize(&streamSize) == OK) {
-         while (offset < streamSize) {
-             status_t status = getFrameSizeByOffset(source, offset, mIsWide, &frameSize);
-             if (status == ERROR_END_OF_STREAM) {
-                 break;
-             } else if (status != OK) {
+        mOffsetTableComplete = true;
+        while (offset < streamSize) {
+            if (numFrames == kMaxFramesScannedAtOpen) {
+                mOffsetTableComplete = false;
+                break;
+            }
+            status_t status = getFrameSizeByOffset(source, offset, mIsWide, &frameSize);
+            if (status == ERROR_END_OF_STREAM) {
+                break;
+            } else if (status != OK) {
                 return;
             }
 
-            if ((numFrames % 50 == 0) && (numFrames / 50 < OFFSET_TABLE_LEN)) {
-                CHECK_EQ(mOffsetTableLength, numFrames / 50);
-                mOffsetTable[mOffsetTableLength] = offset - (mIsWide ? 9: 6);
-                mOffsetTableLength ++;
+            if (numFrames % kFramesPerTableEntry == 0) {
+                CHECK_EQ(mOffsetTable.size(), numFrames / kFramesPerTableEntry);
+                mOffsetTable.push(offset - headerSize);
             }
 
             offset += frameSize;
@@ -185,6 +215,12 @@ AMRExtractor::AMRExtractor(DataSourceBase *source)
             numFrames ++;
         }
 
+        if (!mOffsetTableComplete) {
+            // Estimate the duration from the average size of the frames walked so far.
+            duration = (streamSize - headerSize) * duration / (offset - headerSize);
+        }
+        mStreamSize = streamSize;
+
         mMeta.setInt64(kKeyDuration, duration);
     }
 
@@ -214,7 +250,7 @@ MediaTrack *AMRExtractor::getTrack(size_t index) {
     }
 
     return new AMRSource(mDataSource, mMeta, mIsWide,
-            mOffsetTable, mOffsetTableLength);
+            mOffsetTable, mOffsetTableComplete, mStreamSize);
 }
 
 status_t AMRExtractor::getTrackMetaData(MetaDataBase &meta, size_t index, uint32_t /* flags */) {
@@ -230,7 +266,8 @@ status_t AMRExtractor::getTrackMetaData(MetaDataBase &meta, size_t index, uint32
 
 AMRSource::AMRSource(
         DataSourceBase *source, MetaDataBase &meta,
-        bool isWide, const off64_t *offset_table, size_t offset_table_length)
+        bool isWide, const Vector<off64_t> &offset_table, bool offset_table_complete,
+        off64_t stream_size)
     : mDataSource(source),
       mMeta(meta),
       mIsWide(isWide),
@@ -238,10 +275,10 @@ AMRSource::AMRSource(
       mCurrentTimeUs(0),
       mStarted(false),
       mGroup(NULL),
-      mOffsetTableLength(offset_table_length) {
-    if (mOffsetTableLength > 0 && mOffsetTableLength <= OFFSET_TABLE_LEN) {
-        memcpy ((char*)mOffsetTable, (char*)offset_table, sizeof(off64_t) * mOffsetTableLength);
-    }
+      mOffsetTable(offset_table),
+      mOffsetTableComplete(offset_table_complete),
+      mCurrentFrame(0),
+      mStreamSize(stream_size) {
 }
 
 AMRSource::~AMRSource() {
@@ -254,6 +291,7 @@ status_t AMRSource::start(MetaDataBase * /* params */) {
     CHECK(!mStarted);
 
     mOffset = mIsWide ? 9 : 6;
+    mCurrentFrame = 0;
     mCurrentTimeUs = 0;
     mGroup = new MediaBufferGroup;
     mGroup->add_buffer(MediaBufferBase::Create(128));
@@ -277,31 +315,111 @@ status_t AMRSource::getFormat(MetaDataBase &meta) {
     return OK;
 }
 
+// Walks the frames following the last table entry until the table has entry 'index',
+// or at most kMaxFramesScannedOnSeek frames.
+status_t AMRSource::extendOffsetTable(size_t index) {
+    const off64_t headerSize = mIsWide ? 9 : 6;
+    off64_t offset = mOffsetTable.top() + headerSize;
+    size_t frame = (mOffsetTable.size() - 1) * kFramesPerTableEntry;
+    for (size_t i = 0; i < kMaxFramesScannedOnSeek && mOffsetTable.size() <= index; ++i) {
+        size_t size;
+        status_t err = getFrameSizeByOffset(mDataSource, offset, mIsWide, &size);
+        if (err != OK) {
+            mOffsetTableComplete = true;
+            return err;
+        }
+        offset += size;
+        if (++frame % kFramesPerTableEntry == 0) {
+            mOffsetTable.push(offset - headerSize);
+        }
+    }
+    return mOffsetTable.size() > index ? OK : ERROR_END_OF_STREAM;
+}
+
+// Returns the offset of the first frame at or after 'offset' that is followed by
+// kResyncFrames - 1 valid frames, or -1 if there is none within kMaxResyncBytes.
+off64_t AMRSource::resync(off64_t offset) {
+    // room for the frames to validate after the last candidate, 61 bytes at most each
+    uint8_t buffer[1024 + kResyncFrames * 64];
+    for (off64_t base = offset; base < offset + (off64_t)kMaxResyncBytes; base += 1024) {
+        ssize_t n = mDataSource->readAt(base, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < n && i < 1024; ++i) {
+            ssize_t pos = i;
+            size_t frames = 0;
+            while (frames < kResyncFrames && pos < n) {
+                // padding bits must be 0, and no need to log about junk
+                unsigned FT = (buffer[pos] >> 3) & 0x0f;
+                if ((buffer[pos] & 0x83) || !isLegalFrameType(mIsWide, FT)) {
+                    break;
+                }
+                pos += getFrameSize(mIsWide, FT);
+                frames++;
+            }
+            // accept fewer frames if the stream ends first
+            if (frames == kResyncFrames || (frames > 0 && base + pos == mStreamSize)) {
+                return base + i;
+            }
+        }
+    }
+    return -1;
+}
+
 status_t AMRSource::read(
         MediaBufferBase **out, const ReadOptions *options) {
     *out = NULL;
 
     int64_t seekTimeUs;
     ReadOptions::SeekMode mode;
-    if (mOffsetTableLength > 0 && options && options->getSeekTo(&seekTimeUs, &mode)) {
+    if (mOffsetTable.size() > 0 && options && options->getSeekTo(&seekTimeUs, &mode)) {
         size_t size;
         int64_t seekFrame = seekTimeUs / 20000ll;  // 20ms per frame.
+        if (seekFrame < 0) {
+            seekFrame = 0;
+        }
         mCurrentTimeUs = seekFrame * 20000ll;
 
-        size_t index = seekFrame < 0 ? 0 : seekFrame / 50;
-        if (index >= mOffsetTableLength) {
-            index = mOffsetTableLength - 1;
+        size_t index = seekFrame / kFramesPerTableEntry;
+        if (index >= mOffsetTable.size() && !mOffsetTableComplete
+                && (index - mOffsetTable.size()) * kFramesPerTableEntry
+                        < kMaxFramesScannedOnSeek) {
+            extendOffsetTable(index);
         }
 
-        mOffset = mOffsetTable[index] + (mIsWide ? 9 : 6);
+        if (index >= mOffsetTable.size() && !mOffsetTableComplete
+                && mOffsetTable.size() > 1) {
+            // Not in the table yet: estimate the offset from the average frame size so far,
+            // then look for the next frame from there. The timestamps that follow are as
+            // accurate as that estimate.
+            int64_t lastFrame = (mOffsetTable.size() - 1) * kFramesPerTableEntry;
+            double averageFrameSize = (double)mOffsetTable.top() / lastFrame;
+            off64_t offset = mOffsetTable.top() + (mIsWide ? 9 : 6)
+                    + (off64_t)((seekFrame - lastFrame) * averageFrameSize);
+            if ((offset = resync(offset)) < 0) {
+                return ERROR_END_OF_STREAM;
+            }
+            ALOGV("seek to unindexed frame %lld, estimated at offset %lld",
+                    (long long)seekFrame, (long long)offset);
+            mCurrentFrame = -1;
+            mOffset = offset;
+        } else {
+            if (index >= mOffsetTable.size()) {
+                index = mOffsetTable.size() - 1;
+            }
+
+            mOffset = mOffsetTable[index] + (mIsWide ? 9 : 6);
 
-        for (size_t i = 0; i< seekFrame - index * 50; i++) {
-            status_t err;
-            if ((err = getFrameSizeByOffset(mDataSource, mOffset,
-                            mIsWide, &size)) != OK) {
-                return err;
+            for (size_t i = 0; i< seekFrame - index * kFramesPerTableEntry; i++) {
+                status_t err;
+                if ((err = getFrameSizeByOffset(mDataSource, mOffset,
+                                mIsWide, &size)) != OK) {
+                    return err;
+                }
+                mOffset += size;
             }
-            mOffset += size;
+            mCurrentFrame = seekFrame;
         }
     }
 
@@ -309,6 +427,9 @@ status_t AMRSource::read(
     ssize_t n = mDataSource->readAt(mOffset, &header, 1);
 
     if (n < 1) {
+        if (mCurrentFrame >= 0) {
+            mOffsetTableComplete = true;
+        }
         return ERROR_END_OF_STREAM;
     }
 
@@ -352,6 +473,13 @@ status_t AMRSource::read(
     buffer->meta_data().setInt64(kKeyTime, mCurrentTimeUs);
     buffer->meta_data().setInt32(kKeyIsSyncFrame, 1);
 
+    if (mCurrentFrame >= 0) {
+        if (mCurrentFrame % kFramesPerTableEntry == 0 && !mOffsetTableComplete
+                && (size_t)mCurrentFrame / kFramesPerTableEntry == mOffsetTable.size()) {
+            mOffsetTable.push(mOffset - (mIsWide ? 9 : 6));
+        }
+        mCurrentFrame++;
+    }
     mOffset += frameSize;
     mCurrentTimeUs += 20000;  // Each frame is 20ms
 
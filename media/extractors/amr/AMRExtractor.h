@@ -21,12 +21,12 @@
 #include <utils/Errors.h>
 #include <media/MediaExtractor.h>
 #include <media/stagefright/MetaDataBase.h>
+#include <utils/Vector.h>
 
 namespace android {
 
 struct AMessage;
 class String8;
-#define OFFSET_TABLE_LEN    300
 
 class AMRExtractor : public MediaExtractor {
 public:
@@ -48,8 +48,10 @@ private:
     status_t mInitCheck;
     bool mIsWide;
 
-    off64_t mOffsetTable[OFFSET_TABLE_LEN]; //5 min
-    size_t mOffsetTableLength;
+    // offset of every 50th frame (1s), only for the first frames, see AMRSource
+    Vector<off64_t> mOffsetTable;
+    bool mOffsetTableComplete;
+    off64_t mStreamSize;
 
     AMRExtractor(const AMRExtractor &);
     AMRExtractor &operator=(const AMRExtractor &);
@@ -934,6 +934,7 @@ MatroskaExtractor::MatroskaExtractor(DataSourceBase *source)
             & (DataSourceBase::kWantsPrefetching
                 | DataSourceBase::kIsCachingDataSource))
         && mDataSource->getSize(&size) != OK;
+    mMetadataOnly = mDataSource->flags() & DataSourceBase::kIsMetadataOnly;
 
     mkvparser::EBMLHeader ebmlHeader;
     long long pos;
@@ -1015,8 +1016,9 @@ status_t MatroskaExtractor::getTrackMetaData(
         return UNKNOWN_ERROR;
     }
 
+    // Finding the thumbnails walks the clusters.
     if ((flags & kIncludeExtensiveMetaData) && !mExtractedThumbnails
-            && !isLiveStreaming()) {
+            && !isLiveStreaming() && !mMetadataOnly) {
         findThumbnails();
         mExtractedThumbnails = true;
     }
@@ -81,6 +81,7 @@ private:
     mkvparser::Segment *mSegment;
     bool mExtractedThumbnails;
     bool mIsLiveStreaming;
+    bool mMetadataOnly;
     bool mIsWebm;
     int64_t mSeekPreRollNs;
 
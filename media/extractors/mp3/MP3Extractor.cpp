@@ -36,6 +36,7 @@
 #include <media/stagefright/MediaErrors.h>
 #include <media/stagefright/MetaData.h>
 #include <utils/String8.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -209,6 +210,79 @@ static bool Resync(
     return valid;
 }
 
+// Reads through a rolling window over the source, so that frame headers can be parsed and
+// frames resynced from memory rather than with a readAt() on the source for each. Sources
+// behind a cache or a binder call pay a lot per readAt(), whatever its size.
+class MP3ReadWindow : public DataSourceBase {
+public:
+    MP3ReadWindow(DataSourceBase *source, size_t capacity);
+    virtual ~MP3ReadWindow();
+
+    virtual status_t initCheck() const { return mSource->initCheck(); }
+    virtual ssize_t readAt(off64_t offset, void *data, size_t size);
+    virtual status_t getSize(off64_t *size) { return mSource->getSize(size); }
+    virtual uint32_t flags() { return mSource->flags(); }
+
+    // Sets *data to the window content at offset, refilling the window from offset if it
+    // does not hold [offset, offset + size). Returns the number of bytes available at *data,
+    // less than size at the end of the stream, or an error. *data is valid until the next
+    // call.
+    ssize_t peek(off64_t offset, size_t size, const uint8_t **data);
+
+private:
+    DataSourceBase *mSource;
+    uint8_t *mData;
+    size_t mCapacity;
+    off64_t mOffset;        // of mData[0]
+    size_t mLength;         // valid bytes in mData
+
+    MP3ReadWindow(const MP3ReadWindow &);
+    MP3ReadWindow &operator=(const MP3ReadWindow &);
+};
+
+MP3ReadWindow::MP3ReadWindow(DataSourceBase *source, size_t capacity)
+    : mSource(source),
+      mData(new uint8_t[capacity]),
+      mCapacity(capacity),
+      mOffset(0),
+      mLength(0) {
+}
+
+MP3ReadWindow::~MP3ReadWindow() {
+    delete[] mData;
+}
+
+ssize_t MP3ReadWindow::peek(off64_t offset, size_t size, const uint8_t **data) {
+    if (offset < 0) {
+        return ERROR_MALFORMED;
+    }
+    if (offset < mOffset || offset + (off64_t)size > mOffset + (off64_t)mLength) {
+        // Only the last request of the stream refills a window that was already short.
+        ssize_t n = mSource->readAt(offset, mData, mCapacity);
+        if (n < 0) {
+            mLength = 0;
+            return n;
+        }
+        mOffset = offset;
+        mLength = n;
+    }
+    size_t available = mOffset + mLength - offset;
+    *data = mData + (offset - mOffset);
+    return available < size ? available : size;
+}
+
+ssize_t MP3ReadWindow::readAt(off64_t offset, void *data, size_t size) {
+    if (size > mCapacity) {
+        return mSource->readAt(offset, data, size);
+    }
+    const uint8_t *window;
+    ssize_t n = peek(offset, size, &window);
+    if (n > 0) {
+        memcpy(data, window, n);
+    }
+    return n;
+}
+
 class MP3Source : public MediaTrack {
 public:
     MP3Source(
@@ -229,8 +303,20 @@ protected:
 
 private:
     static const size_t kMaxFrameSize;
+    static const size_t kReadWindowSize;
+    static const size_t kMaxSeekPoints;
+    static const off64_t kMaxSeekScanBytes;
+
+    // Frame positions, about one per second, of the frames read so far in sequence from the
+    // first one. Lets files without a XING or VBRI header seek to the exact frame.
+    struct SeekPoint {
+        off64_t mPos;
+        int64_t mSample;    // of the first sample in the frame
+    };
+
     MetaDataBase &mMeta;
     DataSourceBase *mDataSource;
+    MP3ReadWindow *mReadWindow;
     off64_t mFirstFramePos;
     uint32_t mFixedHeader;
     off64_t mCurrentPos;
@@ -242,6 +328,20 @@ private:
     int64_t mBasisTimeUs;
     int64_t mSamplesRead;
 
+    Vector<SeekPoint> mSeekTable;
+    bool mSeekTableComplete;
+    // complete because the stream ends past the last seek point, rather than because the
+    // table is full or the stream is corrupt there
+    bool mSeekTableAtEnd;
+    // index of the first sample of the frame at mCurrentPos, or -1 if it is not known
+    // because the last seek was past the seek table
+    int64_t mCurrentSample;
+
+    bool parseFrameHeader(off64_t pos, size_t *frame_size, int *num_samples);
+    void addSeekPoint(off64_t pos, int64_t sample, int sample_rate);
+    void extendSeekTable(int64_t sample, int sample_rate);
+    bool seekToSample(int64_t sample, int sample_rate);
+
     MP3Source(const MP3Source &);
     MP3Source &operator=(const MP3Source &);
 };
@@ -368,6 +468,12 @@ MP3Extractor::MP3Extractor(
 
     mInitCheck = OK;
 
+    // The gapless info is only needed to decode, don't parse the id3 tag an
+    // extra time when opened for the metadata.
+    if (mDataSource->flags() & DataSourceBase::kIsMetadataOnly) {
+        return;
+    }
+
     // Get iTunes-style gapless info if present.
     // When getting the id3 tag, skip the V1 tags to prevent the source cache
     // from being iterated to the end of the file.
@@ -439,12 +545,19 @@ status_t MP3Extractor::getTrackMetaData(
 //  (8000 samples/sec * 8 bits/byte)) + 1 padding byte/frame = 2881 bytes/frame.
 // Set our max frame size to the nearest power of 2 above this size (aka, 4kB)
 const size_t MP3Source::kMaxFrameSize = (1 << 12); /* 4096 bytes */
+const size_t MP3Source::kReadWindowSize = 64 * 1024;
+// about 4.5 hours, seeks past that are estimated from the average bitrate
+const size_t MP3Source::kMaxSeekPoints = 16384;
+// how far past the seek table a seek parses frames rather than estimating the position
+const off64_t MP3Source::kMaxSeekScanBytes = 1024 * 1024;
+
 MP3Source::MP3Source(
         MetaDataBase &meta, DataSourceBase *source,
         off64_t first_frame_pos, uint32_t fixed_header,
         MP3Seeker *seeker)
     : mMeta(meta),
       mDataSource(source),
+      mReadWindow(NULL),
       mFirstFramePos(first_frame_pos),
       mFixedHeader(fixed_header),
       mCurrentPos(0),
@@ -453,7 +566,10 @@ MP3Source::MP3Source(
       mSeeker(seeker),
       mGroup(NULL),
       mBasisTimeUs(0),
-      mSamplesRead(0) {
+      mSamplesRead(0),
+      mSeekTableComplete(false),
+      mSeekTableAtEnd(false),
+      mCurrentSample(0) {
 }
 
 MP3Source::~MP3Source() {
@@ -469,11 +585,19 @@ status_t MP3Source::start(MetaDataBase *) {
 
     mGroup->add_buffer(MediaBufferBase::Create(kMaxFrameSize));
 
+    mReadWindow = new MP3ReadWindow(mDataSource, kReadWindowSize);
+
     mCurrentPos = mFirstFramePos;
     mCurrentTimeUs = 0;
 
     mBasisTimeUs = mCurrentTimeUs;
     mSamplesRead = 0;
+    mCurrentSample = 0;
+
+    if (mSeekTable.isEmpty()) {
+        SeekPoint first = { mFirstFramePos, 0 };
+        mSeekTable.push(first);
+    }
 
     mStarted = true;
 
@@ -486,6 +610,9 @@ status_t MP3Source::stop() {
     delete mGroup;
     mGroup = NULL;
 
+    delete mReadWindow;
+    mReadWindow = NULL;
+
     mStarted = false;
 
     return OK;
@@ -496,6 +623,112 @@ status_t MP3Source::getFormat(MetaDataBase &meta) {
     return OK;
 }
 
+bool MP3Source::parseFrameHeader(off64_t pos, size_t *frame_size, int *num_samples) {
+    const uint8_t *data;
+    if (mReadWindow->peek(pos, 4, &data) < 4) {
+        return false;
+    }
+    uint32_t header = U32_AT(data);
+    return (header & kMask) == (mFixedHeader & kMask)
+            && GetMPEGAudioFrameSize(header, frame_size, NULL, NULL, NULL, num_samples);
+}
+
+void MP3Source::addSeekPoint(off64_t pos, int64_t sample, int sample_rate) {
+    const SeekPoint &last = mSeekTable.top();
+    if (mSeekTableComplete || pos <= last.mPos || sample - last.mSample < sample_rate) {
+        return;
+    }
+    if (mSeekTable.size() == kMaxSeekPoints) {
+        ALOGV("seek table full at %lld", (long long)pos);
+        mSeekTableComplete = true;
+        return;
+    }
+    SeekPoint point = { pos, sample };
+    mSeekTable.push(point);
+}
+
+// Parses the frames following the last seek point, until 'sample' is covered or for at most
+// kMaxSeekScanBytes. Parsing is cheap as long as it goes through the read window.
+void MP3Source::extendSeekTable(int64_t sample, int sample_rate) {
+    off64_t pos = mSeekTable.top().mPos;
+    int64_t currentSample = mSeekTable.top().mSample;
+    const off64_t endPos = pos + kMaxSeekScanBytes;
+    while (!mSeekTableComplete && mSeekTable.top().mSample + sample_rate <= sample
+            && pos < endPos) {
+        size_t frame_size;
+        int num_samples;
+        if (!parseFrameHeader(pos, &frame_size, &num_samples)) {
+            const uint8_t *data;
+            ssize_t n = mReadWindow->peek(pos, 4, &data);
+            if (n < 0) {
+                // a read error, try again on the next seek
+                break;
+            }
+            if (n < 4) {
+                mSeekTableComplete = true;
+                mSeekTableAtEnd = true;
+            } else if (!Resync(mReadWindow, mFixedHeader, &pos, NULL, NULL)) {
+                mSeekTableComplete = true;
+            }
+            continue;
+        }
+        addSeekPoint(pos, currentSample, sample_rate);
+        pos += frame_size;
+        currentSample += num_samples;
+    }
+}
+
+// Positions the source on the frame containing 'sample', if the seek table covers it or
+// the stream ends before it.
+bool MP3Source::seekToSample(int64_t sample, int sample_rate) {
+    if (sample >= mSeekTable.top().mSample + sample_rate) {
+        if (!mSeekTableComplete) {
+            extendSeekTable(sample, sample_rate);
+        }
+        if (!mSeekTableAtEnd && sample >= mSeekTable.top().mSample + sample_rate) {
+            return false;
+        }
+    }
+
+    size_t left = 0;
+    size_t right = mSeekTable.size();
+    while (right - left > 1) {
+        size_t center = left + (right - left) / 2;
+        if (mSeekTable.itemAt(center).mSample <= sample) {
+            left = center;
+        } else {
+            right = center;
+        }
+    }
+
+    off64_t pos = mSeekTable.itemAt(left).mPos;
+    int64_t currentSample = mSeekTable.itemAt(left).mSample;
+    const off64_t endPos = pos + kMaxSeekScanBytes;
+    for (;;) {
+        size_t frame_size;
+        int num_samples;
+        if (!parseFrameHeader(pos, &frame_size, &num_samples)
+                || currentSample + num_samples > sample) {
+            // Either the frame containing the sample, or the end of the stream and
+            // read() will tell.
+            break;
+        }
+        pos += frame_size;
+        currentSample += num_samples;
+        if (pos >= endPos) {
+            // seek points are about a second apart, this is not the stream it seemed
+            return false;
+        }
+    }
+
+    ALOGV("seek to sample %lld: frame at %lld starting at sample %lld",
+            (long long)sample, (long long)pos, (long long)currentSample);
+    mCurrentPos = pos;
+    mCurrentSample = currentSample;
+    mCurrentTimeUs = currentSample * 1000000ll / sample_rate;
+    return true;
+}
+
 status_t MP3Source::read(
         MediaBufferBase **out, const ReadOptions *options) {
     *out = NULL;
@@ -503,11 +736,24 @@ status_t MP3Source::read(
     int64_t seekTimeUs;
     ReadOptions::SeekMode mode;
     bool seekCBR = false;
+    // where the bitrate estimate starts from and the bitrate in bits/sec,
+    // 0 to use the bitrate of the frame found
+    off64_t seekBasisPos = mFirstFramePos;
+    int64_t seekBasisTimeUs = 0;
+    int64_t seekBitrate = 0;
 
     if (options != NULL && options->getSeekTo(&seekTimeUs, &mode)) {
         int64_t actualSeekTimeUs = seekTimeUs;
-        if (mSeeker == NULL
-                || !mSeeker->getOffsetForTime(&actualSeekTimeUs, &mCurrentPos)) {
+        int32_t sampleRate;
+        if (mSeeker != NULL
+                && mSeeker->getOffsetForTime(&actualSeekTimeUs, &mCurrentPos)) {
+            mCurrentTimeUs = actualSeekTimeUs;
+            mCurrentSample = -1;
+        } else if (mSeeker == NULL
+                && mMeta.findInt32(kKeySampleRate, &sampleRate) && sampleRate > 0
+                && seekToSample(seekTimeUs * sampleRate / 1000000, sampleRate)) {
+            // mCurrentPos and mCurrentTimeUs set to the exact frame.
+        } else {
             int32_t bitrate;
             if (!mMeta.findInt32(kKeyBitRate, &bitrate)) {
                 // bitrate is in bits/sec.
@@ -516,11 +762,21 @@ status_t MP3Source::read(
                 return ERROR_UNSUPPORTED;
             }
 
+            if (mSeeker == NULL && mSeekTable.size() > 1) {
+                // Past the seek table: estimate from its end, with the bitrate measured over
+                // it rather than the bitrate of the first frame, it may be a VBR file without
+                // a XING header.
+                const SeekPoint &last = mSeekTable.top();
+                seekBasisPos = last.mPos;
+                seekBasisTimeUs = last.mSample * 1000000ll / sampleRate;
+                seekBitrate = (last.mPos - mFirstFramePos) * 8000000ll / seekBasisTimeUs;
+            }
+
             mCurrentTimeUs = seekTimeUs;
-            mCurrentPos = mFirstFramePos + seekTimeUs * bitrate / 8000000;
+            mCurrentPos = seekBasisPos + (seekTimeUs - seekBasisTimeUs)
+                    * (seekBitrate > 0 ? seekBitrate : bitrate) / 8000000;
+            mCurrentSample = -1;
             seekCBR = true;
-        } else {
-            mCurrentTimeUs = actualSeekTimeUs;
         }
 
         mBasisTimeUs = mCurrentTimeUs;
@@ -538,15 +794,21 @@ status_t MP3Source::read(
     int num_samples;
     int sample_rate;
     for (;;) {
-        ssize_t n = mDataSource->readAt(mCurrentPos, buffer->data(), 4);
+        const uint8_t *data;
+        ssize_t n = mReadWindow->peek(mCurrentPos, 4, &data);
         if (n < 4) {
             buffer->release();
             buffer = NULL;
 
+            if (n >= 0 && mCurrentSample >= 0 && !mSeekTableComplete) {
+                // the table went along with the frames read, up to here
+                mSeekTableComplete = true;
+                mSeekTableAtEnd = true;
+            }
             return (n < 0 ? n : ERROR_END_OF_STREAM);
         }
 
-        uint32_t header = U32_AT((const uint8_t *)buffer->data());
+        uint32_t header = U32_AT(data);
 
         if ((header & kMask) == (mFixedHeader & kMask)
             && GetMPEGAudioFrameSize(
@@ -555,7 +817,12 @@ status_t MP3Source::read(
 
             // re-calculate mCurrentTimeUs because we might have called Resync()
             if (seekCBR) {
-                mCurrentTimeUs = (mCurrentPos - mFirstFramePos) * 8000 / bitrate;
+                if (seekBitrate > 0) {
+                    mCurrentTimeUs = seekBasisTimeUs
+                            + (mCurrentPos - seekBasisPos) * 8000000ll / seekBitrate;
+                } else {
+                    mCurrentTimeUs = (mCurrentPos - mFirstFramePos) * 8000 / bitrate;
+                }
                 mBasisTimeUs = mCurrentTimeUs;
             }
 
@@ -566,7 +833,7 @@ status_t MP3Source::read(
         ALOGV("lost sync! header = 0x%08x, old header = 0x%08x\n", header, mFixedHeader);
 
         off64_t pos = mCurrentPos;
-        if (!Resync(mDataSource, mFixedHeader, &pos, NULL, NULL)) {
+        if (!Resync(mReadWindow, mFixedHeader, &pos, NULL, NULL)) {
             ALOGE("Unable to resync. Signalling end of stream.");
 
             buffer->release();
@@ -582,7 +849,7 @@ status_t MP3Source::read(
 
     CHECK(frame_size <= buffer->size());
 
-    ssize_t n = mDataSource->readAt(mCurrentPos, buffer->data(), frame_size);
+    ssize_t n = mReadWindow->readAt(mCurrentPos, buffer->data(), frame_size);
     if (n < (ssize_t)frame_size) {
         buffer->release();
         buffer = NULL;
@@ -595,6 +862,13 @@ status_t MP3Source::read(
     buffer->meta_data().setInt64(kKeyTime, mCurrentTimeUs);
     buffer->meta_data().setInt32(kKeyIsSyncFrame, 1);
 
+    if (mCurrentSample >= 0) {
+        if (mSeeker == NULL) {
+            addSeekPoint(mCurrentPos, mCurrentSample, sample_rate);
+        }
+        mCurrentSample += num_samples;
+    }
+
     mCurrentPos += frame_size;
 
     mSamplesRead += num_samples;
@@ -362,9 +362,10 @@ MPEG4Extractor::MPEG4Extractor(DataSourceBase *source, const char *mime)
       mIsHeif(false),
       mHasMoovBox(false),
       mPreferHeif(mime != NULL && !strcasecmp(mime, MEDIA_MIMETYPE_CONTAINER_HEIF)),
+      mMetadataOnly(source->flags() & DataSourceBase::kIsMetadataOnly),
       mFirstTrack(NULL),
       mLastTrack(NULL) {
-    ALOGV("mime=%s, mPreferHeif=%d", mime, mPreferHeif);
+    ALOGV("mime=%s, mPreferHeif=%d, mMetadataOnly=%d", mime, mPreferHeif, mMetadataOnly);
 }
 
 MPEG4Extractor::~MPEG4Extractor() {
@@ -516,7 +517,8 @@ status_t MPEG4Extractor::getTrackMetaData(
         }
     }();
 
-    if ((flags & kIncludeExtensiveMetaData)
+    // The thumbnail time needs the sample tables.
+    if ((flags & kIncludeExtensiveMetaData) && !mMetadataOnly
             && !track->includes_expensive_metadata) {
         track->includes_expensive_metadata = true;
 
@@ -899,7 +901,7 @@ status_t MPEG4Extractor::parseChunk(off64_t *offset, int depth) {
                     return ERROR_MALFORMED;
                 }
 
-                mLastTrack->sampleTable = new SampleTable(mDataSource);
+                mLastTrack->sampleTable = new SampleTable(mDataSource, mMetadataOnly);
             }
 
             bool isTrack = false;
@@ -1675,14 +1677,21 @@ status_t MPEG4Extractor::parseChunk(off64_t *offset, int depth) {
                 return err;
             }
 
-            size_t max_size;
-            err = mLastTrack->sampleTable->getMaxSampleSize(&max_size);
+            // Finding the largest sample reads all the sample sizes, which
+            // metadata only mode skips.
+            size_t max_size = 0;
+            if (!mMetadataOnly) {
+                err = mLastTrack->sampleTable->getMaxSampleSize(&max_size);
 
-            if (err != OK) {
-                return err;
+                if (err != OK) {
+                    return err;
+                }
             }
 
-            if (max_size != 0) {
+            if (mMetadataOnly) {
+                // Tracks are not handed out in metadata only mode, nothing
+                // reads the input size.
+            } else if (max_size != 0) {
                 // Assume that a given buffer only contains at most 10 chunks,
                 // each chunk originally prefixed with a 2 byte length will
                 // have a 4 byte header (0x00 0x00 0x00 0x01) after conversion,
@@ -3362,6 +3371,11 @@ MediaTrack *MPEG4Extractor::getTrack(size_t index) {
         return NULL;
     }
 
+    if (mMetadataOnly) {
+        ALOGE("tracks can't be read in metadata only mode");
+        return NULL;
+    }
+
     Track *track = mFirstTrack;
     while (index > 0) {
         if (track == NULL) {
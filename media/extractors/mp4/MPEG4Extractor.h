@@ -105,6 +105,9 @@ private:
     bool mIsHeif;
     bool mHasMoovBox;
     bool mPreferHeif;
+    // Opened to read the metadata only, the sample tables are not loaded and
+    // no track can be read.
+    bool mMetadataOnly;
 
     Track *mFirstTrack, *mLastTrack;
 
@@ -114,7 +114,7 @@ int32_t SampleTable::CompositionDeltaLookup::getCompositionTimeOffset(
 
 ////////////////////////////////////////////////////////////////////////////////
 
-SampleTable::SampleTable(DataSourceBase *source)
+SampleTable::SampleTable(DataSourceBase *source, bool metadataOnly)
     : mDataSource(source),
       mChunkOffsetOffset(-1),
       mChunkOffsetType(0),
@@ -137,7 +137,8 @@ SampleTable::SampleTable(DataSourceBase *source)
       mSyncSamples(NULL),
       mLastSyncSampleIndex(0),
       mSampleToChunkEntries(NULL),
-      mTotalSize(0) {
+      mTotalSize(0),
+      mMetadataOnly(metadataOnly) {
     mSampleIterator = new SampleIterator(this);
 }
 
@@ -266,6 +267,11 @@ status_t SampleTable::setSampleToChunkParams(
         return ERROR_OUT_OF_RANGE;
     }
 
+    if (mMetadataOnly) {
+        mNumSampleToChunkOffsets = 0;
+        return OK;
+    }
+
     mSampleToChunkEntries =
         new (std::nothrow) SampleToChunkEntry[mNumSampleToChunkOffsets];
     if (!mSampleToChunkEntries) {
@@ -418,6 +424,12 @@ status_t SampleTable::setTimeToSampleParams(
         return ERROR_OUT_OF_RANGE;
     }
 
+    if (mMetadataOnly) {
+        mTimeToSampleCount = 0;
+        mHasTimeToSample = true;
+        return OK;
+    }
+
     mTimeToSample = new (std::nothrow) uint32_t[mTimeToSampleCount * 2];
     if (!mTimeToSample) {
         ALOGE("Cannot allocate time-to-sample table with %llu entries.",
@@ -492,6 +504,11 @@ status_t SampleTable::setCompositionTimeToSampleParams(
         return ERROR_OUT_OF_RANGE;
     }
 
+    if (mMetadataOnly) {
+        mNumCompositionTimeDeltaEntries = 0;
+        return OK;
+    }
+
     mCompositionTimeDeltaEntries = new (std::nothrow) int32_t[2 * numEntries];
     if (!mCompositionTimeDeltaEntries) {
         ALOGE("Cannot allocate composition-time-to-sample table with %llu "
@@ -557,6 +574,11 @@ status_t SampleTable::setSyncSampleParams(off64_t data_offset, size_t data_size)
         return ERROR_OUT_OF_RANGE;
     }
 
+    if (mMetadataOnly) {
+        mSyncSampleOffset = data_offset;
+        return OK;
+    }
+
     mSyncSamples = new (std::nothrow) uint32_t[numSyncSamples];
     if (!mSyncSamples) {
         ALOGE("Cannot allocate sync sample table with %llu entries.",
@@ -32,7 +32,10 @@ struct SampleIterator;
 
 class SampleTable : public RefBase {
 public:
-    explicit SampleTable(DataSourceBase *source);
+    // A metadata only table checks the sample-to-chunk, time-to-sample and
+    // sync sample boxes without loading them: it can count its samples, but
+    // not locate or time them.
+    explicit SampleTable(DataSourceBase *source, bool metadataOnly = false);
 
     bool isValid() const;
 
@@ -145,6 +148,8 @@ private:
     // Approximate size of all tables combined.
     uint64_t mTotalSize;
 
+    bool mMetadataOnly;
+
     friend struct SampleIterator;
 
     // normally we don't round
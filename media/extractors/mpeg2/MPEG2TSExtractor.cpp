@@ -46,6 +46,7 @@ namespace android {
 using hardware::cas::V1_0::ICas;
 
 static const size_t kTSPacketSize = 188;
+static const size_t kReadBufferSize = 64 * kTSPacketSize;
 static const int kMaxDurationReadSize = 250000LL;
 static const int kMaxDurationRetry = 6;
 
@@ -127,7 +128,9 @@ MPEG2TSExtractor::MPEG2TSExtractor(DataSourceBase *source)
     : mDataSource(source),
       mParser(new ATSParser),
       mLastSyncEvent(0),
-      mOffset(0) {
+      mOffset(0),
+      mReadBuffer(new ABuffer(kReadBufferSize)) {
+    mReadBuffer->setRange(0, 0);
     init();
 }
 
@@ -325,19 +328,25 @@ void MPEG2TSExtractor::init() {
 status_t MPEG2TSExtractor::feedMore(bool isInit) {
     Mutex::Autolock autoLock(mLock);
 
-    uint8_t packet[kTSPacketSize];
-    ssize_t n = mDataSource->readAt(mOffset, packet, kTSPacketSize);
+    if (mReadBuffer->size() < kTSPacketSize) {
+        ssize_t n = mDataSource->readAt(mOffset, mReadBuffer->base(), kReadBufferSize);
 
-    if (n < (ssize_t)kTSPacketSize) {
-        if (n >= 0) {
-            mParser->signalEOS(ERROR_END_OF_STREAM);
+        if (n < (ssize_t)kTSPacketSize) {
+            if (n >= 0) {
+                mParser->signalEOS(ERROR_END_OF_STREAM);
+            }
+            return (n < 0) ? (status_t)n : ERROR_END_OF_STREAM;
         }
-        return (n < 0) ? (status_t)n : ERROR_END_OF_STREAM;
+        mReadBuffer->setRange(0, n - n % kTSPacketSize);
     }
 
+    // Feeds the buffered packets up to the next sync event, if any.
     ATSParser::SyncEvent event(mOffset);
+    size_t n = 0;
+    status_t err = mParser->feedTSPackets(
+            mReadBuffer->data(), mReadBuffer->size(), &event, &n);
     mOffset += n;
-    status_t err = mParser->feedTSPacket(packet, kTSPacketSize, &event);
+    mReadBuffer->setRange(mReadBuffer->offset() + n, mReadBuffer->size() - n);
     if (event.hasReturnedData()) {
         if (isInit) {
             mLastSyncEvent = event;
@@ -523,6 +532,7 @@ status_t MPEG2TSExtractor::seek(int64_t seekTimeUs,
     if (!shouldSeekBeyond || mOffset <= mSeekSyncPoints->valueAt(index)) {
         int64_t actualSeekTimeUs = mSeekSyncPoints->keyAt(index);
         mOffset = mSeekSyncPoints->valueAt(index);
+        mReadBuffer->setRange(0, 0);
         status_t err = queueDiscontinuityForSeek(actualSeekTimeUs);
         if (err != OK) {
             return err;
@@ -31,6 +31,7 @@
 
 namespace android {
 
+struct ABuffer;
 struct AMessage;
 struct AnotherPacketSource;
 struct ATSParser;
@@ -74,6 +75,9 @@ private:
 
     off64_t mOffset;
 
+    // Packets read from mDataSource but not fed to mParser yet, starting at mOffset.
+    sp<ABuffer> mReadBuffer;
+
     static bool isScrambledFormat(MetaDataBase &format);
 
     void init();
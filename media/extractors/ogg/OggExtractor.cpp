@@ -20,6 +20,8 @@
 
 #include "OggExtractor.h"
 
+#include <algorithm>
+
 #include <cutils/properties.h>
 #include <media/DataSourceBase.h>
 #include <media/ExtractorUtils.h>
@@ -110,6 +112,13 @@ protected:
         int64_t mTimeUs;
     };
 
+    static const size_t kMaxTOCSize = 8192;
+    static const size_t kMaxNumTOCEntries = kMaxTOCSize / sizeof(TOCEntry);
+    // how far past the table of contents a seek indexes pages rather than bisecting
+    static const off64_t kMaxTOCScanBytes = 256 * 1024;
+    static const off64_t kBisectionScanBytes = 64 * 1024;
+    static const size_t kMaxBisectionSteps = 32;
+
     DataSourceBase *mSource;
     off64_t mOffset;
     Page mCurrentPage;
@@ -125,6 +134,8 @@ protected:
     int64_t mSeekPreRollUs;
 
     off64_t mFirstDataOffset;
+    off64_t mStreamSize;
+    int64_t mDurationUs;
 
     vorbis_info mVi;
     vorbis_comment mVc;
@@ -132,7 +143,15 @@ protected:
     MetaDataBase mMeta;
     MetaDataBase mFileMeta;
 
+    // The table of contents is built incrementally from the pages read while playing and
+    // seeking, rather than by reading the whole file at open time, see addTOCEntry().
+    // It covers the pages from mFirstDataOffset up to mTOCEndOffset; seeks past that
+    // bisect the rest of the file on granule positions instead, see findPageByBisection().
     Vector<TOCEntry> mTableOfContents;
+    bool mTOCEnabled;
+    bool mTOCComplete;
+    off64_t mTOCEndOffset;
+    int64_t mTOCSpacingUs;
 
     ssize_t readPage(off64_t offset, Page *page);
     status_t findNextPage(off64_t startOffset, off64_t *pageOffset);
@@ -162,7 +181,10 @@ protected:
 
     status_t findPrevGranulePosition(off64_t pageOffset, uint64_t *granulePos);
 
-    void buildTableOfContents();
+    void addTOCEntry(off64_t pageOffset, const Page &page, size_t pageSize);
+    void extendTableOfContents(int64_t timeUs, off64_t maxBytes);
+    status_t findPageByBisection(int64_t timeUs, off64_t *pageOffset);
+    status_t findPageAtOrAfter(off64_t startOffset, int64_t timeUs, off64_t *pageOffset);
 
     MyOggExtractor(const MyOggExtractor &);
     MyOggExtractor &operator=(const MyOggExtractor &);
@@ -311,7 +333,13 @@ MyOggExtractor::MyOggExtractor(
       mMimeType(mimeType),
       mNumHeaders(numHeaders),
       mSeekPreRollUs(seekPreRollUs),
-      mFirstDataOffset(-1) {
+      mFirstDataOffset(-1),
+      mStreamSize(-1),
+      mDurationUs(-1),
+      mTOCEnabled(false),
+      mTOCComplete(false),
+      mTOCEndOffset(-1),
+      mTOCSpacingUs(0) {
     mCurrentPage.mNumSegments = 0;
 
     vorbis_info_init(&mVi);
@@ -419,7 +447,7 @@ status_t MyOggExtractor::seekToTime(int64_t timeUs) {
         timeUs = 0;
     }
 
-    if (mTableOfContents.isEmpty()) {
+    if (!mTOCEnabled) {
         // Perform approximate seeking based on avg. bitrate.
         uint64_t bps = approxBitrate();
         if (bps <= 0) {
@@ -432,6 +460,28 @@ status_t MyOggExtractor::seekToTime(int64_t timeUs) {
         return seekToOffset(pos);
     }
 
+    if (!mTOCComplete
+            && (mTableOfContents.isEmpty() || timeUs > mTableOfContents.top().mTimeUs)) {
+        // The table of contents does not reach that far yet. Extend it if the target is
+        // close to its end, otherwise locate the page without indexing everything before it.
+        extendTableOfContents(timeUs, kMaxTOCScanBytes);
+
+        if (!mTOCComplete
+                && (mTableOfContents.isEmpty() || timeUs > mTableOfContents.top().mTimeUs)) {
+            off64_t pageOffset;
+            status_t err = findPageByBisection(timeUs, &pageOffset);
+            if (err != OK) {
+                return err;
+            }
+            ALOGV("seeking to unindexed page at offset %lld", (long long)pageOffset);
+            return seekToOffset(pageOffset);
+        }
+    }
+
+    if (mTableOfContents.isEmpty()) {
+        return seekToOffset(mFirstDataOffset);
+    }
+
     size_t left = 0;
     size_t right_plus_one = mTableOfContents.size();
     while (left < right_plus_one) {
@@ -458,7 +508,17 @@ status_t MyOggExtractor::seekToTime(int64_t timeUs) {
     ALOGV("seeking to entry %zu / %zu at offset %lld",
          left, mTableOfContents.size(), (long long)entry.mPageOffset);
 
-    return seekToOffset(entry.mPageOffset);
+    // Entries are spaced out by mTOCSpacingUs, the page containing timeUs may be
+    // between this entry and the previous one.
+    off64_t pageOffset = entry.mPageOffset;
+    if (left > 0 && entry.mTimeUs > timeUs && mTOCSpacingUs > 0) {
+        if (findPageAtOrAfter(mTableOfContents.itemAt(left - 1).mPageOffset,
+                timeUs, &pageOffset) != OK) {
+            pageOffset = entry.mPageOffset;
+        }
+    }
+
+    return seekToOffset(pageOffset);
 }
 
 status_t MyOggExtractor::seekToOffset(off64_t offset) {
@@ -810,6 +870,8 @@ status_t MyOggExtractor::_readNextPacket(MediaBufferBase **out, bool calcVorbisT
         mCurrentPageSize = n;
         mNextLaceIndex = 0;
 
+        addTOCEntry(mOffset, mCurrentPage, n);
+
         if (buffer != NULL) {
             if ((mCurrentPage.mFlags & 1) == 0) {
                 // This page does not continue the packet, i.e. the packet
@@ -867,49 +929,156 @@ status_t MyOggExtractor::init() {
 
         mMeta.setInt64(kKeyDuration, durationUs);
 
-        buildTableOfContents();
+        // Seeking is cheap too, so seek by pages rather than by bitrate. The table of
+        // contents starts empty and fills up as pages are read.
+        mStreamSize = size;
+        mDurationUs = durationUs;
+        mTOCEndOffset = mFirstDataOffset;
+        mTOCEnabled = true;
     }
 
     return OK;
 }
 
-void MyOggExtractor::buildTableOfContents() {
-    off64_t offset = mFirstDataOffset;
-    Page page;
-    ssize_t pageSize;
-    while ((pageSize = readPage(offset, &page)) > 0) {
-        mTableOfContents.push();
+void MyOggExtractor::addTOCEntry(off64_t pageOffset, const Page &page, size_t pageSize) {
+    if (!mTOCEnabled || mTOCComplete || pageOffset != mTOCEndOffset) {
+        // Only pages contiguous to the indexed ones extend the table of contents.
+        return;
+    }
+    mTOCEndOffset = pageOffset + pageSize;
+
+    if (page.mGranulePosition == (uint64_t)-1) {
+        // No packet ends on this page.
+        return;
+    }
 
-        TOCEntry &entry =
-            mTableOfContents.editItemAt(mTableOfContents.size() - 1);
+    int64_t timeUs = getTimeUsOfGranule(page.mGranulePosition);
+    if (!mTableOfContents.isEmpty()
+            && timeUs < mTableOfContents.top().mTimeUs + mTOCSpacingUs) {
+        return;
+    }
 
-        entry.mPageOffset = offset;
-        entry.mTimeUs = getTimeUsOfGranule(page.mGranulePosition);
+    TOCEntry entry;
+    entry.mPageOffset = pageOffset;
+    entry.mTimeUs = timeUs;
+    mTableOfContents.push(entry);
+
+    // Limit the maximum amount of RAM we spend on the table of contents: once full,
+    // drop every other entry and only keep pages at least twice as far apart from now on.
+    if (mTableOfContents.size() > kMaxNumTOCEntries) {
+        Vector<TOCEntry> thinned;
+        thinned.setCapacity(kMaxNumTOCEntries / 2 + 1);
+        for (size_t i = 0; i < mTableOfContents.size(); i += 2) {
+            thinned.push(mTableOfContents.itemAt(i));
+        }
+        mTableOfContents = thinned;
 
-        offset += (size_t)pageSize;
+        int64_t spanUs = mTableOfContents.top().mTimeUs - mTableOfContents.itemAt(0).mTimeUs;
+        mTOCSpacingUs = spanUs / (int64_t)mTableOfContents.size();
+        ALOGV("table of contents thinned to %zu entries, %lld us apart",
+                mTableOfContents.size(), (long long)mTOCSpacingUs);
     }
+}
 
-    // Limit the maximum amount of RAM we spend on the table of contents,
-    // if necessary thin out the table evenly to trim it down to maximum
-    // size.
+void MyOggExtractor::extendTableOfContents(int64_t timeUs, off64_t maxBytes) {
+    off64_t endOffset = mTOCEndOffset + maxBytes;
+    Page page;
+    while (!mTOCComplete && mTOCEndOffset < endOffset
+            && (mTableOfContents.isEmpty() || mTableOfContents.top().mTimeUs < timeUs)) {
+        ssize_t pageSize = readPage(mTOCEndOffset, &page);
+        if (pageSize <= 0) {
+            ALOGV("table of contents complete at offset %lld (%zd)",
+                    (long long)mTOCEndOffset, pageSize);
+            mTOCComplete = true;
+            break;
+        }
+        addTOCEntry(mTOCEndOffset, page, pageSize);
+    }
+}
 
-    static const size_t kMaxTOCSize = 8192;
-    static const size_t kMaxNumTOCEntries = kMaxTOCSize / sizeof(TOCEntry);
+// Locates the page containing timeUs in the part of the file past the table of contents,
+// narrowing down the range by interpolating on the granule positions of the pages found
+// at the guessed offsets, until it is small enough to scan.
+status_t MyOggExtractor::findPageByBisection(int64_t timeUs, off64_t *pageOffset) {
+    off64_t low = mTOCEndOffset;
+    int64_t lowTimeUs = mTableOfContents.isEmpty() ? 0 : mTableOfContents.top().mTimeUs;
+    off64_t high = mStreamSize;
+    int64_t highTimeUs = mDurationUs;
+
+    for (size_t i = 0; i < kMaxBisectionSteps && high - low > kBisectionScanBytes; ++i) {
+        off64_t guess = low + (high - low) / 2;
+        if (highTimeUs > lowTimeUs && timeUs > lowTimeUs && timeUs < highTimeUs) {
+            guess = low + (off64_t)((double)(high - low)
+                    * (timeUs - lowTimeUs) / (highTimeUs - lowTimeUs));
+        }
+        // Stay clear of the bounds so that each step shrinks the range.
+        off64_t margin = (high - low) / 16;
+        guess = std::min(std::max(guess, low + margin), high - margin);
+
+        // Resync on the next page that ends a packet.
+        off64_t offset = guess;
+        Page page;
+        ssize_t pageSize = 0;
+        while (offset < high) {
+            if (findNextPage(offset, &offset) != OK) {
+                break;
+            }
+            pageSize = readPage(offset, &page);
+            if (pageSize > 0 && page.mGranulePosition != (uint64_t)-1) {
+                break;
+            }
+            offset += pageSize > 0 ? pageSize : 1;
+            pageSize = 0;
+        }
 
-    size_t numerator = mTableOfContents.size();
+        if (pageSize <= 0 || offset >= high) {
+            high = guess;
+            continue;
+        }
 
-    if (numerator > kMaxNumTOCEntries) {
-        size_t denom = numerator - kMaxNumTOCEntries;
+        int64_t pageTimeUs = getTimeUsOfGranule(page.mGranulePosition);
+        if (pageTimeUs < timeUs) {
+            low = offset + pageSize;
+            lowTimeUs = pageTimeUs;
+        } else {
+            high = offset;
+            highTimeUs = pageTimeUs;
+        }
+    }
 
-        size_t accum = 0;
-        for (ssize_t i = mTableOfContents.size() - 1; i >= 0; --i) {
-            accum += denom;
-            if (accum >= numerator) {
-                mTableOfContents.removeAt(i);
-                accum -= numerator;
-            }
+    ALOGV("bisection for %lld us narrowed down to [%lld, %lld)",
+            (long long)timeUs, (long long)low, (long long)high);
+    return findPageAtOrAfter(low, timeUs, pageOffset);
+}
+
+// Scans the pages from startOffset for the first one ending at or after timeUs,
+// or the last page if there is none.
+status_t MyOggExtractor::findPageAtOrAfter(
+        off64_t startOffset, int64_t timeUs, off64_t *pageOffset) {
+    off64_t offset = startOffset;
+    off64_t lastPageOffset = -1;
+    Page page;
+    for (;;) {
+        if (findNextPage(offset, &offset) != OK) {
+            break;
         }
+        ssize_t pageSize = readPage(offset, &page);
+        if (pageSize <= 0) {
+            break;
+        }
+        lastPageOffset = offset;
+        if (page.mGranulePosition != (uint64_t)-1
+                && getTimeUsOfGranule(page.mGranulePosition) >= timeUs) {
+            break;
+        }
+        offset += pageSize;
     }
+
+    if (lastPageOffset < 0) {
+        return ERROR_END_OF_STREAM;
+    }
+    *pageOffset = lastPageOffset;
+    return OK;
 }
 
 int32_t MyOggExtractor::getPacketBlockSize(MediaBufferBase *buffer) {
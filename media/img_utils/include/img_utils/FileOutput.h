@@ -27,9 +27,18 @@
 namespace android {
 namespace img_utils {
 
+/**
+ * Utility class that writes bytes to a file.  Writes go through a buffer of the
+ * given size, so that the many small writes of TIFF headers and strips don't each
+ * cost a system call.
+ */
 class ANDROID_API FileOutput : public Output {
     public:
-        explicit FileOutput(String8 path);
+        enum {
+            DEFAULT_BUFFER_SIZE = 1 << 20, // 1MB
+        };
+
+        explicit FileOutput(String8 path, size_t bufferSize = DEFAULT_BUFFER_SIZE);
         virtual ~FileOutput();
         virtual status_t open();
         virtual status_t write(const uint8_t* buf, size_t offset, size_t count);
@@ -38,6 +47,8 @@ class ANDROID_API FileOutput : public Output {
         FILE *mFp;
         String8 mPath;
         bool mOpen;
+        char* mBuffer;
+        size_t mBufferSize;
 };
 
 } /*namespace img_utils*/
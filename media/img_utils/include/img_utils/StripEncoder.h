@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IMG_UTILS_STRIP_ENCODER_H
+#define IMG_UTILS_STRIP_ENCODER_H
+
+#include <img_utils/EndianUtils.h>
+#include <img_utils/Output.h>
+#include <img_utils/StripSource.h>
+#include <img_utils/TiffIfd.h>
+
+#include <cutils/compiler.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/StrongPointer.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+namespace img_utils {
+
+/**
+ * This class lays out the image data of an IFD in the strips or tiles set in
+ * the IFD, and compresses each of them as given by its Compression tag.
+ *
+ * The image data is read from a StripSource in raster order, the same way as
+ * for uncompressed strips.  Strips and tiles are independent of each other, and
+ * are encoded in parallel.  The supported compression schemes are:
+ * - TAG_COMPRESSION_NONE, to lay out uncompressed tiles.
+ * - TAG_COMPRESSION_LOSSLESS_JPEG, lossless JPEG (ITU-T T.81 process 14, first
+ *   predictor) as used in DNG, for 8 or 16 bit samples.  An image with a single
+ *   sample per pixel, such as a CFA image, is encoded with its even and odd
+ *   columns as two components so that samples are predicted from the previous
+ *   sample of the same color.
+ * - TAG_COMPRESSION_DEFLATE, zlib compression of the sample bytes.
+ */
+class ANDROID_API StripEncoder : public LightRefBase<StripEncoder> {
+    public:
+        /**
+         * Constructs a StripEncoder for the given IFD.  The endianness must be
+         * the one of the file written.  Up to maxThreads threads are used to
+         * encode, or one per online CPU if maxThreads is 0.
+         */
+        StripEncoder(const sp<TiffIfd>& ifd, Endianness end, uint32_t maxThreads);
+
+        virtual ~StripEncoder();
+
+        /**
+         * Returns true if the image data of the given IFD can't be written as
+         * it comes from its StripSource, and has to go through a StripEncoder.
+         */
+        static bool isEncodingNeeded(const TiffIfd& ifd);
+
+        /**
+         * Read the image data of the IFD from the given source and encode it.
+         * On success, the byte counts set in the IFD are replaced by the sizes
+         * of the encoded strips or tiles, and the strip offsets must be set
+         * again before the IFD is written.
+         *
+         * Returns OK on success, or a negative error code.
+         */
+        virtual status_t encode(StripSource& source);
+
+        /**
+         * Write the encoded strips or tiles to the stream, in order.
+         *
+         * Returns OK on success, or a negative error code.
+         */
+        virtual status_t writeToStream(Output& stream) const;
+
+    private:
+        status_t encodeSegment(size_t index, /*out*/std::vector<uint8_t>* scratch);
+        const uint8_t* getTile(size_t index, /*out*/std::vector<uint8_t>* scratch) const;
+
+        sp<TiffIfd> mIfd;
+        Endianness mEnd;
+        uint32_t mMaxThreads;
+
+        uint32_t mCompression;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mSamplesPerPixel;
+        uint32_t mBytesPerSample;
+        bool mTiled;
+        // Rows per strip, or the tile dimensions
+        uint32_t mSegmentWidth;
+        uint32_t mSegmentLength;
+        size_t mNumSegments;
+
+        std::vector<uint8_t> mImage;
+        std::vector<std::vector<uint8_t> > mSegments;
+};
+
+} /*namespace img_utils*/
+} /*namespace android*/
+
+#endif /*IMG_UTILS_STRIP_ENCODER_H*/
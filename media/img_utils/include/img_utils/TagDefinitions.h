@@ -140,6 +140,10 @@ enum {
     TAG_YRESOLUTION = 0x011Bu,
     TAG_XRESOLUTION = 0x011Au,
     TAG_THRESHHOLDING = 0x0107u,
+    TAG_TILEWIDTH = 0x0142u,
+    TAG_TILELENGTH = 0x0143u,
+    TAG_TILEOFFSETS = 0x0144u,
+    TAG_TILEBYTECOUNTS = 0x0145u,
     TAG_STRIPOFFSETS = 0x0111u,
     TAG_STRIPBYTECOUNTS = 0x0117u,
     TAG_SOFTWARE = 0x0131u,
@@ -204,6 +208,12 @@ enum {
     TAG_ORIENTATION_UNKNOWN = 9
 };
 
+enum {
+    TAG_COMPRESSION_NONE = 1,
+    TAG_COMPRESSION_LOSSLESS_JPEG = 7,
+    TAG_COMPRESSION_DEFLATE = 8
+};
+
 /**
  * TIFF_EP_TAG_DEFINITIONS contains tags defined in the TIFF EP spec
  */
@@ -654,6 +664,38 @@ const TagDefinition_t TIFF_6_TAG_DEFINITIONS[] = {
         1,
         UNDEFINED_ENDIAN
     },
+    { // TileByteCounts
+        "TileByteCounts",
+        0x0145u,
+        LONG,
+        IFD_0,
+        0,
+        UNDEFINED_ENDIAN
+    },
+    { // TileLength
+        "TileLength",
+        0x0143u,
+        LONG,
+        IFD_0,
+        1,
+        UNDEFINED_ENDIAN
+    },
+    { // TileOffsets
+        "TileOffsets",
+        0x0144u,
+        LONG,
+        IFD_0,
+        0,
+        UNDEFINED_ENDIAN
+    },
+    { // TileWidth
+        "TileWidth",
+        0x0142u,
+        LONG,
+        IFD_0,
+        1,
+        UNDEFINED_ENDIAN
+    },
     { // XResolution
         "XResolution",
         0x011Au,
@@ -115,11 +115,31 @@ class ANDROID_API TiffIfd : public TiffWritable {
          */
         virtual status_t validateAndSetStripTags();
 
+        /**
+         * Convenience method to validate and set tile-related image tags.
+         *
+         * This is the tiled counterpart of validateAndSetStripTags, and replaces
+         * any strip tags set.  The tile dimensions must be multiples of 16 as
+         * required by TIFF 6.0.  Tiles on the right and bottom edges of the image
+         * are padded, so every tile holds tileWidth * tileLength pixels.
+         *
+         * The strip methods of this class apply to the tiles once this is set.
+         *
+         * Returns OK on success, or a negative error code.
+         */
+        virtual status_t validateAndSetTileTags(uint32_t tileWidth, uint32_t tileLength);
+
         /**
          * Returns true if validateAndSetStripTags has been called, but not setStripOffsets.
          */
         virtual bool uninitializedOffsets() const;
 
+        /**
+         * Returns true if the image data of this IFD is laid out in tiles rather
+         * than strips.
+         */
+        virtual bool isTiled() const;
+
         /**
          * Convenience method to set beginning offset for strips.
          *
@@ -129,6 +149,16 @@ class ANDROID_API TiffIfd : public TiffWritable {
          */
         virtual status_t setStripOffset(uint32_t offset);
 
+        /**
+         * Replace the byte count of each strip, e.g. with the size of each strip
+         * once compressed.  The given count must match the number of strips.
+         *
+         * Call setStripOffset afterwards to update the strip offsets.
+         *
+         * Returns OK on success, or a negative error code.
+         */
+        virtual status_t setStripByteCounts(const uint32_t* byteCounts, uint32_t count);
+
         /**
          * Get the total size of the strips in bytes.
          *
@@ -137,6 +167,16 @@ class ANDROID_API TiffIfd : public TiffWritable {
          */
         virtual uint32_t getStripSize() const;
 
+        /**
+         * Get the image dimensions and pixel format from the ImageWidth, ImageLength,
+         * SamplesPerPixel, and BitsPerSample tags set in this IFD.
+         *
+         * Returns OK on success, or a negative error code if any of these tags is
+         * missing or the samples are not byte-aligned.
+         */
+        virtual status_t getPixelLayout(/*out*/uint32_t* width, /*out*/uint32_t* height,
+                /*out*/uint32_t* samplesPerPixel, /*out*/uint32_t* bytesPerSample) const;
+
         /**
          * Get a formatted string representing this IFD.
          */
@@ -154,6 +194,8 @@ class ANDROID_API TiffIfd : public TiffWritable {
 
     protected:
         virtual uint32_t checkAndGetOffset(uint32_t offset) const;
+        uint16_t getOffsetsTag() const;
+        uint16_t getByteCountsTag() const;
         SortedEntryVector mEntries;
         sp<TiffIfd> mNextIfd;
         uint32_t mIfdId;
@@ -86,7 +86,11 @@ class ANDROID_API TiffWriter : public LightRefBase<TiffWriter> {
          * Any StripSources passed in will be written to the output as image strips
          * at the appropriate offests.  The StripByteCounts, RowsPerStrip, and
          * StripOffsets tags must be set to use this.  To set these tags in a
-         * given IFD, use the addStrip method.
+         * given IFD, use the addStrip method, or addTiles for a tiled layout.
+         *
+         * The image data of an IFD with a tiled layout, or a Compression tag
+         * other than TAG_COMPRESSION_NONE, is read from its StripSource in raster
+         * order and encoded by a StripEncoder before any of the file is written.
          *
          * Returns OK on success, or a negative error code on failure.
          */
@@ -175,6 +179,23 @@ class ANDROID_API TiffWriter : public LightRefBase<TiffWriter> {
          */
         virtual status_t addStrip(uint32_t ifd);
 
+        /**
+         * Convenience function to set the tile related tags for a given IFD,
+         * instead of the strip related tags set by addStrip.
+         *
+         * The tile dimensions must be multiples of 16, and the same tags as
+         * for addStrip must be set before calling this method.
+         *
+         * Returns OK on success, or a negative error code.
+         */
+        virtual status_t addTiles(uint32_t ifd, uint32_t tileWidth, uint32_t tileLength);
+
+        /**
+         * Set the maximum number of threads used to encode tiled or compressed
+         * image data in write, or 0 to use one per online CPU.  Defaults to 0.
+         */
+        virtual void setMaxEncodingThreads(uint32_t count);
+
         /**
          * Return the TIFF entry with the given tag ID in the IFD with the given ID,
          * or an empty pointer if none exists.
@@ -255,6 +276,8 @@ class ANDROID_API TiffWriter : public LightRefBase<TiffWriter> {
             DEFAULT_NUM_TAG_MAPS = 4,
         };
 
+        static StripSource* findSource(StripSource** sources, size_t sourcesCount,
+                uint32_t ifd);
         sp<TiffIfd> findLastIfd();
         status_t writeFileHeader(EndianOutput& out);
         const TagDefinition_t* lookupDefinition(uint16_t tag) const;
@@ -264,6 +287,7 @@ class ANDROID_API TiffWriter : public LightRefBase<TiffWriter> {
         KeyedVector<uint32_t, sp<TiffIfd> > mNamedIfds;
         KeyedVector<uint16_t, const TagDefinition_t*>* mTagMaps;
         size_t mNumTagMaps;
+        uint32_t mMaxEncodingThreads;
 
         static KeyedVector<uint16_t, const TagDefinition_t*> sTagMaps[];
 };
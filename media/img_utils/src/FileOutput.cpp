@@ -21,7 +21,8 @@
 namespace android {
 namespace img_utils {
 
-FileOutput::FileOutput(String8 path) : mFp(NULL), mPath(path), mOpen(false) {}
+FileOutput::FileOutput(String8 path, size_t bufferSize) : mFp(NULL), mPath(path), mOpen(false),
+        mBuffer(NULL), mBufferSize(bufferSize) {}
 
 FileOutput::~FileOutput() {
     if (mOpen) {
@@ -40,6 +41,12 @@ status_t FileOutput::open() {
         ALOGE("%s: Could not open file %s", __FUNCTION__, mPath.string());
         return BAD_VALUE;
     }
+    if (mBufferSize > 0) {
+        mBuffer = new char[mBufferSize];
+        if (::setvbuf(mFp, mBuffer, _IOFBF, mBufferSize) != 0) {
+            ALOGW("%s: Could not set buffer of file %s.", __FUNCTION__, mPath.string());
+        }
+    }
     mOpen = true;
     return OK;
 }
@@ -71,6 +78,8 @@ status_t FileOutput::close() {
         ALOGE("%s: Failed to close file %s.", __FUNCTION__, mPath.string());
         ret = BAD_VALUE;
     }
+    delete[] mBuffer;
+    mBuffer = NULL;
     mOpen = false;
     return ret;
 }
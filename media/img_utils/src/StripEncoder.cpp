@@ -0,0 +1,569 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "StripEncoder"
+
+#include <img_utils/StripEncoder.h>
+#include <img_utils/TagDefinitions.h>
+#include <img_utils/TiffEntry.h>
+#include <img_utils/TiffHelpers.h>
+
+#include <utils/Log.h>
+#include <utils/Vector.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace android {
+namespace img_utils {
+
+namespace {
+
+/**
+ * Output filling a preallocated buffer, used to read the image data from a StripSource.
+ */
+class BufferOutput : public Output {
+    public:
+        BufferOutput(uint8_t* buf, size_t size) : mBuf(buf), mSize(size), mPosition(0) {}
+
+        virtual ~BufferOutput() {}
+
+        virtual status_t write(const uint8_t* buf, size_t offset, size_t count) {
+            if (count > mSize - mPosition) {
+                ALOGE("%s: Source wrote more than the %zu bytes of the image.", __FUNCTION__,
+                        mSize);
+                return BAD_VALUE;
+            }
+            memcpy(mBuf + mPosition, buf + offset, count);
+            mPosition += count;
+            return OK;
+        }
+
+        size_t getPosition() const {
+            return mPosition;
+        }
+
+    private:
+        uint8_t* mBuf;
+        size_t mSize;
+        size_t mPosition;
+};
+
+/**
+ * Writes the entropy-coded data of a JPEG scan, stuffing a zero byte after each 0xFF.
+ */
+class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>* out) : mOut(out), mBits(0), mCount(0) {}
+
+        // Up to 16 bits at a time
+        inline void write(uint32_t bits, uint32_t count) {
+            mBits = (mBits << count) | (bits & ((1u << count) - 1));
+            mCount += count;
+            while (mCount >= 8) {
+                mCount -= 8;
+                uint8_t byte = static_cast<uint8_t>(mBits >> mCount);
+                mOut->push_back(byte);
+                if (byte == 0xFF) {
+                    mOut->push_back(0);
+                }
+            }
+        }
+
+        // Pads the last byte with ones.
+        void flush() {
+            if (mCount > 0) {
+                write(0xFF, 8 - mCount);
+            }
+        }
+
+    private:
+        std::vector<uint8_t>* mOut;
+        uint32_t mBits;
+        uint32_t mCount;
+};
+
+enum {
+    // Difference categories (SSSS) of lossless JPEG for up to 16 bit samples.
+    NUM_CATEGORIES = 17,
+    MAX_CODE_LENGTH = 16,
+};
+
+struct HuffmanTable {
+    uint8_t bits[MAX_CODE_LENGTH + 1];   // Number of codes of each length, from 1
+    uint8_t values[NUM_CATEGORIES];      // Categories in order of code length
+    uint32_t numValues;
+    uint16_t codes[NUM_CATEGORIES];
+    uint8_t lengths[NUM_CATEGORIES];
+};
+
+inline uint32_t category(int32_t diff) {
+    uint32_t magnitude = static_cast<uint32_t>(diff < 0 ? -diff : diff);
+    return magnitude == 0 ? 0 : 32 - __builtin_clz(magnitude);
+}
+
+/**
+ * Builds the optimal Huffman table of code lengths up to 16 for the given category
+ * frequencies, following ITU-T T.81 Annex K.2.
+ */
+void buildHuffmanTable(const uint32_t* frequencies, /*out*/HuffmanTable* table) {
+    // One extra symbol with a frequency of 1 reserves the code of all ones.
+    const int numSymbols = NUM_CATEGORIES + 1;
+    uint64_t freq[numSymbols];
+    int codeSize[numSymbols];
+    int others[numSymbols];
+    for (int i = 0; i < numSymbols; ++i) {
+        freq[i] = (i < NUM_CATEGORIES) ? frequencies[i] : 1;
+        codeSize[i] = 0;
+        others[i] = -1;
+    }
+
+    for (;;) {
+        // Least frequent symbol, the highest one on ties, then the next least frequent.
+        int v1 = -1;
+        int v2 = -1;
+        for (int i = 0; i < numSymbols; ++i) {
+            if (freq[i] > 0 && (v1 < 0 || freq[i] <= freq[v1])) {
+                v1 = i;
+            }
+        }
+        for (int i = 0; i < numSymbols; ++i) {
+            if (i != v1 && freq[i] > 0 && (v2 < 0 || freq[i] <= freq[v2])) {
+                v2 = i;
+            }
+        }
+        if (v2 < 0) {
+            break;
+        }
+
+        freq[v1] += freq[v2];
+        freq[v2] = 0;
+        ++codeSize[v1];
+        while (others[v1] >= 0) {
+            v1 = others[v1];
+            ++codeSize[v1];
+        }
+        others[v1] = v2;
+        ++codeSize[v2];
+        while (others[v2] >= 0) {
+            v2 = others[v2];
+            ++codeSize[v2];
+        }
+    }
+
+    int bits[2 * numSymbols + 1] = {};
+    for (int i = 0; i < numSymbols; ++i) {
+        if (codeSize[i] > 0) {
+            ++bits[codeSize[i]];
+        }
+    }
+
+    // Limit code lengths to 16 bits.
+    for (int i = 2 * numSymbols; i > MAX_CODE_LENGTH; --i) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                --j;
+            }
+            bits[i] -= 2;
+            ++bits[i - 1];
+            bits[j + 1] += 2;
+            --bits[j];
+        }
+    }
+
+    // Drop the reserved code, which is one of the longest.
+    int longest = MAX_CODE_LENGTH;
+    while (bits[longest] == 0) {
+        --longest;
+    }
+    --bits[longest];
+
+    table->numValues = 0;
+    for (int length = 1; length <= 2 * numSymbols; ++length) {
+        for (int i = 0; i < NUM_CATEGORIES; ++i) {
+            if (codeSize[i] == length) {
+                table->values[table->numValues++] = static_cast<uint8_t>(i);
+            }
+        }
+    }
+
+    memset(table->lengths, 0, sizeof(table->lengths));
+    uint32_t code = 0;
+    uint32_t k = 0;
+    table->bits[0] = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        table->bits[length] = static_cast<uint8_t>(bits[length]);
+        for (int n = 0; n < bits[length]; ++n, ++k) {
+            table->codes[table->values[k]] = static_cast<uint16_t>(code++);
+            table->lengths[table->values[k]] = static_cast<uint8_t>(length);
+        }
+        code <<= 1;
+    }
+}
+
+inline void putMarker(std::vector<uint8_t>* out, uint8_t marker) {
+    out->push_back(0xFF);
+    out->push_back(marker);
+}
+
+inline void put16(std::vector<uint8_t>* out, uint32_t value) {
+    out->push_back(static_cast<uint8_t>(value >> 8));
+    out->push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * Differences of each sample of a row to its prediction, which is the previous
+ * sample of the same component, the sample above for the first samples of a row,
+ * or half the sample range on the first row.  Differences are modulo 2^16.
+ */
+template<typename F>
+inline void forEachDifference(const uint16_t* samples, uint32_t rowLength, uint32_t rows,
+        uint32_t components, uint32_t precision, F f) {
+    for (uint32_t row = 0; row < rows; ++row) {
+        const uint16_t* line = samples + static_cast<size_t>(row) * rowLength;
+        const uint16_t* above = line - ((row > 0) ? rowLength : 0);
+        for (uint32_t i = 0; i < components; ++i) {
+            uint32_t predictor = (row > 0) ? above[i] : (1u << (precision - 1));
+            f(static_cast<int16_t>(static_cast<uint16_t>(line[i] - predictor)));
+        }
+        for (uint32_t i = components; i < rowLength; ++i) {
+            f(static_cast<int16_t>(static_cast<uint16_t>(line[i] - line[i - components])));
+        }
+    }
+}
+
+status_t encodeLosslessJpeg(const uint8_t* data, uint32_t width, uint32_t rows,
+        uint32_t samplesPerPixel, uint32_t bytesPerSample, Endianness end,
+        /*out*/std::vector<uint8_t>* out) {
+    const uint32_t rowLength = width * samplesPerPixel;
+    const uint32_t components = (samplesPerPixel == 1 && (width % 2) == 0) ? 2 :
+            samplesPerPixel;
+    const uint32_t frameWidth = rowLength / components;
+    const uint32_t precision = bytesPerSample * 8;
+
+    if (components > 4 || bytesPerSample > 2 || frameWidth > UINT16_MAX || rows > UINT16_MAX) {
+        ALOGE("%s: Cannot encode %ux%u image with %u samples of %u bits per pixel.",
+                __FUNCTION__, width, rows, samplesPerPixel, precision);
+        return BAD_VALUE;
+    }
+
+    const size_t numSamples = static_cast<size_t>(rowLength) * rows;
+    std::vector<uint16_t> samples(numSamples);
+    if (bytesPerSample == 1) {
+        std::copy(data, data + numSamples, samples.begin());
+    } else if (end == BIG) {
+        for (size_t i = 0; i < numSamples; ++i) {
+            samples[i] = static_cast<uint16_t>((data[2 * i] << 8) | data[2 * i + 1]);
+        }
+    } else {
+        for (size_t i = 0; i < numSamples; ++i) {
+            samples[i] = static_cast<uint16_t>(data[2 * i] | (data[2 * i + 1] << 8));
+        }
+    }
+
+    uint32_t frequencies[NUM_CATEGORIES] = {};
+    forEachDifference(samples.data(), rowLength, rows, components, precision,
+            [&frequencies](int32_t diff) {
+                ++frequencies[category(diff)];
+            });
+
+    HuffmanTable table;
+    buildHuffmanTable(frequencies, &table);
+
+    out->clear();
+    out->reserve(numSamples * bytesPerSample / 2);
+
+    putMarker(out, 0xD8); // SOI
+
+    putMarker(out, 0xC3); // SOF3, lossless Huffman
+    put16(out, 8 + 3 * components);
+    out->push_back(static_cast<uint8_t>(precision));
+    put16(out, rows);
+    put16(out, frameWidth);
+    out->push_back(static_cast<uint8_t>(components));
+    for (uint32_t c = 0; c < components; ++c) {
+        out->push_back(static_cast<uint8_t>(c)); // Component ID
+        out->push_back(0x11); // No subsampling
+        out->push_back(0); // No quantization table
+    }
+
+    putMarker(out, 0xC4); // DHT
+    put16(out, 2 + 1 + MAX_CODE_LENGTH + table.numValues);
+    out->push_back(0); // DC table 0
+    out->insert(out->end(), table.bits + 1, table.bits + 1 + MAX_CODE_LENGTH);
+    out->insert(out->end(), table.values, table.values + table.numValues);
+
+    putMarker(out, 0xDA); // SOS
+    put16(out, 6 + 2 * components);
+    out->push_back(static_cast<uint8_t>(components));
+    for (uint32_t c = 0; c < components; ++c) {
+        out->push_back(static_cast<uint8_t>(c));
+        out->push_back(0); // Table 0
+    }
+    out->push_back(1); // Predictor Ra
+    out->push_back(0);
+    out->push_back(0); // No point transform
+
+    BitWriter writer(out);
+    forEachDifference(samples.data(), rowLength, rows, components, precision,
+            [&writer, &table](int32_t diff) {
+                uint32_t ssss = category(diff);
+                writer.write(table.codes[ssss], table.lengths[ssss]);
+                // The largest difference has no additional bits.
+                if (ssss > 0 && ssss < 16) {
+                    writer.write(static_cast<uint32_t>(diff < 0 ? diff - 1 : diff), ssss);
+                }
+            });
+    writer.flush();
+
+    putMarker(out, 0xD9); // EOI
+    return OK;
+}
+
+status_t encodeDeflate(const uint8_t* data, size_t size, /*out*/std::vector<uint8_t>* out) {
+    uLongf length = compressBound(size);
+    out->resize(length);
+    // Higher levels cost several times the CPU time on sensor data for a few percent.
+    int res = compress2(out->data(), &length, data, size, Z_BEST_SPEED);
+    if (res != Z_OK) {
+        ALOGE("%s: Compression failed with zlib error %d.", __FUNCTION__, res);
+        return UNKNOWN_ERROR;
+    }
+    out->resize(length);
+    return OK;
+}
+
+/**
+ * Index of the row or column to repeat in the padding of a tile.  This keeps the
+ * parity of the index, so that padding follows the CFA pattern.
+ */
+inline uint32_t paddingSource(uint32_t index, uint32_t valid) {
+    return (valid >= 2) ? valid - 2 + (index - valid) % 2 : 0;
+}
+
+} /*anonymous namespace*/
+
+StripEncoder::StripEncoder(const sp<TiffIfd>& ifd, Endianness end, uint32_t maxThreads)
+        : mIfd(ifd), mEnd(end), mMaxThreads(maxThreads), mCompression(TAG_COMPRESSION_NONE),
+          mWidth(0), mHeight(0), mSamplesPerPixel(0), mBytesPerSample(0), mTiled(false),
+          mSegmentWidth(0), mSegmentLength(0), mNumSegments(0) {}
+
+StripEncoder::~StripEncoder() {}
+
+bool StripEncoder::isEncodingNeeded(const TiffIfd& ifd) {
+    if (!ifd.uninitializedOffsets()) {
+        return false;
+    }
+    if (ifd.isTiled()) {
+        return true;
+    }
+    sp<TiffEntry> compression = ifd.getEntry(TAG_COMPRESSION);
+    return compression != NULL && *(compression->getData<uint16_t>()) != TAG_COMPRESSION_NONE;
+}
+
+status_t StripEncoder::encode(StripSource& source) {
+    status_t ret = mIfd->getPixelLayout(&mWidth, &mHeight, &mSamplesPerPixel, &mBytesPerSample);
+    if (ret != OK) {
+        return ret;
+    }
+
+    sp<TiffEntry> compression = mIfd->getEntry(TAG_COMPRESSION);
+    mCompression = (compression != NULL) ? *(compression->getData<uint16_t>()) :
+            static_cast<uint32_t>(TAG_COMPRESSION_NONE);
+    if (mCompression != TAG_COMPRESSION_NONE && mCompression != TAG_COMPRESSION_LOSSLESS_JPEG &&
+            mCompression != TAG_COMPRESSION_DEFLATE) {
+        ALOGE("%s: Unsupported compression %u in IFD %u.", __FUNCTION__, mCompression,
+                mIfd->getId());
+        return BAD_VALUE;
+    }
+
+    mTiled = mIfd->isTiled();
+    sp<TiffEntry> byteCounts;
+    if (mTiled) {
+        sp<TiffEntry> tileWidth = mIfd->getEntry(TAG_TILEWIDTH);
+        sp<TiffEntry> tileLength = mIfd->getEntry(TAG_TILELENGTH);
+        if (tileWidth == NULL || tileLength == NULL) {
+            ALOGE("%s: IFD %u has no tile dimensions.", __FUNCTION__, mIfd->getId());
+            return BAD_VALUE;
+        }
+        mSegmentWidth = *(tileWidth->getData<uint32_t>());
+        mSegmentLength = *(tileLength->getData<uint32_t>());
+        byteCounts = mIfd->getEntry(TAG_TILEBYTECOUNTS);
+    } else {
+        sp<TiffEntry> rowsPerStrip = mIfd->getEntry(TAG_ROWSPERSTRIP);
+        if (rowsPerStrip == NULL) {
+            ALOGE("%s: IFD %u has no RowsPerStrip tag.", __FUNCTION__, mIfd->getId());
+            return BAD_VALUE;
+        }
+        mSegmentWidth = mWidth;
+        mSegmentLength = *(rowsPerStrip->getData<uint32_t>());
+        byteCounts = mIfd->getEntry(TAG_STRIPBYTECOUNTS);
+    }
+
+    if (mSegmentWidth == 0 || mSegmentLength == 0 || byteCounts == NULL) {
+        ALOGE("%s: Invalid strip layout in IFD %u.", __FUNCTION__, mIfd->getId());
+        return BAD_VALUE;
+    }
+    mNumSegments = static_cast<size_t>((mWidth + mSegmentWidth - 1) / mSegmentWidth) *
+            ((mHeight + mSegmentLength - 1) / mSegmentLength);
+    if (mNumSegments != byteCounts->getCount()) {
+        ALOGE("%s: IFD %u has %u byte counts, %zu expected.", __FUNCTION__, mIfd->getId(),
+                byteCounts->getCount(), mNumSegments);
+        return BAD_VALUE;
+    }
+
+    const uint64_t imageSize = static_cast<uint64_t>(mWidth) * mHeight * mSamplesPerPixel *
+            mBytesPerSample;
+    if (imageSize > UINT32_MAX) {
+        ALOGE("%s: Image in IFD %u is too large.", __FUNCTION__, mIfd->getId());
+        return BAD_VALUE;
+    }
+
+    mImage.resize(static_cast<size_t>(imageSize));
+    BufferOutput buffer(mImage.data(), mImage.size());
+    EndianOutput endOut(&buffer, mEnd);
+    if ((ret = source.writeToStream(endOut, static_cast<uint32_t>(imageSize))) != OK) {
+        ALOGE("%s: Could not read image data for IFD %u, received %d.", __FUNCTION__,
+                mIfd->getId(), ret);
+        return ret;
+    }
+    if (buffer.getPosition() != mImage.size()) {
+        ALOGE("%s: Source wrote %zu bytes for IFD %u, %zu expected.", __FUNCTION__,
+                buffer.getPosition(), mIfd->getId(), mImage.size());
+        return BAD_VALUE;
+    }
+
+    mSegments.clear();
+    mSegments.resize(mNumSegments);
+
+    size_t numThreads = mMaxThreads;
+    if (numThreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (cpus > 0) ? static_cast<size_t>(cpus) : 1;
+    }
+    numThreads = std::min(numThreads, mNumSegments);
+
+    std::atomic<size_t> next(0);
+    std::atomic<status_t> error(OK);
+    auto worker = [this, &next, &error]() {
+        std::vector<uint8_t> scratch;
+        size_t index;
+        while (error == OK && (index = next++) < mNumSegments) {
+            status_t res = encodeSegment(index, &scratch);
+            if (res != OK) {
+                error = res;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<uint8_t>().swap(mImage);
+    if ((ret = error) != OK) {
+        return ret;
+    }
+
+    Vector<uint32_t> sizes;
+    uint64_t total = 0;
+    for (size_t i = 0; i < mNumSegments; ++i) {
+        total += mSegments[i].size();
+        sizes.add(static_cast<uint32_t>(mSegments[i].size()));
+    }
+    if (total > UINT32_MAX) {
+        ALOGE("%s: Encoded image in IFD %u is too large.", __FUNCTION__, mIfd->getId());
+        return BAD_VALUE;
+    }
+
+    ALOGV("%s: Encoded IFD %u from %" PRIu64 " to %" PRIu64 " bytes in %zu %s.", __FUNCTION__,
+            mIfd->getId(), imageSize, total, mNumSegments, mTiled ? "tiles" : "strips");
+    return mIfd->setStripByteCounts(sizes.array(), static_cast<uint32_t>(mNumSegments));
+}
+
+const uint8_t* StripEncoder::getTile(size_t index, /*out*/std::vector<uint8_t>* scratch) const {
+    const size_t pixelSize = mSamplesPerPixel * mBytesPerSample;
+    const size_t rowSize = mWidth * pixelSize;
+    if (!mTiled) {
+        return mImage.data() + index * mSegmentLength * rowSize;
+    }
+
+    const uint32_t tilesAcross = (mWidth + mSegmentWidth - 1) / mSegmentWidth;
+    const uint32_t left = static_cast<uint32_t>(index % tilesAcross) * mSegmentWidth;
+    const uint32_t top = static_cast<uint32_t>(index / tilesAcross) * mSegmentLength;
+    const uint32_t validWidth = std::min(mSegmentWidth, mWidth - left);
+    const uint32_t validLength = std::min(mSegmentLength, mHeight - top);
+
+    const size_t tileRowSize = mSegmentWidth * pixelSize;
+    scratch->resize(tileRowSize * mSegmentLength);
+    for (uint32_t y = 0; y < mSegmentLength; ++y) {
+        uint32_t sourceY = (y < validLength) ? y : paddingSource(y, validLength);
+        const uint8_t* src = mImage.data() + (top + sourceY) * rowSize + left * pixelSize;
+        uint8_t* dst = scratch->data() + y * tileRowSize;
+        memcpy(dst, src, validWidth * pixelSize);
+        for (uint32_t x = validWidth; x < mSegmentWidth; ++x) {
+            memcpy(dst + x * pixelSize, dst + paddingSource(x, validWidth) * pixelSize,
+                    pixelSize);
+        }
+    }
+    return scratch->data();
+}
+
+status_t StripEncoder::encodeSegment(size_t index, /*out*/std::vector<uint8_t>* scratch) {
+    uint32_t rows = mSegmentLength;
+    if (!mTiled) {
+        rows = std::min(mSegmentLength,
+                static_cast<uint32_t>(mHeight - index * mSegmentLength));
+    }
+    const uint8_t* data = getTile(index, scratch);
+    const size_t size = static_cast<size_t>(mSegmentWidth) * rows * mSamplesPerPixel *
+            mBytesPerSample;
+
+    std::vector<uint8_t>& out = mSegments[index];
+    switch (mCompression) {
+        case TAG_COMPRESSION_LOSSLESS_JPEG:
+            return encodeLosslessJpeg(data, mSegmentWidth, rows, mSamplesPerPixel,
+                    mBytesPerSample, mEnd, &out);
+        case TAG_COMPRESSION_DEFLATE:
+            return encodeDeflate(data, size, &out);
+        default:
+            out.assign(data, data + size);
+            return OK;
+    }
+}
+
+status_t StripEncoder::writeToStream(Output& stream) const {
+    status_t ret = OK;
+    for (size_t i = 0; i < mSegments.size(); ++i) {
+        BAIL_ON_FAIL(stream.write(mSegments[i].data(), 0, mSegments[i].size()), ret);
+    }
+    return ret;
+}
+
+} /*namespace img_utils*/
+} /*namespace android*/
@@ -168,7 +168,8 @@ uint32_t TiffIfd::getComparableValue() const {
     return mIfdId;
 }
 
-status_t TiffIfd::validateAndSetStripTags() {
+status_t TiffIfd::getPixelLayout(/*out*/uint32_t* width, /*out*/uint32_t* height,
+        /*out*/uint32_t* samplesPerPixel, /*out*/uint32_t* bytesPerSample) const {
     sp<TiffEntry> widthEntry = getEntry(TAG_IMAGEWIDTH);
     if (widthEntry == NULL) {
         ALOGE("%s: IFD %u doesn't have a ImageWidth tag set", __FUNCTION__, mIfdId);
@@ -193,10 +194,9 @@ status_t TiffIfd::validateAndSetStripTags() {
         return BAD_VALUE;
     }
 
-    uint32_t width = *(widthEntry->getData<uint32_t>());
-    uint32_t height = *(heightEntry->getData<uint32_t>());
+    *width = *(widthEntry->getData<uint32_t>());
+    *height = *(heightEntry->getData<uint32_t>());
     uint16_t bitsPerSample = *(bitsEntry->getData<uint16_t>());
-    uint16_t samplesPerPixel = *(samplesEntry->getData<uint16_t>());
 
     if ((bitsPerSample % 8) != 0) {
         ALOGE("%s: BitsPerSample %d in IFD %u is not byte-aligned.", __FUNCTION__,
@@ -204,7 +204,17 @@ status_t TiffIfd::validateAndSetStripTags() {
         return BAD_VALUE;
     }
 
-    uint32_t bytesPerSample = bitsPerSample / 8;
+    *samplesPerPixel = *(samplesEntry->getData<uint16_t>());
+    *bytesPerSample = bitsPerSample / 8;
+    return OK;
+}
+
+status_t TiffIfd::validateAndSetStripTags() {
+    uint32_t width, height, samplesPerPixel, bytesPerSample;
+    status_t ret = getPixelLayout(&width, &height, &samplesPerPixel, &bytesPerSample);
+    if (ret != OK) {
+        return ret;
+    }
 
     // Choose strip size as close to 8kb as possible without splitting rows.
     // If the row length is >8kb, each strip will only contain a single row.
@@ -285,6 +295,72 @@ status_t TiffIfd::validateAndSetStripTags() {
         return BAD_VALUE;
     }
 
+    removeEntry(TAG_TILEWIDTH);
+    removeEntry(TAG_TILELENGTH);
+    removeEntry(TAG_TILEBYTECOUNTS);
+    removeEntry(TAG_TILEOFFSETS);
+
+    mStripOffsetsInitialized = true;
+    return OK;
+}
+
+status_t TiffIfd::validateAndSetTileTags(uint32_t tileWidth, uint32_t tileLength) {
+    if (tileWidth == 0 || tileLength == 0 || (tileWidth % 16) != 0 || (tileLength % 16) != 0) {
+        ALOGE("%s: Tile size %ux%u in IFD %u is not a multiple of 16.", __FUNCTION__, tileWidth,
+                tileLength, mIfdId);
+        return BAD_VALUE;
+    }
+
+    uint32_t width, height, samplesPerPixel, bytesPerSample;
+    status_t ret = getPixelLayout(&width, &height, &samplesPerPixel, &bytesPerSample);
+    if (ret != OK) {
+        return ret;
+    }
+
+    const uint64_t tileSize = static_cast<uint64_t>(tileWidth) * tileLength * samplesPerPixel *
+            bytesPerSample;
+    const uint64_t tilesAcross = (static_cast<uint64_t>(width) + tileWidth - 1) / tileWidth;
+    const uint64_t tilesDown = (static_cast<uint64_t>(height) + tileLength - 1) / tileLength;
+    const uint64_t numTiles = tilesAcross * tilesDown;
+
+    if (numTiles == 0 || tileSize * numTiles > UINT32_MAX) {
+        ALOGE("%s: Invalid tile layout for %ux%u image in IFD %u.", __FUNCTION__, width, height,
+                mIfdId);
+        return BAD_VALUE;
+    }
+
+    Vector<uint32_t> byteCounts;
+    byteCounts.insertAt(static_cast<uint32_t>(tileSize), 0, static_cast<size_t>(numTiles));
+
+    Vector<uint32_t> tileOffsetsVector;
+    tileOffsetsVector.resize(static_cast<size_t>(numTiles));
+
+    sp<TiffEntry> tileWidthEntry = TiffWriter::uncheckedBuildEntry(TAG_TILEWIDTH, LONG, 1,
+            UNDEFINED_ENDIAN, &tileWidth);
+    sp<TiffEntry> tileLengthEntry = TiffWriter::uncheckedBuildEntry(TAG_TILELENGTH, LONG, 1,
+            UNDEFINED_ENDIAN, &tileLength);
+    sp<TiffEntry> tileByteCounts = TiffWriter::uncheckedBuildEntry(TAG_TILEBYTECOUNTS, LONG,
+            static_cast<uint32_t>(numTiles), UNDEFINED_ENDIAN, byteCounts.array());
+    // Set uninitialized offsets
+    sp<TiffEntry> tileOffsets = TiffWriter::uncheckedBuildEntry(TAG_TILEOFFSETS, LONG,
+            static_cast<uint32_t>(numTiles), UNDEFINED_ENDIAN, tileOffsetsVector.array());
+
+    if (tileWidthEntry == NULL || tileLengthEntry == NULL || tileByteCounts == NULL ||
+            tileOffsets == NULL) {
+        ALOGE("%s: Could not build tile entries for IFD %u.", __FUNCTION__, mIfdId);
+        return BAD_VALUE;
+    }
+
+    if (addEntry(tileWidthEntry) != OK || addEntry(tileLengthEntry) != OK ||
+            addEntry(tileByteCounts) != OK || addEntry(tileOffsets) != OK) {
+        ALOGE("%s: Could not add tile entries to IFD %u", __FUNCTION__, mIfdId);
+        return BAD_VALUE;
+    }
+
+    removeEntry(TAG_STRIPOFFSETS);
+    removeEntry(TAG_STRIPBYTECOUNTS);
+    removeEntry(TAG_ROWSPERSTRIP);
+
     mStripOffsetsInitialized = true;
     return OK;
 }
@@ -293,16 +369,28 @@ bool TiffIfd::uninitializedOffsets() const {
     return mStripOffsetsInitialized;
 }
 
+bool TiffIfd::isTiled() const {
+    return mEntries.indexOfTag(TAG_TILEOFFSETS) >= 0;
+}
+
+uint16_t TiffIfd::getOffsetsTag() const {
+    return isTiled() ? TAG_TILEOFFSETS : TAG_STRIPOFFSETS;
+}
+
+uint16_t TiffIfd::getByteCountsTag() const {
+    return isTiled() ? TAG_TILEBYTECOUNTS : TAG_STRIPBYTECOUNTS;
+}
+
 status_t TiffIfd::setStripOffset(uint32_t offset) {
 
     // Get old offsets and bytecounts
-    sp<TiffEntry> oldOffsets = getEntry(TAG_STRIPOFFSETS);
+    sp<TiffEntry> oldOffsets = getEntry(getOffsetsTag());
     if (oldOffsets == NULL) {
         ALOGE("%s: IFD %u does not contain StripOffsets entry.", __FUNCTION__, mIfdId);
         return BAD_VALUE;
     }
 
-    sp<TiffEntry> stripByteCounts = getEntry(TAG_STRIPBYTECOUNTS);
+    sp<TiffEntry> stripByteCounts = getEntry(getByteCountsTag());
     if (stripByteCounts == NULL) {
         ALOGE("%s: IFD %u does not contain StripByteCounts entry.", __FUNCTION__, mIfdId);
         return BAD_VALUE;
@@ -328,7 +416,7 @@ status_t TiffIfd::setStripOffset(uint32_t offset) {
         offset += stripByteCountsArray[i];
     }
 
-    sp<TiffEntry> newOffsets = TiffWriter::uncheckedBuildEntry(TAG_STRIPOFFSETS, LONG,
+    sp<TiffEntry> newOffsets = TiffWriter::uncheckedBuildEntry(getOffsetsTag(), LONG,
             static_cast<uint32_t>(numStrips), UNDEFINED_ENDIAN, stripOffsets.array());
 
     if (newOffsets == NULL) {
@@ -343,8 +431,31 @@ status_t TiffIfd::setStripOffset(uint32_t offset) {
     return OK;
 }
 
+status_t TiffIfd::setStripByteCounts(const uint32_t* byteCounts, uint32_t count) {
+    sp<TiffEntry> oldByteCounts = getEntry(getByteCountsTag());
+    if (oldByteCounts == NULL) {
+        ALOGE("%s: IFD %u does not contain StripByteCounts entry.", __FUNCTION__, mIfdId);
+        return BAD_VALUE;
+    }
+
+    if (oldByteCounts->getCount() != count) {
+        ALOGE("%s: Byte count for %u strips given, IFD %u has %u strips.", __FUNCTION__, count,
+                mIfdId, oldByteCounts->getCount());
+        return BAD_VALUE;
+    }
+
+    sp<TiffEntry> newByteCounts = TiffWriter::uncheckedBuildEntry(getByteCountsTag(), LONG,
+            count, UNDEFINED_ENDIAN, byteCounts);
+
+    if (newByteCounts == NULL || addEntry(newByteCounts) != OK) {
+        ALOGE("%s: Failed to update byte counts entry in IFD %u", __FUNCTION__, mIfdId);
+        return BAD_VALUE;
+    }
+    return OK;
+}
+
 uint32_t TiffIfd::getStripSize() const {
-    sp<TiffEntry> stripByteCounts = getEntry(TAG_STRIPBYTECOUNTS);
+    sp<TiffEntry> stripByteCounts = getEntry(getByteCountsTag());
     if (stripByteCounts == NULL) {
         ALOGE("%s: IFD %u does not contain StripByteCounts entry.", __FUNCTION__, mIfdId);
         return BAD_VALUE;
@@ -16,6 +16,7 @@
 
 #define LOG_TAG "TiffWriter"
 
+#include <img_utils/StripEncoder.h>
 #include <img_utils/TiffHelpers.h>
 #include <img_utils/TiffWriter.h>
 #include <img_utils/TagDefinitions.h>
@@ -49,10 +50,12 @@ KeyedVector<uint16_t, const TagDefinition_t*> TiffWriter::sTagMaps[] = {
     buildTagMap(TIFF_6_TAG_DEFINITIONS, ARRAY_SIZE(TIFF_6_TAG_DEFINITIONS))
 };
 
-TiffWriter::TiffWriter() : mTagMaps(sTagMaps), mNumTagMaps(DEFAULT_NUM_TAG_MAPS) {}
+TiffWriter::TiffWriter() : mTagMaps(sTagMaps), mNumTagMaps(DEFAULT_NUM_TAG_MAPS),
+        mMaxEncodingThreads(0) {}
 
 TiffWriter::TiffWriter(KeyedVector<uint16_t, const TagDefinition_t*>* enabledDefinitions,
-        size_t length) : mTagMaps(enabledDefinitions), mNumTagMaps(length) {}
+        size_t length) : mTagMaps(enabledDefinitions), mNumTagMaps(length),
+        mMaxEncodingThreads(0) {}
 
 TiffWriter::~TiffWriter() {}
 
@@ -66,6 +69,28 @@ status_t TiffWriter::write(Output* out, StripSource** sources, size_t sourcesCou
         return BAD_VALUE;
     }
 
+    // Tiled or compressed image data is read from the sources and encoded up front,
+    // the encoded sizes are needed to lay out the file.
+    KeyedVector<uint32_t, sp<StripEncoder> > encoders;
+    for (size_t i = 0; i < mNamedIfds.size(); ++i) {
+        if (!StripEncoder::isEncodingNeeded(*mNamedIfds[i])) {
+            continue;
+        }
+        uint32_t ifdKey = mNamedIfds.keyAt(i);
+        StripSource* source = findSource(sources, sourcesCount, ifdKey);
+        if (source == NULL) {
+            ALOGE("%s: No stream for byte strips for IFD %u", __FUNCTION__, ifdKey);
+            return BAD_VALUE;
+        }
+        sp<StripEncoder> encoder = new StripEncoder(mNamedIfds[i], end, mMaxEncodingThreads);
+        if ((ret = encoder->encode(*source)) != OK) {
+            ALOGE("%s: Could not encode strips for IFD %u, received %d.", __FUNCTION__, ifdKey,
+                    ret);
+            return ret;
+        }
+        encoders.add(ifdKey, encoder);
+    }
+
     uint32_t totalSize = getTotalSize();
 
     KeyedVector<uint32_t, uint32_t> offsetVector;
@@ -106,23 +131,23 @@ status_t TiffWriter::write(Output* out, StripSource** sources, size_t sourcesCou
 
     for (size_t i = 0; i < offVecSize; ++i) {
         uint32_t ifdKey = offsetVector.keyAt(i);
-        uint32_t sizeToWrite = mNamedIfds[ifdKey]->getStripSize();
-        bool found = false;
-        for (size_t j = 0; j < sourcesCount; ++j) {
-            if (sources[j]->getIfd() == ifdKey) {
-                if ((ret = sources[i]->writeToStream(endOut, sizeToWrite)) != OK) {
-                    ALOGE("%s: Could not write to stream, received %d.", __FUNCTION__, ret);
-                    return ret;
-                }
-                ZERO_TILL_WORD(&endOut, sizeToWrite, ret);
-                found = true;
-                break;
+        uint32_t sizeToWrite = mNamedIfds.valueFor(ifdKey)->getStripSize();
+        ssize_t encoderIndex = encoders.indexOfKey(ifdKey);
+        if (encoderIndex >= 0) {
+            ret = encoders[encoderIndex]->writeToStream(endOut);
+        } else {
+            StripSource* source = findSource(sources, sourcesCount, ifdKey);
+            if (source == NULL) {
+                ALOGE("%s: No stream for byte strips for IFD %u", __FUNCTION__, ifdKey);
+                return BAD_VALUE;
             }
+            ret = source->writeToStream(endOut, sizeToWrite);
         }
-        if (!found) {
-            ALOGE("%s: No stream for byte strips for IFD %u", __FUNCTION__, ifdKey);
-            return BAD_VALUE;
+        if (ret != OK) {
+            ALOGE("%s: Could not write to stream, received %d.", __FUNCTION__, ret);
+            return ret;
         }
+        ZERO_TILL_WORD(&endOut, sizeToWrite, ret);
         assert(offsetVector[i] == endOut.getCurrentOffset());
     }
 
@@ -214,6 +239,20 @@ status_t TiffWriter::addStrip(uint32_t ifd) {
     return selected->validateAndSetStripTags();
 }
 
+status_t TiffWriter::addTiles(uint32_t ifd, uint32_t tileWidth, uint32_t tileLength) {
+    ssize_t index = mNamedIfds.indexOfKey(ifd);
+    if (index < 0) {
+        ALOGE("%s: Ifd %u doesn't exist, cannot add tile entries.", __FUNCTION__, ifd);
+        return BAD_VALUE;
+    }
+    sp<TiffIfd> selected = mNamedIfds[index];
+    return selected->validateAndSetTileTags(tileWidth, tileLength);
+}
+
+void TiffWriter::setMaxEncodingThreads(uint32_t count) {
+    mMaxEncodingThreads = count;
+}
+
 status_t TiffWriter::addIfd(uint32_t ifd) {
     ssize_t index = mNamedIfds.indexOfKey(ifd);
     if (index >= 0) {
@@ -343,6 +382,15 @@ const char* TiffWriter::getTagName(uint16_t tag) const {
     return definition->tagName;
 }
 
+StripSource* TiffWriter::findSource(StripSource** sources, size_t sourcesCount, uint32_t ifd) {
+    for (size_t i = 0; i < sourcesCount; ++i) {
+        if (sources[i]->getIfd() == ifd) {
+            return sources[i];
+        }
+    }
+    return NULL;
+}
+
 sp<TiffIfd> TiffWriter::findLastIfd() {
     sp<TiffIfd> ifd = mIfd;
     while(ifd != NULL) {
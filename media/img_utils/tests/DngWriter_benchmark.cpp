@@ -0,0 +1,231 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Writes a synthetic 16 bit Bayer frame as a DNG with each strip layout and
+// compression supported by TiffWriter, and reports the throughput in MB/s of
+// raw image data and the size of the file written.  The frame is a smooth
+// scene with sensor-like noise, so that it compresses about like a real one.
+//
+// usage: dng_writer_benchmark [-n iterations] [-w width] [-h height]
+//            [-b bits] [-t threads] [-s tile size] [-o path] [-k]
+
+#include <img_utils/FileOutput.h>
+#include <img_utils/StripSource.h>
+#include <img_utils/TagDefinitions.h>
+#include <img_utils/TiffWriter.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace android;
+using namespace android::img_utils;
+
+namespace {
+
+const uint32_t kIfd = IFD_0;
+
+int64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class BufferSource : public StripSource {
+    public:
+        explicit BufferSource(const std::vector<uint8_t>& buffer) : mBuffer(buffer) {}
+
+        virtual status_t writeToStream(Output& stream, uint32_t count) {
+            if (count != mBuffer.size()) {
+                fprintf(stderr, "unexpected strip size %u\n", count);
+                return BAD_VALUE;
+            }
+            // Rows at a time, as a camera source would.
+            const size_t rowSize = 8192;
+            for (size_t offset = 0; offset < mBuffer.size(); offset += rowSize) {
+                size_t size = std::min(rowSize, mBuffer.size() - offset);
+                status_t err = stream.write(mBuffer.data(), offset, size);
+                if (err != OK) {
+                    return err;
+                }
+            }
+            return OK;
+        }
+
+        virtual uint32_t getIfd() const {
+            return kIfd;
+        }
+
+    private:
+        const std::vector<uint8_t>& mBuffer;
+};
+
+// RGGB mosaic of a few gradients and rings, plus noise, little endian.
+void makeBayerFrame(uint32_t width, uint32_t height, uint32_t bits,
+        std::vector<uint8_t>* frame) {
+    const double gains[4] = { 0.45, 0.8, 0.8, 0.6 };
+    const uint32_t white = (1u << bits) - 1;
+    uint32_t seed = 12345;
+    frame->resize(static_cast<size_t>(width) * height * 2);
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            double u = static_cast<double>(x) / width;
+            double v = static_cast<double>(y) / height;
+            double level = 0.25 + 0.35 * u * v + 0.2 * sin(20 * (u * u + v * v));
+            level *= gains[(y % 2) * 2 + (x % 2)];
+            seed = seed * 1103515245 + 12345;
+            double noise = (static_cast<double>((seed >> 16) & 0x7FFF) / 0x7FFF - 0.5) * 0.02;
+            double value = std::max(0.0, std::min(1.0, level + noise)) * white;
+            uint16_t sample = static_cast<uint16_t>(value);
+            size_t i = (static_cast<size_t>(y) * width + x) * 2;
+            (*frame)[i] = static_cast<uint8_t>(sample);
+            (*frame)[i + 1] = static_cast<uint8_t>(sample >> 8);
+        }
+    }
+}
+
+status_t writeDng(const char* path, const std::vector<uint8_t>& frame, uint32_t width,
+        uint32_t height, uint16_t compression, uint32_t tileSize, uint32_t threads) {
+    sp<TiffWriter> writer = new TiffWriter();
+    status_t err = writer->addIfd(kIfd);
+
+    const uint8_t dngVersion[] = { 1, 4, 0, 0 };
+    const uint32_t newSubfileType = 0;
+    const uint16_t bitsPerSample = 16;
+    const uint16_t samplesPerPixel = 1;
+    const uint16_t photometric = 32803; // CFA
+    const uint16_t cfaRepeatDim[] = { 2, 2 };
+    const uint8_t cfaPattern[] = { 0, 1, 1, 2 };
+
+    if (err == OK) err = writer->addEntry(TAG_DNGVERSION, 4, dngVersion, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_NEWSUBFILETYPE, 1, &newSubfileType, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_IMAGEWIDTH, 1, &width, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_IMAGELENGTH, 1, &height, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_BITSPERSAMPLE, 1, &bitsPerSample, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_SAMPLESPERPIXEL, 1, &samplesPerPixel, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_COMPRESSION, 1, &compression, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_PHOTOMETRICINTERPRETATION, 1, &photometric, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_CFAREPEATPATTERNDIM, 2, cfaRepeatDim, kIfd);
+    if (err == OK) err = writer->addEntry(TAG_CFAPATTERN, 4, cfaPattern, kIfd);
+    if (err == OK) {
+        err = (tileSize > 0) ? writer->addTiles(kIfd, tileSize, tileSize) :
+                writer->addStrip(kIfd);
+    }
+    if (err != OK) {
+        return err;
+    }
+    writer->setMaxEncodingThreads(threads);
+
+    FileOutput out((String8(path)));
+    if ((err = out.open()) != OK) {
+        return err;
+    }
+    BufferSource source(frame);
+    StripSource* sources[] = { &source };
+    err = writer->write(&out, sources, 1, LITTLE);
+    status_t closeErr = out.close();
+    return (err != OK) ? err : closeErr;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    int iterations = 5;
+    uint32_t width = 4032;
+    uint32_t height = 3024;
+    uint32_t bits = 10;
+    uint32_t threads = 0;
+    uint32_t tileSize = 256;
+    const char *path = "/data/local/tmp/dng_writer_benchmark.dng";
+    bool keep = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:h:b:t:s:o:k")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'w': width = strtoul(optarg, NULL, 0); break;
+            case 'h': height = strtoul(optarg, NULL, 0); break;
+            case 'b': bits = strtoul(optarg, NULL, 0); break;
+            case 't': threads = strtoul(optarg, NULL, 0); break;
+            case 's': tileSize = strtoul(optarg, NULL, 0); break;
+            case 'o': path = optarg; break;
+            case 'k': keep = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-w width] [-h height] "
+                        "[-b bits] [-t threads] [-s tile size] [-o path] [-k]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations <= 0 || width == 0 || height == 0 || bits == 0 || bits > 16
+            || tileSize == 0 || tileSize % 16 != 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    std::vector<uint8_t> frame;
+    makeBayerFrame(width, height, bits, &frame);
+    printf("frame: %ux%u, %u bits in 16, %.1f MB\n", width, height, bits,
+           frame.size() / 1e6);
+
+    const struct {
+        const char *mName;
+        uint16_t mCompression;
+        bool mTiled;
+    } configs[] = {
+        { "none-strips", TAG_COMPRESSION_NONE, false },
+        { "none-tiles", TAG_COMPRESSION_NONE, true },
+        { "ljpeg-strips", TAG_COMPRESSION_LOSSLESS_JPEG, false },
+        { "ljpeg-tiles", TAG_COMPRESSION_LOSSLESS_JPEG, true },
+        { "deflate-strips", TAG_COMPRESSION_DEFLATE, false },
+        { "deflate-tiles", TAG_COMPRESSION_DEFLATE, true },
+    };
+
+    int result = 0;
+    for (const auto &config : configs) {
+        String8 configPath(path);
+        configPath.appendFormat(".%s.dng", config.mName);
+
+        int64_t bestNs = INT64_MAX;
+        status_t err = OK;
+        for (int i = 0; i < iterations && err == OK; ++i) {
+            int64_t startNs = nowNs();
+            err = writeDng(configPath.string(), frame, width, height, config.mCompression,
+                    config.mTiled ? tileSize : 0, threads);
+            bestNs = std::min(bestNs, nowNs() - startNs);
+        }
+
+        struct stat st;
+        if (err != OK || stat(configPath.string(), &st) != 0) {
+            fprintf(stderr, "%s: failed to write %s (%d)\n", config.mName,
+                    configPath.string(), err);
+            result = 1;
+            continue;
+        }
+        printf("%-16s %8.1f MB/s %10lld bytes (%.2fx)\n", config.mName,
+               frame.size() * 1e3 / bestNs, (long long)st.st_size,
+               (double)frame.size() / st.st_size);
+        if (!keep) {
+            unlink(configPath.string());
+        }
+    }
+    return result;
+}
@@ -260,14 +260,23 @@ status_t AudioMixer::Track::prepareForDownmix()
     if (audio_channel_mask_get_representation(channelMask)
                 == AUDIO_CHANNEL_REPRESENTATION_POSITION
             && DownmixerBufferProvider::isMultichannelCapable()) {
-        mDownmixerBufferProvider.reset(new DownmixerBufferProvider(channelMask,
-                mMixerChannelMask,
-                AUDIO_FORMAT_PCM_16_BIT /* TODO: use mMixerInFormat, now only PCM 16 */,
-                sampleRate, sessionId, kCopyBufferFrameCount));
-        if (static_cast<DownmixerBufferProvider *>(mDownmixerBufferProvider.get())->isValid()) {
-            mDownmixRequiresFormat = AUDIO_FORMAT_PCM_16_BIT; // PCM 16 bit required for downmix
-            reconfigureBufferProviders();
-            return NO_ERROR;
+        // Downmix in the mixer input format when the effect accepts it, which avoids
+        // converting the track to PCM 16 bit and back. Older effects only accept PCM 16 bit.
+        audio_format_t downmixFormat = mMixerInFormat;
+        while (true) {
+            mDownmixerBufferProvider.reset(new DownmixerBufferProvider(channelMask,
+                    mMixerChannelMask, downmixFormat, sampleRate, sessionId,
+                    kCopyBufferFrameCount));
+            if (static_cast<DownmixerBufferProvider *>(
+                    mDownmixerBufferProvider.get())->isValid()) {
+                mDownmixRequiresFormat = downmixFormat;
+                reconfigureBufferProviders();
+                return NO_ERROR;
+            }
+            if (downmixFormat == AUDIO_FORMAT_PCM_16_BIT) {
+                break;
+            }
+            downmixFormat = AUDIO_FORMAT_PCM_16_BIT;
         }
         // mDownmixerBufferProvider reset below.
     }
@@ -26,25 +26,45 @@
 
 #include "EffectDownmix.h"
 
-// Do not submit with DOWNMIX_TEST_CHANNEL_INDEX defined, strictly for testing
-//#define DOWNMIX_TEST_CHANNEL_INDEX 0
-// Do not submit with DOWNMIX_ALWAYS_USE_GENERIC_DOWNMIXER defined, strictly for testing
-//#define DOWNMIX_ALWAYS_USE_GENERIC_DOWNMIXER 0
-
-#define MINUS_3_DB_IN_Q19_12 2896 // -3dB = 0.707 * 2^12 = 2896
+// SIMD fold kernels, see Downmix_fold16() and Downmix_foldFloat()
+#if defined(__aarch64__) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define USE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
 
-#ifdef BUILD_FLOAT
 #define MINUS_3_DB_IN_FLOAT 0.70710678f // -3dB = 0.70710678f
-#endif
 
-// subset of possible audio_channel_mask_t values, and AUDIO_CHANNEL_OUT_* renamed to CHANNEL_MASK_*
-typedef enum {
-    CHANNEL_MASK_QUAD_BACK = AUDIO_CHANNEL_OUT_QUAD_BACK,
-    CHANNEL_MASK_QUAD_SIDE = AUDIO_CHANNEL_OUT_QUAD_SIDE,
-    CHANNEL_MASK_5POINT1_BACK = AUDIO_CHANNEL_OUT_5POINT1_BACK,
-    CHANNEL_MASK_5POINT1_SIDE = AUDIO_CHANNEL_OUT_5POINT1_SIDE,
-    CHANNEL_MASK_7POINT1 = AUDIO_CHANNEL_OUT_7POINT1,
-} downmix_input_channel_mask_t;
+// Gains applied when folding each positional channel to stereo, in channel mask bit order:
+// channels on the left (right) go to the left (right) output, centered channels and LFE go to
+// both outputs at -3dB. The sums are then attenuated by 6dB to limit clipping.
+static const struct {
+    float left;
+    float right;
+} kFoldGains[] = {
+    {1.0f, 0.0f},                                   // FRONT_LEFT
+    {0.0f, 1.0f},                                   // FRONT_RIGHT
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // FRONT_CENTER
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // LOW_FREQUENCY
+    {1.0f, 0.0f},                                   // BACK_LEFT
+    {0.0f, 1.0f},                                   // BACK_RIGHT
+    {1.0f, 0.0f},                                   // FRONT_LEFT_OF_CENTER
+    {0.0f, 1.0f},                                   // FRONT_RIGHT_OF_CENTER
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // BACK_CENTER
+    {1.0f, 0.0f},                                   // SIDE_LEFT
+    {0.0f, 1.0f},                                   // SIDE_RIGHT
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // TOP_CENTER
+    {1.0f, 0.0f},                                   // TOP_FRONT_LEFT
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // TOP_FRONT_CENTER
+    {0.0f, 1.0f},                                   // TOP_FRONT_RIGHT
+    {1.0f, 0.0f},                                   // TOP_BACK_LEFT
+    {MINUS_3_DB_IN_FLOAT, MINUS_3_DB_IN_FLOAT},     // TOP_BACK_CENTER
+    {0.0f, 1.0f},                                   // TOP_BACK_RIGHT
+};
+
+#define FOLD_GAINS_COUNT (sizeof(kFoldGains) / sizeof(kFoldGains[0]))
 
 // effect_handle_t interface implementation for downmix effect
 const struct effect_interface_s gDownmixInterface = {
@@ -86,8 +106,7 @@ static const effect_descriptor_t * const gDescriptors[] = {
 
 // number of effects in this library
 const int kNbEffects = sizeof(gDescriptors) / sizeof(const effect_descriptor_t *);
-#ifdef BUILD_FLOAT
-static LVM_FLOAT clamp_float(LVM_FLOAT a) {
+static float clamp_float(float a) {
     if (a > 1.0f) {
         return 1.0f;
     }
@@ -98,104 +117,40 @@ static LVM_FLOAT clamp_float(LVM_FLOAT a) {
         return a;
     }
 }
-#endif
-/*----------------------------------------------------------------------------
- * Test code
- *--------------------------------------------------------------------------*/
-#ifdef DOWNMIX_TEST_CHANNEL_INDEX
-// strictly for testing, logs the indices of the channels for a given mask,
-// uses the same code as Downmix_foldGeneric()
-void Downmix_testIndexComputation(uint32_t mask) {
-    ALOGI("Testing index computation for 0x%" PRIx32 ":", mask);
-    // check against unsupported channels
-    if (mask & kUnsupported) {
-        ALOGE("Unsupported channels (top or front left/right of center)");
-        return;
-    }
-    // verify has FL/FR
-    if ((mask & AUDIO_CHANNEL_OUT_STEREO) != AUDIO_CHANNEL_OUT_STEREO) {
-        ALOGE("Front channels must be present");
-        return;
-    }
-    // verify uses SIDE as a pair (ok if not using SIDE at all)
-    bool hasSides = false;
-    if ((mask & kSides) != 0) {
-        if ((mask & kSides) != kSides) {
-            ALOGE("Side channels must be used as a pair");
-            return;
-        }
-        hasSides = true;
-    }
-    // verify uses BACK as a pair (ok if not using BACK at all)
-    bool hasBacks = false;
-    if ((mask & kBacks) != 0) {
-        if ((mask & kBacks) != kBacks) {
-            ALOGE("Back channels must be used as a pair");
-            return;
-        }
-        hasBacks = true;
-    }
-
-    const int numChan = audio_channel_count_from_out_mask(mask);
-    const bool hasFC = ((mask & AUDIO_CHANNEL_OUT_FRONT_CENTER) == AUDIO_CHANNEL_OUT_FRONT_CENTER);
-    const bool hasLFE =
-            ((mask & AUDIO_CHANNEL_OUT_LOW_FREQUENCY) == AUDIO_CHANNEL_OUT_LOW_FREQUENCY);
-    const bool hasBC = ((mask & AUDIO_CHANNEL_OUT_BACK_CENTER) == AUDIO_CHANNEL_OUT_BACK_CENTER);
-    // compute at what index each channel is: samples will be in the following order:
-    //   FL FR FC LFE BL BR BC SL SR
-    // when a channel is not present, its index is set to the same as the index of the preceding
-    // channel
-    const int indexFC  = hasFC    ? 2            : 1;        // front center
-    const int indexLFE = hasLFE   ? indexFC + 1  : indexFC;  // low frequency
-    const int indexBL  = hasBacks ? indexLFE + 1 : indexLFE; // back left
-    const int indexBR  = hasBacks ? indexBL + 1  : indexBL;  // back right
-    const int indexBC  = hasBC    ? indexBR + 1  : indexBR;  // back center
-    const int indexSL  = hasSides ? indexBC + 1  : indexBC;  // side left
-    const int indexSR  = hasSides ? indexSL + 1  : indexSL;  // side right
-
-    ALOGI("  FL FR FC LFE BL BR BC SL SR");
-    ALOGI("   %d  %d  %d   %d  %d  %d  %d  %d  %d",
-            0, 1, indexFC, indexLFE, indexBL, indexBR, indexBC, indexSL, indexSR);
-}
-#endif
 
 static bool Downmix_validChannelMask(uint32_t mask)
 {
     if (!mask) {
         return false;
     }
-    // check against unsupported channels
-    if (mask & kUnsupported) {
-        ALOGE("Unsupported channels (top or front left/right of center)");
+    // every positional channel has a fold-down gain, reject index masks and unknown positions
+    if (audio_channel_mask_get_representation(mask) != AUDIO_CHANNEL_REPRESENTATION_POSITION
+            || (mask >> FOLD_GAINS_COUNT) != 0) {
+        ALOGE("Unsupported channels in mask 0x%" PRIx32, mask);
         return false;
     }
-    // verify has FL/FR
+    // the strip path copies the first two channels, and the fold kernels need at least two
+    // channels per frame to stay within the input buffer
     if ((mask & AUDIO_CHANNEL_OUT_STEREO) != AUDIO_CHANNEL_OUT_STEREO) {
-        ALOGE("Front channels must be present");
+        ALOGE("Front channels must be present in mask 0x%" PRIx32, mask);
         return false;
     }
-    // verify uses SIDE as a pair (ok if not using SIDE at all)
-    if ((mask & kSides) != 0) {
-        if ((mask & kSides) != kSides) {
-            ALOGE("Side channels must be used as a pair");
-            return false;
-        }
-    }
-    // verify uses BACK as a pair (ok if not using BACK at all)
-    if ((mask & kBacks) != 0) {
-        if ((mask & kBacks) != kBacks) {
-            ALOGE("Back channels must be used as a pair");
-            return false;
-        }
-    }
     return true;
 }
 
-/*----------------------------------------------------------------------------
- * Effect API implementation
- *--------------------------------------------------------------------------*/
+#if defined(USE_NEON) || defined(USE_SSE)
+// Number of frames the SIMD loops need to process 4 frames: channels are loaded groupWidth at a
+// time, so the loads of the 4th frame end at the end of its last, possibly partial, group.
+static size_t Downmix_minSimdFrames(size_t numChan, size_t groupWidth) {
+    const size_t lastLoaded = 3 * numChan + (numChan + groupWidth - 1) / groupWidth * groupWidth;
+    return (lastLoaded + numChan - 1) / numChan;
+}
+#endif
 
-/*--- Effect Library Interface Implementation ---*/
+static bool Downmix_validFormat(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_FLOAT;
+}
 
 int32_t DownmixLib_Create(const effect_uuid_t *uuid,
         int32_t sessionId __unused,
@@ -208,26 +163,6 @@ int32_t DownmixLib_Create(const effect_uuid_t *uuid,
 
     ALOGV("DownmixLib_Create()");
 
-#ifdef DOWNMIX_TEST_CHANNEL_INDEX
-    // should work (won't log an error)
-    ALOGI("DOWNMIX_TEST_CHANNEL_INDEX: should work:");
-    Downmix_testIndexComputation(AUDIO_CHANNEL_OUT_FRONT_LEFT | AUDIO_CHANNEL_OUT_FRONT_RIGHT |
-                    AUDIO_CHANNEL_OUT_LOW_FREQUENCY | AUDIO_CHANNEL_OUT_BACK_CENTER);
-    Downmix_testIndexComputation(CHANNEL_MASK_QUAD_SIDE | CHANNEL_MASK_QUAD_BACK);
-    Downmix_testIndexComputation(CHANNEL_MASK_5POINT1_SIDE | AUDIO_CHANNEL_OUT_BACK_CENTER);
-    Downmix_testIndexComputation(CHANNEL_MASK_5POINT1_BACK | AUDIO_CHANNEL_OUT_BACK_CENTER);
-    // shouldn't work (will log an error, won't display channel indices)
-    ALOGI("DOWNMIX_TEST_CHANNEL_INDEX: should NOT work:");
-    Downmix_testIndexComputation(AUDIO_CHANNEL_OUT_FRONT_LEFT | AUDIO_CHANNEL_OUT_FRONT_RIGHT |
-                        AUDIO_CHANNEL_OUT_LOW_FREQUENCY | AUDIO_CHANNEL_OUT_BACK_LEFT);
-    Downmix_testIndexComputation(AUDIO_CHANNEL_OUT_FRONT_LEFT | AUDIO_CHANNEL_OUT_FRONT_RIGHT |
-                            AUDIO_CHANNEL_OUT_LOW_FREQUENCY | AUDIO_CHANNEL_OUT_SIDE_LEFT);
-    Downmix_testIndexComputation(AUDIO_CHANNEL_OUT_FRONT_LEFT |
-                        AUDIO_CHANNEL_OUT_BACK_LEFT | AUDIO_CHANNEL_OUT_BACK_RIGHT);
-    Downmix_testIndexComputation(AUDIO_CHANNEL_OUT_FRONT_LEFT |
-                            AUDIO_CHANNEL_OUT_SIDE_LEFT | AUDIO_CHANNEL_OUT_SIDE_RIGHT);
-#endif
-
     if (pHandle == NULL || uuid == NULL) {
         return -EINVAL;
     }
@@ -301,14 +236,12 @@ int32_t DownmixLib_GetDescriptor(const effect_uuid_t *uuid, effect_descriptor_t
     return -EINVAL;
 }
 
-#ifndef BUILD_FLOAT
 /*--- Effect Control Interface Implementation ---*/
 
 static int Downmix_Process(effect_handle_t self,
         audio_buffer_t *inBuffer, audio_buffer_t *outBuffer) {
 
     downmix_object_t *pDownmixer;
-    int16_t *pSrc, *pDst;
     downmix_module_t *pDwmModule = (downmix_module_t *)self;
 
     if (pDwmModule == NULL) {
@@ -331,29 +264,31 @@ static int Downmix_Process(effect_handle_t self,
         return -ENODATA;
     }
 
-    pSrc = inBuffer->s16;
-    pDst = outBuffer->s16;
     size_t numFrames = outBuffer->frameCount;
 
     const bool accumulate =
             (pDwmModule->config.outputCfg.accessMode == EFFECT_BUFFER_ACCESS_ACCUMULATE);
-    const uint32_t downmixInputChannelMask = pDwmModule->config.inputCfg.channels;
+    const bool isFloat = (pDwmModule->config.inputCfg.format == AUDIO_FORMAT_PCM_FLOAT);
 
     switch(pDownmixer->type) {
 
       case DOWNMIX_TYPE_STRIP:
-          if (accumulate) {
+          if (isFloat) {
+              const float *pSrc = inBuffer->f32;
+              float *pDst = outBuffer->f32;
               while (numFrames) {
-                  pDst[0] = clamp16(pDst[0] + pSrc[0]);
-                  pDst[1] = clamp16(pDst[1] + pSrc[1]);
+                  pDst[0] = accumulate ? clamp_float(pDst[0] + pSrc[0]) : pSrc[0];
+                  pDst[1] = accumulate ? clamp_float(pDst[1] + pSrc[1]) : pSrc[1];
                   pSrc += pDownmixer->input_channel_count;
                   pDst += 2;
                   numFrames--;
               }
           } else {
+              const int16_t *pSrc = inBuffer->s16;
+              int16_t *pDst = outBuffer->s16;
               while (numFrames) {
-                  pDst[0] = pSrc[0];
-                  pDst[1] = pSrc[1];
+                  pDst[0] = accumulate ? clamp16(pDst[0] + pSrc[0]) : pSrc[0];
+                  pDst[1] = accumulate ? clamp16(pDst[1] + pSrc[1]) : pSrc[1];
                   pSrc += pDownmixer->input_channel_count;
                   pDst += 2;
                   numFrames--;
@@ -362,138 +297,13 @@ static int Downmix_Process(effect_handle_t self,
           break;
 
       case DOWNMIX_TYPE_FOLD:
-#ifdef DOWNMIX_ALWAYS_USE_GENERIC_DOWNMIXER
-          // bypass the optimized downmix routines for the common formats
-          if (!Downmix_foldGeneric(
-                  downmixInputChannelMask, pSrc, pDst, numFrames, accumulate)) {
-              ALOGE("Multichannel configuration 0x%" PRIx32 " is not supported", downmixInputChannelMask);
-              return -EINVAL;
-          }
-          break;
-#endif
-        // optimize for the common formats
-        switch((downmix_input_channel_mask_t)downmixInputChannelMask) {
-        case CHANNEL_MASK_QUAD_BACK:
-        case CHANNEL_MASK_QUAD_SIDE:
-            Downmix_foldFromQuad(pSrc, pDst, numFrames, accumulate);
-            break;
-        case CHANNEL_MASK_5POINT1_BACK:
-        case CHANNEL_MASK_5POINT1_SIDE:
-            Downmix_foldFrom5Point1(pSrc, pDst, numFrames, accumulate);
-            break;
-        case CHANNEL_MASK_7POINT1:
-            Downmix_foldFrom7Point1(pSrc, pDst, numFrames, accumulate);
-            break;
-        default:
-            if (!Downmix_foldGeneric(
-                    downmixInputChannelMask, pSrc, pDst, numFrames, accumulate)) {
-                ALOGE("Multichannel configuration 0x%" PRIx32 " is not supported", downmixInputChannelMask);
-                return -EINVAL;
-            }
-            break;
-        }
-        break;
-
-      default:
-        return -EINVAL;
-    }
-
-    return 0;
-}
-#else /*BUILD_FLOAT*/
-/*--- Effect Control Interface Implementation ---*/
-
-static int Downmix_Process(effect_handle_t self,
-        audio_buffer_t *inBuffer, audio_buffer_t *outBuffer) {
-
-    downmix_object_t *pDownmixer;
-    LVM_FLOAT *pSrc, *pDst;
-    downmix_module_t *pDwmModule = (downmix_module_t *)self;
-
-    if (pDwmModule == NULL) {
-        return -EINVAL;
-    }
-
-    if (inBuffer == NULL || inBuffer->raw == NULL ||
-        outBuffer == NULL || outBuffer->raw == NULL ||
-        inBuffer->frameCount != outBuffer->frameCount) {
-        return -EINVAL;
-    }
-
-    pDownmixer = (downmix_object_t*) &pDwmModule->context;
-
-    if (pDownmixer->state == DOWNMIX_STATE_UNINITIALIZED) {
-        ALOGE("Downmix_Process error: trying to use an uninitialized downmixer");
-        return -EINVAL;
-    } else if (pDownmixer->state == DOWNMIX_STATE_INITIALIZED) {
-        ALOGE("Downmix_Process error: trying to use a non-configured downmixer");
-        return -ENODATA;
-    }
-
-    pSrc = (LVM_FLOAT *) inBuffer->s16;
-    pDst = (LVM_FLOAT *) outBuffer->s16;
-    size_t numFrames = outBuffer->frameCount;
-
-    const bool accumulate =
-            (pDwmModule->config.outputCfg.accessMode == EFFECT_BUFFER_ACCESS_ACCUMULATE);
-    const uint32_t downmixInputChannelMask = pDwmModule->config.inputCfg.channels;
-
-    switch(pDownmixer->type) {
-
-      case DOWNMIX_TYPE_STRIP:
-          if (accumulate) {
-              while (numFrames) {
-                  pDst[0] = clamp_float(pDst[0] + pSrc[0]);
-                  pDst[1] = clamp_float(pDst[1] + pSrc[1]);
-                  pSrc += pDownmixer->input_channel_count;
-                  pDst += 2;
-                  numFrames--;
-              }
+          // the fold-down matrix for the input channel mask was computed by Downmix_Configure()
+          if (isFloat) {
+              Downmix_foldFloat(pDownmixer, inBuffer->f32, outBuffer->f32, numFrames, accumulate);
           } else {
-              while (numFrames) {
-                  pDst[0] = pSrc[0];
-                  pDst[1] = pSrc[1];
-                  pSrc += pDownmixer->input_channel_count;
-                  pDst += 2;
-                  numFrames--;
-              }
-          }
-          break;
-
-      case DOWNMIX_TYPE_FOLD:
-#ifdef DOWNMIX_ALWAYS_USE_GENERIC_DOWNMIXER
-          // bypass the optimized downmix routines for the common formats
-          if (!Downmix_foldGeneric(
-                  downmixInputChannelMask, pSrc, pDst, numFrames, accumulate)) {
-              ALOGE("Multichannel configuration 0x%" PRIx32 " is not supported",
-                    downmixInputChannelMask);
-              return -EINVAL;
+              Downmix_fold16(pDownmixer, inBuffer->s16, outBuffer->s16, numFrames, accumulate);
           }
           break;
-#endif
-        // optimize for the common formats
-        switch((downmix_input_channel_mask_t)downmixInputChannelMask) {
-        case CHANNEL_MASK_QUAD_BACK:
-        case CHANNEL_MASK_QUAD_SIDE:
-            Downmix_foldFromQuad(pSrc, pDst, numFrames, accumulate);
-            break;
-        case CHANNEL_MASK_5POINT1_BACK:
-        case CHANNEL_MASK_5POINT1_SIDE:
-            Downmix_foldFrom5Point1(pSrc, pDst, numFrames, accumulate);
-            break;
-        case CHANNEL_MASK_7POINT1:
-            Downmix_foldFrom7Point1(pSrc, pDst, numFrames, accumulate);
-            break;
-        default:
-            if (!Downmix_foldGeneric(
-                    downmixInputChannelMask, pSrc, pDst, numFrames, accumulate)) {
-                ALOGE("Multichannel configuration 0x%" PRIx32 " is not supported",
-                      downmixInputChannelMask);
-                return -EINVAL;
-            }
-            break;
-        }
-        break;
 
       default:
         return -EINVAL;
@@ -501,7 +311,6 @@ static int Downmix_Process(effect_handle_t self,
 
     return 0;
 }
-#endif
 
 static int Downmix_Command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
         void *pCmdData, uint32_t *replySize, void *pReplyData) {
@@ -762,8 +571,8 @@ int Downmix_Configure(downmix_module_t *pDwmModule, effect_config_t *pConfig, bo
     // Check configuration compatibility with build options, and effect capabilities
     if (pConfig->inputCfg.samplingRate != pConfig->outputCfg.samplingRate
         || pConfig->outputCfg.channels != DOWNMIX_OUTPUT_CHANNELS
-        || pConfig->inputCfg.format != AUDIO_FORMAT_PCM_16_BIT
-        || pConfig->outputCfg.format != AUDIO_FORMAT_PCM_16_BIT) {
+        || !Downmix_validFormat(pConfig->inputCfg.format)
+        || pConfig->outputCfg.format != pConfig->inputCfg.format) {
         ALOGE("Downmix_Configure error: invalid config");
         return -EINVAL;
     }
@@ -775,16 +584,13 @@ int Downmix_Configure(downmix_module_t *pDwmModule, effect_config_t *pConfig, bo
     if (init) {
         pDownmixer->type = DOWNMIX_TYPE_FOLD;
         pDownmixer->apply_volume_correction = false;
-        pDownmixer->input_channel_count = 8; // matches default input of AUDIO_CHANNEL_OUT_7POINT1
-    } else {
-        // when configuring the effect, do not allow a blank or unsupported channel mask
-        if (!Downmix_validChannelMask(pConfig->inputCfg.channels)) {
-            ALOGE("Downmix_Configure error: input channel mask(0x%x) not supported",
-                                                        pConfig->inputCfg.channels);
-            return -EINVAL;
-        }
-        pDownmixer->input_channel_count =
-                audio_channel_count_from_out_mask(pConfig->inputCfg.channels);
+    }
+    // do not allow a blank or unsupported channel mask, the default input of
+    // AUDIO_CHANNEL_OUT_7POINT1 is always supported
+    if (!Downmix_computeMatrix(pDownmixer, pConfig->inputCfg.channels)) {
+        ALOGE("Downmix_Configure error: input channel mask(0x%x) not supported",
+                                                    pConfig->inputCfg.channels);
+        return -EINVAL;
     }
 
     Downmix_Reset(pDownmixer, init);
@@ -922,509 +728,303 @@ int Downmix_getParameter(downmix_object_t *pDownmixer, int32_t param, uint32_t *
 
 
 /*----------------------------------------------------------------------------
- * Downmix_foldFromQuad()
+ * Downmix_computeMatrix()
  *----------------------------------------------------------------------------
  * Purpose:
- * downmix a quad signal to stereo
+ * compute the stereo fold-down matrix for a multichannel format, which may contain any of the
+ * positional channels (e.g. up to 7.1.4 and beyond).
+ * Samples are interleaved in channel mask bit order, so the matrix has one column per bit set.
  *
  * Inputs:
- *  pSrc       quad audio samples to downmix
- *  numFrames  the number of quad frames to downmix
- *  accumulate whether to mix (when true) the result of the downmix with the contents of pDst,
- *               or overwrite pDst (when false)
+ *  pDownmixer    handle to instance data
+ *  mask          the channel mask of the samples to downmix
  *
  * Outputs:
- *  pDst       downmixed stereo audio samples
+ *  pDownmixer->coefs_float, pDownmixer->coefs_q12 and pDownmixer->input_channel_count
+ *
+ * Returns: false if multichannel format is not supported
  *
  *----------------------------------------------------------------------------
  */
-#ifndef BUILD_FLOAT
-void Downmix_foldFromQuad(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate) {
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is RL
-    // sample at index 3 is RR
-    if (accumulate) {
-        while (numFrames) {
-            // FL + RL
-            pDst[0] = clamp16(pDst[0] + ((pSrc[0] + pSrc[2]) >> 1));
-            // FR + RR
-            pDst[1] = clamp16(pDst[1] + ((pSrc[1] + pSrc[3]) >> 1));
-            pSrc += 4;
-            pDst += 2;
-            numFrames--;
-        }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // FL + RL
-            pDst[0] = clamp16((pSrc[0] + pSrc[2]) >> 1);
-            // FR + RR
-            pDst[1] = clamp16((pSrc[1] + pSrc[3]) >> 1);
-            pSrc += 4;
-            pDst += 2;
-            numFrames--;
-        }
+bool Downmix_computeMatrix(downmix_object_t *pDownmixer, uint32_t mask) {
+
+    if (!Downmix_validChannelMask(mask)) {
+        return false;
     }
-}
-#else
-void Downmix_foldFromQuad(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate) {
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is RL
-    // sample at index 3 is RR
-    if (accumulate) {
-        while (numFrames) {
-            // FL + RL
-            pDst[0] = clamp_float(pDst[0] + ((pSrc[0] + pSrc[2]) / 2.0f));
-            // FR + RR
-            pDst[1] = clamp_float(pDst[1] + ((pSrc[1] + pSrc[3]) / 2.0f));
-            pSrc += 4;
-            pDst += 2;
-            numFrames--;
-        }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // FL + RL
-            pDst[0] = clamp_float((pSrc[0] + pSrc[2]) / 2.0f);
-            // FR + RR
-            pDst[1] = clamp_float((pSrc[1] + pSrc[3]) / 2.0f);
-            pSrc += 4;
-            pDst += 2;
-            numFrames--;
+
+    memset(pDownmixer->coefs_float, 0, sizeof(pDownmixer->coefs_float));
+    memset(pDownmixer->coefs_q12, 0, sizeof(pDownmixer->coefs_q12));
+
+    uint8_t channel = 0;
+    for (uint32_t bit = 0; bit < FOLD_GAINS_COUNT; bit++) {
+        if ((mask & (1u << bit)) == 0) {
+            continue;
         }
+        pDownmixer->coefs_float[0][channel] = kFoldGains[bit].left / 2.0f;
+        pDownmixer->coefs_float[1][channel] = kFoldGains[bit].right / 2.0f;
+        // -3dB = 0.707 * 2^12 = 2896
+        pDownmixer->coefs_q12[0][channel] = (int16_t)(kFoldGains[bit].left * (1 << 12));
+        pDownmixer->coefs_q12[1][channel] = (int16_t)(kFoldGains[bit].right * (1 << 12));
+        channel++;
     }
+    pDownmixer->input_channel_count = channel;
+    return true;
 }
-#endif
 
 /*----------------------------------------------------------------------------
- * Downmix_foldFrom5Point1()
+ * Downmix_fold16()
  *----------------------------------------------------------------------------
  * Purpose:
- * downmix a 5.1 signal to stereo
+ * downmix a multichannel signal to stereo with the matrix computed by Downmix_computeMatrix()
  *
  * Inputs:
- *  pSrc       5.1 audio samples to downmix
- *  numFrames  the number of 5.1 frames to downmix
+ *  pDownmixer handle to instance data
+ *  pSrc       multichannel audio samples to downmix
+ *  numFrames  the number of multichannel frames to downmix
  *  accumulate whether to mix (when true) the result of the downmix with the contents of pDst,
  *               or overwrite pDst (when false)
  *
  * Outputs:
  *  pDst       downmixed stereo audio samples
  *
+ * The SIMD loops process 4 frames at a time, one frame per lane: with NEON each group of 4
+ * channels is transposed from the 4 frames, then scaled by the matrix coefficients of its
+ * channels; with SSE2 pairs of adjacent channels are scaled and summed by _mm_madd_epi16.
+ * The last group of channels may be loaded past the end of the frame, so the frames the last
+ * loads would run past the end of the buffer are left to the scalar loop.
+ *
  *----------------------------------------------------------------------------
  */
-#ifndef BUILD_FLOAT
-void Downmix_foldFrom5Point1(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate) {
-    int32_t lt, rt, centerPlusLfeContrib; // samples in Q19.12 format
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is FC
-    // sample at index 3 is LFE
-    // sample at index 4 is RL
-    // sample at index 5 is RR
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_Q19_12)
-                    + (pSrc[3] * MINUS_3_DB_IN_Q19_12);
-            // FL + centerPlusLfeContrib + RL
-            lt = (pSrc[0] << 12) + centerPlusLfeContrib + (pSrc[4] << 12);
-            // FR + centerPlusLfeContrib + RR
-            rt = (pSrc[1] << 12) + centerPlusLfeContrib + (pSrc[5] << 12);
-            // accumulate in destination
-            pDst[0] = clamp16(pDst[0] + (lt >> 13));
-            pDst[1] = clamp16(pDst[1] + (rt >> 13));
-            pSrc += 6;
-            pDst += 2;
-            numFrames--;
+void Downmix_fold16(const downmix_object_t *pDownmixer,
+        const int16_t *pSrc, int16_t *pDst, size_t numFrames, bool accumulate) {
+    const size_t numChan = pDownmixer->input_channel_count;
+    const int16_t *coefsL = pDownmixer->coefs_q12[0];
+    const int16_t *coefsR = pDownmixer->coefs_q12[1];
+    int32_t lt, rt; // samples in Q19.12 format
+
+#if defined(USE_NEON) || defined(USE_SSE)
+#if defined(USE_NEON)
+    const size_t minFrames = Downmix_minSimdFrames(numChan, 4);
+#else
+    const size_t minFrames = Downmix_minSimdFrames(numChan, 2);
+#endif
+    while (numFrames >= minFrames) {
+#if defined(USE_NEON)
+        int32x4_t accL = vdupq_n_s32(0);
+        int32x4_t accR = vdupq_n_s32(0);
+        for (size_t ch = 0; ch < numChan; ch += 4) {
+            const int16x4x2_t t01 = vtrn_s16(vld1_s16(pSrc + ch), vld1_s16(pSrc + numChan + ch));
+            const int16x4x2_t t23 = vtrn_s16(vld1_s16(pSrc + 2 * numChan + ch),
+                    vld1_s16(pSrc + 3 * numChan + ch));
+            // columns ch and ch + 2, then ch + 1 and ch + 3
+            const int32x2x2_t c02 = vtrn_s32(vreinterpret_s32_s16(t01.val[0]),
+                    vreinterpret_s32_s16(t23.val[0]));
+            const int32x2x2_t c13 = vtrn_s32(vreinterpret_s32_s16(t01.val[1]),
+                    vreinterpret_s32_s16(t23.val[1]));
+            const int16x4_t col0 = vreinterpret_s16_s32(c02.val[0]);
+            const int16x4_t col1 = vreinterpret_s16_s32(c13.val[0]);
+            const int16x4_t col2 = vreinterpret_s16_s32(c02.val[1]);
+            const int16x4_t col3 = vreinterpret_s16_s32(c13.val[1]);
+            accL = vmlal_n_s16(accL, col0, coefsL[ch]);
+            accL = vmlal_n_s16(accL, col1, coefsL[ch + 1]);
+            accL = vmlal_n_s16(accL, col2, coefsL[ch + 2]);
+            accL = vmlal_n_s16(accL, col3, coefsL[ch + 3]);
+            accR = vmlal_n_s16(accR, col0, coefsR[ch]);
+            accR = vmlal_n_s16(accR, col1, coefsR[ch + 1]);
+            accR = vmlal_n_s16(accR, col2, coefsR[ch + 2]);
+            accR = vmlal_n_s16(accR, col3, coefsR[ch + 3]);
         }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_Q19_12)
-                    + (pSrc[3] * MINUS_3_DB_IN_Q19_12);
-            // FL + centerPlusLfeContrib + RL
-            lt = (pSrc[0] << 12) + centerPlusLfeContrib + (pSrc[4] << 12);
-            // FR + centerPlusLfeContrib + RR
-            rt = (pSrc[1] << 12) + centerPlusLfeContrib + (pSrc[5] << 12);
-            // store in destination
-            pDst[0] = clamp16(lt >> 13); // differs from when accumulate is true above
-            pDst[1] = clamp16(rt >> 13); // differs from when accumulate is true above
-            pSrc += 6;
-            pDst += 2;
-            numFrames--;
+        accL = vshrq_n_s32(accL, 13);
+        accR = vshrq_n_s32(accR, 13);
+        int16x4x2_t out;
+        if (accumulate) {
+            const int16x4x2_t dst = vld2_s16(pDst);
+            out.val[0] = vqmovn_s32(vaddw_s16(accL, dst.val[0]));
+            out.val[1] = vqmovn_s32(vaddw_s16(accR, dst.val[1]));
+        } else {
+            out.val[0] = vqmovn_s32(accL);
+            out.val[1] = vqmovn_s32(accR);
         }
-    }
-}
-#else
-void Downmix_foldFrom5Point1(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate) {
-    LVM_FLOAT lt, rt, centerPlusLfeContrib; // samples in Q19.12 format
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is FC
-    // sample at index 3 is LFE
-    // sample at index 4 is RL
-    // sample at index 5 is RR
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_FLOAT)
-                    + (pSrc[3] * MINUS_3_DB_IN_FLOAT);
-            // FL + centerPlusLfeContrib + RL
-            lt = pSrc[0] + centerPlusLfeContrib + pSrc[4];
-            // FR + centerPlusLfeContrib + RR
-            rt = pSrc[1] + centerPlusLfeContrib + pSrc[5];
-            // accumulate in destination
-            pDst[0] = clamp_float(pDst[0] + (lt / 2.0f));
-            pDst[1] = clamp_float(pDst[1] + (rt / 2.0f));
-            pSrc += 6;
-            pDst += 2;
-            numFrames--;
+        vst2_s16(pDst, out);
+#else /* USE_SSE */
+        // _mm_madd_epi16 multiplies and sums pairs of channels, which are contiguous in a frame
+        __m128i accL = _mm_setzero_si128();
+        __m128i accR = _mm_setzero_si128();
+        for (size_t ch = 0; ch < numChan; ch += 2) {
+            int32_t pair0, pair1, pair2, pair3, coefPairL, coefPairR;
+            memcpy(&pair0, pSrc + ch, sizeof(int32_t));
+            memcpy(&pair1, pSrc + numChan + ch, sizeof(int32_t));
+            memcpy(&pair2, pSrc + 2 * numChan + ch, sizeof(int32_t));
+            memcpy(&pair3, pSrc + 3 * numChan + ch, sizeof(int32_t));
+            memcpy(&coefPairL, coefsL + ch, sizeof(int32_t));
+            memcpy(&coefPairR, coefsR + ch, sizeof(int32_t));
+            const __m128i samples = _mm_setr_epi32(pair0, pair1, pair2, pair3);
+            accL = _mm_add_epi32(accL, _mm_madd_epi16(samples, _mm_set1_epi32(coefPairL)));
+            accR = _mm_add_epi32(accR, _mm_madd_epi16(samples, _mm_set1_epi32(coefPairR)));
         }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_FLOAT)
-                    + (pSrc[3] * MINUS_3_DB_IN_FLOAT);
-            // FL + centerPlusLfeContrib + RL
-            lt = pSrc[0] + centerPlusLfeContrib + pSrc[4];
-            // FR + centerPlusLfeContrib + RR
-            rt = pSrc[1] + centerPlusLfeContrib + pSrc[5];
-            // store in destination
-            pDst[0] = clamp_float(lt / 2.0f); // differs from when accumulate is true above
-            pDst[1] = clamp_float(rt / 2.0f); // differs from when accumulate is true above
-            pSrc += 6;
-            pDst += 2;
-            numFrames--;
+        accL = _mm_srai_epi32(accL, 13);
+        accR = _mm_srai_epi32(accR, 13);
+        __m128i lo = _mm_unpacklo_epi32(accL, accR);
+        __m128i hi = _mm_unpackhi_epi32(accL, accR);
+        if (accumulate) {
+            const __m128i dst = _mm_loadu_si128((const __m128i *)pDst);
+            lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(dst, dst), 16));
+            hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(dst, dst), 16));
         }
+        _mm_storeu_si128((__m128i *)pDst, _mm_packs_epi32(lo, hi));
+#endif
+        pSrc += 4 * numChan;
+        pDst += 4 * 2;
+        numFrames -= 4;
     }
-}
 #endif
 
-/*----------------------------------------------------------------------------
- * Downmix_foldFrom7Point1()
- *----------------------------------------------------------------------------
- * Purpose:
- * downmix a 7.1 signal to stereo
- *
- * Inputs:
- *  pSrc       7.1 audio samples to downmix
- *  numFrames  the number of 7.1 frames to downmix
- *  accumulate whether to mix (when true) the result of the downmix with the contents of pDst,
- *               or overwrite pDst (when false)
- *
- * Outputs:
- *  pDst       downmixed stereo audio samples
- *
- *----------------------------------------------------------------------------
- */
-#ifndef BUILD_FLOAT
-void Downmix_foldFrom7Point1(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate) {
-    int32_t lt, rt, centerPlusLfeContrib; // samples in Q19.12 format
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is FC
-    // sample at index 3 is LFE
-    // sample at index 4 is RL
-    // sample at index 5 is RR
-    // sample at index 6 is SL
-    // sample at index 7 is SR
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_Q19_12)
-                    + (pSrc[3] * MINUS_3_DB_IN_Q19_12);
-            // FL + centerPlusLfeContrib + SL + RL
-            lt = (pSrc[0] << 12) + centerPlusLfeContrib + (pSrc[6] << 12) + (pSrc[4] << 12);
-            // FR + centerPlusLfeContrib + SR + RR
-            rt = (pSrc[1] << 12) + centerPlusLfeContrib + (pSrc[7] << 12) + (pSrc[5] << 12);
-            //accumulate in destination
+    while (numFrames) {
+        lt = 0;
+        rt = 0;
+        for (size_t ch = 0; ch < numChan; ch++) {
+            lt += pSrc[ch] * coefsL[ch];
+            rt += pSrc[ch] * coefsR[ch];
+        }
+        if (accumulate) {
             pDst[0] = clamp16(pDst[0] + (lt >> 13));
             pDst[1] = clamp16(pDst[1] + (rt >> 13));
-            pSrc += 8;
-            pDst += 2;
-            numFrames--;
-    }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_Q19_12)
-                    + (pSrc[3] * MINUS_3_DB_IN_Q19_12);
-            // FL + centerPlusLfeContrib + SL + RL
-            lt = (pSrc[0] << 12) + centerPlusLfeContrib + (pSrc[6] << 12) + (pSrc[4] << 12);
-            // FR + centerPlusLfeContrib + SR + RR
-            rt = (pSrc[1] << 12) + centerPlusLfeContrib + (pSrc[7] << 12) + (pSrc[5] << 12);
-            // store in destination
-            pDst[0] = clamp16(lt >> 13); // differs from when accumulate is true above
-            pDst[1] = clamp16(rt >> 13); // differs from when accumulate is true above
-            pSrc += 8;
-            pDst += 2;
-            numFrames--;
-        }
-    }
-}
-#else
-void Downmix_foldFrom7Point1(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate) {
-    LVM_FLOAT lt, rt, centerPlusLfeContrib; // samples in Q19.12 format
-    // sample at index 0 is FL
-    // sample at index 1 is FR
-    // sample at index 2 is FC
-    // sample at index 3 is LFE
-    // sample at index 4 is RL
-    // sample at index 5 is RR
-    // sample at index 6 is SL
-    // sample at index 7 is SR
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_Q19_12)
-                    + (pSrc[3] * MINUS_3_DB_IN_Q19_12);
-            // FL + centerPlusLfeContrib + SL + RL
-            lt = pSrc[0] + centerPlusLfeContrib + pSrc[6] + pSrc[4];
-            // FR + centerPlusLfeContrib + SR + RR
-            rt = pSrc[1] + centerPlusLfeContrib + pSrc[7] + pSrc[5];
-            //accumulate in destination
-            pDst[0] = clamp_float(pDst[0] + (lt / 2.0f));
-            pDst[1] = clamp_float(pDst[1] + (rt / 2.0f));
-            pSrc += 8;
-            pDst += 2;
-            numFrames--;
-        }
-    } else { // same code as above but without adding and clamping pDst[i] to itself
-        while (numFrames) {
-            // centerPlusLfeContrib = FC(-3dB) + LFE(-3dB)
-            centerPlusLfeContrib = (pSrc[2] * MINUS_3_DB_IN_FLOAT)
-                    + (pSrc[3] * MINUS_3_DB_IN_FLOAT);
-            // FL + centerPlusLfeContrib + SL + RL
-            lt = pSrc[0] + centerPlusLfeContrib + pSrc[6] + pSrc[4];
-            // FR + centerPlusLfeContrib + SR + RR
-            rt = pSrc[1] + centerPlusLfeContrib + pSrc[7] + pSrc[5];
-            // store in destination
-            pDst[0] = clamp_float(lt / 2.0f); // differs from when accumulate is true above
-            pDst[1] = clamp_float(rt / 2.0f); // differs from when accumulate is true above
-            pSrc += 8;
-            pDst += 2;
-            numFrames--;
+        } else {
+            pDst[0] = clamp16(lt >> 13);
+            pDst[1] = clamp16(rt >> 13);
         }
+        pSrc += numChan;
+        pDst += 2;
+        numFrames--;
     }
 }
-#endif
+
 /*----------------------------------------------------------------------------
- * Downmix_foldGeneric()
+ * Downmix_foldFloat()
  *----------------------------------------------------------------------------
  * Purpose:
- * downmix to stereo a multichannel signal whose format is:
- *  - has FL/FR
- *  - if using AUDIO_CHANNEL_OUT_SIDE*, it contains both left and right
- *  - if using AUDIO_CHANNEL_OUT_BACK*, it contains both left and right
- *  - doesn't use any of the AUDIO_CHANNEL_OUT_TOP* channels
- *  - doesn't use any of the AUDIO_CHANNEL_OUT_FRONT_*_OF_CENTER channels
- * Only handles channel masks not enumerated in downmix_input_channel_mask_t
- *
- * Inputs:
- *  mask       the channel mask of pSrc
- *  pSrc       multichannel audio buffer to downmix
- *  numFrames  the number of multichannel frames to downmix
- *  accumulate whether to mix (when true) the result of the downmix with the contents of pDst,
- *               or overwrite pDst (when false)
- *
- * Outputs:
- *  pDst       downmixed stereo audio samples
- *
- * Returns: false if multichannel format is not supported
+ * same as Downmix_fold16() for float samples
  *
  *----------------------------------------------------------------------------
  */
-#ifndef BUILD_FLOAT
-bool Downmix_foldGeneric(
-        uint32_t mask, int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate) {
-
-    if (!Downmix_validChannelMask(mask)) {
-        return false;
-    }
-
-    const bool hasSides = (mask & kSides) != 0;
-    const bool hasBacks = (mask & kBacks) != 0;
-
-    const int numChan = audio_channel_count_from_out_mask(mask);
-    const bool hasFC = ((mask & AUDIO_CHANNEL_OUT_FRONT_CENTER) == AUDIO_CHANNEL_OUT_FRONT_CENTER);
-    const bool hasLFE =
-            ((mask & AUDIO_CHANNEL_OUT_LOW_FREQUENCY) == AUDIO_CHANNEL_OUT_LOW_FREQUENCY);
-    const bool hasBC = ((mask & AUDIO_CHANNEL_OUT_BACK_CENTER) == AUDIO_CHANNEL_OUT_BACK_CENTER);
-    // compute at what index each channel is: samples will be in the following order:
-    //   FL FR FC LFE BL BR BC SL SR
-    // when a channel is not present, its index is set to the same as the index of the preceding
-    // channel
-    const int indexFC  = hasFC    ? 2            : 1;        // front center
-    const int indexLFE = hasLFE   ? indexFC + 1  : indexFC;  // low frequency
-    const int indexBL  = hasBacks ? indexLFE + 1 : indexLFE; // back left
-    const int indexBR  = hasBacks ? indexBL + 1  : indexBL;  // back right
-    const int indexBC  = hasBC    ? indexBR + 1  : indexBR;  // back center
-    const int indexSL  = hasSides ? indexBC + 1  : indexBC;  // side left
-    const int indexSR  = hasSides ? indexSL + 1  : indexSL;  // side right
-
-    int32_t lt, rt, centersLfeContrib; // samples in Q19.12 format
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // compute contribution of FC, BC and LFE
-            centersLfeContrib = 0;
-            if (hasFC)  { centersLfeContrib += pSrc[indexFC]; }
-            if (hasLFE) { centersLfeContrib += pSrc[indexLFE]; }
-            if (hasBC)  { centersLfeContrib += pSrc[indexBC]; }
-            centersLfeContrib *= MINUS_3_DB_IN_Q19_12;
-            // always has FL/FR
-            lt = (pSrc[0] << 12);
-            rt = (pSrc[1] << 12);
-            // mix in sides and backs
-            if (hasSides) {
-                lt += pSrc[indexSL] << 12;
-                rt += pSrc[indexSR] << 12;
+void Downmix_foldFloat(const downmix_object_t *pDownmixer,
+        const float *pSrc, float *pDst, size_t numFrames, bool accumulate) {
+    const size_t numChan = pDownmixer->input_channel_count;
+    const float *coefsL = pDownmixer->coefs_float[0];
+    const float *coefsR = pDownmixer->coefs_float[1];
+    float lt, rt;
+
+#if defined(USE_NEON) || defined(USE_SSE)
+    // Samples loaded past the end of a frame have a zero coefficient, but are masked out anyway
+    // as they could be infinite.
+    static const int32_t kLaneMasks[8] = {-1, -1, -1, -1, 0, 0, 0, 0};
+    const size_t lastGroup = numChan & ~(size_t)3; // only partial groups are masked
+    const int32_t *lastGroupMask = &kLaneMasks[4 - (numChan - lastGroup)];
+    const size_t minFrames = Downmix_minSimdFrames(numChan, 4);
+    while (numFrames >= minFrames) {
+#if defined(USE_NEON)
+        const uint32x4_t mask = vld1q_u32((const uint32_t *)lastGroupMask);
+        float32x4_t accL = vdupq_n_f32(0.0f);
+        float32x4_t accR = vdupq_n_f32(0.0f);
+        for (size_t ch = 0; ch < numChan; ch += 4) {
+            float32x4_t r0 = vld1q_f32(pSrc + ch);
+            float32x4_t r1 = vld1q_f32(pSrc + numChan + ch);
+            float32x4_t r2 = vld1q_f32(pSrc + 2 * numChan + ch);
+            float32x4_t r3 = vld1q_f32(pSrc + 3 * numChan + ch);
+            if (ch == lastGroup) {
+                r0 = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r0), mask));
+                r1 = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r1), mask));
+                r2 = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r2), mask));
+                r3 = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r3), mask));
             }
-            if (hasBacks) {
-                lt += pSrc[indexBL] << 12;
-                rt += pSrc[indexBR] << 12;
-            }
-            lt += centersLfeContrib;
-            rt += centersLfeContrib;
-            // accumulate in destination
-            pDst[0] = clamp16(pDst[0] + (lt >> 13));
-            pDst[1] = clamp16(pDst[1] + (rt >> 13));
-            pSrc += numChan;
-            pDst += 2;
-            numFrames--;
+            const float32x4x2_t t01 = vtrnq_f32(r0, r1);
+            const float32x4x2_t t23 = vtrnq_f32(r2, r3);
+            const float32x4_t col0 = vcombine_f32(vget_low_f32(t01.val[0]),
+                    vget_low_f32(t23.val[0]));
+            const float32x4_t col1 = vcombine_f32(vget_low_f32(t01.val[1]),
+                    vget_low_f32(t23.val[1]));
+            const float32x4_t col2 = vcombine_f32(vget_high_f32(t01.val[0]),
+                    vget_high_f32(t23.val[0]));
+            const float32x4_t col3 = vcombine_f32(vget_high_f32(t01.val[1]),
+                    vget_high_f32(t23.val[1]));
+            accL = vmlaq_n_f32(accL, col0, coefsL[ch]);
+            accL = vmlaq_n_f32(accL, col1, coefsL[ch + 1]);
+            accL = vmlaq_n_f32(accL, col2, coefsL[ch + 2]);
+            accL = vmlaq_n_f32(accL, col3, coefsL[ch + 3]);
+            accR = vmlaq_n_f32(accR, col0, coefsR[ch]);
+            accR = vmlaq_n_f32(accR, col1, coefsR[ch + 1]);
+            accR = vmlaq_n_f32(accR, col2, coefsR[ch + 2]);
+            accR = vmlaq_n_f32(accR, col3, coefsR[ch + 3]);
         }
-    } else {
-        while (numFrames) {
-            // compute contribution of FC, BC and LFE
-            centersLfeContrib = 0;
-            if (hasFC)  { centersLfeContrib += pSrc[indexFC]; }
-            if (hasLFE) { centersLfeContrib += pSrc[indexLFE]; }
-            if (hasBC)  { centersLfeContrib += pSrc[indexBC]; }
-            centersLfeContrib *= MINUS_3_DB_IN_Q19_12;
-            // always has FL/FR
-            lt = (pSrc[0] << 12);
-            rt = (pSrc[1] << 12);
-            // mix in sides and backs
-            if (hasSides) {
-                lt += pSrc[indexSL] << 12;
-                rt += pSrc[indexSR] << 12;
-            }
-            if (hasBacks) {
-                lt += pSrc[indexBL] << 12;
-                rt += pSrc[indexBR] << 12;
+        if (accumulate) {
+            const float32x4x2_t dst = vld2q_f32(pDst);
+            accL = vaddq_f32(accL, dst.val[0]);
+            accR = vaddq_f32(accR, dst.val[1]);
+        }
+        float32x4x2_t out;
+        out.val[0] = vminq_f32(vmaxq_f32(accL, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+        out.val[1] = vminq_f32(vmaxq_f32(accR, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+        vst2q_f32(pDst, out);
+#else /* USE_SSE */
+        const __m128 mask = _mm_loadu_ps((const float *)lastGroupMask);
+        __m128 accL = _mm_setzero_ps();
+        __m128 accR = _mm_setzero_ps();
+        for (size_t ch = 0; ch < numChan; ch += 4) {
+            __m128 col0 = _mm_loadu_ps(pSrc + ch);
+            __m128 col1 = _mm_loadu_ps(pSrc + numChan + ch);
+            __m128 col2 = _mm_loadu_ps(pSrc + 2 * numChan + ch);
+            __m128 col3 = _mm_loadu_ps(pSrc + 3 * numChan + ch);
+            if (ch == lastGroup) {
+                col0 = _mm_and_ps(col0, mask);
+                col1 = _mm_and_ps(col1, mask);
+                col2 = _mm_and_ps(col2, mask);
+                col3 = _mm_and_ps(col3, mask);
             }
-            lt += centersLfeContrib;
-            rt += centersLfeContrib;
-            // store in destination
-            pDst[0] = clamp16(lt >> 13); // differs from when accumulate is true above
-            pDst[1] = clamp16(rt >> 13); // differs from when accumulate is true above
-            pSrc += numChan;
-            pDst += 2;
-            numFrames--;
+            _MM_TRANSPOSE4_PS(col0, col1, col2, col3);
+            accL = _mm_add_ps(accL, _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(coefsL[ch])),
+                            _mm_mul_ps(col1, _mm_set1_ps(coefsL[ch + 1]))),
+                    _mm_add_ps(_mm_mul_ps(col2, _mm_set1_ps(coefsL[ch + 2])),
+                            _mm_mul_ps(col3, _mm_set1_ps(coefsL[ch + 3])))));
+            accR = _mm_add_ps(accR, _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(col0, _mm_set1_ps(coefsR[ch])),
+                            _mm_mul_ps(col1, _mm_set1_ps(coefsR[ch + 1]))),
+                    _mm_add_ps(_mm_mul_ps(col2, _mm_set1_ps(coefsR[ch + 2])),
+                            _mm_mul_ps(col3, _mm_set1_ps(coefsR[ch + 3])))));
         }
+        __m128 lo = _mm_unpacklo_ps(accL, accR);
+        __m128 hi = _mm_unpackhi_ps(accL, accR);
+        if (accumulate) {
+            lo = _mm_add_ps(lo, _mm_loadu_ps(pDst));
+            hi = _mm_add_ps(hi, _mm_loadu_ps(pDst + 4));
+        }
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 minusOne = _mm_set1_ps(-1.0f);
+        _mm_storeu_ps(pDst, _mm_min_ps(_mm_max_ps(lo, minusOne), one));
+        _mm_storeu_ps(pDst + 4, _mm_min_ps(_mm_max_ps(hi, minusOne), one));
+#endif
+        pSrc += 4 * numChan;
+        pDst += 4 * 2;
+        numFrames -= 4;
     }
-    return true;
-}
-#else
-bool Downmix_foldGeneric(
-        uint32_t mask, LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate) {
-
-    if (!Downmix_validChannelMask(mask)) {
-        return false;
-    }
+#endif
 
-    const bool hasSides = (mask & kSides) != 0;
-    const bool hasBacks = (mask & kBacks) != 0;
-
-    const int numChan = audio_channel_count_from_out_mask(mask);
-    const bool hasFC = ((mask & AUDIO_CHANNEL_OUT_FRONT_CENTER) == AUDIO_CHANNEL_OUT_FRONT_CENTER);
-    const bool hasLFE =
-            ((mask & AUDIO_CHANNEL_OUT_LOW_FREQUENCY) == AUDIO_CHANNEL_OUT_LOW_FREQUENCY);
-    const bool hasBC = ((mask & AUDIO_CHANNEL_OUT_BACK_CENTER) == AUDIO_CHANNEL_OUT_BACK_CENTER);
-    // compute at what index each channel is: samples will be in the following order:
-    //   FL FR FC LFE BL BR BC SL SR
-    // when a channel is not present, its index is set to the same as the index of the preceding
-    // channel
-    const int indexFC  = hasFC    ? 2            : 1;        // front center
-    const int indexLFE = hasLFE   ? indexFC + 1  : indexFC;  // low frequency
-    const int indexBL  = hasBacks ? indexLFE + 1 : indexLFE; // back left
-    const int indexBR  = hasBacks ? indexBL + 1  : indexBL;  // back right
-    const int indexBC  = hasBC    ? indexBR + 1  : indexBR;  // back center
-    const int indexSL  = hasSides ? indexBC + 1  : indexBC;  // side left
-    const int indexSR  = hasSides ? indexSL + 1  : indexSL;  // side right
-
-    LVM_FLOAT lt, rt, centersLfeContrib;
-    // code is mostly duplicated between the two values of accumulate to avoid repeating the test
-    // for every sample
-    if (accumulate) {
-        while (numFrames) {
-            // compute contribution of FC, BC and LFE
-            centersLfeContrib = 0;
-            if (hasFC)  { centersLfeContrib += pSrc[indexFC]; }
-            if (hasLFE) { centersLfeContrib += pSrc[indexLFE]; }
-            if (hasBC)  { centersLfeContrib += pSrc[indexBC]; }
-            centersLfeContrib *= MINUS_3_DB_IN_FLOAT;
-            // always has FL/FR
-            lt = pSrc[0];
-            rt = pSrc[1];
-            // mix in sides and backs
-            if (hasSides) {
-                lt += pSrc[indexSL];
-                rt += pSrc[indexSR];
-            }
-            if (hasBacks) {
-                lt += pSrc[indexBL];
-                rt += pSrc[indexBR];
-            }
-            lt += centersLfeContrib;
-            rt += centersLfeContrib;
-            // accumulate in destination
-            pDst[0] = clamp_float(pDst[0] + (lt / 2.0f));
-            pDst[1] = clamp_float(pDst[1] + (rt / 2.0f));
-            pSrc += numChan;
-            pDst += 2;
-            numFrames--;
+    while (numFrames) {
+        lt = 0.0f;
+        rt = 0.0f;
+        for (size_t ch = 0; ch < numChan; ch++) {
+            lt += pSrc[ch] * coefsL[ch];
+            rt += pSrc[ch] * coefsR[ch];
         }
-    } else {
-        while (numFrames) {
-            // compute contribution of FC, BC and LFE
-            centersLfeContrib = 0;
-            if (hasFC)  { centersLfeContrib += pSrc[indexFC]; }
-            if (hasLFE) { centersLfeContrib += pSrc[indexLFE]; }
-            if (hasBC)  { centersLfeContrib += pSrc[indexBC]; }
-            centersLfeContrib *= MINUS_3_DB_IN_FLOAT;
-            // always has FL/FR
-            lt = pSrc[0];
-            rt = pSrc[1];
-            // mix in sides and backs
-            if (hasSides) {
-                lt += pSrc[indexSL];
-                rt += pSrc[indexSR];
-            }
-            if (hasBacks) {
-                lt += pSrc[indexBL];
-                rt += pSrc[indexBR];
-            }
-            lt += centersLfeContrib;
-            rt += centersLfeContrib;
-            // store in destination
-            pDst[0] = clamp_float(lt / 2.0f); // differs from when accumulate is true above
-            pDst[1] = clamp_float(rt / 2.0f); // differs from when accumulate is true above
-            pSrc += numChan;
-            pDst += 2;
-            numFrames--;
+        if (accumulate) {
+            pDst[0] = clamp_float(pDst[0] + lt);
+            pDst[1] = clamp_float(pDst[1] + rt);
+        } else {
+            pDst[0] = clamp_float(lt);
+            pDst[1] = clamp_float(rt);
         }
+        pSrc += numChan;
+        pDst += 2;
+        numFrames--;
     }
-    return true;
 }
-#endif
\ No newline at end of file
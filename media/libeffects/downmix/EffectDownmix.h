@@ -27,9 +27,10 @@
 */
 
 #define DOWNMIX_OUTPUT_CHANNELS AUDIO_CHANNEL_OUT_STEREO
-#ifdef BUILD_FLOAT
-#define LVM_FLOAT float
-#endif
+// maximum number of input channels, a multiple of 4 so the fold kernels can process
+// coefficients four at a time
+#define DOWNMIX_MAX_INPUT_CHANNELS 32
+
 typedef enum {
     DOWNMIX_STATE_UNINITIALIZED,
     DOWNMIX_STATE_INITIALIZED,
@@ -42,6 +43,12 @@ typedef struct {
     downmix_type_t type;
     bool apply_volume_correction;
     uint8_t input_channel_count;
+    // fold-down matrix, one row per output channel and one column per input channel,
+    // zero past input_channel_count.
+    // coefs_float includes the 6dB headroom, coefs_q12 does not: the Q19.12 sums are shifted
+    // right by 13 instead of 12.
+    float coefs_float[FCC_2][DOWNMIX_MAX_INPUT_CHANNELS];
+    int16_t coefs_q12[FCC_2][DOWNMIX_MAX_INPUT_CHANNELS];
 } downmix_object_t;
 
 
@@ -51,18 +58,6 @@ typedef struct downmix_module_s {
     downmix_object_t context;
 } downmix_module_t;
 
-const uint32_t kSides = AUDIO_CHANNEL_OUT_SIDE_LEFT | AUDIO_CHANNEL_OUT_SIDE_RIGHT;
-const uint32_t kBacks = AUDIO_CHANNEL_OUT_BACK_LEFT | AUDIO_CHANNEL_OUT_BACK_RIGHT;
-const uint32_t kUnsupported =
-        AUDIO_CHANNEL_OUT_FRONT_LEFT_OF_CENTER | AUDIO_CHANNEL_OUT_FRONT_RIGHT_OF_CENTER |
-        AUDIO_CHANNEL_OUT_TOP_CENTER |
-        AUDIO_CHANNEL_OUT_TOP_FRONT_LEFT |
-        AUDIO_CHANNEL_OUT_TOP_FRONT_CENTER |
-        AUDIO_CHANNEL_OUT_TOP_FRONT_RIGHT |
-        AUDIO_CHANNEL_OUT_TOP_BACK_LEFT |
-        AUDIO_CHANNEL_OUT_TOP_BACK_CENTER |
-        AUDIO_CHANNEL_OUT_TOP_BACK_RIGHT;
-
 /*------------------------------------
  * Effect API
  *------------------------------------
@@ -97,18 +92,10 @@ int Downmix_Configure(downmix_module_t *pDwmModule, effect_config_t *pConfig, bo
 int Downmix_Reset(downmix_object_t *pDownmixer, bool init);
 int Downmix_setParameter(downmix_object_t *pDownmixer, int32_t param, uint32_t size, void *pValue);
 int Downmix_getParameter(downmix_object_t *pDownmixer, int32_t param, uint32_t *pSize, void *pValue);
-#ifdef BUILD_FLOAT
-void Downmix_foldFromQuad(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate);
-void Downmix_foldFrom5Point1(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate);
-void Downmix_foldFrom7Point1(LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate);
-bool Downmix_foldGeneric(
-        uint32_t mask, LVM_FLOAT *pSrc, LVM_FLOAT *pDst, size_t numFrames, bool accumulate);
-#else
-void Downmix_foldFromQuad(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate);
-void Downmix_foldFrom5Point1(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate);
-void Downmix_foldFrom7Point1(int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate);
-bool Downmix_foldGeneric(
-        uint32_t mask, int16_t *pSrc, int16_t*pDst, size_t numFrames, bool accumulate);
-#endif
+bool Downmix_computeMatrix(downmix_object_t *pDownmixer, uint32_t mask);
+void Downmix_fold16(const downmix_object_t *pDownmixer,
+        const int16_t *pSrc, int16_t *pDst, size_t numFrames, bool accumulate);
+void Downmix_foldFloat(const downmix_object_t *pDownmixer,
+        const float *pSrc, float *pDst, size_t numFrames, bool accumulate);
 
 #endif /*ANDROID_EFFECTDOWNMIX_H_*/
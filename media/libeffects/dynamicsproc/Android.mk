@@ -41,3 +41,5 @@ LOCAL_HEADER_LIBRARIES := \
     libaudioeffects
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -225,27 +225,19 @@ void DP_changeVariant(DynamicsProcessingContext *pContext, int newVariant) {
     } //switch
 }
 
-static inline bool isPowerOf2(unsigned long n) {
-    return (n & (n - 1)) == 0;
-}
-
 void DP_configureVariant(DynamicsProcessingContext *pContext, int newVariant) {
     ALOGV("DP_configureVariant %d", newVariant);
     switch(newVariant) {
     case VARIANT_FAVOR_FREQUENCY_RESOLUTION: {
-        int32_t minBlockSize = (int32_t)dp_fx::DPFrequency::getMinBockSize();
         int32_t desiredBlock = pContext->mPreferredFrameDuration *
                 pContext->mConfig.inputCfg.samplingRate / 1000.0f;
-        int32_t currentBlock = desiredBlock;
         ALOGV(" sampling rate: %d, desiredBlock size %0.2f (%d) samples",
                 pContext->mConfig.inputCfg.samplingRate, pContext->mPreferredFrameDuration,
                 desiredBlock);
-        if (desiredBlock < minBlockSize) {
-            currentBlock = minBlockSize;
-        } else if (!isPowerOf2(desiredBlock)) {
-            //find next highest power of 2.
-            currentBlock = 1 << (32 - __builtin_clz(desiredBlock));
-        }
+        //closest block size at or above the preferred duration with a fast transform,
+        //e.g. 480 rather than 512 samples for 10 ms at 48 kHz.
+        int32_t currentBlock = (int32_t)dp_fx::DPFrequency::getNextBlockSize(
+                desiredBlock > 0 ? desiredBlock : 0);
         ((dp_fx::DPFrequency*)pContext->mPDynamics)->configure(currentBlock,
                 currentBlock/2,
                 pContext->mConfig.inputCfg.samplingRate);
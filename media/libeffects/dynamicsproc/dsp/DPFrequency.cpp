@@ -31,9 +31,6 @@ using Eigen::MatrixXd;
 
 static constexpr float MIN_ENVELOPE = 1e-6f; //-120 dB
 //helper functionS
-static inline bool isPowerOf2(unsigned long n) {
-    return (n & (n - 1)) == 0;
-}
 static constexpr float EPSILON = 0.0000001f;
 
 static inline bool isZero(float f) {
@@ -49,6 +46,14 @@ template <> bool compareEquality<float>(float a, float b) {
     return isZero(a - b);
 }
 
+//multiply the first bins of a spectrum by one real factor per bin. Written as an Eigen
+//array expression so it is vectorized.
+static inline void applyFactors(Eigen::VectorXcf &spectrum, const FloatVec &factors,
+        size_t bins) {
+    Eigen::Map<const Eigen::ArrayXf> eFactors(&factors[0], bins);
+    spectrum.head(bins).array() *= eFactors;
+}
+
 //TODO: avoid using macro for estimating change and assignment.
 #define IS_CHANGED(c, a, b) { c |= !compareEquality(a,b); \
     (a) = (b); }
@@ -74,10 +79,14 @@ void ChannelBuffer::initBuffers(unsigned int blockSize, unsigned int overlapSize
     input.resize(mBlockSize);
     output.resize(mBlockSize);
     outTail.resize(overlapSize);
+    windowed.resize(mBlockSize);
+    complexTemp.resize(halfFftSize);
 
     //module vectors
     mPreEqFactorVector.resize(halfFftSize, 1.0);
     mPostEqFactorVector.resize(halfFftSize, 1.0);
+    mEqFactorVector.resize(halfFftSize, 1.0);
+    mEqFactorDirty = true;
 
     mPreEqBands.resize(dpBase.getPreEqBandCount());
     mMbcBands.resize(dpBase.getMbcBandCount());
@@ -142,21 +151,28 @@ size_t DPFrequency::getMaxBockSize() {
     return MAX_BLOCKSIZE;
 }
 
+size_t DPFrequency::getNextBlockSize(size_t blockSize) {
+    size_t size = std::min(std::max(blockSize, (size_t)MIN_BLOCKSIZE), (size_t)MAX_BLOCKSIZE);
+    size += size & 1; //real transforms need an even size
+    for (;; size += 2) {
+        size_t n = size / 2;
+        while (n % 2 == 0) n /= 2;
+        while (n % 3 == 0) n /= 3;
+        while (n % 5 == 0) n /= 5;
+        if (n == 1) {
+            return size; //terminates at the latest on MAX_BLOCKSIZE, a power of 2.
+        }
+    }
+}
+
 void DPFrequency::configure(size_t blockSize, size_t overlapSize,
         size_t samplingRate) {
     ALOGV("configure");
-    mBlockSize = blockSize;
-    if (mBlockSize > MAX_BLOCKSIZE) {
-        mBlockSize = MAX_BLOCKSIZE;
-    } else if (mBlockSize < MIN_BLOCKSIZE) {
-        mBlockSize = MIN_BLOCKSIZE;
-    } else {
-        if (!isPowerOf2(blockSize)) {
-            //find next highest power of 2.
-            mBlockSize = 1 << (32 - __builtin_clz(blockSize));
-        }
-    }
+    mBlockSize = getNextBlockSize(blockSize);
 
+    //only the half spectrum is computed and processed, the inverse transform
+    //reconstructs the other half by symmetry.
+    mFftServer.SetFlag(Eigen::FFT<float>::HalfSpectrum);
     mHalfFFTSize = 1 + mBlockSize / 2; //including Nyquist bin
     mOverlapSize = std::min(overlapSize, mBlockSize/2);
 
@@ -246,6 +262,7 @@ void DPFrequency::updateParameters(ChannelBuffer &cb, int channelIndex) {
                     cb.mPreEqFactorVector[k] = inputGainFactor;
                 }
             }
+            cb.mEqFactorDirty = true;
         }
     } //inputGain and preEq
 
@@ -292,6 +309,9 @@ void DPFrequency::updateParameters(ChannelBuffer &cb, int channelIndex) {
                 }
             }
         } //enabled
+        if (changed) {
+            cb.mEqFactorDirty = true;
+        }
     }
 
     //===MBC
@@ -482,25 +502,38 @@ size_t DPFrequency::processFirstStages(ChannelBuffer &cb) {
     //##apply window
     Eigen::Map<Eigen::VectorXf> eWindow(&mVWindow[0], mVWindow.size());
     Eigen::Map<Eigen::VectorXf> eInput(&cb.input[0], cb.input.size());
+    Eigen::Map<Eigen::VectorXf> eWin(&cb.windowed[0], cb.windowed.size());
 
-    Eigen::VectorXf eWin = eInput.cwiseProduct(eWindow); //apply window
+    eWin = eInput.cwiseProduct(eWindow); //apply window, no temporaries
 
     //##fft
     //Note: we are using eigen with the default scaling, which ensures that
     //  IFFT( FFT(x) ) = x.
     // TODO: optimize by using the noscale option, and compensate with dB scale offsets
-    mFftServer.fwd(cb.complexTemp, eWin);
-
-    size_t cSize = cb.complexTemp.size();
-    size_t maxBin = std::min(cSize/2, mHalfFFTSize);
-
-    //== EqPre (always runs)
-    for (size_t k = 0; k < maxBin; k++) {
-        cb.complexTemp[k] *= cb.mPreEqFactorVector[k];
+    //Half spectrum only: no reflection of the upper bins, which are never used.
+    mFftServer.fwd(cb.complexTemp.data(), eWin.data(), mBlockSize);
+
+    const size_t maxBin = mHalfFFTSize;
+    const bool mbcActive = cb.mMbcInUse && cb.mMbcEnabled;
+    const bool postEqActive = cb.mPostEqInUse && cb.mPostEqEnabled;
+
+    if (postEqActive && !mbcActive) {
+        //== EqPre and EqPost are both static per bin factors. Without the MBC in between
+        // they are applied in a single pass.
+        if (cb.mEqFactorDirty) {
+            Eigen::Map<Eigen::ArrayXf> eEq(&cb.mEqFactorVector[0], maxBin);
+            eEq = Eigen::Map<const Eigen::ArrayXf>(&cb.mPreEqFactorVector[0], maxBin) *
+                    Eigen::Map<const Eigen::ArrayXf>(&cb.mPostEqFactorVector[0], maxBin);
+            cb.mEqFactorDirty = false;
+        }
+        applyFactors(cb.complexTemp, cb.mEqFactorVector, maxBin);
+    } else {
+        //== EqPre (always runs)
+        applyFactors(cb.complexTemp, cb.mPreEqFactorVector, maxBin);
     }
 
     //== MBC
-    if (cb.mMbcInUse && cb.mMbcEnabled) {
+    if (mbcActive) {
         for (size_t band = 0; band < cb.mMbcBands.size(); band++) {
             ChannelBuffer::MbcBandParams *pMbcBandParams = &cb.mMbcBands[band];
             float fEnergySum = 0;
@@ -509,11 +542,15 @@ size_t DPFrequency::processFirstStages(ChannelBuffer &cb) {
             float preGainFactor = dBtoLinear(pMbcBandParams->gainPreDb);
             float preGainSquared = preGainFactor * preGainFactor;
 
-            for (size_t k = pMbcBandParams->binStart; k <= pMbcBandParams->binStop; k++) {
-                fEnergySum += std::norm(cb.complexTemp[k]) * preGainSquared; //mag squared
+            //cutoffs above Nyquist are clamped to the half spectrum
+            const size_t binStart = std::min(pMbcBandParams->binStart, maxBin);
+            const size_t binEnd = std::min(pMbcBandParams->binStop + 1, maxBin);
+            if (binStart < binEnd) {
+                fEnergySum = cb.complexTemp.segment(binStart, binEnd - binStart)
+                        .squaredNorm() * preGainSquared; //mag squared
             }
 
-            //Eigen FFT is full spectrum, even if the source was real data.
+            //Only the half spectrum is computed for real data.
             // Each half spectrum has half the energy. This is taken into account with the * 2
             // factor in the energy computations.
             // energy = sqrt(sum_components_squared) number_points
@@ -570,27 +607,21 @@ size_t DPFrequency::processFirstStages(ChannelBuffer &cb) {
             newFactor *= dBtoLinear(pMbcBandParams->gainPostDb);
 
             //apply to this band
-            for (size_t k = pMbcBandParams->binStart; k <= pMbcBandParams->binStop; k++) {
-                cb.complexTemp[k] *= newFactor;
+            if (binStart < binEnd) {
+                cb.complexTemp.segment(binStart, binEnd - binStart) *= newFactor;
             }
 
         } //end per band process
 
-    } //end MBC
-
-    //== EqPost
-    if (cb.mPostEqInUse && cb.mPostEqEnabled) {
-        for (size_t k = 0; k < maxBin; k++) {
-            cb.complexTemp[k] *= cb.mPostEqFactorVector[k];
+        //== EqPost
+        if (postEqActive) {
+            applyFactors(cb.complexTemp, cb.mPostEqFactorVector, maxBin);
         }
-    }
+    } //end MBC
 
     //== Limiter. First Pass
     if (cb.mLimiterInUse && cb.mLimiterEnabled) {
-        float fEnergySum = 0;
-        for (size_t k = 0; k < maxBin; k++) {
-            fEnergySum += std::norm(cb.complexTemp[k]);
-        }
+        float fEnergySum = cb.complexTemp.head(maxBin).squaredNorm();
 
         //see explanation above for energy computation logic
         fEnergySum = sqrt(fEnergySum * 2) / (mBlockSize * mWindowRms);
@@ -659,16 +690,11 @@ size_t DPFrequency::processLastStages(ChannelBuffer &cb) {
 
     //apply to all if != 1.0
     if (!compareEquality(outputGainFactor, 1.0f)) {
-        size_t cSize = cb.complexTemp.size();
-        size_t maxBin = std::min(cSize/2, mHalfFFTSize);
-        for (size_t k = 0; k < maxBin; k++) {
-            cb.complexTemp[k] *= outputGainFactor;
-        }
+        cb.complexTemp.head(mHalfFFTSize) *= outputGainFactor;
     }
 
-    //##ifft directly to output.
-    Eigen::Map<Eigen::VectorXf> eOutput(&cb.output[0], cb.output.size());
-    mFftServer.inv(eOutput, cb.complexTemp);
+    //##ifft directly to output, from the half spectrum.
+    mFftServer.inv(&cb.output[0], cb.complexTemp.data(), mBlockSize);
     return mBlockSize;
 }
 
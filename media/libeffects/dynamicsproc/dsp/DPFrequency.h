@@ -38,8 +38,9 @@ public:
     FloatVec input;     // time domain temp vector for input
     FloatVec output;    // time domain temp vector for output
     FloatVec outTail;   // time domain temp vector for output tail (for overlap-add method)
+    FloatVec windowed;  // time domain temp vector for windowed input
 
-    Eigen::VectorXcf complexTemp; // complex temp vector for frequency domain operations
+    Eigen::VectorXcf complexTemp; // half spectrum (including Nyquist bin) of the current block
 
     //Current parameters
     float inputGainDb;
@@ -98,6 +99,9 @@ public:
     LimiterParams mLimiterParams;
     FloatVec mPreEqFactorVector; // temp pre-computed vector to shape spectrum at preEQ stage
     FloatVec mPostEqFactorVector; // temp pre-computed vector to shape spectrum at postEQ stage
+    // preEQ and postEQ folded into one vector, valid while the MBC is not between them.
+    FloatVec mEqFactorVector;
+    bool mEqFactorDirty;
 
     void initBuffers(unsigned int blockSize, unsigned int overlapSize, unsigned int halfFftSize,
             unsigned int samplingRate, DPBase &dpBase);
@@ -127,6 +131,9 @@ public:
     void configure(size_t blockSize, size_t overlapSize, size_t samplingRate);
     static size_t getMinBockSize();
     static size_t getMaxBockSize();
+    // Smallest supported block size >= blockSize: an even product of powers of 2, 3 and 5,
+    // so that sizes close to the requested latency keep a fast transform.
+    static size_t getNextBlockSize(size_t blockSize);
 
 private:
     void updateParameters(ChannelBuffer &cb, int channelIndex);
@@ -0,0 +1,29 @@
+LOCAL_PATH:= $(call my-dir)
+
+# DPFrequency benchmark
+include $(CLEAR_VARS)
+
+LOCAL_VENDOR_MODULE := true
+
+EIGEN_PATH := external/eigen
+LOCAL_C_INCLUDES += \
+    $(EIGEN_PATH) \
+    $(LOCAL_PATH)/.. \
+
+LOCAL_SRC_FILES:= \
+    dpfrequency_benchmark.cpp \
+    ../dsp/DPBase.cpp \
+    ../dsp/DPFrequency.cpp
+
+LOCAL_CFLAGS+= -O2
+LOCAL_CFLAGS += -Wall -Werror
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog \
+
+LOCAL_MODULE:= dpfrequency_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
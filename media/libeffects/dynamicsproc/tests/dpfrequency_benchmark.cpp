@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the CPU cost of DPFrequency with all stages in use, for stereo and 5.1
+// at 48 kHz and a range of block sizes.
+//
+// usage: dpfrequency_benchmark [-s seconds] [-f framesPerCall]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <dsp/DPFrequency.h>
+
+namespace {
+
+constexpr uint32_t kSampleRate = 48000;
+constexpr uint32_t kBandCount = 6;
+
+int64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Enables preEq, Mbc, postEq and limiter with bands spread over the spectrum.
+void setupChannels(dp_fx::DPFrequency &dp, uint32_t channelCount) {
+    const float cutoffs[kBandCount] = {100, 400, 1000, 4000, 10000, 20000};
+    for (uint32_t ch = 0; ch < channelCount; ch++) {
+        dp_fx::DPChannel *channel = dp.getChannel(ch);
+        channel->getPreEq()->setEnabled(true);
+        channel->getMbc()->setEnabled(true);
+        channel->getPostEq()->setEnabled(true);
+        channel->getLimiter()->setEnabled(true);
+        for (uint32_t b = 0; b < kBandCount; b++) {
+            channel->getPreEq()->getBand(b)->init(true, cutoffs[b], (b % 3) * 2.0f - 2.0f);
+            channel->getPostEq()->getBand(b)->init(true, cutoffs[b], 1.0f - (b % 2) * 2.0f);
+            channel->getMbc()->getBand(b)->init(true, cutoffs[b], 3 /*attackTime*/,
+                    80 /*releaseTime*/, 2 /*ratio*/, -20 /*threshold*/, 0 /*kneeWidth*/,
+                    -90 /*noiseGateThreshold*/, 1 /*expanderRatio*/, 0 /*preGain*/,
+                    0 /*postGain*/);
+        }
+    }
+}
+
+int64_t benchmark(uint32_t channelCount, size_t blockSize, size_t framesPerCall,
+        size_t seconds) {
+    dp_fx::DPFrequency dp;
+    dp.init(channelCount, true, kBandCount, true, kBandCount, true, kBandCount, true);
+    dp.configure(blockSize, blockSize / 2, kSampleRate);
+    setupChannels(dp, channelCount);
+
+    const size_t samples = framesPerCall * channelCount;
+    std::vector<float> input(samples);
+    std::vector<float> output(samples);
+    srand(0);
+    for (auto &sample : input) {
+        sample = (rand() / (float)RAND_MAX - 0.5f) * 0.5f;
+    }
+
+    const size_t calls = seconds * kSampleRate / framesPerCall;
+    const int trials = 4;
+    int64_t best = 0;
+    for (int n = 0; n < trials; ++n) {
+        const int64_t start = nowNs();
+        for (size_t i = 0; i < calls; i++) {
+            dp.processSamples(input.data(), output.data(), samples);
+        }
+        const int64_t elapsed = nowNs() - start;
+        if (n == 0 || elapsed < best) {
+            best = elapsed;  // save the best out of our trials.
+        }
+    }
+    return best;
+}
+
+int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-s seconds] [-f framesPerCall]\n", name);
+    return EXIT_FAILURE;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t seconds = 10;
+    size_t framesPerCall = 240;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "s:f:")) != -1) {
+        switch (ch) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'f':
+            framesPerCall = atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (seconds == 0 || framesPerCall == 0) {
+        return usage(argv[0]);
+    }
+
+    const struct {
+        const char *name;
+        uint32_t channelCount;
+    } layouts[] = {
+        {"stereo", 2},
+        {"5.1", 6},
+    };
+    // 5, 10 and 20 ms at 48 kHz, and the previous power of 2 equivalents.
+    const size_t blockSizes[] = {240, 256, 480, 512, 960, 1024};
+
+    printf("%u Hz, %zu frames per call, %zu s\n", kSampleRate, framesPerCall, seconds);
+    for (const auto &layout : layouts) {
+        for (size_t blockSize : blockSizes) {
+            const int64_t ns = benchmark(layout.channelCount, blockSize, framesPerCall, seconds);
+            // Load is the fraction of one core needed to run in real time.
+            printf("%-6s block: %4zu  msec: %" PRId64 "  load: %.2f%%\n",
+                    layout.name, blockSize, ns / 1000000, ns / (seconds * 1e9) * 100);
+        }
+    }
+    return EXIT_SUCCESS;
+}
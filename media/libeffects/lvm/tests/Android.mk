@@ -0,0 +1,37 @@
+LOCAL_PATH:= $(call my-dir)
+
+# reverb benchmark, LVREV against the convolution engine
+include $(CLEAR_VARS)
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES:= \
+    reverb_benchmark.cpp \
+    ../wrapper/Reverb/ConvolutionReverb.cpp \
+    ../wrapper/Reverb/EffectReverb.cpp
+
+LOCAL_CFLAGS += -DBUILD_FLOAT -DHIGHER_FS
+LOCAL_CFLAGS += -Wall -Werror
+
+LOCAL_MODULE:= reverb_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_STATIC_LIBRARIES += libreverb
+
+LOCAL_SHARED_LIBRARIES := \
+     libaudioutils \
+     libcutils \
+     libdl \
+     liblog \
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/../wrapper/Reverb \
+    $(LOCAL_PATH)/../lib/Common/lib/ \
+    $(LOCAL_PATH)/../lib/Reverb/lib/ \
+    $(call include-path-for, audio-effects) \
+    $(call include-path-for, audio-utils) \
+    external/eigen \
+
+LOCAL_HEADER_LIBRARIES += libhardware_headers
+
+include $(BUILD_EXECUTABLE)
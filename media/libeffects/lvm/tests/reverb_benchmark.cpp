@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the CPU cost of one auxiliary preset reverb stream for the LVREV
+// and the partitioned convolution implementations of libreverbwrapper.
+//
+// usage: reverb_benchmark [-r sampleRate] [-f framesPerCall] [-s seconds] [-p preset]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <audio_effects/effect_presetreverb.h>
+#include <hardware/audio_effect.h>
+#include <system/audio.h>
+
+extern audio_effect_library_t AUDIO_EFFECT_LIBRARY_INFO_SYM;
+
+namespace {
+
+// Implementation UUIDs, see EffectReverb.cpp
+const effect_uuid_t kLvrevAuxPresetUuid =
+        {0xf29a1400, 0xa3bb, 0x11df, 0x8ddc, {0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b}};
+const effect_uuid_t kConvolutionAuxPresetUuid =
+        {0x5d1a2c40, 0xc4a9, 0x11e8, 0xa8d5, {0xf2, 0x80, 0x1f, 0x1b, 0x9f, 0xd1}};
+
+int64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int command(effect_handle_t handle, uint32_t cmd, uint32_t size, void *data) {
+    int reply = 0;
+    uint32_t replySize = sizeof(reply);
+    int status = (*handle)->command(handle, cmd, size, data, &replySize, &reply);
+    return status != 0 ? status : reply;
+}
+
+// Returns the best time out of a few trials, in ns, to process the given duration,
+// or -1 on error.
+int64_t benchmark(const effect_uuid_t &uuid, uint32_t sampleRate, size_t framesPerCall,
+        size_t seconds, uint16_t preset) {
+    effect_handle_t handle;
+    if (AUDIO_EFFECT_LIBRARY_INFO_SYM.create_effect(&uuid, 0, 0, &handle) != 0) {
+        fprintf(stderr, "cannot create effect\n");
+        return -1;
+    }
+
+    effect_config_t config = {};
+    config.inputCfg.samplingRate = sampleRate;
+    config.inputCfg.channels = AUDIO_CHANNEL_OUT_MONO;
+    config.inputCfg.format = EFFECT_BUFFER_FORMAT;
+    config.inputCfg.accessMode = EFFECT_BUFFER_ACCESS_READ;
+    config.inputCfg.mask = EFFECT_CONFIG_ALL;
+    config.outputCfg = config.inputCfg;
+    config.outputCfg.channels = AUDIO_CHANNEL_OUT_STEREO;
+    config.outputCfg.accessMode = EFFECT_BUFFER_ACCESS_ACCUMULATE;
+
+    uint32_t paramBuffer[(sizeof(effect_param_t) + 2 * sizeof(int32_t)) / sizeof(uint32_t) + 1];
+    effect_param_t *param = (effect_param_t *)paramBuffer;
+    param->psize = sizeof(int32_t);
+    param->vsize = sizeof(uint16_t);
+    *(int32_t *)param->data = REVERB_PARAM_PRESET;
+    *(uint16_t *)(param->data + sizeof(int32_t)) = preset;
+
+    if (command(handle, EFFECT_CMD_INIT, 0, NULL) != 0
+            || command(handle, EFFECT_CMD_SET_CONFIG, sizeof(config), &config) != 0
+            || command(handle, EFFECT_CMD_SET_PARAM,
+                    sizeof(effect_param_t) + param->psize + param->vsize, param) != 0
+            || command(handle, EFFECT_CMD_ENABLE, 0, NULL) != 0) {
+        fprintf(stderr, "cannot configure effect\n");
+        AUDIO_EFFECT_LIBRARY_INFO_SYM.release_effect(handle);
+        return -1;
+    }
+
+    std::vector<effect_buffer_t> input(framesPerCall);
+    std::vector<effect_buffer_t> output(framesPerCall * FCC_2);
+    srand(0);
+    for (auto &sample : input) {
+#ifdef NATIVE_FLOAT_BUFFER
+        sample = (rand() / (float)RAND_MAX - 0.5f) * 0.5f;
+#else
+        sample = (rand() % 16384) - 8192;
+#endif
+    }
+
+    const size_t calls = seconds * sampleRate / framesPerCall;
+    const int trials = 4;
+    int64_t best = 0;
+    for (int n = 0; n < trials; ++n) {
+        const int64_t start = nowNs();
+        for (size_t i = 0; i < calls; i++) {
+            audio_buffer_t in = {framesPerCall, {input.data()}};
+            audio_buffer_t out = {framesPerCall, {output.data()}};
+            (*handle)->process(handle, &in, &out);
+        }
+        const int64_t elapsed = nowNs() - start;
+        if (n == 0 || elapsed < best) {
+            best = elapsed;  // save the best out of our trials.
+        }
+    }
+
+    AUDIO_EFFECT_LIBRARY_INFO_SYM.release_effect(handle);
+    return best;
+}
+
+int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-r sampleRate] [-f framesPerCall] [-s seconds] [-p preset]\n",
+            name);
+    return EXIT_FAILURE;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint32_t sampleRate = 48000;
+    size_t framesPerCall = 960;
+    size_t seconds = 10;
+    uint16_t preset = REVERB_PRESET_LARGEHALL;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "r:f:s:p:")) != -1) {
+        switch (ch) {
+        case 'r':
+            sampleRate = atoi(optarg);
+            break;
+        case 'f':
+            framesPerCall = atoi(optarg);
+            break;
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'p':
+            preset = atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (sampleRate == 0 || framesPerCall == 0 || seconds == 0 || preset > REVERB_PRESET_LAST) {
+        return usage(argv[0]);
+    }
+
+    const struct {
+        const char *name;
+        const effect_uuid_t *uuid;
+    } engines[] = {
+        {"lvrev", &kLvrevAuxPresetUuid},
+        {"convolution", &kConvolutionAuxPresetUuid},
+    };
+    printf("preset %u, %u Hz, %zu frames per call, %zu s of mono aux send\n",
+            preset, sampleRate, framesPerCall, seconds);
+    for (const auto &engine : engines) {
+        const int64_t ns = benchmark(*engine.uuid, sampleRate, framesPerCall, seconds, preset);
+        if (ns < 0) {
+            return EXIT_FAILURE;
+        }
+        // Load is the fraction of one core needed to run a single stream in real time.
+        printf("%-12s msec: %" PRId64 "  load per stream: %.2f%%\n",
+                engine.name, ns / 1000000, ns / (seconds * 1e9) * 100);
+    }
+    return EXIT_SUCCESS;
+}
@@ -46,6 +46,7 @@ LOCAL_ARM_MODE := arm
 
 LOCAL_VENDOR_MODULE := true
 LOCAL_SRC_FILES:= \
+    Reverb/ConvolutionReverb.cpp \
     Reverb/EffectReverb.cpp
 
 LOCAL_CFLAGS += -fvisibility=hidden -DBUILD_FLOAT -DHIGHER_FS
@@ -69,6 +70,7 @@ LOCAL_C_INCLUDES += \
     $(LOCAL_PATH)/../lib/Reverb/lib/ \
     $(call include-path-for, audio-effects) \
     $(call include-path-for, audio-utils) \
+    external/eigen \
 
 LOCAL_HEADER_LIBRARIES += libhardware_headers
 
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ConvolutionReverb"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include <log/log.h>
+
+#include "ConvolutionReverb.h"
+
+namespace android {
+
+namespace {
+
+// Reference frequency of the OpenSL ES HF level and HF decay ratio parameters.
+constexpr float kHfReferenceHz = 5000.0f;
+// Number of discrete early reflections placed before the diffuse tail.
+constexpr size_t kEarlyReflectionCount = 8;
+// ln(1000): amplitude decay of 60 dB.
+constexpr float kLn1000 = 6.907755f;
+
+inline float millibelToLinear(int32_t mb) {
+    return powf(10.0f, mb / 2000.0f);
+}
+
+// Small deterministic generator, so that every process builds bit-identical tails.
+class NoiseGenerator {
+public:
+    explicit NoiseGenerator(uint32_t seed) : mState(seed * 2654435761u + 1) {}
+    // Uniform in [-1, 1).
+    float next() {
+        mState = mState * 1664525u + 1013904223u;
+        return (int32_t)mState * (1.0f / 2147483648.0f);
+    }
+    // Uniform in [0, 1).
+    float nextUnipolar() {
+        return next() * 0.5f + 0.5f;
+    }
+private:
+    uint32_t mState;
+};
+
+using ImpulseResponseKey = std::tuple<int16_t, int16_t, uint32_t, int16_t, int16_t, uint32_t,
+        int16_t, uint32_t, int16_t, int16_t, uint32_t, size_t, size_t>;
+
+std::mutex gImpulseResponseLock;
+// Entries are weak so a table is released once the last engine using it moves on.
+std::map<ImpulseResponseKey, std::weak_ptr<const ConvolutionImpulseResponse>>
+        gImpulseResponses;
+
+// Synthesizes the time-domain tail for one output channel: sparse early reflections followed
+// by exponentially decaying noise, with a separate decay rate above kHfReferenceHz.
+void synthesizeTail(const t_reverb_settings &settings, uint32_t sampleRate, size_t channel,
+        std::vector<float> &tail) {
+    std::fill(tail.begin(), tail.end(), 0.0f);
+    NoiseGenerator noise(channel + 1);
+
+    const size_t reflectionsStart = (size_t)settings.reflectionsDelay * sampleRate / 1000;
+    const size_t lateStart = reflectionsStart
+            + std::max<size_t>((size_t)settings.reverbDelay * sampleRate / 1000, 1);
+
+    // Early reflections are spread over the reverb delay.
+    const float reflectionsGain = millibelToLinear(settings.roomLevel + settings.reflectionsLevel);
+    for (size_t i = 0; i < kEarlyReflectionCount; i++) {
+        const size_t offset = reflectionsStart
+                + (size_t)(noise.nextUnipolar() * (lateStart - reflectionsStart));
+        if (offset < tail.size()) {
+            tail[offset] += reflectionsGain * noise.next();
+        }
+    }
+
+    const float decayTimeS = std::max(settings.decayTime, 100u) / 1000.0f;
+    const float hfDecayTimeS = decayTimeS * std::max<int16_t>(settings.decayHFRatio, 100) / 1000.0f;
+    const float lowDecay = expf(-kLn1000 / (decayTimeS * sampleRate));
+    const float highDecay = expf(-kLn1000 / (hfDecayTimeS * sampleRate));
+
+    // Normalize so that the tail carries the requested level in energy, independently of the
+    // decay time: sum of (a^2 * decay^(2n)) = 1 for unit variance noise.
+    const float lateGain = millibelToLinear(settings.roomLevel + settings.reverbLevel)
+            * sqrtf(3.0f * (1.0f - lowDecay * lowDecay));
+    const float highGain = millibelToLinear(settings.roomHFLevel);
+    // Density in per mille sets how many taps of the tail are non-zero.
+    const float tapProbability = 0.1f + 0.9f * std::min<int16_t>(settings.density, 1000) / 1000.0f;
+    const float tapGain = 1.0f / sqrtf(tapProbability);
+
+    const float lowpass = 1.0f - expf(-2.0f * (float)M_PI * kHfReferenceHz / sampleRate);
+    float lowState = 0.0f;
+    float lowEnvelope = lateGain;
+    float highEnvelope = lateGain * highGain;
+    for (size_t i = lateStart; i < tail.size(); i++) {
+        float sample = noise.next();
+        if (noise.nextUnipolar() >= tapProbability) {
+            sample = 0.0f;
+        }
+        sample *= tapGain;
+        lowState += lowpass * (sample - lowState);
+        tail[i] += lowState * lowEnvelope + (sample - lowState) * highEnvelope;
+        lowEnvelope *= lowDecay;
+        highEnvelope *= highDecay;
+    }
+}
+
+}  // namespace
+
+// static
+std::shared_ptr<const ConvolutionImpulseResponse> ConvolutionReverb::getImpulseResponse(
+        const t_reverb_settings &settings, uint32_t sampleRate, size_t channelCount,
+        size_t blockSize) {
+    const ImpulseResponseKey key(settings.roomLevel, settings.roomHFLevel, settings.decayTime,
+            settings.decayHFRatio, settings.reflectionsLevel, settings.reflectionsDelay,
+            settings.reverbLevel, settings.reverbDelay, settings.diffusion, settings.density,
+            sampleRate, channelCount, blockSize);
+
+    std::lock_guard<std::mutex> lock(gImpulseResponseLock);
+    std::shared_ptr<const ConvolutionImpulseResponse> cached = gImpulseResponses[key].lock();
+    if (cached != nullptr) {
+        return cached;
+    }
+
+    const uint32_t lengthMs = std::min(settings.decayTime, kMaxImpulseResponseMs)
+            + settings.reflectionsDelay + settings.reverbDelay;
+    const size_t length = std::max<size_t>((size_t)lengthMs * sampleRate / 1000, 1);
+
+    auto ir = std::make_shared<ConvolutionImpulseResponse>();
+    ir->sampleRate = sampleRate;
+    ir->blockSize = blockSize;
+    ir->binCount = blockSize + 1;
+    ir->channelCount = channelCount;
+    ir->partitionCount = (length + blockSize - 1) / blockSize;
+    ir->real.resize(channelCount * ir->partitionCount * ir->binCount);
+    ir->imag.resize(ir->real.size());
+
+    // The engine runs the inverse transform unscaled; fold the 1 / N into the filter.
+    const float scale = 1.0f / (2 * blockSize);
+    Eigen::FFT<float> fft;
+    fft.SetFlag(Eigen::FFT<float>::HalfSpectrum);
+    std::vector<float> tail(ir->partitionCount * blockSize);
+    std::vector<float> segment(2 * blockSize);
+    std::vector<std::complex<float>> spectrum(2 * blockSize);
+    for (size_t ch = 0; ch < channelCount; ch++) {
+        synthesizeTail(settings, sampleRate, ch, tail);
+        for (size_t p = 0; p < ir->partitionCount; p++) {
+            // Overlap-save: each partition is zero padded to twice its length.
+            std::copy(tail.begin() + p * blockSize, tail.begin() + (p + 1) * blockSize,
+                    segment.begin());
+            std::fill(segment.begin() + blockSize, segment.end(), 0.0f);
+            fft.fwd(spectrum.data(), segment.data(), 2 * blockSize);
+            float *real = &ir->real[(ch * ir->partitionCount + p) * ir->binCount];
+            float *imag = &ir->imag[(ch * ir->partitionCount + p) * ir->binCount];
+            for (size_t k = 0; k < ir->binCount; k++) {
+                real[k] = spectrum[k].real() * scale;
+                imag[k] = spectrum[k].imag() * scale;
+            }
+        }
+    }
+    ALOGV("getImpulseResponse built %zu partitions x %zu channels at %u Hz",
+            ir->partitionCount, channelCount, sampleRate);
+
+    // Prune entries whose tables were released, keeping the map bounded by live settings.
+    for (auto it = gImpulseResponses.begin(); it != gImpulseResponses.end(); ) {
+        if (it->second.expired()) {
+            it = gImpulseResponses.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    gImpulseResponses[key] = ir;
+    return ir;
+}
+
+ConvolutionReverb::ConvolutionReverb(size_t blockSize)
+    : mBlockSize(std::min(std::max(blockSize, kMinBlockSize), kMaxBlockSize))
+    , mBinCount(mBlockSize + 1)
+    , mSampleRate(0)
+    , mInChannels(0)
+    , mOutChannels(0)
+    , mPendingProgram(nullptr)
+    , mFill(0)
+    , mDelayLineHead(0) {
+    ALOGW_IF(mBlockSize != blockSize, "block size %zu clamped to %zu", blockSize, mBlockSize);
+    for (std::atomic<Program *> &retired : mRetiredPrograms) {
+        retired.store(nullptr, std::memory_order_relaxed);
+    }
+    mFft.SetFlag(Eigen::FFT<float>::HalfSpectrum);
+    mFft.SetFlag(Eigen::FFT<float>::Unscaled);
+    mAccumReal.resize(mBinCount);
+    mAccumImag.resize(mBinCount);
+    mSpectrum.resize(2 * mBlockSize);
+    mTime.resize(2 * mBlockSize);
+}
+
+ConvolutionReverb::~ConvolutionReverb() {
+    delete mPendingProgram.exchange(nullptr);
+    releaseRetiredSettings();
+}
+
+int ConvolutionReverb::configure(uint32_t sampleRate, size_t inChannels, size_t outChannels) {
+    if (sampleRate == 0 || inChannels == 0 || inChannels > kMaxChannels
+            || outChannels == 0 || outChannels > kMaxChannels) {
+        ALOGE("configure invalid rate %u or channels %zu -> %zu",
+                sampleRate, inChannels, outChannels);
+        return -EINVAL;
+    }
+    mSampleRate = sampleRate;
+    mInChannels = inChannels;
+    mOutChannels = outChannels;
+    delete mPendingProgram.exchange(nullptr);
+    releaseRetiredSettings();
+    mProgram.reset();
+    mInput.assign(mInChannels * 2 * mBlockSize, 0.0f);
+    mOutput.assign(mOutChannels * mBlockSize, 0.0f);
+    reset();
+    return 0;
+}
+
+void ConvolutionReverb::setSettings(const t_reverb_settings *settings) {
+    if (mSampleRate == 0) {
+        return;
+    }
+    releaseRetiredSettings();
+
+    std::unique_ptr<Program> program(new Program());
+    if (settings != nullptr) {
+        program->impulseResponse =
+                getImpulseResponse(*settings, mSampleRate, mOutChannels, mBlockSize);
+        program->delayLineReal.assign(
+                mInChannels * program->impulseResponse->partitionCount * mBinCount, 0.0f);
+        program->delayLineImag.assign(program->delayLineReal.size(), 0.0f);
+    }
+    // Replaces settings process() has not picked up yet.
+    delete mPendingProgram.exchange(program.release(), std::memory_order_acq_rel);
+}
+
+void ConvolutionReverb::releaseRetiredSettings() {
+    for (std::atomic<Program *> &retired : mRetiredPrograms) {
+        delete retired.exchange(nullptr, std::memory_order_acq_rel);
+    }
+}
+
+void ConvolutionReverb::applyPendingProgram() {
+    std::atomic<Program *> *slot = nullptr;
+    for (std::atomic<Program *> &retired : mRetiredPrograms) {
+        if (retired.load(std::memory_order_acquire) == nullptr) {
+            slot = &retired;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        // not reached, see mRetiredPrograms
+        return;
+    }
+    Program *next = mPendingProgram.exchange(nullptr, std::memory_order_acq_rel);
+    if (next == nullptr) {
+        return;
+    }
+    if (mProgram != nullptr && mProgram->impulseResponse != nullptr
+            && next->impulseResponse != nullptr
+            && mProgram->impulseResponse->partitionCount
+                    == next->impulseResponse->partitionCount) {
+        // The history is kept across settings of equal length, so switching presets
+        // does not click; a different length restarts the tail.
+        next->delayLineReal.swap(mProgram->delayLineReal);
+        next->delayLineImag.swap(mProgram->delayLineImag);
+    } else {
+        mDelayLineHead = 0;
+    }
+    slot->store(mProgram.release(), std::memory_order_release);
+    mProgram.reset(next);
+}
+
+void ConvolutionReverb::reset() {
+    std::fill(mInput.begin(), mInput.end(), 0.0f);
+    std::fill(mOutput.begin(), mOutput.end(), 0.0f);
+    if (mProgram != nullptr) {
+        std::fill(mProgram->delayLineReal.begin(), mProgram->delayLineReal.end(), 0.0f);
+        std::fill(mProgram->delayLineImag.begin(), mProgram->delayLineImag.end(), 0.0f);
+    }
+    mDelayLineHead = 0;
+    mFill = 0;
+}
+
+void ConvolutionReverb::process(const float *in, float *out, size_t frameCount) {
+    applyPendingProgram();
+    if (mProgram == nullptr || mProgram->impulseResponse == nullptr) {
+        memset(out, 0, frameCount * mOutChannels * sizeof(float));
+        return;
+    }
+    while (frameCount > 0) {
+        const size_t frames = std::min(frameCount, mBlockSize - mFill);
+        // Read the inputs before writing the outputs, in case in and out alias.
+        for (size_t ch = 0; ch < mInChannels; ch++) {
+            float *input = &mInput[ch * 2 * mBlockSize + mBlockSize + mFill];
+            for (size_t i = 0; i < frames; i++) {
+                input[i] = in[i * mInChannels + ch];
+            }
+        }
+        for (size_t ch = 0; ch < mOutChannels; ch++) {
+            const float *output = &mOutput[ch * mBlockSize + mFill];
+            for (size_t i = 0; i < frames; i++) {
+                out[i * mOutChannels + ch] = output[i];
+            }
+        }
+        in += frames * mInChannels;
+        out += frames * mOutChannels;
+        frameCount -= frames;
+        mFill += frames;
+        if (mFill == mBlockSize) {
+            processBlock();
+            mFill = 0;
+        }
+    }
+}
+
+void ConvolutionReverb::processBlock() {
+    const ConvolutionImpulseResponse &ir = *mProgram->impulseResponse;
+    std::vector<float> &delayLineReal = mProgram->delayLineReal;
+    std::vector<float> &delayLineImag = mProgram->delayLineImag;
+    const size_t partitions = ir.partitionCount;
+    const size_t bins = mBinCount;
+
+    // Transform the newest 2B input frames of every channel into the delay line head.
+    for (size_t ch = 0; ch < mInChannels; ch++) {
+        float *input = &mInput[ch * 2 * mBlockSize];
+        mFft.fwd(mSpectrum.data(), input, 2 * mBlockSize);
+        float *real = &delayLineReal[(ch * partitions + mDelayLineHead) * bins];
+        float *imag = &delayLineImag[(ch * partitions + mDelayLineHead) * bins];
+        for (size_t k = 0; k < bins; k++) {
+            real[k] = mSpectrum[k].real();
+            imag[k] = mSpectrum[k].imag();
+        }
+        std::copy(input + mBlockSize, input + 2 * mBlockSize, input);
+    }
+
+    for (size_t ch = 0; ch < mOutChannels; ch++) {
+        const size_t inChannel = ch % mInChannels;
+        float * __restrict accumReal = mAccumReal.data();
+        float * __restrict accumImag = mAccumImag.data();
+        std::fill(mAccumReal.begin(), mAccumReal.end(), 0.0f);
+        std::fill(mAccumImag.begin(), mAccumImag.end(), 0.0f);
+
+        // Partition p of the filter applies to the input spectrum from p blocks ago.
+        size_t slot = mDelayLineHead;
+        for (size_t p = 0; p < partitions; p++) {
+            const float * __restrict xr = &delayLineReal[(inChannel * partitions + slot) * bins];
+            const float * __restrict xi = &delayLineImag[(inChannel * partitions + slot) * bins];
+            const float * __restrict hr = ir.realAt(ch, p);
+            const float * __restrict hi = ir.imagAt(ch, p);
+            for (size_t k = 0; k < bins; k++) {
+                accumReal[k] += xr[k] * hr[k] - xi[k] * hi[k];
+                accumImag[k] += xr[k] * hi[k] + xi[k] * hr[k];
+            }
+            slot = (slot == 0 ? partitions : slot) - 1;
+        }
+
+        for (size_t k = 0; k < bins; k++) {
+            mSpectrum[k] = std::complex<float>(accumReal[k], accumImag[k]);
+        }
+        mFft.inv(mTime.data(), mSpectrum.data(), 2 * mBlockSize);
+        // Overlap-save: the first half is circularly aliased, the second half is valid.
+        std::copy(mTime.begin() + mBlockSize, mTime.end(), &mOutput[ch * mBlockSize]);
+    }
+
+    mDelayLineHead = (mDelayLineHead + 1) % partitions;
+}
+
+}  // namespace android
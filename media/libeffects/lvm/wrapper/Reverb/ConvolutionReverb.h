@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CONVOLUTION_REVERB_H_
+#define ANDROID_CONVOLUTION_REVERB_H_
+
+#include <atomic>
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include <audio_effects/effect_environmentalreverb.h>
+#include <unsupported/Eigen/FFT>
+
+namespace android {
+
+// Impulse response of one reverb setting at one sampling rate, split into uniform partitions
+// of blockSize frames and transformed to the frequency domain (blockSize + 1 bins per
+// partition, real and imaginary parts stored separately so the multiply-accumulate loop
+// vectorizes). Instances are immutable and shared by every engine running the same setting.
+struct ConvolutionImpulseResponse {
+    uint32_t sampleRate;
+    size_t   blockSize;
+    size_t   binCount;
+    size_t   channelCount;      // one decorrelated tail per output channel
+    size_t   partitionCount;
+    std::vector<float> real;    // [channel][partition][bin]
+    std::vector<float> imag;
+
+    const float *realAt(size_t channel, size_t partition) const {
+        return &real[(channel * partitionCount + partition) * binCount];
+    }
+    const float *imagAt(size_t channel, size_t partition) const {
+        return &imag[(channel * partitionCount + partition) * binCount];
+    }
+};
+
+// Uniformly partitioned overlap-save convolution reverb.
+//
+// Input is buffered until a full partition is available, so the output is delayed by exactly
+// getLatencyFrames() frames regardless of the size of the process() calls.  Each input channel
+// is transformed once per partition and the spectra are kept in a frequency-domain delay line;
+// output channel k is the convolution of input channel (k % inChannels) with tail k of the
+// impulse response.
+//
+// Settings are built by setSettings() on a control thread and picked up by the next process()
+// call through an atomic pointer, so process() never locks, allocates or frees memory.  The
+// settings process() moves away from are handed back and freed by the next control call.
+class ConvolutionReverb {
+public:
+    static constexpr size_t kDefaultBlockSize = 256;
+    static constexpr size_t kMinBlockSize = 32;
+    static constexpr size_t kMaxBlockSize = 4096;
+    static constexpr size_t kMaxChannels = 8;
+    // Tails are truncated past this length, whatever the requested decay time.
+    static constexpr uint32_t kMaxImpulseResponseMs = 4000;
+
+    explicit ConvolutionReverb(size_t blockSize = kDefaultBlockSize);
+    ~ConvolutionReverb();
+
+    // Returns 0 on success or -EINVAL for an unsupported configuration.
+    // Any loaded impulse response is dropped and must be set again.
+    int configure(uint32_t sampleRate, size_t inChannels, size_t outChannels);
+
+    // Loads the impulse response for the given settings, building it if no other engine
+    // in the process is using it yet, and queues it for the next process() call. Passing
+    // nullptr mutes the reverb. Must not be called on the audio thread.
+    void setSettings(const t_reverb_settings *settings);
+
+    // Frees the settings process() has switched away from. Must not be called on the audio
+    // thread; setSettings() and configure() do it too.
+    void releaseRetiredSettings();
+
+    // Clears the audio history without releasing the impulse response.
+    void reset();
+
+    // Processes interleaved float frames. out is overwritten, and may alias in.
+    void process(const float *in, float *out, size_t frameCount);
+
+    size_t getLatencyFrames() const { return mBlockSize; }
+    size_t getBlockSize() const { return mBlockSize; }
+
+    // Returns the shared impulse response for the given parameters, building it on first use.
+    static std::shared_ptr<const ConvolutionImpulseResponse> getImpulseResponse(
+            const t_reverb_settings &settings, uint32_t sampleRate, size_t channelCount,
+            size_t blockSize);
+
+private:
+    // An impulse response and the frequency-domain delay line sized for it, allocated
+    // together off the audio thread.
+    struct Program {
+        std::shared_ptr<const ConvolutionImpulseResponse> impulseResponse;  // null when muted
+        std::vector<float> delayLineReal;  // [inChannel][partition][bin]
+        std::vector<float> delayLineImag;
+    };
+
+    void applyPendingProgram();
+    void processBlock();
+
+    const size_t mBlockSize;
+    const size_t mBinCount;
+    uint32_t mSampleRate;
+    size_t mInChannels;
+    size_t mOutChannels;
+
+    // Owned by process(); only replaced by configure() when not processing.
+    std::unique_ptr<Program> mProgram;
+    // Queued by setSettings() for process() to pick up.
+    std::atomic<Program *> mPendingProgram;
+    // Handed back by process() to be freed off the audio thread. Every control call frees
+    // both, and process() retires at most two programs in between: the one pending when
+    // they were freed and the one the call queues. So process() never waits for a slot.
+    static constexpr size_t kRetiredSlots = 2;
+    std::atomic<Program *> mRetiredPrograms[kRetiredSlots];
+
+    size_t mFill;                       // frames buffered in the current partition
+    std::vector<float> mInput;          // [inChannel][2 * blockSize], previous + current block
+    std::vector<float> mOutput;         // [outChannel][blockSize], output of the last partition
+    size_t mDelayLineHead;
+    std::vector<float> mAccumReal;      // [bin]
+    std::vector<float> mAccumImag;
+    std::vector<std::complex<float>> mSpectrum;
+    std::vector<float> mTime;           // [2 * blockSize]
+
+    Eigen::FFT<float> mFft;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_CONVOLUTION_REVERB_H_
@@ -23,13 +23,17 @@ typedef float LVM_FLOAT;
 
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
 #include <new>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <audio_utils/primitives.h>
 #include <log/log.h>
 
+#include "ConvolutionReverb.h"
 #include "EffectReverb.h"
 // from Reverb/lib
 #include "LVREV.h"
@@ -56,6 +60,10 @@ extern "C" const struct effect_interface_s gReverbInterface;
 namespace android {
 namespace {
 
+// Largest block processConvolution() hands to the convolution engine at once; longer
+// process() calls are split.
+static const int kConvolutionBlockFrames = LVREV_MAX_FRAME_SIZE;
+
 /************************************************************************************/
 /*                                                                                  */
 /* Preset definitions                                                               */
@@ -128,12 +136,38 @@ static const effect_descriptor_t gInsertPresetReverbDescriptor = {
         "NXP Software Ltd.",
 };
 
+// Partitioned convolution auxiliary preset reverb
+static const effect_descriptor_t gAuxConvPresetReverbDescriptor = {
+        {0x47382d60, 0xddd8, 0x11db, 0xbf3a, {0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b}},
+        {0x5d1a2c40, 0xc4a9, 0x11e8, 0xa8d5, {0xf2, 0x80, 0x1f, 0x1b, 0x9f, 0xd1}},
+        EFFECT_CONTROL_API_VERSION,
+        EFFECT_FLAG_TYPE_AUXILIARY,
+        CONVREV_CPU_LOAD_ARM9E,
+        CONVREV_MEM_USAGE,
+        "Auxiliary Convolution Preset Reverb",
+        "The Android Open Source Project",
+};
+
+// Partitioned convolution insert preset reverb
+static const effect_descriptor_t gInsertConvPresetReverbDescriptor = {
+        {0x47382d60, 0xddd8, 0x11db, 0xbf3a, {0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b}},
+        {0x7b6e3c20, 0xc4a9, 0x11e8, 0xa8d5, {0xf2, 0x80, 0x1f, 0x1b, 0x9f, 0xd1}},
+        EFFECT_CONTROL_API_VERSION,
+        EFFECT_FLAG_TYPE_INSERT | EFFECT_FLAG_INSERT_FIRST | EFFECT_FLAG_VOLUME_CTRL,
+        CONVREV_CPU_LOAD_ARM9E,
+        CONVREV_MEM_USAGE,
+        "Insert Convolution Preset Reverb",
+        "The Android Open Source Project",
+};
+
 // gDescriptors contains pointers to all defined effect descriptor in this library
 static const effect_descriptor_t * const gDescriptors[] = {
         &gAuxEnvReverbDescriptor,
         &gInsertEnvReverbDescriptor,
         &gAuxPresetReverbDescriptor,
-        &gInsertPresetReverbDescriptor
+        &gInsertPresetReverbDescriptor,
+        &gAuxConvPresetReverbDescriptor,
+        &gInsertConvPresetReverbDescriptor
 };
 
 #ifdef BUILD_FLOAT
@@ -173,6 +207,9 @@ struct ReverbContext{
     LVM_INT16                       prevLeftVolume;
     LVM_INT16                       prevRightVolume;
     int                             volumeMode;
+    // Non NULL when the preset is rendered by the partitioned convolution engine
+    // instead of LVREV. LVREV still tracks the decay time used for the exit tail.
+    ConvolutionReverb               *pConvolution;
 };
 
 enum {
@@ -202,6 +239,12 @@ int  Reverb_getParameter    (ReverbContext *pContext,
                              void          *pValue);
 int Reverb_LoadPreset       (ReverbContext   *pContext);
 int Reverb_paramValueSize   (int32_t param);
+int Reverb_configureConvolution(ReverbContext *pContext);
+int Reverb_getExitSamples     (ReverbContext *pContext, LVM_UINT16 T60);
+int processConvolution      (effect_buffer_t *pIn,
+                             effect_buffer_t *pOut,
+                             int             frameCount,
+                             ReverbContext   *pContext);
 
 /* Effect Library Interface Implementation */
 
@@ -239,6 +282,12 @@ extern "C" int EffectCreate(const effect_uuid_t *uuid,
     pContext->itfe      = &gReverbInterface;
     pContext->hInstance = NULL;
 
+    pContext->pConvolution = NULL;
+    if (desc == &gAuxConvPresetReverbDescriptor || desc == &gInsertConvPresetReverbDescriptor) {
+        pContext->pConvolution = new ConvolutionReverb();
+        ALOGV("\tEffectCreate - CONVOLUTION");
+    }
+
     pContext->auxiliary = false;
     if ((desc->flags & EFFECT_FLAG_TYPE_MASK) == EFFECT_FLAG_TYPE_AUXILIARY){
         pContext->auxiliary = true;
@@ -263,6 +312,7 @@ extern "C" int EffectCreate(const effect_uuid_t *uuid,
 
     if (ret < 0){
         ALOGV("\tLVM_ERROR : EffectCreate() init failed");
+        delete pContext->pConvolution;
         delete pContext;
         return ret;
     }
@@ -283,10 +333,11 @@ extern "C" int EffectCreate(const effect_uuid_t *uuid,
 #endif
 
     int channels = audio_channel_count_from_out_mask(pContext->config.inputCfg.channels);
+    int outChannels = audio_channel_count_from_out_mask(pContext->config.outputCfg.channels);
 
-    // Allocate memory for reverb process (*2 is for STEREO)
+    // Allocate memory for reverb process
     pContext->bufferSizeIn = LVREV_MAX_FRAME_SIZE * sizeof(process_buffer_t) * channels;
-    pContext->bufferSizeOut = LVREV_MAX_FRAME_SIZE * sizeof(process_buffer_t) * FCC_2;
+    pContext->bufferSizeOut = LVREV_MAX_FRAME_SIZE * sizeof(process_buffer_t) * outChannels;
     pContext->InFrames  = (process_buffer_t *)calloc(pContext->bufferSizeIn, 1 /* size */);
     pContext->OutFrames = (process_buffer_t *)calloc(pContext->bufferSizeOut, 1 /* size */);
 
@@ -313,6 +364,7 @@ extern "C" int EffectRelease(effect_handle_t handle){
     pContext->bufferSizeIn = 0;
     pContext->bufferSizeOut = 0;
     Reverb_free(pContext);
+    delete pContext->pConvolution;
     delete pContext;
     return 0;
 } /* end EffectRelease */
@@ -369,6 +421,10 @@ int process( effect_buffer_t   *pIn,
              int           frameCount,
              ReverbContext *pContext){
 
+    if (pContext->pConvolution != NULL) {
+        return processConvolution(pIn, pOut, frameCount, pContext);
+    }
+
     int channels = audio_channel_count_from_out_mask(pContext->config.inputCfg.channels);
     LVREV_ReturnStatus_en   LvmStatus = LVREV_SUCCESS;              /* Function call status */
 
@@ -585,6 +641,211 @@ int process( effect_buffer_t   *pIn,
     return 0;
 }    /* end process */
 
+//----------------------------------------------------------------------------
+// processConvolution()
+//----------------------------------------------------------------------------
+// Purpose:
+// Apply the Reverb with the partitioned convolution engine. Unlike process(),
+// input and output may have any channel count up to ConvolutionReverb::kMaxChannels,
+// and all intermediate processing is done in float.
+//
+// Inputs:
+//  pIn:        pointer to float or 16 bit input data
+//  pOut:       pointer to float or 16 bit output data
+//  frameCount: Frames to process
+//  pContext:   effect engine context
+//
+//  Outputs:
+//  pOut:       pointer to updated output data
+//
+//----------------------------------------------------------------------------
+int processConvolution(effect_buffer_t   *pIn,
+                       effect_buffer_t   *pOut,
+                       int           frameCount,
+                       ReverbContext *pContext){
+
+    const int channels = audio_channel_count_from_out_mask(pContext->config.inputCfg.channels);
+    const int outChannels =
+            audio_channel_count_from_out_mask(pContext->config.outputCfg.channels);
+
+    // The engine always works in float, whatever process_buffer_t is. The buffers hold
+    // kConvolutionBlockFrames, they are sized by Reverb_configureConvolution() so that
+    // nothing is allocated here.
+    if ((pContext->InFrames == NULL) || (pContext->OutFrames == NULL)) {
+        ALOGE("\tLVREV_ERROR : processConvolution called without temporary buffers");
+        return -EINVAL;
+    }
+    float * const inFrames = (float *)pContext->InFrames;
+    float * const outFrames = (float *)pContext->OutFrames;
+
+    if (pContext->nextPreset != pContext->curPreset) {
+        Reverb_LoadPreset(pContext);
+    }
+
+    // Left volume applies to even channels, right volume to odd channels. The ramp spans
+    // the whole call, not each block.
+    bool applyVolume = false;
+    float vl = 1.0f;
+    float vr = 1.0f;
+    float incl = 0;
+    float incr = 0;
+    if (!pContext->auxiliary && pContext->volumeMode != REVERB_VOLUME_OFF) {
+        vl = (float)pContext->prevLeftVolume / REVERB_UNIT_VOLUME;
+        vr = (float)pContext->prevRightVolume / REVERB_UNIT_VOLUME;
+        if (pContext->volumeMode == REVERB_VOLUME_RAMP) {
+            incl = ((float)pContext->leftVolume / REVERB_UNIT_VOLUME - vl) / frameCount;
+            incr = ((float)pContext->rightVolume / REVERB_UNIT_VOLUME - vr) / frameCount;
+        } else {
+            vl = (float)pContext->leftVolume / REVERB_UNIT_VOLUME;
+            vr = (float)pContext->rightVolume / REVERB_UNIT_VOLUME;
+        }
+        applyVolume = vl != 1.0f || vr != 1.0f || incl != 0 || incr != 0;
+        pContext->prevLeftVolume = pContext->leftVolume;
+        pContext->prevRightVolume = pContext->rightVolume;
+        pContext->volumeMode = REVERB_VOLUME_RAMP;
+    }
+
+    for (int done = 0; done < frameCount; ) {
+        const int frames = std::min(frameCount - done, kConvolutionBlockFrames);
+        const size_t inSamples = (size_t)frames * channels;
+        const size_t outSamples = (size_t)frames * outChannels;
+        const effect_buffer_t * const in = pIn + (size_t)done * channels;
+        effect_buffer_t * const out = pOut + (size_t)done * outChannels;
+
+#ifdef NATIVE_FLOAT_BUFFER
+        memcpy(inFrames, in, inSamples * sizeof(float));
+#else
+        memcpy_to_float_from_i16(inFrames, in, inSamples);
+#endif
+        if (!pContext->auxiliary) {
+#ifdef BUILD_FLOAT
+            const float sendLevel = REVERB_SEND_LEVEL;
+#else
+            const float sendLevel = REVERB_SEND_LEVEL / 4096.0f; // 4.12 format
+#endif
+            for (size_t i = 0; i < inSamples; i++) {
+                inFrames[i] *= sendLevel;
+            }
+        }
+        if (pContext->bEnabled == LVM_FALSE && pContext->SamplesToExitCount > 0) {
+            memset(inFrames, 0, inSamples * sizeof(float));
+        }
+
+        pContext->pConvolution->process(inFrames, outFrames, frames);
+
+        if (!pContext->auxiliary) {
+            // Mix with dry input; insert output has the input channel mask.
+            for (size_t i = 0; i < outSamples; i++) {
+#ifdef NATIVE_FLOAT_BUFFER
+                outFrames[i] += in[i];
+#else
+                outFrames[i] += in[i] / 32768.0f;
+#endif
+            }
+            if (applyVolume) {
+                for (int i = 0; i < frames; i++) {
+                    for (int ch = 0; ch < outChannels; ch++) {
+                        outFrames[i * outChannels + ch] *= (ch & 1) ? vr : vl;
+                    }
+                    vl += incl;
+                    vr += incr;
+                }
+            }
+        }
+
+        if (pContext->config.outputCfg.accessMode == EFFECT_BUFFER_ACCESS_ACCUMULATE) {
+            for (size_t i = 0; i < outSamples; i++) {
+#ifdef NATIVE_FLOAT_BUFFER
+                out[i] += outFrames[i];
+#else
+                out[i] = clamp16((int32_t)out[i] + (int32_t)lrintf(outFrames[i] * 32768.0f));
+#endif
+            }
+        } else {
+#ifdef NATIVE_FLOAT_BUFFER
+            memcpy(out, outFrames, outSamples * sizeof(float));
+#else
+            memcpy_to_i16_from_float(out, outFrames, outSamples);
+#endif
+        }
+        done += frames;
+    }
+
+    return 0;
+}    /* end processConvolution */
+
+//----------------------------------------------------------------------------
+// Reverb_configureConvolution()
+//----------------------------------------------------------------------------
+// Purpose: Apply the current configuration to the convolution engine and reload
+// the current preset at the new sampling rate or channel count.
+//
+// Inputs:
+//  pContext:   effect engine context
+//
+// Outputs:
+//
+//----------------------------------------------------------------------------
+
+int Reverb_configureConvolution(ReverbContext *pContext){
+    const int channels = audio_channel_count_from_out_mask(pContext->config.inputCfg.channels);
+    const int outChannels =
+            audio_channel_count_from_out_mask(pContext->config.outputCfg.channels);
+
+    // processConvolution() works in float blocks of kConvolutionBlockFrames and never
+    // allocates on the audio thread.
+    const size_t bufferSizeIn = kConvolutionBlockFrames * sizeof(float) * channels;
+    const size_t bufferSizeOut = kConvolutionBlockFrames * sizeof(float) * outChannels;
+    if (pContext->InFrames == NULL || pContext->bufferSizeIn < bufferSizeIn) {
+        free(pContext->InFrames);
+        pContext->bufferSizeIn = bufferSizeIn;
+        pContext->InFrames = (process_buffer_t *)calloc(1, pContext->bufferSizeIn);
+    }
+    if (pContext->OutFrames == NULL || pContext->bufferSizeOut < bufferSizeOut) {
+        free(pContext->OutFrames);
+        pContext->bufferSizeOut = bufferSizeOut;
+        pContext->OutFrames = (process_buffer_t *)calloc(1, pContext->bufferSizeOut);
+    }
+    if ((pContext->InFrames == NULL) || (pContext->OutFrames == NULL)) {
+        ALOGE("\tLVREV_ERROR : Reverb_configureConvolution failed to allocate memory");
+        return -ENOMEM;
+    }
+
+    const int status = pContext->pConvolution->configure(
+            pContext->config.inputCfg.samplingRate, channels, outChannels);
+    if (status != 0) {
+        return status;
+    }
+    // configure() dropped the impulse response: queue the one for the preset
+    // process() will load next.
+    pContext->pConvolution->setSettings(pContext->nextPreset != REVERB_PRESET_NONE ?
+            &sReverbPresets[pContext->nextPreset] : NULL);
+    return Reverb_LoadPreset(pContext);
+}   /* end Reverb_configureConvolution */
+
+//----------------------------------------------------------------------------
+// Reverb_getExitSamples()
+//----------------------------------------------------------------------------
+// Purpose: Number of frames to keep processing after the effect is disabled so
+// that the tail of the reverb is not cut.
+//
+// Inputs:
+//  pContext:   effect engine context
+//  T60:        decay time in ms
+//
+// Outputs:
+//  the decay time in frames, plus the convolution engine latency if any
+//
+//----------------------------------------------------------------------------
+
+int Reverb_getExitSamples(ReverbContext *pContext, LVM_UINT16 T60){
+    int samples = (T60 * pContext->config.inputCfg.samplingRate)/1000;
+    if (pContext->pConvolution != NULL) {
+        samples += pContext->pConvolution->getLatencyFrames();
+    }
+    return samples;
+}   /* end Reverb_getExitSamples */
+
 //----------------------------------------------------------------------------
 // Reverb_free()
 //----------------------------------------------------------------------------
@@ -651,9 +912,23 @@ int Reverb_setConfig(ReverbContext *pContext, effect_config_t *pConfig){
 
     CHECK_ARG(pConfig->inputCfg.samplingRate == pConfig->outputCfg.samplingRate);
     CHECK_ARG(pConfig->inputCfg.format == pConfig->outputCfg.format);
-    CHECK_ARG((pContext->auxiliary && pConfig->inputCfg.channels == AUDIO_CHANNEL_OUT_MONO) ||
-              ((!pContext->auxiliary) && pConfig->inputCfg.channels == AUDIO_CHANNEL_OUT_STEREO));
-    CHECK_ARG(pConfig->outputCfg.channels == AUDIO_CHANNEL_OUT_STEREO);
+    if (pContext->pConvolution != NULL) {
+        // The convolution engine is not limited to mono or stereo; insert output
+        // keeps the input channel mask since it carries the dry signal.
+        CHECK_ARG(audio_channel_count_from_out_mask(pConfig->inputCfg.channels) > 0 &&
+                  audio_channel_count_from_out_mask(pConfig->inputCfg.channels) <=
+                          (int)ConvolutionReverb::kMaxChannels);
+        CHECK_ARG(audio_channel_count_from_out_mask(pConfig->outputCfg.channels) > 0 &&
+                  audio_channel_count_from_out_mask(pConfig->outputCfg.channels) <=
+                          (int)ConvolutionReverb::kMaxChannels);
+        CHECK_ARG(pContext->auxiliary ||
+                  pConfig->inputCfg.channels == pConfig->outputCfg.channels);
+    } else {
+        CHECK_ARG((pContext->auxiliary && pConfig->inputCfg.channels == AUDIO_CHANNEL_OUT_MONO) ||
+                  ((!pContext->auxiliary) &&
+                          pConfig->inputCfg.channels == AUDIO_CHANNEL_OUT_STEREO));
+        CHECK_ARG(pConfig->outputCfg.channels == AUDIO_CHANNEL_OUT_STEREO);
+    }
     CHECK_ARG(pConfig->outputCfg.accessMode == EFFECT_BUFFER_ACCESS_WRITE
               || pConfig->outputCfg.accessMode == EFFECT_BUFFER_ACCESS_ACCUMULATE);
     CHECK_ARG(pConfig->inputCfg.format == EFFECT_BUFFER_FORMAT);
@@ -719,6 +994,10 @@ int Reverb_setConfig(ReverbContext *pContext, effect_config_t *pConfig){
         //ALOGV("\tReverb_setConfig keep sampling rate at %d", SampleRate);
     }
 
+    if (pContext->pConvolution != NULL) {
+        return Reverb_configureConvolution(pContext);
+    }
+
     //ALOGV("\tReverb_setConfig End");
     return 0;
 }   /* end Reverb_setConfig */
@@ -881,7 +1160,7 @@ int Reverb_init(ReverbContext *pContext){
     params.Damping        = 21;
     params.RoomSize       = 100;
 
-    pContext->SamplesToExitCount = (params.T60 * pContext->config.inputCfg.samplingRate)/1000;
+    pContext->SamplesToExitCount = Reverb_getExitSamples(pContext, params.T60);
 
     /* Saved strength is used to return the exact strength that was used in the set to the get
      * because we map the original strength range of 0:1000 to 1:15, and this will avoid
@@ -904,6 +1183,10 @@ int Reverb_init(ReverbContext *pContext){
     if(LvmStatus != LVREV_SUCCESS) return -EINVAL;
 
     ALOGV("\tReverb_init CreateInstance Succesfully called LVREV_SetControlParameters\n");
+
+    if (pContext->pConvolution != NULL) {
+        return Reverb_configureConvolution(pContext);
+    }
     ALOGV("\tReverb_init End");
     return 0;
 }   /* end Reverb_init */
@@ -1272,7 +1555,7 @@ void ReverbSetDecayTime(ReverbContext *pContext, uint32_t time){
     LVM_ERROR_CHECK(LvmStatus, "LVREV_SetControlParameters", "ReverbSetDecayTime")
     //ALOGV("\tReverbSetDecayTime() just Set -> %d\n", ActiveParams.T60);
 
-    pContext->SamplesToExitCount = (ActiveParams.T60 * pContext->config.inputCfg.samplingRate)/1000;
+    pContext->SamplesToExitCount = Reverb_getExitSamples(pContext, ActiveParams.T60);
     //ALOGV("\tReverbSetDecayTime() just Set SamplesToExitCount-> %d\n",pContext->SamplesToExitCount);
     pContext->SavedDecayTime = (int16_t)time;
     //ALOGV("\tReverbSetDecayTime end");
@@ -1538,6 +1821,8 @@ int Reverb_LoadPreset(ReverbContext   *pContext)
 {
     //TODO: add reflections delay, level and reverb delay when early reflections are
     // implemented
+    // The convolution engine already has the impulse response for nextPreset,
+    // queued by Reverb_setParameter() and picked up by its next process() call.
     pContext->curPreset = pContext->nextPreset;
 
     if (pContext->curPreset != REVERB_PRESET_NONE) {
@@ -1821,6 +2106,12 @@ int Reverb_setParameter (ReverbContext *pContext, void *pParam, void *pValue, in
             return -EINVAL;
         }
         pContext->nextPreset = preset;
+        if (pContext->pConvolution != NULL) {
+            // Build the impulse response and delay line here rather than on the
+            // audio thread; process() swaps them in without locking or allocating.
+            pContext->pConvolution->setSettings(preset != REVERB_PRESET_NONE ?
+                    &sReverbPresets[preset] : NULL);
+        }
         return 0;
     }
 
@@ -1995,6 +2286,11 @@ int Reverb_command(effect_handle_t  self,
 
     //ALOGV("\tReverb_command INPUTS are: command %d cmdSize %d",cmdCode, cmdSize);
 
+    if (pContext->pConvolution != NULL) {
+        // Free the impulse response process() switched away from, if any.
+        pContext->pConvolution->releaseRetiredSettings();
+    }
+
     switch (cmdCode){
         case EFFECT_CMD_INIT:
             //ALOGV("\tReverb_command cmdCode Case: "
@@ -2130,8 +2426,7 @@ int Reverb_command(effect_handle_t  self,
             /* Get the current settings */
             LvmStatus = LVREV_GetControlParameters(pContext->hInstance, &ActiveParams);
             LVM_ERROR_CHECK(LvmStatus, "LVREV_GetControlParameters", "EFFECT_CMD_ENABLE")
-            pContext->SamplesToExitCount =
-                    (ActiveParams.T60 * pContext->config.inputCfg.samplingRate)/1000;
+            pContext->SamplesToExitCount = Reverb_getExitSamples(pContext, ActiveParams.T60);
             // force no volume ramp for first buffer processed after enabling the effect
             pContext->volumeMode = android::REVERB_VOLUME_FLAT;
             //ALOGV("\tEFFECT_CMD_ENABLE SamplesToExitCount = %d", pContext->SamplesToExitCount);
@@ -2209,7 +2504,13 @@ int Reverb_getDescriptor(effect_handle_t   self,
         return -EINVAL;
     }
 
-    if (pContext->auxiliary) {
+    if (pContext->pConvolution != NULL) {
+        if (pContext->auxiliary) {
+            desc = &android::gAuxConvPresetReverbDescriptor;
+        } else {
+            desc = &android::gInsertConvPresetReverbDescriptor;
+        }
+    } else if (pContext->auxiliary) {
         if (pContext->preset) {
             desc = &android::gAuxPresetReverbDescriptor;
         } else {
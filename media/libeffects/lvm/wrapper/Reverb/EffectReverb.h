@@ -31,6 +31,10 @@ extern "C" {
 #define LVREV_MAX_FRAME_SIZE    2560
 #define LVREV_CUP_LOAD_ARM9E    470    // Expressed in 0.1 MIPS
 #define LVREV_MEM_USAGE         (71+(LVREV_MAX_FRAME_SIZE>>7))     // Expressed in kB
+// Convolution preset reverb, stereo output at 48 kHz with the default 256 frame partitions.
+// Memory is the per instance frequency domain delay line, impulse responses are shared.
+#define CONVREV_CPU_LOAD_ARM9E  1100   // Expressed in 0.1 MIPS
+#define CONVREV_MEM_USAGE       (LVREV_MEM_USAGE+700)               // Expressed in kB
 //#define LVM_PCM
 
 typedef struct _LPFPair_t
@@ -21,6 +21,8 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+
 #include <binder/IMemory.h>
 #include <binder/MemoryDealer.h>
 #include <drm/drm_framework_common.h>
@@ -295,19 +297,34 @@ HeifDecoderImpl::HeifDecoderImpl() :
     mCurScanline(0),
     mWidth(0),
     mHeight(0),
+    mOutputHeight(0),
     mFrameDecoded(false),
     mHasImage(false),
     mHasVideo(false),
     mAvailableLines(0),
     mNumSlices(1),
     mSliceHeight(0),
-    mAsyncDecodeDone(false) {
+    mAsyncDecodeDone(false),
+    mAbortDecode(false),
+    mRowBytes(0) {
 }
 
 HeifDecoderImpl::~HeifDecoderImpl() {
-    if (mThread != nullptr) {
-        mThread->join();
+    stopDecodeThread();
+}
+
+void HeifDecoderImpl::stopDecodeThread() {
+    if (mThread == nullptr) {
+        return;
     }
+    {
+        Mutex::Autolock autolock(mLock);
+        mAbortDecode = true;
+        mSliceConsumed.signal();
+    }
+    mThread->join();
+    mThread.clear();
+    mAbortDecode = false;
 }
 
 bool HeifDecoderImpl::init(HeifStream* stream, HeifFrameInfo* frameInfo) {
@@ -373,6 +390,7 @@ bool HeifDecoderImpl::init(HeifStream* stream, HeifFrameInfo* frameInfo) {
     }
     mWidth = videoFrame->mWidth;
     mHeight = videoFrame->mHeight;
+    mOutputHeight = mHeight;
     if (mHasImage && videoFrame->mTileHeight >= 512 && mWidth >= 3000 && mHeight >= 2000 ) {
         // Try decoding in slices only if the image has tiles and is big enough.
         mSliceHeight = videoFrame->mTileHeight;
@@ -411,8 +429,45 @@ bool HeifDecoderImpl::setOutputColor(HeifColorFormat heifColor) {
     return false;
 }
 
+bool HeifDecoderImpl::copySlice(const sp<IMemory>& frameMemory, size_t slice) {
+    if (frameMemory == nullptr || frameMemory->pointer() == nullptr) {
+        return false;
+    }
+    // The retriever returns the slice alone, in a frame one slice high that
+    // is reused for the next slice.
+    VideoFrame* videoFrame = static_cast<VideoFrame*>(frameMemory->pointer());
+    if (videoFrame->mWidth != mWidth || videoFrame->mHeight < mSliceHeight
+            || videoFrame->mBytesPerPixel * mWidth != mRowBytes) {
+        ALOGE("unexpected slice frame %dx%d", videoFrame->mWidth, videoFrame->mHeight);
+        return false;
+    }
+
+    size_t top = slice * mSliceHeight;
+    size_t lines = std::min((size_t)mSliceHeight, mHeight - top);
+    uint8_t* dst = mRingBuffer.get() + (slice % kNumRingSlices) * mSliceHeight * mRowBytes;
+    const uint8_t* src = videoFrame->getFlattenedData();
+    for (size_t i = 0; i < lines; i++) {
+        memcpy(dst, src, mRowBytes);
+        dst += mRowBytes;
+        src += videoFrame->mRowBytes;
+    }
+    return true;
+}
+
 bool HeifDecoderImpl::decodeAsync() {
     for (size_t i = 1; i < mNumSlices; i++) {
+        {
+            Mutex::Autolock autolock(mLock);
+
+            // wait for the ring slot of slice i to be consumed
+            while (!mAbortDecode && i >= mCurScanline / mSliceHeight + kNumRingSlices) {
+                mSliceConsumed.wait(mLock);
+            }
+            if (mAbortDecode) {
+                break;
+            }
+        }
+
         ALOGV("decodeAsync(): decoding slice %zu", i);
         size_t top = i * mSliceHeight;
         size_t bottom = (i + 1) * mSliceHeight;
@@ -421,73 +476,98 @@ bool HeifDecoderImpl::decodeAsync() {
         }
         sp<IMemory> frameMemory = mRetriever->getImageRectAtIndex(
                 -1, mOutputColor, 0, top, mWidth, bottom);
+
+        // the slot is not read until the lines are made available
+        bool copied = copySlice(frameMemory, i);
         {
             Mutex::Autolock autolock(mLock);
 
-            if (frameMemory == nullptr || frameMemory->pointer() == nullptr) {
+            if (!copied) {
                 mAsyncDecodeDone = true;
                 mScanlineReady.signal();
                 break;
             }
-            mFrameMemory = frameMemory;
             mAvailableLines = bottom;
             ALOGV("decodeAsync(): available lines %zu", mAvailableLines);
             mScanlineReady.signal();
         }
     }
-    // Aggressive clear to avoid holding on to resources
-    mRetriever.clear();
-    mDataSource.clear();
+    // The retriever is kept until the decoder is destroyed: the slices are
+    // gone once read, decoding again or decoding a region starts over from it.
     return false;
 }
 
-bool HeifDecoderImpl::decode(HeifFrameInfo* frameInfo) {
-    // reset scanline pointer
-    mCurScanline = 0;
+bool HeifDecoderImpl::decodeSlices(HeifFrameInfo* frameInfo) {
+    // get first slice and metadata
+    sp<IMemory> frameMemory = mRetriever->getImageRectAtIndex(
+            -1, mOutputColor, 0, 0, mWidth, mSliceHeight);
 
-    if (mFrameDecoded) {
-        return true;
+    if (frameMemory == nullptr || frameMemory->pointer() == nullptr) {
+        ALOGE("decode: metadata is a nullptr");
+        return false;
     }
 
-    // See if we want to decode in slices to allow client to start
-    // scanline processing in parallel with decode. If this fails
-    // we fallback to decoding the full frame.
-    if (mHasImage && mNumSlices > 1) {
-        // get first slice and metadata
-        sp<IMemory> frameMemory = mRetriever->getImageRectAtIndex(
-                -1, mOutputColor, 0, 0, mWidth, mSliceHeight);
+    VideoFrame* videoFrame = static_cast<VideoFrame*>(frameMemory->pointer());
 
-        if (frameMemory == nullptr || frameMemory->pointer() == nullptr) {
-            ALOGE("decode: metadata is a nullptr");
+    mRowBytes = videoFrame->mBytesPerPixel * mWidth;
+    if (mRingBuffer == nullptr) {
+        mRingBuffer.reset(new (std::nothrow) uint8_t[kNumRingSlices * mSliceHeight * mRowBytes]);
+        if (mRingBuffer == nullptr) {
             return false;
         }
+    }
+    if (!copySlice(frameMemory, 0)) {
+        return false;
+    }
 
-        VideoFrame* videoFrame = static_cast<VideoFrame*>(frameMemory->pointer());
+    if (frameInfo != nullptr) {
+        frameInfo->set(
+                mWidth,
+                mHeight,
+                videoFrame->mRotationAngle,
+                videoFrame->mBytesPerPixel,
+                videoFrame->mIccSize,
+                videoFrame->getFlattenedIccData());
+    }
 
-        if (frameInfo != nullptr) {
-            frameInfo->set(
-                    videoFrame->mWidth,
-                    videoFrame->mHeight,
-                    videoFrame->mRotationAngle,
-                    videoFrame->mBytesPerPixel,
-                    videoFrame->mIccSize,
-                    videoFrame->getFlattenedIccData());
-        }
+    mAvailableLines = mSliceHeight;
+    mAsyncDecodeDone = false;
+    mThread = new DecodeThread(this);
+    if (mThread->run("HeifDecode", ANDROID_PRIORITY_FOREGROUND) != OK) {
+        mThread.clear();
+        return false;
+    }
+    return true;
+}
+
+bool HeifDecoderImpl::decode(HeifFrameInfo* frameInfo) {
+    // the decode thread reads mCurScanline, stop it first
+    stopDecodeThread();
 
-        mFrameMemory = frameMemory;
-        mAvailableLines = mSliceHeight;
-        mThread = new DecodeThread(this);
-        if (mThread->run("HeifDecode", ANDROID_PRIORITY_FOREGROUND) == OK) {
+    // reset scanline pointer
+    mCurScanline = 0;
+    mOutputHeight = mHeight;
+
+    // Slices are not kept once read, decoding again starts over.
+    if (mFrameDecoded && mNumSlices <= 1) {
+        return true;
+    }
+
+    // See if we want to decode in slices to allow client to start
+    // scanline processing in parallel with decode, and to only hold a
+    // few slices in memory. If this fails we fallback to decoding the
+    // full frame.
+    if (mHasImage && mNumSlices > 1) {
+        if (decodeSlices(frameInfo)) {
             mFrameDecoded = true;
             return true;
         }
 
         // Fallback to decode without slicing
-        mThread.clear();
         mNumSlices = 1;
         mSliceHeight = 0;
         mAvailableLines = 0;
-        mFrameMemory.clear();
+        mRingBuffer.reset();
     }
 
     if (mHasImage) {
@@ -536,7 +616,71 @@ bool HeifDecoderImpl::decode(HeifFrameInfo* frameInfo) {
     return true;
 }
 
+bool HeifDecoderImpl::decodeRegion(HeifFrameInfo* frameInfo,
+        uint32_t left, uint32_t top, uint32_t right, uint32_t bottom) {
+    stopDecodeThread();
+
+    // the retriever is released once the whole picture is decoded without slices
+    if (!mHasImage || mRetriever == nullptr) {
+        return false;
+    }
+
+    if (left >= right || top >= bottom || right > mWidth || bottom > mHeight) {
+        ALOGE("decodeRegion: bad region {%u, %u, %u, %u}", left, top, right, bottom);
+        return false;
+    }
+
+    // a streamed decode is dropped, decode() will start over without slices
+    if (mNumSlices > 1) {
+        mRingBuffer.reset();
+        mFrameDecoded = false;
+    }
+
+    // image index < 0 to retrieve primary image
+    sp<IMemory> frameMemory = mRetriever->getImageRoiAtIndex(
+            -1, mOutputColor, left, top, right, bottom);
+
+    if (frameMemory == nullptr || frameMemory->pointer() == nullptr) {
+        ALOGE("decodeRegion: videoFrame is a nullptr");
+        return false;
+    }
+
+    VideoFrame* videoFrame = static_cast<VideoFrame*>(frameMemory->pointer());
+    if (videoFrame->mSize == 0 ||
+            frameMemory->size() < videoFrame->getFlattenedSize()) {
+        ALOGE("decodeRegion: videoFrame size is invalid");
+        return false;
+    }
+
+    if (frameInfo != nullptr) {
+        frameInfo->set(
+                videoFrame->mWidth,
+                videoFrame->mHeight,
+                videoFrame->mRotationAngle,
+                videoFrame->mBytesPerPixel,
+                videoFrame->mIccSize,
+                videoFrame->getFlattenedIccData());
+    }
+
+    mFrameMemory = frameMemory;
+    mOutputHeight = videoFrame->mHeight;
+    mCurScanline = 0;
+    mNumSlices = 1;
+    return true;
+}
+
 bool HeifDecoderImpl::getScanlineInner(uint8_t* dst) {
+    if (mNumSlices > 1) {
+        const uint8_t* src = mRingBuffer.get()
+                + (mCurScanline / mSliceHeight % kNumRingSlices) * mSliceHeight * mRowBytes
+                + (mCurScanline % mSliceHeight) * mRowBytes;
+        memcpy(dst, src, mRowBytes);
+        if (++mCurScanline % mSliceHeight == 0) {
+            mSliceConsumed.signal();
+        }
+        return true;
+    }
+
     if (mFrameMemory == nullptr || mFrameMemory->pointer() == nullptr) {
         return false;
     }
@@ -547,7 +691,7 @@ bool HeifDecoderImpl::getScanlineInner(uint8_t* dst) {
 }
 
 bool HeifDecoderImpl::getScanline(uint8_t* dst) {
-    if (mCurScanline >= mHeight) {
+    if (mCurScanline >= mOutputHeight) {
         ALOGE("no more scanline available");
         return false;
     }
@@ -565,10 +709,20 @@ bool HeifDecoderImpl::getScanline(uint8_t* dst) {
 }
 
 size_t HeifDecoderImpl::skipScanlines(size_t count) {
+    if (mNumSlices > 1) {
+        Mutex::Autolock autolock(mLock);
+        size_t skipped = skipScanlinesInner(count);
+        mSliceConsumed.signal();
+        return skipped;
+    }
+    return skipScanlinesInner(count);
+}
+
+size_t HeifDecoderImpl::skipScanlinesInner(size_t count) {
     uint32_t oldScanline = mCurScanline;
     mCurScanline += count;
-    if (mCurScanline > mHeight) {
-        mCurScanline = mHeight;
+    if (mCurScanline > mOutputHeight) {
+        mCurScanline = mOutputHeight;
     }
     return (mCurScanline > oldScanline) ? (mCurScanline - oldScanline) : 0;
 }
@@ -18,6 +18,7 @@
 #define _HEIF_DECODER_IMPL_
 
 #include "include/HeifDecoderAPI.h"
+#include <memory>
 #include <system/graphics.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
@@ -46,6 +47,9 @@ public:
 
     bool decode(HeifFrameInfo* frameInfo) override;
 
+    bool decodeRegion(HeifFrameInfo* frameInfo,
+            uint32_t left, uint32_t top, uint32_t right, uint32_t bottom) override;
+
     bool getScanline(uint8_t* dst) override;
 
     size_t skipScanlines(size_t count) override;
@@ -60,21 +64,33 @@ private:
     size_t mCurScanline;
     uint32_t mWidth;
     uint32_t mHeight;
+    uint32_t mOutputHeight;   // mHeight, or the height of the decoded region
     bool mFrameDecoded;
     bool mHasImage;
     bool mHasVideo;
 
-    // Slice decoding only
+    // Slice decoding only. Slices are copied into a ring buffer of
+    // kNumRingSlices slices as they are decoded, the decode thread waits for
+    // the oldest one to be consumed before decoding the next.
+    static const size_t kNumRingSlices = 2;
     Mutex mLock;
     Condition mScanlineReady;
+    Condition mSliceConsumed;
     sp<DecodeThread> mThread;
     size_t mAvailableLines;
     size_t mNumSlices;
     uint32_t mSliceHeight;
     bool mAsyncDecodeDone;
+    bool mAbortDecode;
+    std::unique_ptr<uint8_t[]> mRingBuffer;
+    size_t mRowBytes;
 
     bool decodeAsync();
+    bool decodeSlices(HeifFrameInfo* frameInfo);
+    void stopDecodeThread();
+    bool copySlice(const sp<IMemory>& frameMemory, size_t slice);
     bool getScanlineInner(uint8_t* dst);
+    size_t skipScanlinesInner(size_t count);
 };
 
 } // namespace android
@@ -155,6 +155,19 @@ struct HeifDecoder {
      */
     virtual bool decode(HeifFrameInfo* frameInfo) = 0;
 
+    /*
+     * Decode only the region [left, right) x [top, bottom) of the primary
+     * picture, returning whether it succeeded. For tiled pictures only the
+     * tiles intersecting the region are decoded. |frameInfo| will be filled
+     * with the size of the region, whose left edge may be moved one column to
+     * the left to be even, upon success and unmodified upon failure.
+     *
+     * After this succeeded, getScanline can be called to read the scanlines
+     * of the region. Can be called repeatedly, but not after decode().
+     */
+    virtual bool decodeRegion(HeifFrameInfo* frameInfo,
+            uint32_t left, uint32_t top, uint32_t right, uint32_t bottom) = 0;
+
     /*
      * Read the next scanline (in top-down order), returns true upon success
      * and false otherwise.
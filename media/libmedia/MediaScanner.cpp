@@ -22,19 +22,533 @@
 #include <media/mediascanner.h>
 
 #include <sys/stat.h>
+#include <sys/xattr.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <utils/Timers.h>
 
 namespace android {
 
+namespace {
+
+const int kDefaultNumWalkers = 4;
+const int kMaxNumWalkers = 16;
+
+// Walkers block once that many entries wait to be reported.
+const size_t kMaxQueuedEntries = 1024;
+// Entries of a directory are queued in batches of that many.
+const size_t kEntryBatchSize = 256;
+// Files are prefetched that many entries before being reported.
+const size_t kPrefetchWindow = 32;
+
+const size_t kProgressLogInterval = 10000;
+
+// Extended attribute of the provider database holding the tag of the manifest
+// written for it.
+const char kDatabaseTagAttribute[] = "user.mediascanner.manifest";
+const size_t kDatabaseTagSize = 16;
+
+int64_t nowUs() {
+    return ns2us(systemTime(SYSTEM_TIME_MONOTONIC));
+}
+
+bool isDotOrDotDot(const char *name) {
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+}  // namespace
+
+struct MediaScanner::ScanEntry {
+    std::string mPath;
+    long long mLastModified;
+    long long mSize;
+    unsigned long long mInode;
+    bool mIsDirectory;
+    bool mNoMedia;
+    bool mPrefetched;
+};
+
+// Files of the previous scan, read from the manifest, and the file the files
+// of this scan are written to as they are reported. It replaces the manifest
+// once the scan completes; files outside of the scanned directory are kept.
+//
+// The manifest records a random tag, also set as an extended attribute of the
+// provider database it was written for. It is discarded if the database file
+// was recreated since, so that the files it lists are not left out of the new
+// database.
+struct MediaScanner::Manifest {
+    Manifest(const char *path, const char *root, const char *database);
+    ~Manifest();
+
+    // Whether the file was reported by the last scan, with the same inode,
+    // mtime, size and nomedia state.
+    bool isUnchanged(const ScanEntry &entry) const;
+    // Whether the file was reported by the last scan, but has changed since.
+    bool isModified(const ScanEntry &entry) const;
+    void add(const ScanEntry &entry);
+    void commit();
+
+private:
+    struct Entry {
+        unsigned long long mInode;
+        long long mLastModified;
+        long long mSize;
+        bool mNoMedia;
+    };
+
+    static bool matches(const Entry &manifestEntry, const ScanEntry &entry);
+    static bool getDatabaseTag(const char *database, std::string *tag);
+
+    std::string mPath;
+    std::string mTmpPath;
+    std::string mRoot;
+    std::unordered_map<std::string, Entry> mEntries;
+    FILE *mFile;
+    std::string mDatabaseTag;
+
+    Manifest(const Manifest &);
+    Manifest &operator=(const Manifest &);
+};
+
+MediaScanner::Manifest::Manifest(const char *path, const char *root, const char *database)
+    : mPath(path), mTmpPath(mPath + ".tmp"), mRoot(root), mFile(NULL) {
+    if (!getDatabaseTag(database, &mDatabaseTag)) {
+        // the manifest would not say what the files were reported to
+        return;
+    }
+
+    FILE *file = fopen(path, "re");
+    if (file != NULL) {
+        char line[PATH_MAX + 128];
+        if (fgets(line, sizeof(line), file) == NULL
+                || line != "database " + mDatabaseTag + "\n") {
+            ALOGI("manifest %s is not for database %s, scanning all files", path, database);
+            fclose(file);
+            file = NULL;
+        }
+    }
+    if (file != NULL) {
+        char line[PATH_MAX + 128];
+        while (fgets(line, sizeof(line), file) != NULL) {
+            Entry entry;
+            int noMedia, pathOffset;
+            size_t length = strlen(line);
+            if (length == 0 || line[length - 1] != '\n'
+                    || sscanf(line, "%llu %lld %lld %d %n", &entry.mInode, &entry.mLastModified,
+                            &entry.mSize, &noMedia, &pathOffset) != 4) {
+                continue;
+            }
+            line[length - 1] = 0;
+            entry.mNoMedia = noMedia != 0;
+            mEntries[line + pathOffset] = entry;
+        }
+        fclose(file);
+    }
+    ALOGV("%zu files in manifest %s", mEntries.size(), path);
+
+    mFile = fopen(mTmpPath.c_str(), "we");
+    if (mFile == NULL) {
+        ALOGW("cannot write manifest %s: %s", mTmpPath.c_str(), strerror(errno));
+    } else {
+        fprintf(mFile, "database %s\n", mDatabaseTag.c_str());
+    }
+}
+
+MediaScanner::Manifest::~Manifest() {
+    if (mFile != NULL) {
+        fclose(mFile);
+        unlink(mTmpPath.c_str());
+    }
+}
+
+bool MediaScanner::Manifest::getDatabaseTag(const char *database, std::string *tag) {
+    char value[2 * kDatabaseTagSize + 1];
+    ssize_t length = getxattr(database, kDatabaseTagAttribute, value, sizeof(value) - 1);
+    if (length > 0) {
+        value[length] = 0;
+        *tag = value;
+        return true;
+    }
+    if (errno != ENODATA) {
+        ALOGW("cannot read tag of database %s, not using manifest: %s",
+                database, strerror(errno));
+        return false;
+    }
+
+    // a new database, or one that was never scanned with a manifest
+    uint8_t random[kDatabaseTagSize];
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    bool haveRandom = fd >= 0 && read(fd, random, sizeof(random)) == (ssize_t)sizeof(random);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!haveRandom) {
+        ALOGW("cannot generate database tag, not using manifest");
+        return false;
+    }
+    for (size_t i = 0; i < kDatabaseTagSize; ++i) {
+        snprintf(&value[2 * i], 3, "%02x", random[i]);
+    }
+    if (setxattr(database, kDatabaseTagAttribute, value, 2 * kDatabaseTagSize, 0) != 0) {
+        ALOGW("cannot tag database %s, not using manifest: %s", database, strerror(errno));
+        return false;
+    }
+    *tag = value;
+    return true;
+}
+
+bool MediaScanner::Manifest::matches(const Entry &manifestEntry, const ScanEntry &entry) {
+    return manifestEntry.mInode == entry.mInode
+            && manifestEntry.mLastModified == entry.mLastModified
+            && manifestEntry.mSize == entry.mSize
+            && manifestEntry.mNoMedia == entry.mNoMedia;
+}
+
+bool MediaScanner::Manifest::isUnchanged(const ScanEntry &entry) const {
+    auto it = mEntries.find(entry.mPath);
+    return it != mEntries.end() && matches(it->second, entry);
+}
+
+bool MediaScanner::Manifest::isModified(const ScanEntry &entry) const {
+    auto it = mEntries.find(entry.mPath);
+    return it != mEntries.end() && !matches(it->second, entry);
+}
+
+void MediaScanner::Manifest::add(const ScanEntry &entry) {
+    // paths with a new line are not recorded, and just scanned every time
+    if (mFile == NULL || entry.mPath.find('\n') != std::string::npos) {
+        return;
+    }
+    fprintf(mFile, "%llu %lld %lld %d %s\n", entry.mInode,
+            entry.mLastModified, entry.mSize, entry.mNoMedia, entry.mPath.c_str());
+}
+
+void MediaScanner::Manifest::commit() {
+    if (mFile == NULL) {
+        return;
+    }
+    for (const auto &it : mEntries) {
+        if (it.first.compare(0, mRoot.size(), mRoot) != 0) {
+            fprintf(mFile, "%llu %lld %lld %d %s\n", it.second.mInode,
+                    it.second.mLastModified, it.second.mSize, it.second.mNoMedia,
+                    it.first.c_str());
+        }
+    }
+    bool failed = ferror(mFile) != 0;
+    failed = fclose(mFile) != 0 || failed;
+    mFile = NULL;
+    if (failed || rename(mTmpPath.c_str(), mPath.c_str()) != 0) {
+        ALOGW("cannot write manifest %s: %s", mPath.c_str(), strerror(errno));
+        unlink(mTmpPath.c_str());
+    }
+}
+
+// Walks a directory tree on a pool of threads. Each thread takes directories
+// from its own deque, newest first, and steals the oldest ones from the
+// others when it runs out. The entries of a directory are queued for the
+// scanning thread before its subdirectories are walked, so a directory is
+// always reported before its contents.
+struct MediaScanner::DirectoryWalker {
+    DirectoryWalker(const MediaScanner *scanner, const char *root, int numThreads);
+    ~DirectoryWalker();
+
+    // Returns OK with the next entry, WOULD_BLOCK if none is available yet
+    // and block is false, or NOT_ENOUGH_DATA once the walk is over.
+    status_t dequeue(ScanEntry *entry, bool block);
+
+    void abort();
+
+    // SKIPPED if the root directory could not be opened.
+    MediaScanResult rootResult();
+
+private:
+    struct Job {
+        std::string mPath;  // with a trailing '/'
+        bool mNoMedia;
+    };
+
+    struct Worker {
+        Mutex mLock;
+        std::deque<Job> mJobs;
+        std::thread mThread;
+    };
+
+    const MediaScanner *mScanner;
+    std::string mRoot;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    Mutex mLock;
+    Condition mJobAvailable;
+    Condition mEntryAvailable;
+    Condition mEntryConsumed;
+    // jobs queued or being processed, the walk is over when it drops to 0
+    size_t mPendingJobs;
+    bool mAborted;
+    std::deque<ScanEntry> mEntries;
+    MediaScanResult mRootResult;
+
+    void threadLoop(size_t index);
+    bool nextJob(size_t index, Job *job);
+    void processJob(size_t index, const Job &job);
+    bool flush(size_t index, std::vector<ScanEntry> *entries, std::vector<Job> *subdirs);
+
+    DirectoryWalker(const DirectoryWalker &);
+    DirectoryWalker &operator=(const DirectoryWalker &);
+};
+
+MediaScanner::DirectoryWalker::DirectoryWalker(
+        const MediaScanner *scanner, const char *root, int numThreads)
+    : mScanner(scanner),
+      mRoot(root),
+      mPendingJobs(1),
+      mAborted(false),
+      mRootResult(MEDIA_SCAN_RESULT_OK) {
+    for (int i = 0; i < numThreads; ++i) {
+        mWorkers.emplace_back(new Worker);
+    }
+    mWorkers[0]->mJobs.push_back({mRoot, false});
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i]->mThread = std::thread([this, i] { threadLoop(i); });
+    }
+}
+
+MediaScanner::DirectoryWalker::~DirectoryWalker() {
+    abort();
+    for (const auto &worker : mWorkers) {
+        worker->mThread.join();
+    }
+}
+
+void MediaScanner::DirectoryWalker::abort() {
+    Mutex::Autolock autoLock(mLock);
+    mAborted = true;
+    mJobAvailable.broadcast();
+    mEntryAvailable.broadcast();
+    mEntryConsumed.broadcast();
+}
+
+MediaScanResult MediaScanner::DirectoryWalker::rootResult() {
+    Mutex::Autolock autoLock(mLock);
+    return mRootResult;
+}
+
+status_t MediaScanner::DirectoryWalker::dequeue(ScanEntry *entry, bool block) {
+    Mutex::Autolock autoLock(mLock);
+    while (block && !mAborted && mEntries.empty() && mPendingJobs > 0) {
+        mEntryAvailable.wait(mLock);
+    }
+    if (mAborted || (mEntries.empty() && mPendingJobs == 0)) {
+        return NOT_ENOUGH_DATA;
+    }
+    if (mEntries.empty()) {
+        return WOULD_BLOCK;
+    }
+    *entry = std::move(mEntries.front());
+    mEntries.pop_front();
+    mEntryConsumed.signal();
+    return OK;
+}
+
+void MediaScanner::DirectoryWalker::threadLoop(size_t index) {
+    Job job;
+    while (nextJob(index, &job)) {
+        processJob(index, job);
+
+        Mutex::Autolock autoLock(mLock);
+        if (--mPendingJobs == 0) {
+            mJobAvailable.broadcast();
+            mEntryAvailable.signal();
+        }
+    }
+}
+
+bool MediaScanner::DirectoryWalker::nextJob(size_t index, Job *job) {
+    Worker *self = mWorkers[index].get();
+    {
+        Mutex::Autolock autoLock(self->mLock);
+        if (!self->mJobs.empty()) {
+            *job = std::move(self->mJobs.back());
+            self->mJobs.pop_back();
+            return true;
+        }
+    }
+
+    // Jobs are pushed with mLock held, so none can be missed while waiting.
+    Mutex::Autolock autoLock(mLock);
+    for (;;) {
+        if (mAborted || mPendingJobs == 0) {
+            return false;
+        }
+        // the oldest jobs are the closest to the root, with the most work below
+        for (size_t i = 1; i < mWorkers.size(); ++i) {
+            Worker *victim = mWorkers[(index + i) % mWorkers.size()].get();
+            Mutex::Autolock victimLock(victim->mLock);
+            if (!victim->mJobs.empty()) {
+                *job = std::move(victim->mJobs.front());
+                victim->mJobs.pop_front();
+                return true;
+            }
+        }
+        mJobAvailable.wait(mLock);
+    }
+}
+
+bool MediaScanner::DirectoryWalker::flush(
+        size_t index, std::vector<ScanEntry> *entries, std::vector<Job> *subdirs) {
+    Mutex::Autolock autoLock(mLock);
+    while (!mAborted && mEntries.size() >= kMaxQueuedEntries) {
+        mEntryConsumed.wait(mLock);
+    }
+    if (mAborted) {
+        return false;
+    }
+    if (!entries->empty()) {
+        for (ScanEntry &entry : *entries) {
+            mEntries.push_back(std::move(entry));
+        }
+        entries->clear();
+        mEntryAvailable.signal();
+    }
+
+    if (!subdirs->empty()) {
+        Worker *self = mWorkers[index].get();
+        Mutex::Autolock selfLock(self->mLock);
+        for (Job &job : *subdirs) {
+            self->mJobs.push_back(std::move(job));
+            ++mPendingJobs;
+        }
+        subdirs->clear();
+        mJobAvailable.broadcast();
+    }
+    return true;
+}
+
+void MediaScanner::DirectoryWalker::processJob(size_t index, const Job &job) {
+    const std::string &dirPath = job.mPath;
+    if (mScanner->shouldSkipDirectory(dirPath.c_str())) {
+        ALOGD("Skipping: %s", dirPath.c_str());
+        return;
+    }
+
+    // Treat all files as non-media in directories that contain a  ".nomedia" file
+    bool noMedia = job.mNoMedia;
+    if (!noMedia && dirPath.size() + 8 /* strlen(".nomedia") */ <= PATH_MAX
+            && access((dirPath + ".nomedia").c_str(), F_OK) == 0) {
+        ALOGV("found .nomedia, setting noMedia flag");
+        noMedia = true;
+    }
+
+    DIR* dir = opendir(dirPath.c_str());
+    if (!dir) {
+        ALOGW("Error opening directory '%s', skipping: %s.", dirPath.c_str(), strerror(errno));
+        if (dirPath == mRoot) {
+            Mutex::Autolock autoLock(mLock);
+            mRootResult = MEDIA_SCAN_RESULT_SKIPPED;
+        }
+        return;
+    }
+
+    std::vector<ScanEntry> entries;
+    std::vector<Job> subdirs;
+    struct dirent* dirent;
+    bool aborted = false;
+    while (!aborted && (dirent = readdir(dir))) {
+        const char* name = dirent->d_name;
+        if (isDotOrDotDot(name)) {
+            continue;
+        }
+        if (dirPath.size() + strlen(name) + 1 > PATH_MAX) {
+            // path too long!
+            continue;
+        }
+        std::string path = dirPath + name;
+
+        struct stat statbuf;
+        bool haveStat = false;
+        int type = dirent->d_type;
+        if (type == DT_UNKNOWN) {
+            if (stat(path.c_str(), &statbuf) == 0) {
+                haveStat = true;
+                if (S_ISREG(statbuf.st_mode)) {
+                    type = DT_REG;
+                } else if (S_ISDIR(statbuf.st_mode)) {
+                    type = DT_DIR;
+                }
+            } else {
+                ALOGD("stat() failed for %s: %s", path.c_str(), strerror(errno));
+            }
+        }
+
+        if (type == DT_DIR) {
+            // set noMedia flag on directories with a name that starts with '.'
+            bool childNoMedia = noMedia || name[0] == '.';
+            if (haveStat || stat(path.c_str(), &statbuf) == 0) {
+                entries.push_back({path, statbuf.st_mtime, 0, statbuf.st_ino,
+                        true /* isDirectory */, childNoMedia, false});
+            }
+            subdirs.push_back({path + "/", childNoMedia});
+        } else if (type == DT_REG) {
+            if (!haveStat && stat(path.c_str(), &statbuf) != 0) {
+                memset(&statbuf, 0, sizeof(statbuf));
+            }
+            entries.push_back({path, statbuf.st_mtime, statbuf.st_size, statbuf.st_ino,
+                    false /* isDirectory */, noMedia, false});
+        }
+
+        if (entries.size() >= kEntryBatchSize) {
+            aborted = !flush(index, &entries, &subdirs);
+        }
+    }
+    closedir(dir);
+
+    if (!aborted) {
+        flush(index, &entries, &subdirs);
+    }
+}
+
 MediaScanner::MediaScanner()
-    : mLocale(NULL), mSkipList(NULL), mSkipIndex(NULL) {
+    : mLocale(NULL), mSkipList(NULL), mSkipIndex(NULL),
+      mNumWalkers(kDefaultNumWalkers), mManifestPath(NULL), mManifestDatabase(NULL),
+      mManifest(NULL),
+      mNumDirectories(0), mNumFiles(0), mNumUnchangedFiles(0),
+      mScanStartUs(0), mScanEndUs(0) {
     loadSkipList();
+
+    mNumWalkers = property_get_int32("media.scanner.threads", kDefaultNumWalkers);
+    if (mNumWalkers < 1) {
+        mNumWalkers = 1;
+    } else if (mNumWalkers > kMaxNumWalkers) {
+        mNumWalkers = kMaxNumWalkers;
+    }
+
+    char manifestPath[PROPERTY_VALUE_MAX];
+    char manifestDatabase[PROPERTY_VALUE_MAX];
+    if (property_get("media.scanner.manifest", manifestPath, NULL) > 0) {
+        if (property_get("media.scanner.manifest.database", manifestDatabase, NULL) > 0) {
+            mManifestPath = strdup(manifestPath);
+            mManifestDatabase = strdup(manifestDatabase);
+        } else {
+            ALOGW("media.scanner.manifest.database not set, not using manifest");
+        }
+    }
 }
 
 MediaScanner::~MediaScanner() {
     setLocale(NULL);
     free(mSkipList);
     free(mSkipIndex);
+    free(mManifestPath);
+    free(mManifestDatabase);
 }
 
 void MediaScanner::setLocale(const char *locale) {
@@ -99,14 +613,141 @@ MediaScanResult MediaScanner::processDirectory(
 
     client.setLocale(locale());
 
-    MediaScanResult result = doProcessDirectory(pathBuffer, pathRemaining, client, false);
+    mNumDirectories = 0;
+    mNumFiles = 0;
+    mNumUnchangedFiles = 0;
+    mScanEndUs = 0;
+    mScanStartUs = nowUs();
+    if (mManifestPath != NULL) {
+        mManifest = new Manifest(mManifestPath, pathBuffer, mManifestDatabase);
+    }
+
+    MediaScanResult result;
+    if (mNumWalkers > 1) {
+        result = doProcessDirectoryParallel(pathBuffer, client);
+    } else {
+        result = doProcessDirectory(pathBuffer, pathRemaining, client, false);
+    }
+
+    if (mManifest != NULL) {
+        if (result == MEDIA_SCAN_RESULT_OK) {
+            mManifest->commit();
+        }
+        delete mManifest;
+        mManifest = NULL;
+    }
+    mScanEndUs = nowUs();
+    logProgress(true /* done */);
 
     free(pathBuffer);
 
     return result;
 }
 
-bool MediaScanner::shouldSkipDirectory(char *path) {
+MediaScanProgress MediaScanner::getScanProgress() const {
+    MediaScanProgress progress;
+    progress.mDirectories = mNumDirectories;
+    progress.mFiles = mNumFiles;
+    progress.mUnchangedFiles = mNumUnchangedFiles;
+    int64_t startUs = mScanStartUs;
+    int64_t endUs = mScanEndUs;
+    progress.mElapsedUs = startUs == 0 ? 0 : (endUs != 0 ? endUs : nowUs()) - startUs;
+    return progress;
+}
+
+void MediaScanner::logProgress(bool done) const {
+    MediaScanProgress progress = getScanProgress();
+    size_t files = progress.mFiles + progress.mUnchangedFiles;
+    ALOGI("%s %zu directories, %zu files (%zu unchanged) in %lld ms, %.1f files/s",
+            done ? "scanned" : "scanning", progress.mDirectories, files,
+            progress.mUnchangedFiles, (long long)(progress.mElapsedUs / 1000),
+            progress.mElapsedUs > 0 ? files * 1E6 / progress.mElapsedUs : 0.0);
+}
+
+status_t MediaScanner::reportEntry(const ScanEntry &entry, MediaScannerClient &client) {
+    if (entry.mIsDirectory) {
+        ++mNumDirectories;
+        return client.scanFile(entry.mPath.c_str(), entry.mLastModified, 0,
+                true /*isDirectory*/, entry.mNoMedia);
+    }
+
+    status_t status = OK;
+    if (mManifest != NULL && mManifest->isUnchanged(entry)) {
+        ++mNumUnchangedFiles;
+    } else {
+        status = client.scanFile(entry.mPath.c_str(), entry.mLastModified, entry.mSize,
+                false /*isDirectory*/, entry.mNoMedia);
+        if (status != OK) {
+            return status;
+        }
+        ++mNumFiles;
+    }
+    if (mManifest != NULL) {
+        mManifest->add(entry);
+    }
+
+    if ((mNumFiles + mNumUnchangedFiles) % kProgressLogInterval == 0) {
+        logProgress(false /* done */);
+    }
+    return OK;
+}
+
+MediaScanResult MediaScanner::doProcessDirectoryParallel(
+        const char *path, MediaScannerClient &client) {
+    DirectoryWalker walker(this, path, mNumWalkers);
+
+    // Entries are reported in order; the files in the window behind the one
+    // being reported are prefetched if the client will process them. It
+    // does not for nomedia files, nor, in the usual case, for files it
+    // already has in its database unchanged, so only files the manifest
+    // knows to have been modified are prefetched.
+    std::deque<ScanEntry> window;
+    MediaScanResult result = MEDIA_SCAN_RESULT_OK;
+    bool walking = true;
+    for (;;) {
+        while (walking && window.size() < kPrefetchWindow) {
+            ScanEntry entry;
+            status_t err = walker.dequeue(&entry, window.empty() /* block */);
+            if (err == WOULD_BLOCK) {
+                break;
+            } else if (err != OK) {
+                walking = false;
+                break;
+            }
+            if (!entry.mIsDirectory && !entry.mNoMedia
+                    && mManifest != NULL && mManifest->isModified(entry)) {
+                prefetchFile(entry.mPath.c_str());
+                entry.mPrefetched = true;
+            }
+            window.push_back(std::move(entry));
+        }
+        if (window.empty()) {
+            break;
+        }
+
+        ScanEntry entry = std::move(window.front());
+        window.pop_front();
+        status_t status = reportEntry(entry, client);
+        if (entry.mPrefetched) {
+            releaseFile(entry.mPath.c_str());
+        }
+        if (status != OK) {
+            result = MEDIA_SCAN_RESULT_ERROR;
+            break;
+        }
+    }
+
+    for (const ScanEntry &entry : window) {
+        if (entry.mPrefetched) {
+            releaseFile(entry.mPath.c_str());
+        }
+    }
+    walker.abort();
+
+    return result == MEDIA_SCAN_RESULT_OK ? walker.rootResult() : result;
+}
+
+bool MediaScanner::shouldSkipDirectory(const char *path) const {
     if (path && mSkipList && mSkipIndex) {
         int len = strlen(path);
         int idx = 0;
@@ -211,8 +852,9 @@ MediaScanResult MediaScanner::doProcessDirectoryEntry(
 
         // report the directory to the client
         if (stat(path, &statbuf) == 0) {
-            status_t status = client.scanFile(path, statbuf.st_mtime, 0,
-                    true /*isDirectory*/, childNoMedia);
+            ScanEntry dirEntry = {path, statbuf.st_mtime, 0, statbuf.st_ino,
+                    true /*isDirectory*/, childNoMedia, false};
+            status_t status = reportEntry(dirEntry, client);
             if (status) {
                 return MEDIA_SCAN_RESULT_ERROR;
             }
@@ -227,8 +869,9 @@ MediaScanResult MediaScanner::doProcessDirectoryEntry(
         }
     } else if (type == DT_REG) {
         stat(path, &statbuf);
-        status_t status = client.scanFile(path, statbuf.st_mtime, statbuf.st_size,
-                false /*isDirectory*/, noMedia);
+        ScanEntry fileEntry = {path, statbuf.st_mtime, statbuf.st_size, statbuf.st_ino,
+                false /*isDirectory*/, noMedia, false};
+        status_t status = reportEntry(fileEntry, client);
         if (status) {
             return MEDIA_SCAN_RESULT_ERROR;
         }
@@ -91,8 +91,16 @@ public:
             int colorFormat = HAL_PIXEL_FORMAT_RGB_565, bool metaOnly = false);
     sp<IMemory> getImageAtIndex(int index,
             int colorFormat = HAL_PIXEL_FORMAT_RGB_565, bool metaOnly = false, bool thumbnail = false);
+    // Decodes the next row of tiles of the image, rows must be requested in
+    // order from the top. The bitmap only holds the rows of the rect, starting
+    // at its first line, and is reused for the next row.
     sp<IMemory> getImageRectAtIndex(
             int index, int colorFormat, int left, int top, int right, int bottom);
+    // Decodes only the region {left, top, right, bottom} of the image, into
+    // a bitmap of the size of the region. For tiled images, only the tiles
+    // intersecting the region are decoded.
+    sp<IMemory> getImageRoiAtIndex(
+            int index, int colorFormat, int left, int top, int right, int bottom);
     status_t getFrameAtIndex(
             std::vector<sp<IMemory> > *frames, int frameIndex, int numFrames = 1,
             int colorFormat = HAL_PIXEL_FORMAT_RGB_565, bool metaOnly = false);
@@ -23,6 +23,9 @@
 #include <utils/Errors.h>
 #include <utils/String8.h>
 #include <pthread.h>
+#include <sys/types.h>
+
+#include <atomic>
 
 struct dirent;
 
@@ -68,6 +71,14 @@ private:
     MediaAlbumArt();
 } __packed;
 
+// Counters of the ongoing or last directory scan.
+struct MediaScanProgress {
+    size_t mDirectories;    // directories reported to the client
+    size_t mFiles;          // files reported to the client
+    size_t mUnchangedFiles; // files skipped as unchanged since the last scan
+    int64_t mElapsedUs;
+};
+
 struct MediaScanner {
     MediaScanner();
     virtual ~MediaScanner();
@@ -82,22 +93,58 @@ struct MediaScanner {
 
     virtual MediaAlbumArt *extractAlbumArt(int fd) = 0;
 
+    // Can be called from another thread while processDirectory() runs.
+    MediaScanProgress getScanProgress() const;
+
 protected:
     const char *locale() const;
 
+    // With media.scanner.threads > 1, directories are walked on that many
+    // threads, and files are reported to the client in order of discovery on
+    // the thread calling processDirectory(). prefetchFile() is called a few
+    // entries before it is reported for a media file the manifest knows to
+    // have been modified since the last scan, so that it can be processed
+    // ahead, and releaseFile() once it has been reported, whether
+    // processFile() was called on it or not.
+    virtual void prefetchFile(const char * /* path */) {}
+    virtual void releaseFile(const char * /* path */) {}
+
 private:
+    struct ScanEntry;
+    struct DirectoryWalker;
+    struct Manifest;
+
     // current locale (like "ja_JP"), created/destroyed with strdup()/free()
     char *mLocale;
     char *mSkipList;
     int *mSkipIndex;
+    int mNumWalkers;
+
+    // Files unchanged since the last scan, by inode, mtime and size, are not
+    // reported if media.scanner.manifest names a file to keep them in, and
+    // media.scanner.manifest.database the provider database they were
+    // reported to.
+    char *mManifestPath;
+    char *mManifestDatabase;
+    Manifest *mManifest;
+
+    std::atomic<size_t> mNumDirectories;
+    std::atomic<size_t> mNumFiles;
+    std::atomic<size_t> mNumUnchangedFiles;
+    std::atomic<int64_t> mScanStartUs;
+    std::atomic<int64_t> mScanEndUs;
 
     MediaScanResult doProcessDirectory(
             char *path, int pathRemaining, MediaScannerClient &client, bool noMedia);
     MediaScanResult doProcessDirectoryEntry(
             char *path, int pathRemaining, MediaScannerClient &client, bool noMedia,
             struct dirent* entry, char* fileSpot);
+    MediaScanResult doProcessDirectoryParallel(
+            const char *path, MediaScannerClient &client);
+    status_t reportEntry(const ScanEntry &entry, MediaScannerClient &client);
     void loadSkipList();
-    bool shouldSkipDirectory(char *path);
+    bool shouldSkipDirectory(const char *path) const;
+    void logProgress(bool done) const;
 
 
     MediaScanner(const MediaScanner &);
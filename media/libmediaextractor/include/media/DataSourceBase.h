@@ -33,6 +33,9 @@ public:
         kIsCachingDataSource   = 4,
         kIsHTTPBasedSource     = 8,
         kIsLocalFileSource     = 16,
+        // Opened only to read the metadata of the content; extractors may skip
+        // parsing what they only need to read samples.
+        kIsMetadataOnly        = 32,
     };
 
     DataSourceBase() {}
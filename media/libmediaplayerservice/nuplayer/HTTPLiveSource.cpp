@@ -27,6 +27,7 @@
 #include <media/stagefright/foundation/ABuffer.h>
 #include <media/stagefright/foundation/ADebug.h>
 #include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/foundation/AString.h>
 #include <media/stagefright/MediaErrors.h>
 #include <media/stagefright/MetaData.h>
 #include <media/stagefright/MediaDefs.h>
@@ -110,10 +111,14 @@ void NuPlayer::HTTPLiveSource::prepareAsync() {
 
     sp<AMessage> notify = new AMessage(kWhatSessionNotify, this);
 
-    mLiveSession = new LiveSession(
+    sp<LiveSession> liveSession = new LiveSession(
             notify,
             (mFlags & kFlagIncognito) ? LiveSession::kFlagIncognito : 0,
             mHTTPService);
+    {
+        Mutex::Autolock autoLock(mLiveSessionLock);
+        mLiveSession = liveSession;
+    }
 
     mLiveLooper->registerHandler(mLiveSession);
 
@@ -125,6 +130,40 @@ void NuPlayer::HTTPLiveSource::prepareAsync() {
 void NuPlayer::HTTPLiveSource::start() {
 }
 
+sp<AMessage> NuPlayer::HTTPLiveSource::getStats() const {
+    sp<LiveSession> liveSession;
+    {
+        Mutex::Autolock autoLock(mLiveSessionLock);
+        liveSession = mLiveSession;
+    }
+    if (liveSession == NULL) {
+        return NULL;
+    }
+
+    LiveSession::ABRMetrics metrics;
+    liveSession->getABRMetrics(&metrics);
+
+    sp<AMessage> stats = new AMessage;
+    stats->setString("abr-estimator", metrics.mEstimator);
+    stats->setString("abr-policy", metrics.mPolicy);
+    stats->setInt32("abr-up-switches", metrics.mNumUpSwitches);
+    stats->setInt32("abr-down-switches", metrics.mNumDownSwitches);
+    stats->setInt32("abr-fallbacks", metrics.mNumFallbacks);
+
+    AString switches;
+    for (size_t i = 0; i < metrics.mSwitches.size(); ++i) {
+        const ABRPolicy::Switch &s = metrics.mSwitches[i];
+        switches.append(AStringPrintf(
+                "    %.3f s: %zu -> %zu (%s), estimate %d bps, buffered %lld ms\n",
+                s.mTimeUs / 1E6, s.mFromIndex, s.mToIndex,
+                ABRPolicy::ReasonToString(s.mReason), s.mBandwidthBps,
+                (long long)(s.mBufferedDurationUs / 1000)));
+    }
+    stats->setString("abr-switches", switches);
+
+    return stats;
+}
+
 sp<MetaData> NuPlayer::HTTPLiveSource::getFormatMeta(bool audio) {
     sp<MetaData> meta;
     if (mLiveSession != NULL) {
@@ -44,6 +44,7 @@ struct NuPlayer::HTTPLiveSource : public NuPlayer::Source {
     virtual status_t dequeueAccessUnit(bool audio, sp<ABuffer> *accessUnit);
     virtual sp<MetaData> getFormatMeta(bool audio);
     virtual sp<AMessage> getFormat(bool audio);
+    virtual sp<AMessage> getStats() const;
 
     virtual status_t feedMoreTSData();
     virtual status_t getDuration(int64_t *durationUs);
@@ -79,6 +80,7 @@ private:
     status_t mFinalResult;
     off64_t mOffset;
     sp<ALooper> mLiveLooper;
+    mutable Mutex mLiveSessionLock;  // guards |mLiveSession| for getStats().
     sp<LiveSession> mLiveSession;
     int32_t mFetchSubtitleDataGeneration;
     int32_t mFetchMetaDataGeneration;
@@ -2220,12 +2220,26 @@ void NuPlayer::getStats(Vector<sp<AMessage> > *trackStats) {
 
     trackStats->clear();
 
-    Mutex::Autolock autoLock(mDecoderLock);
-    if (mVideoDecoder != NULL) {
-        trackStats->push_back(mVideoDecoder->getStats());
+    {
+        Mutex::Autolock autoLock(mDecoderLock);
+        if (mVideoDecoder != NULL) {
+            trackStats->push_back(mVideoDecoder->getStats());
+        }
+        if (mAudioDecoder != NULL) {
+            trackStats->push_back(mAudioDecoder->getStats());
+        }
     }
-    if (mAudioDecoder != NULL) {
-        trackStats->push_back(mAudioDecoder->getStats());
+
+    sp<Source> source;
+    {
+        Mutex::Autolock autoLock(mSourceLock);
+        source = mSource;
+    }
+    if (source != NULL) {
+        sp<AMessage> sourceStats = source->getStats();
+        if (sourceStats != NULL) {
+            trackStats->push_back(sourceStats);
+        }
     }
 }
 
@@ -66,6 +66,12 @@ static const char *kPlayerDataSourceType = "android.media.mediaplayer.dataSource
 static const char *kPlayerRebuffering = "android.media.mediaplayer.rebufferingMs";
 static const char *kPlayerRebufferingCount = "android.media.mediaplayer.rebuffers";
 static const char *kPlayerRebufferingAtExit = "android.media.mediaplayer.rebufferExit";
+//
+static const char *kPlayerAbrEstimator = "android.media.mediaplayer.abr.estimator";
+static const char *kPlayerAbrPolicy = "android.media.mediaplayer.abr.policy";
+static const char *kPlayerAbrUpSwitches = "android.media.mediaplayer.abr.upswitches";
+static const char *kPlayerAbrDownSwitches = "android.media.mediaplayer.abr.downswitches";
+static const char *kPlayerAbrFallbacks = "android.media.mediaplayer.abr.fallbacks";
 
 
 NuPlayerDriver::NuPlayerDriver(pid_t pid)
@@ -583,6 +589,22 @@ void NuPlayerDriver::updateMetrics(const char *where) {
                     mAnalyticsItem->setCString(kPlayerACodec, name.c_str());
                 }
             }
+
+            AString policy;
+            if (stats->findString("abr-policy", &policy)) {
+                AString estimator;
+                int32_t upSwitches = 0, downSwitches = 0, fallbacks = 0;
+                stats->findString("abr-estimator", &estimator);
+                stats->findInt32("abr-up-switches", &upSwitches);
+                stats->findInt32("abr-down-switches", &downSwitches);
+                stats->findInt32("abr-fallbacks", &fallbacks);
+
+                mAnalyticsItem->setCString(kPlayerAbrPolicy, policy.c_str());
+                mAnalyticsItem->setCString(kPlayerAbrEstimator, estimator.c_str());
+                mAnalyticsItem->setInt32(kPlayerAbrUpSwitches, upSwitches);
+                mAnalyticsItem->setInt32(kPlayerAbrDownSwitches, downSwitches);
+                mAnalyticsItem->setInt32(kPlayerAbrFallbacks, fallbacks);
+            }
         }
     }
 
@@ -936,6 +958,24 @@ status_t NuPlayerDriver::dump(
                             ? 0.0 : (double)(numFramesDropped * 100) / numFramesTotal);
             logString.append(buf);
         }
+
+        AString policy;
+        if (stats->findString("abr-policy", &policy)) {
+            AString estimator, switches;
+            int32_t upSwitches = 0, downSwitches = 0, fallbacks = 0;
+            stats->findString("abr-estimator", &estimator);
+            stats->findInt32("abr-up-switches", &upSwitches);
+            stats->findInt32("abr-down-switches", &downSwitches);
+            stats->findInt32("abr-fallbacks", &fallbacks);
+            snprintf(buf, sizeof(buf), "  abr(%s), estimator(%s), upSwitches(%d), "
+                     "downSwitches(%d), fallbacks(%d)\n",
+                     policy.c_str(), estimator.c_str(), upSwitches, downSwitches, fallbacks);
+            logString.append(buf);
+
+            if (stats->findString("abr-switches", &switches)) {
+                logString.append(switches);
+            }
+        }
     }
 
     ALOGI("%s", logString.c_str());
@@ -92,6 +92,10 @@ struct NuPlayer::Source : public AHandler {
     virtual sp<MetaData> getFormatMeta(bool /* audio */) { return NULL; }
     virtual sp<MetaData> getFileFormatMeta() const { return NULL; }
 
+    // Returns statistics about the source itself, NULL if it has none.
+    // May be called from any thread.
+    virtual sp<AMessage> getStats() const { return NULL; }
+
     virtual status_t dequeueAccessUnit(
             bool audio, sp<ABuffer> *accessUnit) = 0;
 
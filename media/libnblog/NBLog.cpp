@@ -32,6 +32,7 @@
 #include <string.h>
 #include <sys/prctl.h>
 #include <time.h>
+#include <unistd.h>
 #include <new>
 #include <audio_utils/roundup.h>
 #include <media/nblog/NBLog.h>
@@ -810,52 +811,68 @@ void NBLog::MergeReader::getAndProcessSnapshot(NBLog::Reader::Snapshot &snapshot
     String8 timestamp, body;
 
     for (auto entry = snapshot.begin(); entry != snapshot.end();) {
-        switch (entry->type) {
-        case EVENT_START_FMT:
-            entry = handleFormat(FormatEntry(entry), &timestamp, &body);
-            break;
-        case EVENT_HISTOGRAM_ENTRY_TS: {
-            HistTsEntryWithAuthor *data = (HistTsEntryWithAuthor *) (entry->data);
-            // TODO This memcpies are here to avoid unaligned memory access crash.
-            // There's probably a more efficient way to do it
-            log_hash_t hash;
-            memcpy(&hash, &(data->hash), sizeof(hash));
-            int64_t ts;
-            memcpy(&ts, &data->ts, sizeof(ts));
-            // TODO: hash for histogram ts and audio state need to match
-            // and correspond to audio production source file location
-            mThreadPerformanceAnalysis[data->author][0 /*hash*/].logTsEntry(ts);
-            ++entry;
-            break;
-        }
-        case EVENT_AUDIO_STATE: {
-            HistTsEntryWithAuthor *data = (HistTsEntryWithAuthor *) (entry->data);
-            // TODO This memcpies are here to avoid unaligned memory access crash.
-            // There's probably a more efficient way to do it
-            log_hash_t hash;
-            memcpy(&hash, &(data->hash), sizeof(hash));
-            // TODO: remove ts if unused
-            int64_t ts;
-            memcpy(&ts, &data->ts, sizeof(ts));
-            mThreadPerformanceAnalysis[data->author][0 /*hash*/].handleStateChange();
-            ++entry;
-            break;
-        }
-        case EVENT_END_FMT:
-            body.appendFormat("warning: got to end format event");
-            ++entry;
-            break;
-        case EVENT_RESERVED:
-        default:
-            body.appendFormat("warning: unexpected event %d", entry->type);
-            ++entry;
-            break;
-        }
+        entry = handleEntry(entry, &timestamp, &body);
     }
     // FIXME: decide whether to print the warnings here or elsewhere
     if (!body.isEmpty()) {
         dumpLine(timestamp, body);
     }
+
+    // keep the raw entries for dumpRaw()
+    const size_t size = snapshot.end() - snapshot.begin();
+    if (size > 0) {
+        const uint8_t *begin = snapshot.begin();
+        Mutex::Autolock _l(mRawLock);
+        mRawSnapshots.emplace_back(begin, begin + size);
+        mRawSize += size;
+        // snapshots are whole sequences of entries, so dropping the oldest keeps entries intact
+        while (mRawSize > kMaxRawSize && mRawSnapshots.size() > 1) {
+            mRawSize -= mRawSnapshots.front().size();
+            mRawSnapshots.pop_front();
+        }
+    }
+}
+
+NBLog::EntryIterator NBLog::MergeReader::handleEntry(const EntryIterator &entry,
+                                                     String8 *timestamp, String8 *body)
+{
+    switch (entry->type) {
+    case EVENT_START_FMT:
+        return handleFormat(FormatEntry(entry), timestamp, body);
+    case EVENT_HISTOGRAM_ENTRY_TS: {
+        HistTsEntryWithAuthor *data = (HistTsEntryWithAuthor *) (entry->data);
+        // TODO This memcpies are here to avoid unaligned memory access crash.
+        // There's probably a more efficient way to do it
+        log_hash_t hash;
+        memcpy(&hash, &(data->hash), sizeof(hash));
+        int64_t ts;
+        memcpy(&ts, &data->ts, sizeof(ts));
+        // TODO: hash for histogram ts and audio state need to match
+        // and correspond to audio production source file location
+        mThreadPerformanceAnalysis[data->author][0 /*hash*/].logTsEntry(ts);
+        break;
+    }
+    case EVENT_AUDIO_STATE: {
+        HistTsEntryWithAuthor *data = (HistTsEntryWithAuthor *) (entry->data);
+        // TODO This memcpies are here to avoid unaligned memory access crash.
+        // There's probably a more efficient way to do it
+        log_hash_t hash;
+        memcpy(&hash, &(data->hash), sizeof(hash));
+        // TODO: remove ts if unused
+        int64_t ts;
+        memcpy(&ts, &data->ts, sizeof(ts));
+        mThreadPerformanceAnalysis[data->author][0 /*hash*/].handleStateChange();
+        break;
+    }
+    case EVENT_END_FMT:
+        body->appendFormat("warning: got to end format event");
+        break;
+    case EVENT_RESERVED:
+    default:
+        body->appendFormat("warning: unexpected event %d", entry->type);
+        break;
+    }
+    return entry.next();
 }
 
 void NBLog::MergeReader::getAndProcessSnapshot()
@@ -865,9 +882,27 @@ void NBLog::MergeReader::getAndProcessSnapshot()
     getAndProcessSnapshot(*snap);
 }
 
-void NBLog::MergeReader::dump(int fd, int indent) {
+void NBLog::MergeReader::dump(int fd, int indent, const char *directory) {
     // TODO: add a mutex around media.log dump
-    ReportPerformance::dump(fd, indent, mThreadPerformanceAnalysis);
+    ReportPerformance::dump(fd, indent, mThreadPerformanceAnalysis, directory);
+}
+
+void NBLog::MergeReader::dumpRaw(int fd) {
+    String8 header;
+    const uint32_t fields[] = {kRawMagic, kRawVersion, (uint32_t) mNamedReaders.size()};
+    header.append((const char *) fields, sizeof(fields));
+    // FIXME Needs a lock, see mNamedReaders
+    for (const auto &namedReader : mNamedReaders) {
+        const uint32_t length = strlen(namedReader.name());
+        header.append((const char *) &length, sizeof(length));
+        header.append(namedReader.name(), length);
+    }
+    write(fd, header.string(), header.size());
+
+    Mutex::Autolock _l(mRawLock);
+    for (const auto &raw : mRawSnapshots) {
+        write(fd, raw.data(), raw.size());
+    }
 }
 
 // Writes a string to the console
@@ -1099,17 +1134,86 @@ const std::vector<NBLog::NamedReader>& NBLog::Merger::getNamedReaders() const {
 // ---------------------------------------------------------------------------
 
 NBLog::MergeReader::MergeReader(const void *shared, size_t size, Merger &merger)
-    : Reader(shared, size), mNamedReaders(merger.getNamedReaders()) {}
+    : Reader(shared, size), mNamedReaders(merger.getNamedReaders()), mRawSize(0) {}
 
 void NBLog::MergeReader::handleAuthor(const NBLog::AbstractEntry &entry, String8 *body) {
     int author = entry.author();
     // FIXME Needs a lock
+    if (author < 0 || (size_t) author >= mNamedReaders.size()) {
+        body->appendFormat("author %d: ", author);
+        return;
+    }
     const char* name = mNamedReaders[author].name();
     body->appendFormat("%s: ", name);
 }
 
 // ---------------------------------------------------------------------------
 
+NBLog::Replay::Replay(NBLog::Merger &merger, int fd, int indent)
+    : MergeReader(NULL, 0, merger), mMerger(merger) {
+    mFd = fd;
+    mIndent = indent;
+}
+
+bool NBLog::Replay::replay(const uint8_t *data, size_t size) {
+    const uint8_t *ptr = data;
+    const uint8_t *end = data + size;
+    auto readU32 = [&ptr, end](uint32_t *value) {
+        if ((size_t) (end - ptr) < sizeof(*value)) {
+            return false;
+        }
+        memcpy(value, ptr, sizeof(*value));
+        ptr += sizeof(*value);
+        return true;
+    };
+
+    uint32_t magic, version, authors;
+    if (!readU32(&magic) || magic != kRawMagic || !readU32(&version) || version != kRawVersion
+            || !readU32(&authors)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < authors; ++i) {
+        uint32_t length;
+        if (!readU32(&length) || (size_t) (end - ptr) < length) {
+            return false;
+        }
+        std::string name((const char *) ptr, length);
+        ptr += length;
+        mMerger.addReader(NamedReader(NULL, name.c_str()));
+    }
+
+    // Only process whole entries, up to the last one that can end a sequence,
+    // as Reader::getSnapshot() does for a live FIFO.
+    const uint8_t *last = ptr;
+    for (const uint8_t *entry = ptr; (size_t) (end - entry) >= Entry::kOverhead; ) {
+        const size_t length = entry[offsetof(NBLog::entry, length)];
+        if ((size_t) (end - entry) < length + Entry::kOverhead
+                || !EntryIterator(entry).hasConsistentLength()) {
+            ALOGW("NBLog Replay: truncated or inconsistent entry at offset %zu",
+                    (size_t) (entry - data));
+            break;
+        }
+        const Event type = (Event) entry[offsetof(NBLog::entry, type)];
+        entry += length + Entry::kOverhead;
+        if (type == EVENT_END_FMT || type == EVENT_HISTOGRAM_ENTRY_TS
+                || type == EVENT_AUDIO_STATE) {
+            last = entry;
+        }
+    }
+
+    // unlike the periodic merge, print each format entry on its own line
+    String8 timestamp, body;
+    for (EntryIterator entry(ptr), stop(last); entry != stop; ) {
+        entry = handleEntry(entry, &timestamp, &body);
+        if (!body.isEmpty()) {
+            dumpLine(timestamp, body);
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+
 NBLog::MergeThread::MergeThread(NBLog::Merger &merger, NBLog::MergeReader &mergeReader)
     : mMerger(merger),
       mMergeReader(mergeReader),
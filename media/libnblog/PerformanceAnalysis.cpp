@@ -348,9 +348,9 @@ void PerformanceAnalysis::reportPerformance(String8 *body, int author, log_hash_
 //------------------------------------------------------------------------------
 
 // writes summary of performance into specified file descriptor
-void dump(int fd, int indent, PerformanceAnalysisMap &threadPerformanceAnalysis) {
+void dump(int fd, int indent, PerformanceAnalysisMap &threadPerformanceAnalysis,
+          const char *directory) {
     String8 body;
-    const char* const kDirectory = "/data/misc/audioserver/";
     for (auto & thread : threadPerformanceAnalysis) {
         for (auto & hash: thread.second) {
             PerformanceAnalysis& curr = hash.second;
@@ -361,8 +361,10 @@ void dump(int fd, int indent, PerformanceAnalysisMap &threadPerformanceAnalysis)
                 body.clear();
             }
             // write to file
-            writeToFile(curr.mHists, curr.mOutlierData, curr.mPeakTimestamps,
-                        kDirectory, false, thread.first, hash.first);
+            if (directory != NULL) {
+                writeToFile(curr.mHists, curr.mOutlierData, curr.mPeakTimestamps,
+                            directory, false, thread.first, hash.first);
+            }
         }
     }
 }
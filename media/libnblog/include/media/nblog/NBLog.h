@@ -536,12 +536,31 @@ public:
     public:
         MergeReader(const void *shared, size_t size, Merger &merger);
 
-        void dump(int fd, int indent = 0);
+        // prints the performance analysis, and writes it to files in directory unless NULL
+        void dump(int fd, int indent = 0,
+                  const char *directory = ReportPerformance::kDefaultDirectory);
         // process a particular snapshot of the reader
         void getAndProcessSnapshot(Snapshot & snap);
         // call getSnapshot of the content of the reader's buffer and process the data
         void getAndProcessSnapshot();
 
+        // Writes the author names and the most recently processed entries, as they were
+        // merged, so that they can be archived and replayed offline, see Replay.
+        // Format, in host byte order:
+        //    uint32_t kRawMagic, uint32_t kRawVersion, uint32_t number of authors
+        //    for each author: uint32_t name length, name (not NUL-terminated)
+        //    entries until the end of the file
+        void dumpRaw(int fd);
+
+        static const uint32_t kRawMagic = 0x4e424c52; // 'NBLR'
+        static const uint32_t kRawVersion = 1;
+
+    protected:
+        // processes a single entry, format entries are appended to body
+        // returns iterator to the next entry
+        EntryIterator   handleEntry(const EntryIterator &entry, String8 *timestamp,
+                                    String8 *body);
+
     private:
         // FIXME Needs to be protected by a lock,
         //       because even though our use of it is read-only there may be asynchronous updates
@@ -552,11 +571,36 @@ public:
         // location within each author
         ReportPerformance::PerformanceAnalysisMap mThreadPerformanceAnalysis;
 
+        // entries of the most recent snapshots, oldest first, for dumpRaw().
+        // Keeping the raw entries is cheap compared to the analysis, which can then be
+        // done offline on as much history as was archived.
+        Mutex                               mRawLock;
+        std::deque<std::vector<uint8_t>>    mRawSnapshots;  // protected by mRawLock
+        size_t                              mRawSize;       // protected by mRawLock
+        static const size_t kMaxRawSize = 256 * 1024;
+
         // handle author entry by looking up the author's name and appending it to the body
         // returns number of bytes read from fmtEntry
         void handleAuthor(const AbstractEntry &fmtEntry, String8 *body);
     };
 
+    // Replays a log written by MergeReader::dumpRaw(), e.g. archived from a device with
+    // "dumpsys media.log --raw", through the same analysis as media.log, offline.
+    class Replay : public MergeReader {
+    public:
+        // author names found in the log are added to merger, which needs no shared memory
+        Replay(Merger &merger, int fd, int indent = 0);
+        virtual ~Replay() {}
+
+        // Prints the format entries and analyzes the timestamps of a raw log.
+        // A truncated or corrupted log is processed up to the last complete entry.
+        // Returns false if data is not a raw log.
+        bool replay(const uint8_t *data, size_t size);
+
+    private:
+        Merger&     mMerger;
+    };
+
     // MergeThread is a thread that contains a Merger. It works as a retriggerable one-shot:
     // when triggered, it awakes for a lapse of time, during which it periodically merges; if
     // retriggered, the timeout is reset.
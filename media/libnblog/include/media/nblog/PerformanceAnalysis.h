@@ -43,7 +43,7 @@ public:
     PerformanceAnalysis() {};
 
     friend void dump(int fd, int indent,
-                     PerformanceAnalysisMap &threadPerformanceAnalysis);
+                     PerformanceAnalysisMap &threadPerformanceAnalysis, const char *directory);
 
     // Called in the case of an audio on/off event, e.g., EVENT_AUDIO_STATE.
     // Used to discard idle time intervals
@@ -116,7 +116,9 @@ private:
     } mOutlierDistribution;
 };
 
-void dump(int fd, int indent, PerformanceAnalysisMap &threadPerformanceAnalysis);
+// writes the analysis files to directory unless it is NULL
+void dump(int fd, int indent, PerformanceAnalysisMap &threadPerformanceAnalysis,
+          const char *directory);
 void dumpLine(int fd, int indent, const String8 &body);
 
 } // namespace ReportPerformance
@@ -31,6 +31,9 @@ namespace ReportPerformance {
 constexpr int kMsPerSec = 1000;
 constexpr int kSecPerMin = 60;
 
+// where media.log writes the analysis files
+constexpr char kDefaultDirectory[] = "/data/misc/audioserver/";
+
 constexpr int kJiffyPerMs = 10; // time unit for histogram as a multiple of milliseconds
 
 // stores a histogram: key: observed buffer period (multiple of jiffy). value: count
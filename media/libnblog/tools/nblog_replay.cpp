@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays raw media.log dumps through PerformanceAnalysis, offline.
+//
+// On the device:
+//   adb exec-out dumpsys media.log --raw > nblog.raw
+// then:
+//   nblog_replay [-q] [-o directory] nblog.raw ...
+//
+// Prints the logged format entries (unless -q), then the buffer period histograms and
+// the glitch timeline of each thread. With -o, the histograms, outliers and peaks are
+// also written to csv files in the directory, as media.log does on the device.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <media/nblog/NBLog.h>
+
+using namespace android;
+
+static bool readFile(const char *path, std::vector<uint8_t> *data) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // the size is only a hint, so that pipes can be read too
+    struct stat st;
+    data->resize(fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size : 64 * 1024);
+    size_t done = 0;
+    ssize_t n;
+    while ((n = read(fd, data->data() + done, data->size() - done)) > 0) {
+        done += n;
+        if (done == data->size()) {
+            data->resize(done * 2);
+        }
+    }
+    data->resize(done);
+    close(fd);
+    return n == 0;
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-q] [-o directory] file ...\n", name);
+    fprintf(stderr, "    -q            do not print the format entries\n");
+    fprintf(stderr, "    -o directory  also write the analysis to csv files in directory\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    bool quiet = false;
+    std::string directory;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "qo:")) != -1) {
+        switch (ch) {
+        case 'q':
+            quiet = true;
+            break;
+        case 'o':
+            directory = optarg;
+            if (!directory.empty() && directory.back() != '/') {
+                directory += '/';
+            }
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        return usage(argv[0]);
+    }
+
+    int entriesFd = quiet ? open("/dev/null", O_WRONLY) : STDOUT_FILENO;
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        std::vector<uint8_t> data;
+        if (!readFile(argv[i], &data)) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        // each dump has its own author names, so it is analyzed on its own
+        NBLog::Merger merger(NULL, 0);
+        NBLog::Replay replay(merger, entriesFd);
+        printf("%s:\n", argv[i]);
+        fflush(stdout);
+        if (!replay.replay(data.data(), data.size())) {
+            fprintf(stderr, "%s: not a raw media.log dump\n", argv[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        replay.dump(STDOUT_FILENO, 0, directory.empty() ? NULL : directory.c_str());
+    }
+    if (quiet) {
+        close(entriesFd);
+    }
+    return status;
+}
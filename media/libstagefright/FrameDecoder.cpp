@@ -20,12 +20,14 @@
 #include "include/FrameDecoder.h"
 #include <binder/MemoryBase.h>
 #include <binder/MemoryHeapBase.h>
+#include <cutils/properties.h>
 #include <gui/Surface.h>
 #include <inttypes.h>
 #include <media/ICrypto.h>
 #include <media/IMediaSource.h>
 #include <media/MediaCodecBuffer.h>
 #include <media/stagefright/foundation/avc_utils.h>
+#include <media/stagefright/foundation/ABuffer.h>
 #include <media/stagefright/foundation/ADebug.h>
 #include <media/stagefright/foundation/AMessage.h>
 #include <media/stagefright/ColorConverter.h>
@@ -36,11 +38,15 @@
 #include <media/stagefright/Utils.h>
 #include <private/media/VideoFrame.h>
 #include <utils/Log.h>
+#include <utils/Thread.h>
+
+#include <algorithm>
 
 namespace android {
 
 static const int64_t kBufferTimeOutUs = 10000ll; // 10 msec
 static const size_t kRetryCount = 50; // must be >0
+static const int32_t kMaxTileDecoders = 8;
 
 sp<IMemory> allocVideoFrame(const sp<MetaData>& trackMeta,
         int32_t width, int32_t height, int32_t tileWidth, int32_t tileHeight,
@@ -559,7 +565,16 @@ ImageDecoder::ImageDecoder(
       mTileWidth(0),
       mTileHeight(0),
       mTilesDecoded(0),
-      mTargetTiles(0) {
+      mTargetTiles(0),
+      mSliceMode(false),
+      mNumDecoders(1),
+      mDecodeTilesInParallel(false) {
+    mNumDecoders = property_get_int32("media.stagefright.heif.decoders", 1);
+    if (mNumDecoders < 1) {
+        mNumDecoders = 1;
+    } else if (mNumDecoders > kMaxTileDecoders) {
+        mNumDecoders = kMaxTileDecoders;
+    }
 }
 
 sp<AMessage> ImageDecoder::onGetFormatAndSeekOptions(
@@ -632,6 +647,7 @@ sp<AMessage> ImageDecoder::onGetFormatAndSeekOptions(
         videoFormat->setInt32("android._num-input-buffers", 1);
         videoFormat->setInt32("android._num-output-buffers", 1);
     }
+    mVideoFormat = videoFormat;
     return videoFormat;
 }
 
@@ -650,6 +666,7 @@ status_t ImageDecoder::onExtractRect(FrameRect *rect) {
             return ERROR_UNSUPPORTED;
         }
         mTargetTiles = mGridRows * mGridCols;
+        mDecodeTilesInParallel = (mNumDecoders > 1 && mTargetTiles > 1);
         return OK;
     }
 
@@ -671,6 +688,7 @@ status_t ImageDecoder::onExtractRect(FrameRect *rect) {
 
     // advance one row
     mTargetTiles = mTilesDecoded + mGridCols;
+    mSliceMode = true;
     return OK;
 }
 
@@ -681,28 +699,48 @@ status_t ImageDecoder::onOutputReceived(
         return ERROR_MALFORMED;
     }
 
-    int32_t width, height;
-    CHECK(outputFormat->findInt32("width", &width));
-    CHECK(outputFormat->findInt32("height", &height));
-
     if (mFrame == NULL) {
         sp<IMemory> frameMem = allocVideoFrame(
-                trackMeta(), mWidth, mHeight, mTileWidth, mTileHeight, dstBpp());
+                trackMeta(), mWidth, mSliceMode ? mTileHeight : mHeight,
+                mTileWidth, mTileHeight, dstBpp());
         mFrame = static_cast<VideoFrame*>(frameMem->pointer());
 
         addFrame(frameMem);
     }
 
+    FrameRect region = {0, 0, mWidth, mHeight};
+    if (mSliceMode) {
+        region.top = mTilesDecoded / mGridCols * mTileHeight;
+        region.bottom = std::min(region.top + mTileHeight, mHeight);
+    }
+    status_t err = convertTile(videoFrameBuffer, outputFormat, mTilesDecoded, region);
+
+    *done = (++mTilesDecoded >= mTargetTiles);
+
+    return err;
+}
+
+status_t ImageDecoder::convertTile(
+        const sp<MediaCodecBuffer> &tileBuffer,
+        const sp<AMessage> &outputFormat,
+        int32_t tileIndex, const FrameRect &region) {
+    if (outputFormat == NULL) {
+        return ERROR_MALFORMED;
+    }
+
+    int32_t width, height;
+    CHECK(outputFormat->findInt32("width", &width));
+    CHECK(outputFormat->findInt32("height", &height));
+
     int32_t srcFormat;
     CHECK(outputFormat->findInt32("color-format", &srcFormat));
 
     ColorConverter converter((OMX_COLOR_FORMATTYPE)srcFormat, dstFormat());
-
-    int32_t dstLeft, dstTop, dstRight, dstBottom;
-    dstLeft = mTilesDecoded % mGridCols * width;
-    dstTop = mTilesDecoded / mGridCols * height;
-    dstRight = dstLeft + width - 1;
-    dstBottom = dstTop + height - 1;
+    if (!converter.isValid()) {
+        ALOGE("Unable to convert from format 0x%08x to 0x%08x",
+                srcFormat, dstFormat());
+        return ERROR_UNSUPPORTED;
+    }
 
     int32_t crop_left, crop_top, crop_right, crop_bottom;
     if (!outputFormat->findRect("crop", &crop_left, &crop_top, &crop_right, &crop_bottom)) {
@@ -711,34 +749,321 @@ status_t ImageDecoder::onOutputReceived(
         crop_bottom = height - 1;
     }
 
-    // apply crop on bottom-right
-    // TODO: need to move this into the color converter itself.
-    if (dstRight >= mWidth) {
-        crop_right = mWidth - dstLeft - 1;
-        dstRight = dstLeft + crop_right;
+    // A picture without grid is a single tile.
+    int32_t tileWidth = (mTileWidth > 0) ? mTileWidth : width;
+    int32_t tileHeight = (mTileHeight > 0) ? mTileHeight : height;
+    int32_t tileLeft = tileIndex % mGridCols * tileWidth;
+    int32_t tileTop = tileIndex / mGridCols * tileHeight;
+
+    // Part of the tile within the region, in picture coordinates.
+    int32_t left = std::max(tileLeft, region.left);
+    int32_t top = std::max(tileTop, region.top);
+    int32_t right = std::min(
+            tileLeft + crop_right - crop_left + 1, std::min(region.right, mWidth));
+    int32_t bottom = std::min(
+            tileTop + crop_bottom - crop_top + 1, std::min(region.bottom, mHeight));
+    if (left >= right || top >= bottom) {
+        return OK;
     }
-    if (dstBottom >= mHeight) {
-        crop_bottom = mHeight - dstTop - 1;
-        dstBottom = dstTop + crop_bottom;
+
+    converter.convert(
+            (const uint8_t *)tileBuffer->data(),
+            width, height,
+            crop_left + left - tileLeft, crop_top + top - tileTop,
+            crop_left + right - tileLeft - 1, crop_top + bottom - tileTop - 1,
+            mFrame->getFlattenedData(),
+            mFrame->mWidth,
+            mFrame->mHeight,
+            left - region.left, top - region.top,
+            right - region.left - 1, bottom - region.top - 1);
+    return OK;
+}
+
+status_t ImageDecoder::extractInternal() {
+    if (!mDecodeTilesInParallel) {
+        return FrameDecoder::extractInternal();
     }
 
-    *done = (++mTilesDecoded >= mTargetTiles);
+    FrameRect picture = {0, 0, mWidth, mHeight};
+    sp<IMemory> frameMem;
+    return decodeTiles(picture, &frameMem);
+}
 
-    if (converter.isValid()) {
-        converter.convert(
-                (const uint8_t *)videoFrameBuffer->data(),
-                width, height,
-                crop_left, crop_top, crop_right, crop_bottom,
-                mFrame->getFlattenedData(),
-                mFrame->mWidth,
-                mFrame->mHeight,
-                dstLeft, dstTop, dstRight, dstBottom);
-        return OK;
+sp<IMemory> ImageDecoder::extractRegion(const FrameRect &region) {
+    FrameRect roi = region;
+    // the color converters need an even horizontal offset in the tiles
+    roi.left &= ~1;
+
+    if (roi.left < 0 || roi.top < 0
+            || roi.right > mWidth || roi.bottom > mHeight
+            || roi.left >= roi.right || roi.top >= roi.bottom) {
+        ALOGE("bad region {%d, %d, %d, %d} for picture size %dx%d",
+                region.left, region.top, region.right, region.bottom,
+                mWidth, mHeight);
+        return NULL;
     }
 
-    ALOGE("Unable to convert from format 0x%08x to 0x%08x",
-                srcFormat, dstFormat());
-    return ERROR_UNSUPPORTED;
+    sp<IMemory> frameMem;
+    if (decodeTiles(roi, &frameMem) != OK) {
+        return NULL;
+    }
+    return frameMem;
+}
+
+struct ImageDecoder::TileInput {
+    int32_t mIndex;
+    sp<ABuffer> mData;
+};
+
+// Feeds a share of the tiles to one codec instance and converts its outputs
+// into the frame. The first one runs on the calling thread, the others on
+// their own, the tiles they write to are disjoint.
+struct ImageDecoder::TileDecoder : public Thread {
+    TileDecoder(ImageDecoder *owner, const sp<MediaCodec> &codec,
+            const sp<ALooper> &looper, const FrameRect &region)
+        : Thread(false /* canCallJava */),
+          mOwner(owner),
+          mCodec(codec),
+          mLooper(looper),
+          mRegion(region),
+          mStatus(OK) {
+    }
+
+    void addTile(const TileInput &tile) {
+        mTiles.push_back(tile);
+    }
+
+    status_t decode();
+
+    // Decodes on a thread of its own, or right away if it can't be started.
+    void start() {
+        if (run("ImageTileDecoder", ANDROID_PRIORITY_FOREGROUND) != OK) {
+            mStatus = decode();
+        }
+    }
+
+    status_t status() const {
+        return mStatus;
+    }
+
+protected:
+    virtual ~TileDecoder() {
+        // the first decoder is owned by FrameDecoder
+        if (mLooper != NULL) {
+            mCodec->release();
+            mLooper->stop();
+        }
+    }
+
+private:
+    ImageDecoder *mOwner;
+    sp<MediaCodec> mCodec;
+    sp<ALooper> mLooper;
+    FrameRect mRegion;
+    std::vector<TileInput> mTiles;
+    status_t mStatus;
+
+    virtual bool threadLoop() {
+        mStatus = decode();
+        return false;
+    }
+
+    DISALLOW_EVIL_CONSTRUCTORS(TileDecoder);
+};
+
+status_t ImageDecoder::TileDecoder::decode() {
+    size_t numQueued = 0;
+    size_t numDecoded = 0;
+    bool eosQueued = false;
+    size_t retriesLeft = kRetryCount;
+    sp<AMessage> outputFormat;
+
+    while (numDecoded < mTiles.size()) {
+        // Tiles are independent pictures, queue as many as the codec takes.
+        while (!eosQueued) {
+            size_t index;
+            if (mCodec->dequeueInputBuffer(&index, 0) != OK) {
+                break;
+            }
+
+            if (numQueued == mTiles.size()) {
+                (void)mCodec->queueInputBuffer(
+                        index, 0, 0, 0, MediaCodec::BUFFER_FLAG_EOS);
+                eosQueued = true;
+                break;
+            }
+
+            sp<MediaCodecBuffer> codecBuffer;
+            status_t err = mCodec->getInputBuffer(index, &codecBuffer);
+            if (err != OK) {
+                ALOGE("failed to get input buffer %zu", index);
+                return err;
+            }
+
+            const TileInput &tile = mTiles[numQueued++];
+            if (tile.mData->size() > codecBuffer->capacity()) {
+                ALOGE("buffer size (%zu) too large for codec input size (%zu)",
+                        tile.mData->size(), codecBuffer->capacity());
+                return BAD_VALUE;
+            }
+            memcpy(codecBuffer->data(), tile.mData->data(), tile.mData->size());
+            codecBuffer->setRange(0, tile.mData->size());
+
+            // the tile index is carried as timestamp to place the output
+            err = mCodec->queueInputBuffer(
+                    index, 0, tile.mData->size(), tile.mIndex, 0);
+            if (err != OK) {
+                return err;
+            }
+        }
+
+        size_t index, offset, size;
+        int64_t ptsUs;
+        uint32_t flags;
+        status_t err = mCodec->dequeueOutputBuffer(
+                &index, &offset, &size, &ptsUs, &flags, kBufferTimeOutUs);
+
+        if (err == INFO_FORMAT_CHANGED) {
+            err = mCodec->getOutputFormat(&outputFormat);
+        } else if (err == INFO_OUTPUT_BUFFERS_CHANGED) {
+            err = OK;
+        } else if (err == -EAGAIN /* INFO_TRY_AGAIN_LATER */ && --retriesLeft > 0) {
+            err = OK;
+        } else if (err == OK) {
+            if (size == 0 && (flags & MediaCodec::BUFFER_FLAG_EOS)) {
+                ALOGE("decoder output %zu of %zu tiles", numDecoded, mTiles.size());
+                mCodec->releaseOutputBuffer(index);
+                return ERROR_MALFORMED;
+            }
+
+            sp<MediaCodecBuffer> tileBuffer;
+            err = mCodec->getOutputBuffer(index, &tileBuffer);
+            if (err == OK) {
+                err = mOwner->convertTile(
+                        tileBuffer, outputFormat, (int32_t)ptsUs, mRegion);
+            }
+            mCodec->releaseOutputBuffer(index);
+            ++numDecoded;
+        }
+
+        if (err != OK) {
+            ALOGW("tile decoding failed w/ error %d (%s)", err, asString(err));
+            return err;
+        }
+    }
+
+    return OK;
+}
+
+status_t ImageDecoder::decodeTiles(const FrameRect &region, sp<IMemory> *frameMem) {
+    if (mTilesDecoded > 0) {
+        // the image track can't seek back to the first tile
+        return ERROR_UNSUPPORTED;
+    }
+
+    int32_t tileWidth = (mTileWidth > 0) ? mTileWidth : mWidth;
+    int32_t tileHeight = (mTileHeight > 0) ? mTileHeight : mHeight;
+    int32_t firstCol = region.left / tileWidth;
+    int32_t lastCol = (region.right - 1) / tileWidth;
+    int32_t firstRow = region.top / tileHeight;
+    int32_t lastRow = (region.bottom - 1) / tileHeight;
+    int32_t lastTile = lastRow * mGridCols + lastCol;
+
+    // Tiles can only be read in raster order, read up to the last one needed
+    // and keep those intersecting the region.
+    std::vector<TileInput> tiles;
+    for (int32_t i = 0; i <= lastTile; i++) {
+        MediaBufferBase *mediaBuffer = NULL;
+        status_t err = source()->read(&mediaBuffer, readOptions());
+        readOptions()->clearSeekTo();
+        if (err != OK) {
+            ALOGW("failed to read tile %d: err=%d", i, err);
+            return err;
+        }
+
+        int32_t row = i / mGridCols;
+        int32_t col = i % mGridCols;
+        if (row >= firstRow && col >= firstCol && col <= lastCol) {
+            TileInput tile;
+            tile.mIndex = i;
+            tile.mData = new ABuffer(mediaBuffer->range_length());
+            memcpy(tile.mData->data(),
+                    (const uint8_t*)mediaBuffer->data() + mediaBuffer->range_offset(),
+                    mediaBuffer->range_length());
+            tiles.push_back(tile);
+        }
+        mediaBuffer->release();
+    }
+    mTilesDecoded = lastTile + 1;
+
+    if (region.left == 0 && region.top == 0
+            && region.right == mWidth && region.bottom == mHeight) {
+        *frameMem = allocVideoFrame(
+                trackMeta(), mWidth, mHeight, mTileWidth, mTileHeight, dstBpp());
+    } else {
+        sp<MetaData> regionMeta = new MetaData(*(trackMeta()));
+        regionMeta->remove(kKeySARWidth);
+        regionMeta->remove(kKeySARHeight);
+        regionMeta->remove(kKeyDisplayWidth);
+        regionMeta->remove(kKeyDisplayHeight);
+        *frameMem = allocVideoFrame(
+                regionMeta, region.right - region.left, region.bottom - region.top,
+                0, 0, dstBpp());
+    }
+    if (*frameMem == NULL) {
+        return NO_MEMORY;
+    }
+    mFrame = static_cast<VideoFrame*>((*frameMem)->pointer());
+    addFrame(*frameMem);
+
+    // The decoder from init() takes the first share, more instances are
+    // created as long as the component allows.
+    size_t numDecoders = std::min((size_t)mNumDecoders, tiles.size());
+    std::vector<sp<TileDecoder> > tileDecoders;
+    tileDecoders.push_back(new TileDecoder(this, decoder(), NULL, region));
+    while (tileDecoders.size() < numDecoders) {
+        status_t err;
+        sp<ALooper> looper = new ALooper;
+        looper->start();
+        sp<MediaCodec> codec = MediaCodec::CreateByComponentName(
+                looper, componentName(), &err);
+        if (codec == NULL || err != OK) {
+            looper->stop();
+            break;
+        }
+        err = codec->configure(
+                mVideoFormat->dup(), NULL /* surface */, NULL /* crypto */, 0 /* flags */);
+        if (err == OK) {
+            err = codec->start();
+        }
+        if (err != OK) {
+            codec->release();
+            looper->stop();
+            break;
+        }
+        tileDecoders.push_back(new TileDecoder(this, codec, looper, region));
+    }
+    ALOGV("decoding %zu tiles of region {%d, %d, %d, %d} on %zu decoders",
+            tiles.size(), region.left, region.top, region.right, region.bottom,
+            tileDecoders.size());
+
+    for (size_t i = 0; i < tiles.size(); i++) {
+        tileDecoders[i % tileDecoders.size()]->addTile(tiles[i]);
+    }
+    tiles.clear();
+
+    for (size_t i = 1; i < tileDecoders.size(); i++) {
+        tileDecoders[i]->start();
+    }
+    status_t err = tileDecoders[0]->decode();
+    for (size_t i = 1; i < tileDecoders.size(); i++) {
+        tileDecoders[i]->join();
+        if (err == OK) {
+            err = tileDecoders[i]->status();
+        }
+    }
+
+    return err;
 }
 
 }  // namespace android
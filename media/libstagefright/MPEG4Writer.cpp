@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
@@ -86,6 +87,8 @@ static const int kTimestampDebugCount = 10;
 static const int kItemIdBase = 10000;
 static const char kExifHeader[] = {'E', 'x', 'i', 'f', '\0', '\0'};
 static const int32_t kTiffHeaderOffset = htonl(sizeof(kExifHeader));
+// sample data that can be queued for writing, see media.recorder.mp4-io-budget-kb
+static const int32_t kDefaultIoBudgetKb = 8 * 1024;
 
 static const uint8_t kMandatoryHevcNalUnitTypes[3] = {
     kHevcNalUnitTypeVps,
@@ -507,6 +510,17 @@ void MPEG4Writer::initInternal(int fd, bool isFirstSession) {
     mAssociationEntryCount = 0;
     mNumGrids = 0;
     mHasRefs = false;
+    mStaged = WriteBatch();
+    mIoBudgetBytes = std::max(0, property_get_int32(
+            "media.recorder.mp4-io-budget-kb", kDefaultIoBudgetKb)) * 1024ll;
+    mIoQueuedBytes = 0;
+    mIoDone = false;
+    mIoThreadStarted = false;
+    for (size_t i = 0; i < kNumWriteLatencyBuckets; ++i) {
+        mWriteLatencyHistogram[i] = 0;
+    }
+    mMaxWriteLatencyUs = 0;
+    mWriteBytes = 0;
 
     // Following variables only need to be set for the first recording session.
     // And they will stay the same for all the recording sessions.
@@ -543,6 +557,17 @@ status_t MPEG4Writer::dump(
     result.append(buffer);
     snprintf(buffer, SIZE, "     mStarted: %s\n", mStarted? "true": "false");
     result.append(buffer);
+    snprintf(buffer, SIZE, "     sample data written: %" PRId64 " bytes, max latency %" PRId64
+            " us\n", mWriteBytes.load(), mMaxWriteLatencyUs.load());
+    result.append(buffer);
+    result.append("     write latency (ms):");
+    for (size_t i = 0; i < kNumWriteLatencyBuckets; ++i) {
+        snprintf(buffer, SIZE, " %s%d: %u", i + 1 < kNumWriteLatencyBuckets ? "<" : ">=",
+                1 << (i + 1 < kNumWriteLatencyBuckets ? i : i - 1),
+                mWriteLatencyHistogram[i].load());
+        result.append(buffer);
+    }
+    result.append("\n");
     ::write(fd, result.string(), result.size());
     for (List<Track *>::iterator it = mTracks.begin();
          it != mTracks.end(); ++it) {
@@ -980,6 +1005,9 @@ void MPEG4Writer::stopWriterThread() {
     pthread_join(mThread, &dummy);
     mWriterThreadStarted = false;
     ALOGD("Writer thread stopped");
+
+    // the remaining sample data must be in the file before the headers are written
+    stopIoThread();
 }
 
 /*
@@ -1364,11 +1392,11 @@ off64_t MPEG4Writer::addSample_l(
         addMultipleLengthPrefixedSamples_l(buffer);
     } else {
         if (isExif) {
-            ::write(mFd, &kTiffHeaderOffset, 4); // exif_tiff_header_offset field
+            stageSamplePrefix_l(&kTiffHeaderOffset, 4); // exif_tiff_header_offset field
             mOffset += 4;
         }
 
-        ::write(mFd,
+        stageSampleData_l(
               (const uint8_t *)buffer->data() + buffer->range_offset(),
               buffer->range_length());
 
@@ -1421,32 +1449,207 @@ void MPEG4Writer::addLengthPrefixedSample_l(MediaBuffer *buffer) {
     size_t length = buffer->range_length();
 
     if (mUse4ByteNalLength) {
-        uint8_t x = length >> 24;
-        ::write(mFd, &x, 1);
-        x = (length >> 16) & 0xff;
-        ::write(mFd, &x, 1);
-        x = (length >> 8) & 0xff;
-        ::write(mFd, &x, 1);
-        x = length & 0xff;
-        ::write(mFd, &x, 1);
-
-        ::write(mFd,
-              (const uint8_t *)buffer->data() + buffer->range_offset(),
-              length);
-
+        uint8_t prefix[4] = {
+            (uint8_t)(length >> 24), (uint8_t)((length >> 16) & 0xff),
+            (uint8_t)((length >> 8) & 0xff), (uint8_t)(length & 0xff) };
+        stageSamplePrefix_l(prefix, sizeof(prefix));
+        stageSampleData_l((const uint8_t *)buffer->data() + buffer->range_offset(), length);
         mOffset += length + 4;
     } else {
         CHECK_LT(length, 65536u);
 
-        uint8_t x = length >> 8;
-        ::write(mFd, &x, 1);
-        x = length & 0xff;
-        ::write(mFd, &x, 1);
-        ::write(mFd, (const uint8_t *)buffer->data() + buffer->range_offset(), length);
+        uint8_t prefix[2] = { (uint8_t)(length >> 8), (uint8_t)(length & 0xff) };
+        stageSamplePrefix_l(prefix, sizeof(prefix));
+        stageSampleData_l((const uint8_t *)buffer->data() + buffer->range_offset(), length);
         mOffset += length + 2;
     }
 }
 
+void MPEG4Writer::stageSampleData_l(const void *data, size_t size) {
+    if (size > 0) {
+        if (mStaged.mData.empty()) {
+            mStaged.mOffset = mOffset;
+        }
+        mStaged.mData.push_back({(const uint8_t *)data, 0, size});
+        mStaged.mSize += size;
+    }
+}
+
+void MPEG4Writer::stageSamplePrefix_l(const void *prefix, size_t size) {
+    // consecutive prefixes, e.g. the exif header offset, are merged
+    if (mStaged.mData.empty()) {
+        mStaged.mOffset = mOffset;
+    }
+    if (!mStaged.mData.empty() && mStaged.mData.back().mData == NULL) {
+        mStaged.mData.back().mSize += size;
+    } else {
+        mStaged.mData.push_back({NULL, mStaged.mPrefixes.size(), size});
+    }
+    const uint8_t *bytes = (const uint8_t *)prefix;
+    mStaged.mPrefixes.insert(mStaged.mPrefixes.end(), bytes, bytes + size);
+    mStaged.mSize += size;
+}
+
+void MPEG4Writer::flushSamples_l(List<MediaBuffer *> *buffers) {
+    if (mStaged.mData.empty() && (buffers == NULL || buffers->empty())) {
+        return;
+    }
+
+    WriteBatch *batch = new WriteBatch();
+    batch->mFd = mFd;
+    batch->mOffset = mStaged.mOffset;
+    batch->mSize = mStaged.mSize;
+    batch->mData.swap(mStaged.mData);
+    batch->mPrefixes.swap(mStaged.mPrefixes);
+    if (buffers != NULL) {
+        for (List<MediaBuffer *>::iterator it = buffers->begin(); it != buffers->end(); ++it) {
+            batch->mBuffers.push_back(*it);
+        }
+        buffers->clear();
+    }
+    mStaged.mSize = 0;
+
+    if (!mIoThreadStarted) {
+        writeBatch(batch);
+        delete batch;
+        return;
+    }
+
+    Mutex::Autolock autolock(mIoLock);
+    // a batch larger than the budget is still queued once everything else is written
+    while (mIoQueuedBytes > 0 && mIoQueuedBytes + batch->mSize > mIoBudgetBytes) {
+        mIoSpaceCondition.wait(mIoLock);
+    }
+    mIoQueue.push_back(batch);
+    mIoQueuedBytes += batch->mSize;
+    mIoQueueCondition.signal();
+}
+
+// Writes the batch with as few pwritev() as possible, instead of one write() per NAL
+// length prefix byte and per NAL unit, then releases its sample buffers.
+void MPEG4Writer::writeBatch(WriteBatch *batch) {
+    std::vector<struct iovec> iovs(batch->mData.size());
+    for (size_t i = 0; i < batch->mData.size(); ++i) {
+        const StagedData &staged = batch->mData[i];
+        iovs[i].iov_base = (void *)(staged.mData != NULL ?
+                staged.mData : &batch->mPrefixes[staged.mPrefixOffset]);
+        iovs[i].iov_len = staged.mSize;
+    }
+
+    const nsecs_t startNs = systemTime();
+    struct iovec *iov = iovs.data();
+    size_t iovCount = iovs.size();
+    off64_t offset = batch->mOffset;
+    while (iovCount > 0) {
+        ssize_t n = ::pwritev64(batch->mFd, iov, std::min(iovCount, (size_t)IOV_MAX), offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            ALOGE("failed to write sample data: %s (%d)", strerror(errno), errno);
+            break;
+        }
+        offset += n;
+        // skip what was written, resuming within a partially written iovec
+        while (iovCount > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovCount;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    const int64_t latencyUs = (systemTime() - startNs) / 1000;
+
+    if (batch->mSize > 0) {
+        size_t bucket = 0;
+        while (bucket + 1 < kNumWriteLatencyBuckets && latencyUs >= (1000ll << bucket)) {
+            ++bucket;
+        }
+        ++mWriteLatencyHistogram[bucket];
+        if (latencyUs > mMaxWriteLatencyUs) {
+            mMaxWriteLatencyUs = latencyUs;
+        }
+        mWriteBytes += batch->mSize;
+    }
+
+    for (List<MediaBuffer *>::iterator it = batch->mBuffers.begin();
+         it != batch->mBuffers.end(); ++it) {
+        (*it)->release();
+        (*it) = NULL;
+    }
+    batch->mBuffers.clear();
+}
+
+// static
+void *MPEG4Writer::IoThreadWrapper(void *me) {
+    MPEG4Writer *writer = static_cast<MPEG4Writer *>(me);
+    writer->ioThreadFunc();
+    return NULL;
+}
+
+void MPEG4Writer::ioThreadFunc() {
+    prctl(PR_SET_NAME, (unsigned long)"MPEG4WriterIO", 0, 0, 0);
+
+    Mutex::Autolock autolock(mIoLock);
+    for (;;) {
+        while (mIoQueue.empty() && !mIoDone) {
+            mIoQueueCondition.wait(mIoLock);
+        }
+        if (mIoQueue.empty()) {
+            break;
+        }
+
+        // only this thread removes batches, and the writer thread only appends
+        WriteBatch *batch = *mIoQueue.begin();
+        mIoLock.unlock();
+        writeBatch(batch);
+        mIoLock.lock();
+
+        mIoQueue.erase(mIoQueue.begin());
+        mIoQueuedBytes -= batch->mSize;
+        delete batch;
+        mIoSpaceCondition.signal();
+    }
+}
+
+status_t MPEG4Writer::startIoThread() {
+    if (mIoBudgetBytes == 0) {
+        ALOGV("Writing sample data synchronously");
+        return OK;
+    }
+
+    mIoDone = false;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    int err = pthread_create(&mIoThread, &attr, IoThreadWrapper, this);
+    pthread_attr_destroy(&attr);
+    // fall back to synchronous writes
+    mIoThreadStarted = (err == 0);
+    ALOGW_IF(err != 0, "cannot start I/O thread: %s", strerror(err));
+    return OK;
+}
+
+void MPEG4Writer::stopIoThread() {
+    if (!mIoThreadStarted) {
+        return;
+    }
+
+    {
+        Mutex::Autolock autolock(mIoLock);
+        mIoDone = true;
+        mIoQueueCondition.signal();
+    }
+
+    void *dummy;
+    pthread_join(mIoThread, &dummy);
+    mIoThreadStarted = false;
+    ALOGD("I/O thread stopped");
+}
+
 size_t MPEG4Writer::write(
         const void *ptr, size_t size, size_t nmemb) {
 
@@ -2234,9 +2437,8 @@ void MPEG4Writer::writeChunkToFile(Chunk* chunk) {
         chunk->mTimeStampUs, chunk->mTrack->getTrackType());
 
     int32_t isFirstSample = true;
-    while (!chunk->mSamples.empty()) {
-        List<MediaBuffer *>::iterator it = chunk->mSamples.begin();
-
+    for (List<MediaBuffer *>::iterator it = chunk->mSamples.begin();
+         it != chunk->mSamples.end(); ++it) {
         int32_t isExif;
         if (!(*it)->meta_data().findInt32(kKeyIsExif, &isExif)) {
             isExif = 0;
@@ -2252,12 +2454,10 @@ void MPEG4Writer::writeChunkToFile(Chunk* chunk) {
             chunk->mTrack->addChunkOffset(offset);
             isFirstSample = false;
         }
-
-        (*it)->release();
-        (*it) = NULL;
-        chunk->mSamples.erase(it);
     }
-    chunk->mSamples.clear();
+
+    // the whole chunk goes out at once, the samples are released after that
+    flushSamples_l(&chunk->mSamples);
 }
 
 void MPEG4Writer::writeAllChunks() {
@@ -2367,6 +2567,8 @@ status_t MPEG4Writer::startWriterThread() {
         mChunkInfos.push_back(info);
     }
 
+    startIoThread();
+
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
@@ -3281,7 +3483,10 @@ status_t MPEG4Writer::Track::threadEntry() {
                     addChunkOffset(offset);
                 }
             }
-            copy->release();
+            // released by the writer once written
+            List<MediaBuffer *> samples;
+            samples.push_back(copy);
+            mOwner->flushSamples_l(&samples);
             copy = NULL;
             continue;
         }
@@ -18,6 +18,7 @@
 #define LOG_TAG "MediaCodecList"
 #include <utils/Log.h>
 
+#include "MediaCodecListCache.h"
 #include "MediaCodecListOverrides.h"
 #include "StagefrightPluginLoader.h"
 
@@ -42,6 +43,7 @@
 #include <cutils/properties.h>
 
 #include <algorithm>
+#include <string>
 
 namespace android {
 
@@ -198,6 +200,29 @@ sp<IMediaCodecList> MediaCodecList::getInstance() {
 MediaCodecList::MediaCodecList(std::vector<MediaCodecListBuilderBase*> builders) {
     mGlobalSettings = new AMessage();
     mCodecInfos.clear();
+
+    // The cache holds the sorted list, as built below.
+    bool useCache = property_get_bool("debug.stagefright.codeclistcache", true);
+    uint64_t inputsChecksum = 0;
+    if (useCache) {
+        // GetBuilders() leaves the OMX builder out if the plugin provides the
+        // input surface, and the plugin may provide no builder.
+        std::string buildersKey;
+        for (MediaCodecListBuilderBase *builder : builders) {
+            buildersKey += builder == &sOmxInfoBuilder ? "omx;"
+                    : builder == nullptr ? "none;" : "plugin;";
+        }
+        inputsChecksum = MediaCodecListCache::ComputeInputsChecksum(
+                MediaCodecsXmlParser::defaultSearchDirs, kProfilingResults,
+                buildersKey.c_str());
+        if (MediaCodecListCache::Load(
+                MediaCodecListCache::kDefaultPath, inputsChecksum,
+                &mGlobalSettings, &mCodecInfos) == OK) {
+            mInitCheck = OK;
+            return;
+        }
+    }
+
     MediaCodecListWriter writer;
     for (MediaCodecListBuilderBase *builder : builders) {
         if (builder == nullptr) {
@@ -223,6 +248,13 @@ MediaCodecList::MediaCodecList(std::vector<MediaCodecListBuilderBase*> builders)
                     return info1->rank() < info2->rank();
                 }
             });
+
+    // Processes that cannot write the cache just keep building the list.
+    if (useCache && mInitCheck == OK) {
+        MediaCodecListCache::Store(
+                MediaCodecListCache::kDefaultPath, inputsChecksum,
+                mGlobalSettings, mCodecInfos);
+    }
 }
 
 MediaCodecList::~MediaCodecList() {
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2018, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "MediaCodecListCache"
+#include <utils/Log.h>
+
+#include "MediaCodecListCache.h"
+
+#include <binder/Parcel.h>
+#include <cutils/properties.h>
+#include <media/stagefright/foundation/AString.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+namespace android {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x434c434d;  // 'MCLC'
+// Bump when the layout or the Parcel form of the codec infos changes.
+constexpr uint32_t kVersion = 1;
+
+// No device has anywhere near that many codecs, anything above is corrupted.
+constexpr int32_t kMaxCodecInfos = 4096;
+
+// Properties the list depends on besides the xml files: the builds the codec
+// services come from, and the ranks the builders give to their codecs.
+const char* const kInputProperties[] = {
+    "ro.build.fingerprint",
+    "ro.vendor.build.fingerprint",
+    "debug.stagefright.omx_default_rank",
+    "debug.stagefright.ccodec",
+};
+
+struct Header {
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint64_t mInputsChecksum;
+    uint64_t mDataChecksum;
+    uint32_t mDataSize;
+    uint32_t mReserved;
+};
+
+// FNV-1a
+constexpr uint64_t kChecksumSeed = 0xcbf29ce484222325ull;
+
+uint64_t updateChecksum(uint64_t checksum, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        checksum ^= bytes[i];
+        checksum *= 0x100000001b3ull;
+    }
+    return checksum;
+}
+
+// Hashes the path and the contents of the file, or only the path if it does
+// not exist, so that adding or removing a file changes the checksum too.
+uint64_t updateChecksumWithFile(uint64_t checksum, const std::string &path) {
+    checksum = updateChecksum(checksum, path.c_str(), path.size() + 1);
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return checksum;
+    }
+    uint8_t buffer[4096];
+    ssize_t n;
+    while ((n = TEMP_FAILURE_RETRY(read(fd, buffer, sizeof(buffer)))) > 0) {
+        checksum = updateChecksum(checksum, buffer, n);
+    }
+    close(fd);
+    return checksum;
+}
+
+bool isCodecsXml(const char *name) {
+    static const char kPrefix[] = "media_codecs";
+    static const char kSuffix[] = ".xml";
+    size_t length = strlen(name);
+    return length >= strlen(kPrefix) + strlen(kSuffix)
+            && !strncmp(name, kPrefix, strlen(kPrefix))
+            && !strcmp(name + length - strlen(kSuffix), kSuffix);
+}
+
+}  // unnamed namespace
+
+// static
+uint64_t MediaCodecListCache::ComputeInputsChecksum(
+        const char* const* searchDirs, const char* profilingResultsXmlPath,
+        const char* buildersKey) {
+    uint64_t checksum = kChecksumSeed;
+
+    // media_codecs.xml includes the other media_codecs_*.xml of its directory
+    for (size_t i = 0; searchDirs != nullptr && searchDirs[i] != nullptr; ++i) {
+        DIR *dir = opendir(searchDirs[i]);
+        if (dir == nullptr) {
+            continue;
+        }
+        std::vector<std::string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (isCodecsXml(entry->d_name)) {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+
+        std::sort(names.begin(), names.end());
+        for (const std::string &name : names) {
+            checksum = updateChecksumWithFile(
+                    checksum, std::string(searchDirs[i]) + "/" + name);
+        }
+    }
+
+    if (profilingResultsXmlPath != nullptr) {
+        checksum = updateChecksumWithFile(checksum, profilingResultsXmlPath);
+    }
+
+    if (buildersKey != nullptr) {
+        checksum = updateChecksum(checksum, buildersKey, strlen(buildersKey) + 1);
+    }
+
+    // hashed with their names, so that a value moving from one property to
+    // another changes the checksum too
+    for (const char *name : kInputProperties) {
+        char value[PROPERTY_VALUE_MAX];
+        property_get(name, value, "");
+        checksum = updateChecksum(checksum, name, strlen(name) + 1);
+        checksum = updateChecksum(checksum, value, strlen(value) + 1);
+    }
+    return checksum;
+}
+
+// static
+status_t MediaCodecListCache::Load(
+        const char* path, uint64_t inputsChecksum,
+        sp<AMessage>* globalSettings,
+        std::vector<sp<MediaCodecInfo>>* codecInfos) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NAME_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return BAD_VALUE;
+    }
+
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ALOGW("failed to map %s (%s)", path, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    const Header *header = static_cast<const Header *>(map);
+    const uint8_t *data = static_cast<const uint8_t *>(map) + sizeof(Header);
+    status_t err = OK;
+    if (header->mMagic != kMagic || header->mVersion != kVersion) {
+        ALOGV("%s has an unknown format", path);
+        err = BAD_VALUE;
+    } else if (header->mInputsChecksum != inputsChecksum) {
+        ALOGV("%s is stale", path);
+        err = BAD_VALUE;
+    } else if (header->mDataSize != size - sizeof(Header)
+            || header->mDataChecksum != updateChecksum(
+                    kChecksumSeed, data, header->mDataSize)) {
+        ALOGW("%s is corrupted", path);
+        err = BAD_VALUE;
+    }
+
+    Parcel parcel;
+    if (err == OK) {
+        err = parcel.setData(data, header->mDataSize);
+    }
+    munmap(map, size);
+    if (err != OK) {
+        return err;
+    }
+
+    sp<AMessage> settings = AMessage::FromParcel(parcel);
+    int32_t count = parcel.readInt32();
+    if (settings == nullptr || count < 0 || count > kMaxCodecInfos) {
+        return BAD_VALUE;
+    }
+
+    std::vector<sp<MediaCodecInfo>> infos;
+    infos.reserve(count);
+    for (int32_t i = 0; i < count; ++i) {
+        sp<MediaCodecInfo> info = MediaCodecInfo::FromParcel(parcel);
+        if (info == nullptr) {
+            return BAD_VALUE;
+        }
+        infos.push_back(info);
+    }
+    if (parcel.dataAvail() != 0) {
+        return BAD_VALUE;
+    }
+
+    *globalSettings = settings;
+    codecInfos->swap(infos);
+    ALOGV("loaded %d codecs from %s", count, path);
+    return OK;
+}
+
+// static
+status_t MediaCodecListCache::Store(
+        const char* path, uint64_t inputsChecksum,
+        const sp<AMessage>& globalSettings,
+        const std::vector<sp<MediaCodecInfo>>& codecInfos) {
+    Parcel parcel;
+    globalSettings->writeToParcel(&parcel);
+    parcel.writeInt32(codecInfos.size());
+    for (const sp<MediaCodecInfo> &info : codecInfos) {
+        if (info == nullptr) {
+            return BAD_VALUE;
+        }
+        status_t err = info->writeToParcel(&parcel);
+        if (err != OK) {
+            return err;
+        }
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.mMagic = kMagic;
+    header.mVersion = kVersion;
+    header.mInputsChecksum = inputsChecksum;
+    header.mDataSize = parcel.dataSize();
+    header.mDataChecksum = updateChecksum(
+            kChecksumSeed, parcel.data(), parcel.dataSize());
+
+    // written next to the cache and renamed, readers never see a partial file
+    AString tmpPath = AStringPrintf("%s.%d.tmp", path, getpid());
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ALOGV("cannot create %s (%s)", tmpPath.c_str(), strerror(errno));
+        return -errno;
+    }
+
+    status_t err = OK;
+    const struct {
+        const void *mData;
+        size_t mSize;
+    } chunks[] = {
+        { &header, sizeof(header) },
+        { parcel.data(), parcel.dataSize() },
+    };
+    for (const auto &chunk : chunks) {
+        const uint8_t *ptr = static_cast<const uint8_t *>(chunk.mData);
+        size_t left = chunk.mSize;
+        while (err == OK && left > 0) {
+            ssize_t n = TEMP_FAILURE_RETRY(write(fd, ptr, left));
+            if (n <= 0) {
+                err = n < 0 ? -errno : UNKNOWN_ERROR;
+                break;
+            }
+            ptr += n;
+            left -= n;
+        }
+    }
+    if (err == OK && fsync(fd) != 0) {
+        err = -errno;
+    }
+    close(fd);
+
+    if (err == OK && rename(tmpPath.c_str(), path) != 0) {
+        err = -errno;
+    }
+    if (err != OK) {
+        ALOGW("failed to write %s (%d)", path, err);
+        unlink(tmpPath.c_str());
+    }
+    return err;
+}
+
+}  // namespace android
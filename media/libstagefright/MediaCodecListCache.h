@@ -0,0 +1,62 @@
+/*
+ * Copyright 2018, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEDIA_CODEC_LIST_CACHE_H_
+
+#define MEDIA_CODEC_LIST_CACHE_H_
+
+#include <media/MediaCodecInfo.h>
+#include <media/stagefright/foundation/AMessage.h>
+
+#include <utils/Errors.h>
+#include <utils/StrongPointer.h>
+#include <vector>
+
+namespace android {
+
+// Binary cache of a built codec list, so that processes creating a local
+// MediaCodecList map it instead of going through the xml parsers and the
+// codec services again. The file is a header followed by the global settings
+// and codec infos in their Parcel form, and is only used if its format
+// version and the checksum of the inputs it was built from still match.
+struct MediaCodecListCache {
+    static constexpr const char* kDefaultPath = "/data/misc/media/media_codecs_cache.bin";
+
+    // Checksum of the media_codecs*.xml files in searchDirs (nullptr
+    // terminated), of the profiling results, of the builders the list is
+    // built with, as described by buildersKey, of the properties the builders
+    // rank codecs with and of the system and vendor build fingerprints.
+    static uint64_t ComputeInputsChecksum(
+            const char* const* searchDirs, const char* profilingResultsXmlPath,
+            const char* buildersKey);
+
+    // Returns NAME_NOT_FOUND if there is no cache, and BAD_VALUE if it is
+    // stale or corrupted.
+    static status_t Load(
+            const char* path, uint64_t inputsChecksum,
+            sp<AMessage>* globalSettings,
+            std::vector<sp<MediaCodecInfo>>* codecInfos);
+
+    // Replaces the cache atomically.
+    static status_t Store(
+            const char* path, uint64_t inputsChecksum,
+            const sp<AMessage>& globalSettings,
+            const std::vector<sp<MediaCodecInfo>>& codecInfos);
+};
+
+}  // namespace android
+
+#endif  // MEDIA_CODEC_LIST_CACHE_H_
@@ -24,15 +24,72 @@
 
 #include <media/stagefright/StagefrightMediaScanner.h>
 
+#include <cutils/properties.h>
 #include <media/IMediaHTTPService.h>
 #include <media/mediametadataretriever.h>
 #include <private/media/VideoFrame.h>
 
 namespace android {
 
-StagefrightMediaScanner::StagefrightMediaScanner() {}
+static const int32_t kDefaultMaxExtractors = 4;
+static const int32_t kMaxExtractors = 8;
 
-StagefrightMediaScanner::~StagefrightMediaScanner() {}
+struct StagefrightMediaScanner::PrefetchedFile {
+    struct Tag {
+        bool mIsMimeType;
+        std::string mName;
+        std::string mValue;
+    };
+
+    std::string mPath;
+    bool mStarted;
+    bool mDone;
+    MediaScanResult mResult;
+    std::vector<Tag> mTags;
+};
+
+// Records what processFileInternal() reports for a prefetched file.
+struct StagefrightMediaScanner::RecordingClient : public MediaScannerClient {
+    explicit RecordingClient(PrefetchedFile *file) : mFile(file) {}
+
+    virtual status_t scanFile(const char* /* path */, long long /* lastModified */,
+            long long /* fileSize */, bool /* isDirectory */, bool /* noMedia */) {
+        return INVALID_OPERATION;
+    }
+
+    virtual status_t handleStringTag(const char* name, const char* value) {
+        mFile->mTags.push_back({false, name, value});
+        return OK;
+    }
+
+    virtual status_t setMimeType(const char* mimeType) {
+        mFile->mTags.push_back({true, "", mimeType});
+        return OK;
+    }
+
+private:
+    PrefetchedFile *mFile;
+};
+
+StagefrightMediaScanner::StagefrightMediaScanner()
+    : mMaxExtractors(kDefaultMaxExtractors),
+      mStopping(false) {
+    int32_t maxExtractors =
+            property_get_int32("media.scanner.extractors", kDefaultMaxExtractors);
+    mMaxExtractors = maxExtractors < 1 ? 1 :
+            (maxExtractors > kMaxExtractors ? kMaxExtractors : maxExtractors);
+}
+
+StagefrightMediaScanner::~StagefrightMediaScanner() {
+    {
+        Mutex::Autolock autoLock(mLock);
+        mStopping = true;
+        mCondition.broadcast();
+    }
+    for (std::thread &extractor : mExtractors) {
+        extractor.join();
+    }
+}
 
 static bool FileHasAcceptableExtension(const char *extension) {
     static const char *kValidExtensions[] = {
@@ -55,6 +112,74 @@ static bool FileHasAcceptableExtension(const char *extension) {
     return false;
 }
 
+void StagefrightMediaScanner::prefetchFile(const char *path) {
+    const char *extension = strrchr(path, '.');
+    if (!extension || !FileHasAcceptableExtension(extension)) {
+        return;
+    }
+
+    std::shared_ptr<PrefetchedFile> file(new PrefetchedFile);
+    file->mPath = path;
+    file->mStarted = false;
+    file->mDone = false;
+    file->mResult = MEDIA_SCAN_RESULT_OK;
+
+    Mutex::Autolock autoLock(mLock);
+    // the scanner bounds how many files are prefetched at once
+    mPrefetched[file->mPath] = file;
+    mPending.push_back(file);
+    if (mExtractors.size() < mMaxExtractors && mExtractors.size() < mPending.size()) {
+        mExtractors.emplace_back([this] { extractorLoop(); });
+    }
+    mCondition.signal();
+}
+
+void StagefrightMediaScanner::releaseFile(const char *path) {
+    Mutex::Autolock autoLock(mLock);
+    releaseFile_l(path);
+}
+
+void StagefrightMediaScanner::releaseFile_l(const char *path) {
+    auto it = mPrefetched.find(path);
+    if (it == mPrefetched.end()) {
+        return;
+    }
+    // an extractor still processing the file just drops its result
+    if (!it->second->mStarted) {
+        for (auto pending = mPending.begin(); pending != mPending.end(); ++pending) {
+            if (*pending == it->second) {
+                mPending.erase(pending);
+                break;
+            }
+        }
+    }
+    mPrefetched.erase(it);
+}
+
+void StagefrightMediaScanner::extractorLoop() {
+    Mutex::Autolock autoLock(mLock);
+    for (;;) {
+        while (!mStopping && mPending.empty()) {
+            mCondition.wait(mLock);
+        }
+        if (mStopping) {
+            break;
+        }
+        std::shared_ptr<PrefetchedFile> file = mPending.front();
+        mPending.pop_front();
+        file->mStarted = true;
+
+        mLock.unlock();
+        RecordingClient recorder(file.get());
+        MediaScanResult result = processFileInternal(file->mPath.c_str(), NULL, recorder);
+        mLock.lock();
+
+        file->mResult = result;
+        file->mDone = true;
+        mCondition.broadcast();
+    }
+}
+
 MediaScanResult StagefrightMediaScanner::processFile(
         const char *path, const char *mimeType,
         MediaScannerClient &client) {
@@ -62,7 +187,42 @@ MediaScanResult StagefrightMediaScanner::processFile(
 
     client.setLocale(locale());
     client.beginFile();
-    MediaScanResult result = processFileInternal(path, mimeType, client);
+
+    // processFileInternal() does not depend on mimeType, a prefetched result
+    // is used as is.
+    std::shared_ptr<PrefetchedFile> file;
+    {
+        Mutex::Autolock autoLock(mLock);
+        auto it = mPrefetched.find(path);
+        if (it != mPrefetched.end()) {
+            file = it->second;
+            while (file->mStarted && !file->mDone) {
+                mCondition.wait(mLock);
+            }
+            if (!file->mDone) {
+                // not picked up yet, process it inline below
+                releaseFile_l(path);
+                file.reset();
+            }
+        }
+    }
+
+    MediaScanResult result;
+    if (file != NULL) {
+        ALOGV("using prefetched result for '%s'", path);
+        result = file->mResult;
+        for (const PrefetchedFile::Tag &tag : file->mTags) {
+            status_t status = tag.mIsMimeType
+                    ? client.setMimeType(tag.mValue.c_str())
+                    : client.addStringTag(tag.mName.c_str(), tag.mValue.c_str());
+            if (status != OK) {
+                result = MEDIA_SCAN_RESULT_ERROR;
+                break;
+            }
+        }
+    } else {
+        result = processFileInternal(path, mimeType, client);
+    }
     ALOGV("result: %d", result);
     if (mimeType == NULL && result != MEDIA_SCAN_RESULT_OK) {
         ALOGW("media scan failed for %s", path);
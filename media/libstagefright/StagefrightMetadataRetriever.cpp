@@ -38,8 +38,54 @@
 
 namespace android {
 
+namespace {
+
+// Passes the reads through to the source of the retriever, only adding
+// kIsMetadataOnly to its flags, so that the extractor created on it can skip
+// what it only needs to read samples.
+class MetadataProbeSource : public DataSource {
+public:
+    explicit MetadataProbeSource(const sp<DataSource> &source)
+        : mSource(source) {
+    }
+
+    virtual status_t initCheck() const {
+        return mSource->initCheck();
+    }
+    virtual ssize_t readAt(off64_t offset, void *data, size_t size) {
+        return mSource->readAt(offset, data, size);
+    }
+    virtual status_t getSize(off64_t *size) {
+        return mSource->getSize(size);
+    }
+    virtual uint32_t flags() {
+        return mSource->flags() | kIsMetadataOnly;
+    }
+    // The source is still needed for the frames, the retriever closes it.
+    virtual void close() {
+    }
+    virtual String8 toString() {
+        return mSource->toString();
+    }
+    virtual sp<DecryptHandle> DrmInitialization(const char *mime) {
+        return mSource->DrmInitialization(mime);
+    }
+    virtual String8 getUri() {
+        return mSource->getUri();
+    }
+    virtual String8 getMIMEType() const {
+        return mSource->getMIMEType();
+    }
+
+private:
+    sp<DataSource> mSource;
+};
+
+}  // namespace
+
 StagefrightMetadataRetriever::StagefrightMetadataRetriever()
-    : mParsedMetaData(false),
+    : mMetadataOnly(false),
+      mParsedMetaData(false),
       mAlbumArt(NULL),
       mLastImageIndex(-1) {
     ALOGV("StagefrightMetadataRetriever()");
@@ -67,9 +113,7 @@ status_t StagefrightMetadataRetriever::setDataSource(
         return UNKNOWN_ERROR;
     }
 
-    mExtractor = MediaExtractorFactory::Create(mSource);
-
-    if (mExtractor == NULL) {
+    if (createMetadataExtractor(NULL /* mime */) != OK) {
         ALOGE("Unable to instantiate an extractor for '%s'.", uri);
 
         mSource.clear();
@@ -97,9 +141,7 @@ status_t StagefrightMetadataRetriever::setDataSource(
         return err;
     }
 
-    mExtractor = MediaExtractorFactory::Create(mSource);
-
-    if (mExtractor == NULL) {
+    if (createMetadataExtractor(NULL /* mime */) != OK) {
         mSource.clear();
 
         return UNKNOWN_ERROR;
@@ -114,9 +156,8 @@ status_t StagefrightMetadataRetriever::setDataSource(
 
     clearMetadata();
     mSource = source;
-    mExtractor = MediaExtractorFactory::Create(mSource, mime);
 
-    if (mExtractor == NULL) {
+    if (createMetadataExtractor(mime) != OK) {
         ALOGE("Failed to instantiate a MediaExtractor.");
         mSource.clear();
         return UNKNOWN_ERROR;
@@ -125,6 +166,36 @@ status_t StagefrightMetadataRetriever::setDataSource(
     return OK;
 }
 
+status_t StagefrightMetadataRetriever::createMetadataExtractor(const char *mime) {
+    mMime = (mime != NULL) ? mime : "";
+    mExtractor = MediaExtractorFactory::Create(new MetadataProbeSource(mSource), mime);
+    mMetadataOnly = true;
+
+    return (mExtractor == NULL) ? UNKNOWN_ERROR : OK;
+}
+
+status_t StagefrightMetadataRetriever::ensureFullExtractor() {
+    if (mExtractor == NULL) {
+        return NO_INIT;
+    }
+    if (!mMetadataOnly) {
+        return OK;
+    }
+
+    // The headers are parsed again, this time with everything the tracks need.
+    ALOGV("switching to a full extractor");
+    sp<IMediaExtractor> extractor = MediaExtractorFactory::Create(
+            mSource, mMime.empty() ? NULL : mMime.c_str());
+    if (extractor == NULL) {
+        ALOGE("Unable to instantiate a full extractor.");
+        return UNKNOWN_ERROR;
+    }
+
+    mExtractor = extractor;
+    mMetadataOnly = false;
+    return OK;
+}
+
 sp<IMemory> StagefrightMetadataRetriever::getImageAtIndex(
         int index, int colorFormat, bool metaOnly, bool thumbnail) {
     ALOGV("getImageAtIndex: index(%d) colorFormat(%d) metaOnly(%d) thumbnail(%d)",
@@ -140,7 +211,8 @@ sp<IMemory> StagefrightMetadataRetriever::getImageRectAtIndex(
 
     FrameRect rect = {left, top, right, bottom};
 
-    if (mImageDecoder != NULL && index == mLastImageIndex) {
+    // Rows are decoded in order, a rect at the top starts over.
+    if (mImageDecoder != NULL && index == mLastImageIndex && top > 0) {
         return mImageDecoder->extractFrame(&rect);
     }
 
@@ -148,10 +220,23 @@ sp<IMemory> StagefrightMetadataRetriever::getImageRectAtIndex(
             index, colorFormat, false /*metaOnly*/, false /*thumbnail*/, &rect);
 }
 
+sp<IMemory> StagefrightMetadataRetriever::getImageRoiAtIndex(
+        int index, int colorFormat, int left, int top, int right, int bottom) {
+    ALOGV("getImageRoiAtIndex: index(%d) colorFormat(%d) rect {%d, %d, %d, %d}",
+            index, colorFormat, left, top, right, bottom);
+
+    FrameRect roi = {left, top, right, bottom};
+
+    return getImageInternal(
+            index, colorFormat, false /*metaOnly*/, false /*thumbnail*/,
+            NULL /*rect*/, &roi);
+}
+
 sp<IMemory> StagefrightMetadataRetriever::getImageInternal(
-        int index, int colorFormat, bool metaOnly, bool thumbnail, FrameRect* rect) {
+        int index, int colorFormat, bool metaOnly, bool thumbnail, FrameRect* rect,
+        const FrameRect* roi) {
 
-    if (mExtractor.get() == NULL) {
+    if (ensureFullExtractor() != OK) {
         ALOGE("no extractor.");
         return NULL;
     }
@@ -216,7 +301,8 @@ sp<IMemory> StagefrightMetadataRetriever::getImageInternal(
         sp<ImageDecoder> decoder = new ImageDecoder(componentName, trackMeta, source);
         int64_t frameTimeUs = thumbnail ? -1 : 0;
         if (decoder->init(frameTimeUs, 1 /*numFrames*/, 0 /*option*/, colorFormat) == OK) {
-            sp<IMemory> frame = decoder->extractFrame(rect);
+            sp<IMemory> frame = (roi != NULL) ?
+                    decoder->extractRegion(*roi) : decoder->extractFrame(rect);
 
             if (frame != NULL) {
                 if (rect != NULL) {
@@ -258,7 +344,7 @@ status_t StagefrightMetadataRetriever::getFrameAtIndex(
 status_t StagefrightMetadataRetriever::getFrameInternal(
         int64_t timeUs, int numFrames, int option, int colorFormat, bool metaOnly,
         sp<IMemory>* outFrame, std::vector<sp<IMemory> >* outFrames) {
-    if (mExtractor.get() == NULL) {
+    if (ensureFullExtractor() != OK) {
         ALOGE("no extractor.");
         return NO_INIT;
     }
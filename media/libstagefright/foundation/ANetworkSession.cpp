@@ -27,6 +27,7 @@
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
@@ -41,6 +42,15 @@ namespace android {
 static const size_t kMaxUDPSize = 1500;
 static const int32_t kMaxUDPRetries = 200;
 
+// Datagrams fetched per recvmmsg() call.
+static const size_t kMaxUDPBatchSize = 16;
+
+// Readiness events handled per epoll_wait() call.
+static const int kMaxPollEvents = 32;
+
+// epoll user data of the wakeup pipe, session IDs start at 1.
+static const uint32_t kPipePollID = 0;
+
 struct ANetworkSession::NetworkThread : public Thread {
     explicit NetworkThread(ANetworkSession *session);
 
@@ -85,6 +95,10 @@ struct ANetworkSession::Session : public RefBase {
     bool wantsToRead();
     bool wantsToWrite();
 
+    // Events the socket is registered for in the epoll set, 0 if it is not.
+    uint32_t pollEvents() const;
+    void setPollEvents(uint32_t events);
+
     status_t readMore();
     status_t writeMore();
 
@@ -115,6 +129,7 @@ private:
     sp<AMessage> mNotify;
     bool mSawReceiveFailure, mSawSendFailure;
     int32_t mUDPRetries;
+    uint32_t mPollEvents;
 
     List<Fragment> mOutFragments;
 
@@ -159,6 +174,7 @@ ANetworkSession::Session::Session(
       mSawReceiveFailure(false),
       mSawSendFailure(false),
       mUDPRetries(kMaxUDPRetries),
+      mPollEvents(0),
       mLastStallReportUs(-1ll) {
     if (mState == CONNECTED) {
         struct sockaddr_in localAddr;
@@ -254,40 +270,71 @@ bool ANetworkSession::Session::wantsToWrite() {
             || (mState == DATAGRAM && !mOutFragments.empty()));
 }
 
+uint32_t ANetworkSession::Session::pollEvents() const {
+    return mPollEvents;
+}
+
+void ANetworkSession::Session::setPollEvents(uint32_t events) {
+    mPollEvents = events;
+}
+
 status_t ANetworkSession::Session::readMore() {
     if (mState == DATAGRAM) {
         CHECK_EQ(mMode, MODE_DATAGRAM);
 
+        sp<ABuffer> bufs[kMaxUDPBatchSize];
+        struct sockaddr_in remoteAddrs[kMaxUDPBatchSize];
+        struct iovec iovs[kMaxUDPBatchSize];
+        struct mmsghdr msgs[kMaxUDPBatchSize];
+
         status_t err;
         do {
-            sp<ABuffer> buf = new ABuffer(kMaxUDPSize);
+            for (size_t i = 0; i < kMaxUDPBatchSize; ++i) {
+                if (bufs[i] == NULL) {
+                    bufs[i] = new ABuffer(kMaxUDPSize);
+                }
 
-            struct sockaddr_in remoteAddr;
-            socklen_t remoteAddrLen = sizeof(remoteAddr);
+                iovs[i].iov_base = bufs[i]->base();
+                iovs[i].iov_len = bufs[i]->capacity();
 
-            ssize_t n;
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_name = &remoteAddrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(remoteAddrs[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int n;
             do {
-                n = recvfrom(
-                        mSocket, buf->data(), buf->capacity(), 0,
-                        (struct sockaddr *)&remoteAddr, &remoteAddrLen);
+                n = recvmmsg(mSocket, msgs, kMaxUDPBatchSize, 0, NULL);
             } while (n < 0 && errno == EINTR);
 
             err = OK;
             if (n < 0) {
                 err = -errno;
-            } else if (n == 0) {
-                err = -ECONNRESET;
-            } else {
-                buf->setRange(0, n);
+                break;
+            }
 
-                int64_t nowUs = ALooper::GetNowUs();
+            int64_t nowUs = ALooper::GetNowUs();
+
+            for (int i = 0; i < n; ++i) {
+                if (msgs[i].msg_len == 0) {
+                    // an empty datagram, not a reset: the ones after it are
+                    // still good, and its buffer is reused for the next batch
+                    continue;
+                }
+
+                sp<ABuffer> buf = bufs[i];
+                bufs[i].clear();
+
+                buf->setRange(0, msgs[i].msg_len);
                 buf->meta()->setInt64("arrivalTimeUs", nowUs);
 
                 sp<AMessage> notify = mNotify->dup();
                 notify->setInt32("sessionID", mSessionID);
                 notify->setInt32("reason", kWhatDatagram);
 
-                uint32_t ip = ntohl(remoteAddr.sin_addr.s_addr);
+                uint32_t ip = ntohl(remoteAddrs[i].sin_addr.s_addr);
                 notify->setString(
                         "fromAddr",
                         AStringPrintf(
@@ -297,11 +344,17 @@ status_t ANetworkSession::Session::readMore() {
                             (ip >> 8) & 0xff,
                             ip & 0xff).c_str());
 
-                notify->setInt32("fromPort", ntohs(remoteAddr.sin_port));
+                notify->setInt32("fromPort", ntohs(remoteAddrs[i].sin_port));
 
                 notify->setBuffer("data", buf);
                 notify->post();
             }
+
+            // A short batch means the socket is drained, the next readiness
+            // event brings us back here.
+            if (err == OK && n < (int)kMaxUDPBatchSize) {
+                err = -EAGAIN;
+            }
         } while (err == OK);
 
         if (err == -EAGAIN) {
@@ -789,10 +842,22 @@ void ANetworkSession::Session::notify(NotificationReason reason) {
 ANetworkSession::ANetworkSession()
     : mNextSessionID(1) {
     mPipeFd[0] = mPipeFd[1] = -1;
+
+    // Sessions may be created before start(), so the epoll set lives as long
+    // as the object.
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        ALOGE("epoll_create1 failed w/ error %d (%s)", errno, strerror(errno));
+    }
 }
 
 ANetworkSession::~ANetworkSession() {
     stop();
+
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+        mEpollFd = -1;
+    }
 }
 
 status_t ANetworkSession::start() {
@@ -800,19 +865,34 @@ status_t ANetworkSession::start() {
         return INVALID_OPERATION;
     }
 
+    if (mEpollFd < 0) {
+        return NO_INIT;
+    }
+
     int res = pipe(mPipeFd);
     if (res != 0) {
         mPipeFd[0] = mPipeFd[1] = -1;
         return -errno;
     }
 
-    mThread = new NetworkThread(this);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = kPipePollID;
 
-    status_t err = mThread->run("ANetworkSession", ANDROID_PRIORITY_AUDIO);
+    status_t err = OK;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mPipeFd[0], &ev) < 0) {
+        err = -errno;
+    } else {
+        mThread = new NetworkThread(this);
+
+        err = mThread->run("ANetworkSession", ANDROID_PRIORITY_AUDIO);
+    }
 
     if (err != OK) {
         mThread.clear();
 
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mPipeFd[0], NULL);
         close(mPipeFd[0]);
         close(mPipeFd[1]);
         mPipeFd[0] = mPipeFd[1] = -1;
@@ -834,6 +914,7 @@ status_t ANetworkSession::stop() {
 
     mThread.clear();
 
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mPipeFd[0], NULL);
     close(mPipeFd[0]);
     close(mPipeFd[1]);
     mPipeFd[0] = mPipeFd[1] = -1;
@@ -926,9 +1007,15 @@ status_t ANetworkSession::destroySession(int32_t sessionID) {
         return -ENOENT;
     }
 
-    mSessions.removeItemsAt(index);
+    const sp<Session> session = mSessions.valueAt(index);
+    if (session->pollEvents() != 0) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, session->socket(), NULL);
+        session->setPollEvents(0);
+    }
 
-    interrupt();
+    // No need to wake up the network thread, events already fetched for this
+    // session are dropped when its ID is not found.
+    mSessions.removeItemsAt(index);
 
     return OK;
 }
@@ -1139,7 +1226,8 @@ status_t ANetworkSession::createClientOrServer(
 
     mSessions.add(session->sessionID(), session);
 
-    interrupt();
+    // Registering the socket wakes up the network thread if it is ready.
+    updatePollEvents_l(session);
 
     *sessionID = session->sessionID();
 
@@ -1206,7 +1294,7 @@ status_t ANetworkSession::sendRequest(
 
     status_t err = session->sendRequest(data, size, timeValid, timeUs);
 
-    interrupt();
+    updatePollEvents_l(session);
 
     return err;
 }
@@ -1237,43 +1325,53 @@ void ANetworkSession::interrupt() {
     }
 }
 
-void ANetworkSession::threadLoop() {
-    fd_set rs, ws;
-    FD_ZERO(&rs);
-    FD_ZERO(&ws);
-
-    FD_SET(mPipeFd[0], &rs);
-    int maxFd = mPipeFd[0];
+void ANetworkSession::updatePollEvents_l(const sp<Session> &session) {
+    int s = session->socket();
 
-    {
-        Mutex::Autolock autoLock(mLock);
+    if (s < 0) {
+        return;
+    }
 
-        for (size_t i = 0; i < mSessions.size(); ++i) {
-            const sp<Session> &session = mSessions.valueAt(i);
+    uint32_t events = 0;
+    if (session->wantsToRead()) {
+        events |= EPOLLIN;
+    }
+    if (session->wantsToWrite()) {
+        events |= EPOLLOUT;
+    }
 
-            int s = session->socket();
+    uint32_t registered = session->pollEvents();
+    if (events == registered) {
+        return;
+    }
 
-            if (s < 0) {
-                continue;
-            }
+    int op;
+    if (registered == 0) {
+        op = EPOLL_CTL_ADD;
+    } else if (events == 0) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
 
-            if (session->wantsToRead()) {
-                FD_SET(s, &rs);
-                if (s > maxFd) {
-                    maxFd = s;
-                }
-            }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = session->sessionID();
 
-            if (session->wantsToWrite()) {
-                FD_SET(s, &ws);
-                if (s > maxFd) {
-                    maxFd = s;
-                }
-            }
-        }
+    if (epoll_ctl(mEpollFd, op, s, &ev) < 0) {
+        ALOGE("epoll_ctl on socket %d failed w/ error %d (%s)",
+              s, errno, strerror(errno));
+        return;
     }
 
-    int res = select(maxFd + 1, &rs, &ws, NULL, NULL /* tv */);
+    session->setPollEvents(events);
+}
+
+void ANetworkSession::threadLoop() {
+    struct epoll_event events[kMaxPollEvents];
+
+    int res = epoll_wait(mEpollFd, events, kMaxPollEvents, -1 /* timeout */);
 
     if (res == 0) {
         return;
@@ -1284,117 +1382,123 @@ void ANetworkSession::threadLoop() {
             return;
         }
 
-        ALOGE("select failed w/ error %d (%s)", errno, strerror(errno));
+        ALOGE("epoll_wait failed w/ error %d (%s)", errno, strerror(errno));
         return;
     }
 
-    if (FD_ISSET(mPipeFd[0], &rs)) {
-        char c;
-        ssize_t n;
-        do {
-            n = read(mPipeFd[0], &c, 1);
-        } while (n < 0 && errno == EINTR);
+    Mutex::Autolock autoLock(mLock);
+
+    List<sp<Session> > sessionsToAdd;
+
+    for (int i = 0; i < res; ++i) {
+        if (events[i].data.u32 == kPipePollID) {
+            char tmp[64];
+            ssize_t n;
+            do {
+                n = read(mPipeFd[0], tmp, sizeof(tmp));
+            } while (n < 0 && errno == EINTR);
 
-        if (n < 0) {
-            ALOGW("Error reading from pipe (%s)", strerror(errno));
+            if (n < 0) {
+                ALOGW("Error reading from pipe (%s)", strerror(errno));
+            }
+            continue;
         }
 
-        --res;
-    }
+        ssize_t index = mSessions.indexOfKey((int32_t)events[i].data.u32);
 
-    {
-        Mutex::Autolock autoLock(mLock);
+        if (index < 0) {
+            // destroyed since epoll_wait returned
+            continue;
+        }
 
-        List<sp<Session> > sessionsToAdd;
+        const sp<Session> session = mSessions.valueAt(index);
 
-        for (size_t i = mSessions.size(); res > 0 && i > 0;) {
-            i--;
-            const sp<Session> &session = mSessions.valueAt(i);
+        int s = session->socket();
 
-            int s = session->socket();
+        uint32_t revents = events[i].events;
 
-            if (s < 0) {
-                continue;
-            }
+        // Errors and hangups are reported whatever the registered events,
+        // let the pending read or write fail on them as select() did.
+        if (revents & (EPOLLERR | EPOLLHUP)) {
+            revents |= session->pollEvents();
+        }
 
-            if (FD_ISSET(s, &rs) || FD_ISSET(s, &ws)) {
-                --res;
-            }
+        if (revents & EPOLLIN) {
+            if (session->isRTSPServer() || session->isTCPDatagramServer()) {
+                struct sockaddr_in remoteAddr;
+                socklen_t remoteAddrLen = sizeof(remoteAddr);
 
-            if (FD_ISSET(s, &rs)) {
-                if (session->isRTSPServer() || session->isTCPDatagramServer()) {
-                    struct sockaddr_in remoteAddr;
-                    socklen_t remoteAddrLen = sizeof(remoteAddr);
-
-                    int clientSocket = accept(
-                            s, (struct sockaddr *)&remoteAddr, &remoteAddrLen);
-
-                    if (clientSocket >= 0) {
-                        status_t err = MakeSocketNonBlocking(clientSocket);
-
-                        if (err != OK) {
-                            ALOGE("Unable to make client socket non blocking, "
-                                  "failed w/ error %d (%s)",
-                                  err, strerror(-err));
-
-                            close(clientSocket);
-                            clientSocket = -1;
-                        } else {
-                            in_addr_t addr = ntohl(remoteAddr.sin_addr.s_addr);
-
-                            ALOGI("incoming connection from %d.%d.%d.%d:%d "
-                                  "(socket %d)",
-                                  (addr >> 24),
-                                  (addr >> 16) & 0xff,
-                                  (addr >> 8) & 0xff,
-                                  addr & 0xff,
-                                  ntohs(remoteAddr.sin_port),
-                                  clientSocket);
-
-                            sp<Session> clientSession =
-                                new Session(
-                                        mNextSessionID++,
-                                        Session::CONNECTED,
-                                        clientSocket,
-                                        session->getNotificationMessage());
-
-                            clientSession->setMode(
-                                    session->isRTSPServer()
-                                        ? Session::MODE_RTSP
-                                        : Session::MODE_DATAGRAM);
-
-                            sessionsToAdd.push_back(clientSession);
-                        }
+                int clientSocket = accept(
+                        s, (struct sockaddr *)&remoteAddr, &remoteAddrLen);
+
+                if (clientSocket >= 0) {
+                    status_t err = MakeSocketNonBlocking(clientSocket);
+
+                    if (err != OK) {
+                        ALOGE("Unable to make client socket non blocking, "
+                              "failed w/ error %d (%s)",
+                              err, strerror(-err));
+
+                        close(clientSocket);
+                        clientSocket = -1;
                     } else {
-                        ALOGE("accept returned error %d (%s)",
-                              errno, strerror(errno));
+                        in_addr_t addr = ntohl(remoteAddr.sin_addr.s_addr);
+
+                        ALOGI("incoming connection from %d.%d.%d.%d:%d "
+                              "(socket %d)",
+                              (addr >> 24),
+                              (addr >> 16) & 0xff,
+                              (addr >> 8) & 0xff,
+                              addr & 0xff,
+                              ntohs(remoteAddr.sin_port),
+                              clientSocket);
+
+                        sp<Session> clientSession =
+                            new Session(
+                                    mNextSessionID++,
+                                    Session::CONNECTED,
+                                    clientSocket,
+                                    session->getNotificationMessage());
+
+                        clientSession->setMode(
+                                session->isRTSPServer()
+                                    ? Session::MODE_RTSP
+                                    : Session::MODE_DATAGRAM);
+
+                        sessionsToAdd.push_back(clientSession);
                     }
                 } else {
-                    status_t err = session->readMore();
-                    if (err != OK) {
-                        ALOGE("readMore on socket %d failed w/ error %d (%s)",
-                              s, err, strerror(-err));
-                    }
+                    ALOGE("accept returned error %d (%s)",
+                          errno, strerror(errno));
                 }
-            }
-
-            if (FD_ISSET(s, &ws)) {
-                status_t err = session->writeMore();
+            } else {
+                status_t err = session->readMore();
                 if (err != OK) {
-                    ALOGE("writeMore on socket %d failed w/ error %d (%s)",
+                    ALOGE("readMore on socket %d failed w/ error %d (%s)",
                           s, err, strerror(-err));
                 }
             }
         }
 
-        while (!sessionsToAdd.empty()) {
-            sp<Session> session = *sessionsToAdd.begin();
-            sessionsToAdd.erase(sessionsToAdd.begin());
+        if (revents & EPOLLOUT) {
+            status_t err = session->writeMore();
+            if (err != OK) {
+                ALOGE("writeMore on socket %d failed w/ error %d (%s)",
+                      s, err, strerror(-err));
+            }
+        }
+
+        updatePollEvents_l(session);
+    }
 
-            mSessions.add(session->sessionID(), session);
+    while (!sessionsToAdd.empty()) {
+        sp<Session> session = *sessionsToAdd.begin();
+        sessionsToAdd.erase(sessionsToAdd.begin());
 
-            ALOGI("added clientSession %d", session->sessionID());
-        }
+        mSessions.add(session->sessionID(), session);
+        updatePollEvents_l(session);
+
+        ALOGI("added clientSession %d", session->sessionID());
     }
 }
 
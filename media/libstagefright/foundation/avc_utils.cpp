@@ -275,6 +275,26 @@ void FindAVCDimensions(
     }
 }
 
+size_t findStartCodePrefix(const uint8_t *data, size_t size) {
+    // Look for the 0x01 byte with memchr(), which libc vectorizes, then check the two bytes
+    // before it, instead of comparing three bytes at every offset. 0x01 is rare enough in
+    // coded data that most of the scan is memchr().
+    size_t offset = 2;
+    while (offset < size) {
+        const uint8_t *one = (const uint8_t *)memchr(&data[offset], 0x01, size - offset);
+        if (one == NULL) {
+            break;
+        }
+        offset = one - data;
+        if (data[offset - 1] == 0x00 && data[offset - 2] == 0x00) {
+            return offset - 2;
+        }
+        // Neither of the next two bytes can end a start code unless this one is 0x00.
+        offset += 3;
+    }
+    return size;
+}
+
 status_t getNextNALUnit(
         const uint8_t **_data, size_t *_size,
         const uint8_t **nalStart, size_t *nalSize,
@@ -289,17 +309,10 @@ status_t getNextNALUnit(
         return -EAGAIN;
     }
 
-    size_t offset = 0;
-
     // A valid startcode consists of at least two 0x00 bytes followed by 0x01.
-    for (; offset + 2 < size; ++offset) {
-        if (data[offset + 2] == 0x01 && data[offset] == 0x00
-                && data[offset + 1] == 0x00) {
-            break;
-        }
-    }
-    if (offset + 2 >= size) {
-        *_data = &data[offset];
+    size_t offset = findStartCodePrefix(data, size);
+    if (offset == size) {
+        *_data = &data[size - 2];
         *_size = 2;
         return -EAGAIN;
     }
@@ -307,25 +320,13 @@ status_t getNextNALUnit(
 
     size_t startOffset = offset;
 
-    for (;;) {
-        while (offset < size && data[offset] != 0x01) {
-            ++offset;
-        }
-
-        if (offset == size) {
-            if (startCodeFollows) {
-                offset = size + 2;
-                break;
-            }
-
-            return -EAGAIN;
-        }
-
-        if (data[offset - 1] == 0x00 && data[offset - 2] == 0x00) {
-            break;
-        }
-
-        ++offset;
+    offset = startOffset + findStartCodePrefix(&data[startOffset], size - startOffset);
+    if (offset + 2 < size) {
+        offset += 2;
+    } else if (startCodeFollows) {
+        offset = size + 2;
+    } else {
+        return -EAGAIN;
     }
 
     size_t endOffset = offset - 2;
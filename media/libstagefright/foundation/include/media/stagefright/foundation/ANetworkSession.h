@@ -103,6 +103,7 @@ private:
     int32_t mNextSessionID;
 
     int mPipeFd[2];
+    int mEpollFd;
 
     KeyedVector<int32_t, sp<Session> > mSessions;
 
@@ -125,6 +126,10 @@ private:
     void threadLoop();
     void interrupt();
 
+    // Registers the session socket for the events it currently waits for,
+    // called whenever these may have changed.
+    void updatePollEvents_l(const sp<Session> &session);
+
     static status_t MakeSocketNonBlocking(int s);
 
     DISALLOW_EVIL_CONSTRUCTORS(ANetworkSession);
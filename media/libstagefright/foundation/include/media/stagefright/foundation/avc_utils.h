@@ -75,6 +75,10 @@ inline void skipSE(ABitReader *br) {
     (void)parseSEWithFallback(br, 0);
 }
 
+// Returns the offset of the first 0x00 0x00 0x01 start code prefix in |data|, or |size| if
+// there is none.
+size_t findStartCodePrefix(const uint8_t *data, size_t size);
+
 status_t getNextNALUnit(
         const uint8_t **_data, size_t *_size,
         const uint8_t **nalStart, size_t *nalSize,
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sends UDP packets over loopback to an ANetworkSession datagram session and
+// reports the packet rate and the CPU time spent receiving them, that is the
+// network thread and the looper the notifications are delivered on. The
+// sender keeps at most a window of packets in flight so that none are dropped.
+//
+// usage: anetworksession_benchmark [-n packets] [-s size] [-p port] [-w window]
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/foundation/ANetworkSession.h>
+
+using namespace android;
+
+namespace {
+
+int64_t nowNs(clockid_t clock = CLOCK_MONOTONIC) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t processCpuNs() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+struct Receiver : public AHandler {
+    Receiver() : mNumPackets(0), mNumErrors(0) {}
+
+    std::atomic<size_t> mNumPackets;
+    std::atomic<size_t> mNumErrors;
+
+protected:
+    virtual void onMessageReceived(const sp<AMessage> &msg) {
+        int32_t reason;
+        CHECK(msg->findInt32("reason", &reason));
+
+        if (reason == ANetworkSession::kWhatDatagram) {
+            sp<ABuffer> data;
+            CHECK(msg->findBuffer("data", &data));
+            ++mNumPackets;
+        } else if (reason == ANetworkSession::kWhatError) {
+            ++mNumErrors;
+        }
+    }
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    size_t numPackets = 200000;
+    size_t packetSize = 1316;   // 7 TS packets, as sent over RTP
+    unsigned port = 19000;
+    size_t window = 128;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:p:w:")) != -1) {
+        switch (opt) {
+            case 'n': numPackets = strtoul(optarg, NULL, 0); break;
+            case 's': packetSize = strtoul(optarg, NULL, 0); break;
+            case 'p': port = strtoul(optarg, NULL, 0); break;
+            case 'w': window = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n packets] [-s size] [-p port] "
+                        "[-w window]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (numPackets == 0 || packetSize == 0 || packetSize > 1500 || window == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    sp<ALooper> looper = new ALooper;
+    looper->setName("anetworksession_benchmark");
+    looper->start();
+
+    sp<Receiver> receiver = new Receiver;
+    looper->registerHandler(receiver);
+
+    sp<ANetworkSession> netSession = new ANetworkSession;
+    status_t err = netSession->start();
+    if (err != OK) {
+        fprintf(stderr, "failed to start network session (%d)\n", err);
+        return 1;
+    }
+
+    int32_t sessionID;
+    err = netSession->createUDPSession(
+            port, new AMessage(0, receiver), &sessionID);
+    if (err != OK) {
+        fprintf(stderr, "failed to create UDP session on port %u (%d)\n",
+                port, err);
+        return 1;
+    }
+
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK_GE(s, 0);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    CHECK_EQ(connect(s, (const sockaddr *)&addr, sizeof(addr)), 0);
+
+    char *packet = (char *)calloc(1, packetSize);
+
+    int64_t startNs = nowNs();
+    int64_t startCpuNs = processCpuNs();
+    int64_t startSenderCpuNs = nowNs(CLOCK_THREAD_CPUTIME_ID);
+
+    size_t numSent = 0;
+    while (numSent < numPackets) {
+        if (numSent - receiver->mNumPackets >= window) {
+            usleep(20);
+            continue;
+        }
+
+        ssize_t n = send(s, packet, packetSize, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            fprintf(stderr, "send failed (%s)\n", strerror(errno));
+            break;
+        }
+        ++numSent;
+    }
+
+    // Give up on anything lost after a second without progress.
+    size_t numReceived = receiver->mNumPackets;
+    int64_t lastProgressNs = nowNs();
+    while (numReceived < numSent && nowNs() - lastProgressNs < 1000000000LL) {
+        usleep(100);
+        if (receiver->mNumPackets != numReceived) {
+            numReceived = receiver->mNumPackets;
+            lastProgressNs = nowNs();
+        }
+    }
+
+    int64_t elapsedNs = nowNs() - startNs;
+    int64_t senderCpuNs = nowNs(CLOCK_THREAD_CPUTIME_ID) - startSenderCpuNs;
+    int64_t receiveCpuNs = processCpuNs() - startCpuNs - senderCpuNs;
+
+    printf("packets: %zu sent, %zu received, %zu errors, %zu bytes each\n",
+           numSent, numReceived, (size_t)receiver->mNumErrors, packetSize);
+    if (numReceived > 0) {
+        printf("rate: %.0f packets/s\n", numReceived * 1e9 / elapsedNs);
+        printf("receive cpu: %.3f ms per 1k packets\n",
+               receiveCpuNs / 1e3 / numReceived);
+    }
+
+    free(packet);
+    close(s);
+
+    netSession->destroySession(sessionID);
+    netSession->stop();
+    looper->stop();
+
+    return numReceived == numSent ? 0 : 1;
+}
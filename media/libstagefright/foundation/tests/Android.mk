@@ -27,6 +27,26 @@ LOCAL_CLANG := true
 
 include $(BUILD_NATIVE_TEST)
 
+# ANetworkSession loopback benchmark
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := anetworksession_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+	ANetworkSession_benchmark.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	liblog \
+	libstagefright_foundation \
+	libutils \
+
+LOCAL_CFLAGS += -Werror -Wall
+LOCAL_CLANG := true
+
+include $(BUILD_EXECUTABLE)
+
 # Include subdirectory makefiles
 # ============================================================
 
@@ -222,7 +222,8 @@ ssize_t HTTPDownloader::fetchFile(
 }
 
 sp<M3UParser> HTTPDownloader::fetchPlaylist(
-        const char *url, uint8_t *curPlaylistHash, bool *unchanged) {
+        const char *url, uint8_t *curPlaylistHash, bool *unchanged,
+        const sp<M3UParser> &previous) {
     ALOGV("fetchPlaylist '%s'", url);
 
     *unchanged = false;
@@ -259,7 +260,7 @@ sp<M3UParser> HTTPDownloader::fetchPlaylist(
 #endif
 
     sp<M3UParser> playlist =
-        new M3UParser(actualUrl.string(), buffer->data(), buffer->size());
+        new M3UParser(actualUrl.string(), buffer->data(), buffer->size(), previous);
 
     if (playlist->initCheck() != OK) {
         ALOGE("failed to parse .m3u8 playlist");
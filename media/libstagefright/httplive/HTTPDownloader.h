@@ -67,8 +67,11 @@ struct HTTPDownloader : public RefBase {
             String8 *actualUrl = NULL);
 
     // fetch a playlist file
+    // |previous|, if any, is the last version of the playlist, used to
+    // avoid parsing again the segments that did not change.
     sp<M3UParser> fetchPlaylist(
-            const char *url, uint8_t *curPlaylistHash, bool *unchanged);
+            const char *url, uint8_t *curPlaylistHash, bool *unchanged,
+            const sp<M3UParser> &previous = NULL);
 
 private:
     sp<HTTPBase> mHTTPDataSource;
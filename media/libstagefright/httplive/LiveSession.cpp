@@ -53,175 +53,6 @@ const int64_t LiveSession::kResumeThresholdUs = 100000ll;
 // default buffer underflow mark
 static const int kUnderflowMarkMs = 1000;  // 1 second
 
-struct LiveSession::BandwidthEstimator : public RefBase {
-    BandwidthEstimator();
-
-    void addBandwidthMeasurement(size_t numBytes, int64_t delayUs);
-    bool estimateBandwidth(
-            int32_t *bandwidth,
-            bool *isStable = NULL,
-            int32_t *shortTermBps = NULL);
-
-private:
-    // Bandwidth estimation parameters
-    static const int32_t kShortTermBandwidthItems = 3;
-    static const int32_t kMinBandwidthHistoryItems = 20;
-    static const int64_t kMinBandwidthHistoryWindowUs = 5000000ll; // 5 sec
-    static const int64_t kMaxBandwidthHistoryWindowUs = 30000000ll; // 30 sec
-    static const int64_t kMaxBandwidthHistoryAgeUs = 60000000ll; // 60 sec
-
-    struct BandwidthEntry {
-        int64_t mTimestampUs;
-        int64_t mDelayUs;
-        size_t mNumBytes;
-    };
-
-    Mutex mLock;
-    List<BandwidthEntry> mBandwidthHistory;
-    List<int32_t> mPrevEstimates;
-    int32_t mShortTermEstimate;
-    bool mHasNewSample;
-    bool mIsStable;
-    int64_t mTotalTransferTimeUs;
-    size_t mTotalTransferBytes;
-
-    DISALLOW_EVIL_CONSTRUCTORS(BandwidthEstimator);
-};
-
-LiveSession::BandwidthEstimator::BandwidthEstimator() :
-    mShortTermEstimate(0),
-    mHasNewSample(false),
-    mIsStable(true),
-    mTotalTransferTimeUs(0),
-    mTotalTransferBytes(0) {
-}
-
-void LiveSession::BandwidthEstimator::addBandwidthMeasurement(
-        size_t numBytes, int64_t delayUs) {
-    AutoMutex autoLock(mLock);
-
-    int64_t nowUs = ALooper::GetNowUs();
-    BandwidthEntry entry;
-    entry.mTimestampUs = nowUs;
-    entry.mDelayUs = delayUs;
-    entry.mNumBytes = numBytes;
-    mTotalTransferTimeUs += delayUs;
-    mTotalTransferBytes += numBytes;
-    mBandwidthHistory.push_back(entry);
-    mHasNewSample = true;
-
-    // Remove no more than 10% of total transfer time at a time
-    // to avoid sudden jump on bandwidth estimation. There might
-    // be long blocking reads that takes up signification time,
-    // we have to keep a longer window in that case.
-    int64_t bandwidthHistoryWindowUs = mTotalTransferTimeUs * 9 / 10;
-    if (bandwidthHistoryWindowUs < kMinBandwidthHistoryWindowUs) {
-        bandwidthHistoryWindowUs = kMinBandwidthHistoryWindowUs;
-    } else if (bandwidthHistoryWindowUs > kMaxBandwidthHistoryWindowUs) {
-        bandwidthHistoryWindowUs = kMaxBandwidthHistoryWindowUs;
-    }
-    // trim old samples, keeping at least kMaxBandwidthHistoryItems samples,
-    // and total transfer time at least kMaxBandwidthHistoryWindowUs.
-    while (mBandwidthHistory.size() > kMinBandwidthHistoryItems) {
-        List<BandwidthEntry>::iterator it = mBandwidthHistory.begin();
-        // remove sample if either absolute age or total transfer time is
-        // over kMaxBandwidthHistoryWindowUs
-        if (nowUs - it->mTimestampUs < kMaxBandwidthHistoryAgeUs &&
-                mTotalTransferTimeUs - it->mDelayUs < bandwidthHistoryWindowUs) {
-            break;
-        }
-        mTotalTransferTimeUs -= it->mDelayUs;
-        mTotalTransferBytes -= it->mNumBytes;
-        mBandwidthHistory.erase(mBandwidthHistory.begin());
-    }
-}
-
-bool LiveSession::BandwidthEstimator::estimateBandwidth(
-        int32_t *bandwidthBps, bool *isStable, int32_t *shortTermBps) {
-    AutoMutex autoLock(mLock);
-
-    if (mBandwidthHistory.size() < 2) {
-        return false;
-    }
-
-    if (!mHasNewSample) {
-        *bandwidthBps = *(--mPrevEstimates.end());
-        if (isStable) {
-            *isStable = mIsStable;
-        }
-        if (shortTermBps) {
-            *shortTermBps = mShortTermEstimate;
-        }
-        return true;
-    }
-
-    *bandwidthBps = ((double)mTotalTransferBytes * 8E6 / mTotalTransferTimeUs);
-    mPrevEstimates.push_back(*bandwidthBps);
-    while (mPrevEstimates.size() > 3) {
-        mPrevEstimates.erase(mPrevEstimates.begin());
-    }
-    mHasNewSample = false;
-
-    int64_t totalTimeUs = 0;
-    size_t totalBytes = 0;
-    if (mBandwidthHistory.size() >= kShortTermBandwidthItems) {
-        List<BandwidthEntry>::iterator it = --mBandwidthHistory.end();
-        for (size_t i = 0; i < kShortTermBandwidthItems; i++, it--) {
-            totalTimeUs += it->mDelayUs;
-            totalBytes += it->mNumBytes;
-        }
-    }
-    mShortTermEstimate = totalTimeUs > 0 ?
-            (totalBytes * 8E6 / totalTimeUs) : *bandwidthBps;
-    if (shortTermBps) {
-        *shortTermBps = mShortTermEstimate;
-    }
-
-    int64_t minEstimate = -1, maxEstimate = -1;
-    List<int32_t>::iterator it;
-    for (it = mPrevEstimates.begin(); it != mPrevEstimates.end(); it++) {
-        int32_t estimate = *it;
-        if (minEstimate < 0 || minEstimate > estimate) {
-            minEstimate = estimate;
-        }
-        if (maxEstimate < 0 || maxEstimate < estimate) {
-            maxEstimate = estimate;
-        }
-    }
-    // consider it stable if long-term average is not jumping a lot
-    // and short-term average is not much lower than long-term average
-    mIsStable = (maxEstimate <= minEstimate * 4 / 3)
-            && mShortTermEstimate > minEstimate * 7 / 10;
-    if (isStable) {
-        *isStable = mIsStable;
-    }
-
-#if 0
-    {
-        char dumpStr[1024] = {0};
-        size_t itemIdx = 0;
-        size_t histSize = mBandwidthHistory.size();
-        sprintf(dumpStr, "estimate bps=%d stable=%d history (n=%d): {",
-            *bandwidthBps, mIsStable, histSize);
-        List<BandwidthEntry>::iterator it = mBandwidthHistory.begin();
-        for (; it != mBandwidthHistory.end(); ++it) {
-            if (itemIdx > 50) {
-                sprintf(dumpStr + strlen(dumpStr),
-                        "...(%zd more items)... }", histSize - itemIdx);
-                break;
-            }
-            sprintf(dumpStr + strlen(dumpStr), "%dk/%.3fs%s",
-                it->mNumBytes / 1024,
-                (double)it->mDelayUs * 1.0e-6,
-                (it == (--mBandwidthHistory.end())) ? "}" : ", ");
-            itemIdx++;
-        }
-        ALOGE(dumpStr);
-    }
-#endif
-    return true;
-}
-
 //static
 const char *LiveSession::getKeyForStream(StreamType type) {
     switch (type) {
@@ -286,7 +117,11 @@ LiveSession::LiveSession(
       mOrigBandwidthIndex(-1),
       mLastBandwidthBps(-1ll),
       mLastBandwidthStable(false),
-      mBandwidthEstimator(new BandwidthEstimator()),
+      mLastBufferedDurationUs(-1ll),
+      mTargetDurationUs(-1ll),
+      mNumUpSwitches(0),
+      mNumDownSwitches(0),
+      mNumFallbacks(0),
       mMaxWidth(720),
       mMaxHeight(480),
       mStreamMask(0),
@@ -313,6 +148,14 @@ LiveSession::LiveSession(
         mPacketSources.add(indexToType(i), new AnotherPacketSource(NULL /* meta */));
         mPacketSources2.add(indexToType(i), new AnotherPacketSource(NULL /* meta */));
     }
+
+    char value[PROPERTY_VALUE_MAX];
+    mBandwidthEstimator = BandwidthEstimator::Create(
+            property_get("media.httplive.abr-estimator", value, NULL) ? value : NULL);
+    mABRPolicy = ABRPolicy::Create(
+            property_get("media.httplive.abr-policy", value, NULL) ? value : NULL);
+    ALOGV("rate adaptation: estimator %s, policy %s",
+            mBandwidthEstimator->name(), mABRPolicy->name());
 }
 
 LiveSession::~LiveSession() {
@@ -732,6 +575,7 @@ void LiveSession::onMessageReceived(const sp<AMessage> &msg) {
                 {
                     int64_t targetDurationUs;
                     CHECK(msg->findInt64("targetDurationUs", &targetDurationUs));
+                    mTargetDurationUs = targetDurationUs;
                     mUpSwitchMark = min(kUpSwitchMarkUs, targetDurationUs * 7 / 4);
                     mDownSwitchMark = min(kDownSwitchMarkUs, targetDurationUs * 9 / 4);
                     mUpSwitchMargin = min(kUpSwitchMarginUs, targetDurationUs);
@@ -1329,121 +1173,70 @@ float LiveSession::getAbortThreshold(
 }
 
 void LiveSession::addBandwidthMeasurement(size_t numBytes, int64_t delayUs) {
-    mBandwidthEstimator->addBandwidthMeasurement(numBytes, delayUs);
+    mBandwidthEstimator->addBandwidthMeasurement(
+            numBytes, delayUs, ALooper::GetNowUs());
 }
 
-ssize_t LiveSession::getLowestValidBandwidthIndex() const {
-    for (size_t index = 0; index < mBandwidthItems.size(); index++) {
-        if (isBandwidthValid(mBandwidthItems[index])) {
-            return index;
-        }
+void LiveSession::getABRVariants(Vector<ABRPolicy::Variant> *variants) const {
+    variants->clear();
+    variants->setCapacity(mBandwidthItems.size());
+    for (size_t i = 0; i < mBandwidthItems.size(); ++i) {
+        ABRPolicy::Variant variant;
+        variant.mBandwidth = mBandwidthItems[i].mBandwidth;
+        variant.mValid = isBandwidthValid(mBandwidthItems[i]);
+        variants->push(variant);
     }
-    // if playlists are all blacklisted, return 0 and hope it's alive
-    return 0;
 }
 
-size_t LiveSession::getBandwidthIndex(int32_t bandwidthBps) {
-    if (mBandwidthItems.size() < 2) {
-        // shouldn't be here if we only have 1 bandwidth, check
-        // logic to get rid of redundant bandwidth polling
-        ALOGW("getBandwidthIndex() called for single bandwidth playlist!");
-        return 0;
-    }
-
-#if 1
-    char value[PROPERTY_VALUE_MAX];
-    ssize_t index = -1;
-    if (property_get("media.httplive.bw-index", value, NULL)) {
-        char *end;
-        index = strtol(value, &end, 10);
-        CHECK(end > value && *end == '\0');
-
-        if (index >= 0 && (size_t)index >= mBandwidthItems.size()) {
-            index = mBandwidthItems.size() - 1;
-        }
-    }
-
-    if (index < 0) {
-        char value[PROPERTY_VALUE_MAX];
-        if (property_get("media.httplive.max-bw", value, NULL)) {
-            char *end;
-            long maxBw = strtoul(value, &end, 10);
-            if (end > value && *end == '\0') {
-                if (maxBw > 0 && bandwidthBps > maxBw) {
-                    ALOGV("bandwidth capped to %ld bps", maxBw);
-                    bandwidthBps = maxBw;
-                }
-            }
-        }
+ssize_t LiveSession::getLowestValidBandwidthIndex() const {
+    Vector<ABRPolicy::Variant> variants;
+    getABRVariants(&variants);
+    return ABRPolicy::GetLowestValidIndex(variants);
+}
 
-        // Pick the highest bandwidth stream that's not currently blacklisted
-        // below or equal to estimated bandwidth.
-
-        index = mBandwidthItems.size() - 1;
-        ssize_t lowestBandwidth = getLowestValidBandwidthIndex();
-        while (index > lowestBandwidth) {
-            // be conservative (70%) to avoid overestimating and immediately
-            // switching down again.
-            size_t adjustedBandwidthBps = bandwidthBps * 7 / 10;
-            const BandwidthItem &item = mBandwidthItems[index];
-            if (item.mBandwidth <= adjustedBandwidthBps
-                    && isBandwidthValid(item)) {
-                break;
-            }
-            --index;
-        }
-    }
-#elif 0
-    // Change bandwidth at random()
-    size_t index = uniformRand() * mBandwidthItems.size();
-#elif 0
-    // There's a 50% chance to stay on the current bandwidth and
-    // a 50% chance to switch to the next higher bandwidth (wrapping around
-    // to lowest)
-    const size_t kMinIndex = 0;
-
-    static ssize_t mCurBandwidthIndex = -1;
-
-    size_t index;
-    if (mCurBandwidthIndex < 0) {
-        index = kMinIndex;
-    } else if (uniformRand() < 0.5) {
-        index = (size_t)mCurBandwidthIndex;
+void LiveSession::recordSwitch(size_t toIndex, ABRPolicy::SwitchReason reason) {
+    ABRPolicy::Switch entry;
+    entry.mTimeUs = ALooper::GetNowUs();
+    entry.mFromIndex = mCurBandwidthIndex;
+    entry.mToIndex = toIndex;
+    entry.mReason = reason;
+    entry.mBandwidthBps = mLastBandwidthBps;
+    entry.mBufferedDurationUs = mLastBufferedDurationUs;
+
+    ALOGI("switching variant %zu (%lu bps) => %zu (%lu bps): %s, "
+            "estimated %d bps, buffered %lld us",
+            entry.mFromIndex, mBandwidthItems[entry.mFromIndex].mBandwidth,
+            toIndex, mBandwidthItems[toIndex].mBandwidth,
+            ABRPolicy::ReasonToString(reason),
+            entry.mBandwidthBps, (long long)entry.mBufferedDurationUs);
+
+    AutoMutex autoLock(mABRMetricsLock);
+    if (reason == ABRPolicy::REASON_FALLBACK) {
+        ++mNumFallbacks;
+    } else if (toIndex > entry.mFromIndex) {
+        ++mNumUpSwitches;
     } else {
-        index = mCurBandwidthIndex + 1;
-        if (index == mBandwidthItems.size()) {
-            index = kMinIndex;
-        }
-    }
-    mCurBandwidthIndex = index;
-#elif 0
-    // Pick the highest bandwidth stream below or equal to 1.2 Mbit/sec
-
-    size_t index = mBandwidthItems.size() - 1;
-    while (index > 0 && mBandwidthItems.itemAt(index).mBandwidth > 1200000) {
-        --index;
+        ++mNumDownSwitches;
     }
-#elif 1
-    char value[PROPERTY_VALUE_MAX];
-    size_t index;
-    if (property_get("media.httplive.bw-index", value, NULL)) {
-        char *end;
-        index = strtoul(value, &end, 10);
-        CHECK(end > value && *end == '\0');
-
-        if (index >= mBandwidthItems.size()) {
-            index = mBandwidthItems.size() - 1;
-        }
-    } else {
-        index = 0;
+    mSwitchHistory.push_back(entry);
+    if (mSwitchHistory.size() > kMaxSwitchHistory) {
+        mSwitchHistory.erase(mSwitchHistory.begin());
     }
-#else
-    size_t index = mBandwidthItems.size() - 1;  // Highest bandwidth stream
-#endif
+}
 
-    CHECK_GE(index, 0);
+void LiveSession::getABRMetrics(ABRMetrics *metrics) const {
+    metrics->mEstimator = mBandwidthEstimator->name();
+    metrics->mPolicy = mABRPolicy->name();
 
-    return index;
+    AutoMutex autoLock(mABRMetricsLock);
+    metrics->mNumUpSwitches = mNumUpSwitches;
+    metrics->mNumDownSwitches = mNumDownSwitches;
+    metrics->mNumFallbacks = mNumFallbacks;
+    metrics->mSwitches.clear();
+    for (List<ABRPolicy::Switch>::const_iterator it = mSwitchHistory.begin();
+            it != mSwitchHistory.end(); ++it) {
+        metrics->mSwitches.push(*it);
+    }
 }
 
 HLSTime LiveSession::latestMediaSegmentStartTime() const {
@@ -2168,6 +1961,7 @@ bool LiveSession::checkBuffering(
     size_t activeCount, underflowCount, readyCount, downCount, upCount;
     activeCount = underflowCount = readyCount = downCount = upCount =0;
     int32_t minBufferPercent = -1;
+    int64_t minBufferedDurationUs = -1ll;
     int64_t durationUs;
     if (getDuration(&durationUs) != OK) {
         durationUs = -1;
@@ -2214,6 +2008,10 @@ bool LiveSession::checkBuffering(
             ++readyCount;
         }
         if (!mPacketSources[i]->isFinished(0)) {
+            if (minBufferedDurationUs < 0
+                    || bufferedDurationUs < minBufferedDurationUs) {
+                minBufferedDurationUs = bufferedDurationUs;
+            }
             if (bufferedDurationUs < kUnderflowMarkMs * 1000ll) {
                 ++underflowCount;
             }
@@ -2231,6 +2029,7 @@ bool LiveSession::checkBuffering(
     }
 
     if (activeCount > 0) {
+        mLastBufferedDurationUs = minBufferedDurationUs;
         up        = (upCount == activeCount);
         down      = (downCount > 0);
         ready     = (readyCount == activeCount);
@@ -2291,6 +2090,7 @@ bool LiveSession::tryBandwidthFallback() {
     }
     if (mCurBandwidthIndex > mOrigBandwidthIndex) {
         // if we're switching up, simply cancel and resume old variant
+        recordSwitch(mOrigBandwidthIndex, ABRPolicy::REASON_FALLBACK);
         cancelBandwidthSwitch(true /* resume */);
         return true;
     } else {
@@ -2299,6 +2099,7 @@ bool LiveSession::tryBandwidthFallback() {
         // not on that variant already.
         ssize_t lowestValid = getLowestValidBandwidthIndex();
         if (mCurBandwidthIndex > lowestValid) {
+            recordSwitch(lowestValid, ABRPolicy::REASON_FALLBACK);
             cancelBandwidthSwitch();
             changeConfiguration(-1ll, lowestValid);
             return true;
@@ -2339,42 +2140,70 @@ bool LiveSession::switchBandwidthIfNeeded(bool bufferHigh, bool bufferLow) {
         return false;
     }
 
-    int32_t curBandwidth = mBandwidthItems.itemAt(mCurBandwidthIndex).mBandwidth;
-    // canSwithDown and canSwitchUp can't both be true.
-    // we only want to switch up when measured bw is 120% higher than current variant,
-    // and we only want to switch down when measured bw is below current variant.
-    bool canSwitchDown = bufferLow
-            && (bandwidthBps < (int32_t)curBandwidth);
-    bool canSwitchUp = bufferHigh
-            && (bandwidthBps > (int32_t)curBandwidth * 12 / 10);
-
-    if (canSwitchDown || canSwitchUp) {
-        // bandwidth estimating has some delay, if we have to downswitch when
-        // it hasn't stabilized, use the short term to guess real bandwidth,
-        // since it may be dropping too fast.
-        // (note this doesn't apply to upswitch, always use longer average there)
-        if (!isStable && canSwitchDown) {
-            if (shortTermBps < bandwidthBps) {
-                bandwidthBps = shortTermBps;
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("media.httplive.bw-index", value, NULL)) {
+        // variant forced for debugging: move to it when the buffer level
+        // allows a switch in its direction, instead of adapting
+        char *end;
+        long index = strtol(value, &end, 10);
+        if (end > value && *end == '\0' && index >= 0) {
+            ssize_t forcedIndex = ((size_t)index >= mBandwidthItems.size())
+                    ? mBandwidthItems.size() - 1 : index;
+            if ((bufferHigh && forcedIndex > mCurBandwidthIndex)
+                    || (bufferLow && forcedIndex < mCurBandwidthIndex)) {
+                recordSwitch(forcedIndex, ABRPolicy::REASON_FORCED);
+                changeConfiguration(
+                        mInPreparationPhase ? 0 : -1ll, forcedIndex);
+                return true;
             }
+            return false;
         }
-
-        ssize_t bandwidthIndex = getBandwidthIndex(bandwidthBps);
-
-        // it's possible that we're checking for canSwitchUp case, but the returned
-        // bandwidthIndex is < mCurBandwidthIndex, as getBandwidthIndex() only uses 70%
-        // of measured bw. In that case we don't want to do anything, since we have
-        // both enough buffer and enough bw.
-        if ((canSwitchUp && bandwidthIndex > mCurBandwidthIndex)
-         || (canSwitchDown && bandwidthIndex < mCurBandwidthIndex)) {
-            // if not yet prepared, just restart again with new bw index.
-            // this is faster and playback experience is cleaner.
-            changeConfiguration(
-                    mInPreparationPhase ? 0 : -1ll, bandwidthIndex);
-            return true;
+    }
+    if (property_get("media.httplive.max-bw", value, NULL)) {
+        char *end;
+        long maxBw = strtoul(value, &end, 10);
+        if (end > value && *end == '\0' && maxBw > 0) {
+            if (bandwidthBps > maxBw) {
+                ALOGV("bandwidth capped to %ld bps", maxBw);
+                bandwidthBps = maxBw;
+            }
+            if (shortTermBps > maxBw) {
+                shortTermBps = maxBw;
+            }
         }
     }
-    return false;
+
+    // nothing left to fetch on any stream
+    if (mLastBufferedDurationUs < 0) {
+        return false;
+    }
+
+    Vector<ABRPolicy::Variant> variants;
+    getABRVariants(&variants);
+
+    ABRPolicy::State state;
+    state.mBandwidthBps = bandwidthBps;
+    state.mShortTermBps = shortTermBps;
+    state.mIsStable = isStable;
+    state.mBufferedDurationUs = mLastBufferedDurationUs;
+    state.mSegmentDurationUs = mTargetDurationUs;
+    state.mBufferHigh = bufferHigh;
+    state.mBufferLow = bufferLow;
+    state.mCurIndex = mCurBandwidthIndex;
+
+    ABRPolicy::SwitchReason reason;
+    ssize_t bandwidthIndex = mABRPolicy->selectVariant(variants, state, &reason);
+    if (bandwidthIndex < 0 || bandwidthIndex == mCurBandwidthIndex) {
+        return false;
+    }
+
+    recordSwitch(bandwidthIndex, reason);
+
+    // if not yet prepared, just restart again with new bw index.
+    // this is faster and playback experience is cleaner.
+    changeConfiguration(
+            mInPreparationPhase ? 0 : -1ll, bandwidthIndex);
+    return true;
 }
 
 void LiveSession::postError(status_t err) {
@@ -22,8 +22,10 @@
 #include <media/stagefright/foundation/AHandler.h>
 #include <media/mediaplayer.h>
 
+#include <utils/Mutex.h>
 #include <utils/String8.h>
 
+#include "RateAdaptation.h"
 #include "mpeg2ts/ATSParser.h"
 
 namespace android {
@@ -104,6 +106,19 @@ struct LiveSession : public AHandler {
     static const char *getNameForStream(StreamType type);
     static ATSParser::SourceType getSourceTypeForStream(StreamType type);
 
+    struct ABRMetrics {
+        const char *mEstimator;
+        const char *mPolicy;
+        size_t mNumUpSwitches;
+        size_t mNumDownSwitches;
+        size_t mNumFallbacks;
+        // last kMaxSwitchHistory switches, oldest first
+        Vector<ABRPolicy::Switch> mSwitches;
+    };
+
+    // Safe to call from any thread.
+    void getABRMetrics(ABRMetrics *metrics) const;
+
     enum {
         kWhatStreamsChanged,
         kWhatError,
@@ -141,10 +156,11 @@ private:
     static const int64_t kUpSwitchMarginUs;
     static const int64_t kResumeThresholdUs;
 
+    static const size_t kMaxSwitchHistory = 16;
+
     // Buffer Prepare/Ready/Underflow Marks
     BufferingSettings mBufferingSettings;
 
-    struct BandwidthEstimator;
     struct BandwidthItem {
         size_t mPlaylistIndex;
         unsigned long mBandwidth;
@@ -204,6 +220,15 @@ private:
     int32_t mLastBandwidthBps;
     bool mLastBandwidthStable;
     sp<BandwidthEstimator> mBandwidthEstimator;
+    sp<ABRPolicy> mABRPolicy;
+    int64_t mLastBufferedDurationUs;
+    int64_t mTargetDurationUs;
+
+    mutable Mutex mABRMetricsLock;
+    List<ABRPolicy::Switch> mSwitchHistory;
+    size_t mNumUpSwitches;
+    size_t mNumDownSwitches;
+    size_t mNumFallbacks;
 
     sp<M3UParser> mPlaylist;
     int32_t mMaxWidth;
@@ -271,8 +296,9 @@ private:
     float getAbortThreshold(
             ssize_t currentBWIndex, ssize_t targetBWIndex) const;
     void addBandwidthMeasurement(size_t numBytes, int64_t delayUs);
-    size_t getBandwidthIndex(int32_t bandwidthBps);
+    void getABRVariants(Vector<ABRPolicy::Variant> *variants) const;
     ssize_t getLowestValidBandwidthIndex() const;
+    void recordSwitch(size_t toIndex, ABRPolicy::SwitchReason reason);
     HLSTime latestMediaSegmentStartTime() const;
 
     static bool isBandwidthValid(const BandwidthItem &item);
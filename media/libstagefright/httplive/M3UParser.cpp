@@ -249,7 +249,8 @@ bool M3UParser::MediaGroup::getActiveURI(AString *uri, const char *baseURL) cons
 ////////////////////////////////////////////////////////////////////////////////
 
 M3UParser::M3UParser(
-        const char *baseURI, const void *data, size_t size)
+        const char *baseURI, const void *data, size_t size,
+        const sp<M3UParser> &previous)
     : mInitCheck(NO_INIT),
       mBaseURI(baseURI),
       mIsExtM3U(false),
@@ -262,7 +263,7 @@ M3UParser::M3UParser(
       mDiscontinuitySeq(0),
       mDiscontinuityCount(0),
       mSelectedIndex(-1) {
-    mInitCheck = parse(data, size);
+    mInitCheck = parse(data, size, previous);
 }
 
 M3UParser::~M3UParser() {
@@ -310,7 +311,7 @@ sp<AMessage> M3UParser::meta() {
 }
 
 size_t M3UParser::size() {
-    return mItems.size();
+    return mIsVariantPlaylist ? mItems.size() : mSegmentURIOffsets.size();
 }
 
 bool M3UParser::itemAt(size_t index, AString *uri, sp<AMessage> *meta) {
@@ -322,21 +323,87 @@ bool M3UParser::itemAt(size_t index, AString *uri, sp<AMessage> *meta) {
         *meta = NULL;
     }
 
-    if (index >= mItems.size()) {
+    if (index >= size()) {
         return false;
     }
 
+    if (mIsVariantPlaylist) {
+        if (uri) {
+            *uri = mItems.itemAt(index).makeURL(mBaseURI.c_str());
+        }
+
+        if (meta) {
+            *meta = mItems.itemAt(index).mMeta;
+        }
+
+        return true;
+    }
+
     if (uri) {
-        *uri = mItems.itemAt(index).makeURL(mBaseURI.c_str());
+        *uri = makeSegmentURL(index);
     }
 
     if (meta) {
-        *meta = mItems.itemAt(index).mMeta;
+        int32_t cipherIndex = mSegmentCipherIndices[index];
+        if (cipherIndex >= 0) {
+            *meta = mCipherInfos[cipherIndex]->dup();
+        } else {
+            *meta = new AMessage;
+        }
+
+        uint8_t flags = mSegmentFlags[index];
+        (*meta)->setInt64("durationUs", mSegmentDurationsUs[index]);
+        if (flags & kSegmentDiscontinuity) {
+            (*meta)->setInt32("discontinuity", true);
+        }
+        if (flags & kSegmentByteRange) {
+            (*meta)->setInt64("range-offset", mSegmentRangeOffsets[index]);
+            (*meta)->setInt64("range-length", mSegmentRangeLengths[index]);
+        }
+        (*meta)->setInt32("discontinuity-sequence", mSegmentDiscontinuitySeqs[index]);
     }
 
     return true;
 }
 
+int64_t M3UParser::getItemDurationUs(size_t index) const {
+    CHECK(!mIsVariantPlaylist);
+    CHECK_LT(index, mSegmentDurationsUs.size());
+    return mSegmentDurationsUs[index];
+}
+
+int64_t M3UParser::getItemStartTimeUs(size_t index) const {
+    CHECK(!mIsVariantPlaylist);
+    CHECK_LT(index, mSegmentStartTimesUs.size());
+    return mSegmentStartTimesUs[index];
+}
+
+int32_t M3UParser::getItemDiscontinuitySeq(size_t index) const {
+    CHECK(!mIsVariantPlaylist);
+    CHECK_LT(index, mSegmentDiscontinuitySeqs.size());
+    return mSegmentDiscontinuitySeqs[index];
+}
+
+sp<AMessage> M3UParser::getItemCipherInfo(size_t index) const {
+    CHECK(!mIsVariantPlaylist);
+    CHECK_LT(index, mSegmentCipherIndices.size());
+    for (ssize_t i = index; i >= 0; --i) {
+        int32_t cipherIndex = mSegmentCipherIndices[i];
+        if (cipherIndex >= 0 && mCipherInfos[cipherIndex]->contains("cipher-method")) {
+            return mCipherInfos[cipherIndex];
+        }
+    }
+    return NULL;
+}
+
+int64_t M3UParser::getTotalDurationUs() const {
+    size_t n = mSegmentDurationsUs.size();
+    if (n == 0) {
+        return 0;
+    }
+    return mSegmentStartTimesUs[n - 1] + mSegmentDurationsUs[n - 1];
+}
+
 void M3UParser::pickRandomMediaItems() {
     for (size_t i = 0; i < mMediaGroups.size(); ++i) {
         mMediaGroups.valueAt(i)->pickRandomMediaItems();
@@ -559,17 +626,163 @@ AString M3UParser::Item::makeURL(const char *baseURL) const {
     return out;
 }
 
+AString M3UParser::makeSegmentURL(size_t index) const {
+    AString out;
+    CHECK(MakeURL(mBaseURI.c_str(),
+            mSegmentURIData.array() + mSegmentURIOffsets[index], &out));
+    return out;
+}
+
+void M3UParser::appendSegment(
+        const char *uri, size_t uriLength, int64_t durationUs,
+        uint8_t flags, uint64_t rangeOffset, uint64_t rangeLength,
+        const sp<AMessage> &cipherInfo) {
+    int64_t startTimeUs = 0;
+    if (!mSegmentDurationsUs.isEmpty()) {
+        startTimeUs = mSegmentStartTimesUs.top() + mSegmentDurationsUs.top();
+    }
+
+    mSegmentURIOffsets.push(mSegmentURIData.size());
+    mSegmentURIData.appendArray(uri, uriLength);
+    mSegmentURIData.push('\0');
+    mSegmentDurationsUs.push(durationUs);
+    mSegmentStartTimesUs.push(startTimeUs);
+    mSegmentDiscontinuitySeqs.push(mDiscontinuitySeq + mDiscontinuityCount);
+    mSegmentFlags.push(flags);
+    mSegmentRangeOffsets.push(rangeOffset);
+    mSegmentRangeLengths.push(rangeLength);
+    if (cipherInfo != NULL) {
+        mSegmentCipherIndices.push(mCipherInfos.size());
+        mCipherInfos.push(cipherInfo);
+    } else {
+        mSegmentCipherIndices.push(-1);
+    }
+}
+
+// Called once the first segment of a media playlist is parsed, with |offset|
+// at the line following it. A segment keeps its media sequence number and
+// content for as long as it stays in a live playlist, so the segments after it
+// that |previous| already has are copied from there after checking that
+// their URIs match, skipping the lines describing them. Returns the offset of
+// the first line past the copied segments, or |offset| if none were copied.
+size_t M3UParser::copySegments(
+        const sp<M3UParser> &previous, const char *data, size_t size,
+        size_t offset, uint64_t *segmentRangeOffset) {
+    if (previous == NULL
+            || previous->mInitCheck != OK
+            || previous->mIsVariantPlaylist
+            || previous->mBaseURI != mBaseURI) {
+        return offset;
+    }
+
+    int32_t firstSeqNumber = 0;
+    if (mMeta != NULL) {
+        mMeta->findInt32("media-sequence", &firstSeqNumber);
+    }
+    size_t prevCount = previous->mSegmentURIOffsets.size();
+    if (firstSeqNumber < previous->mFirstSeqNumber
+            || (int64_t)firstSeqNumber - previous->mFirstSeqNumber >= (int64_t)prevCount) {
+        return offset;
+    }
+    size_t first = firstSeqNumber - previous->mFirstSeqNumber;
+    if (strcmp(mSegmentURIData.array(),
+            previous->mSegmentURIData.array() + previous->mSegmentURIOffsets[first])) {
+        return offset;
+    }
+
+    // match URI lines against the previous segments, other lines only
+    // carry the attributes of the segments.
+    size_t count = 0;
+    size_t end = offset;
+    while (first + 1 + count < prevCount && offset < size) {
+        const char *lineEnd = (const char *)memchr(&data[offset], '\n', size - offset);
+        size_t offsetLF = lineEnd != NULL ? lineEnd - data : size;
+        size_t length = offsetLF - offset;
+        if (length > 0 && data[offsetLF - 1] == '\r') {
+            --length;
+        }
+
+        if (length > 0 && data[offset] != '#') {
+            const char *uri = previous->mSegmentURIData.array()
+                    + previous->mSegmentURIOffsets[first + 1 + count];
+            if (strlen(uri) != length || memcmp(uri, &data[offset], length)) {
+                break;
+            }
+            ++count;
+            end = offsetLF + 1;
+        }
+        offset = offsetLF + 1;
+    }
+
+    if (count == 0) {
+        return end;
+    }
+
+    ALOGV("copying %zu segments from previous playlist", count);
+
+    size_t start = first + 1;
+    size_t last = first + count;
+    uint32_t uriBase = previous->mSegmentURIOffsets[start];
+    size_t uriEnd = last + 1 < prevCount
+            ? previous->mSegmentURIOffsets[last + 1] : previous->mSegmentURIData.size();
+    uint32_t uriOffset = mSegmentURIData.size();
+    mSegmentURIData.appendArray(
+            previous->mSegmentURIData.array() + uriBase, uriEnd - uriBase);
+
+    // the first segment was parsed with this playlist's attributes, the
+    // copied ones follow on from it.
+    int64_t startTimeDeltaUs =
+            mSegmentStartTimesUs[0] + mSegmentDurationsUs[0]
+            - previous->mSegmentStartTimesUs[start];
+    int32_t discontinuitySeqDelta =
+            mSegmentDiscontinuitySeqs[0] - previous->mSegmentDiscontinuitySeqs[first];
+
+    for (size_t i = start; i <= last; ++i) {
+        int32_t cipherIndex = previous->mSegmentCipherIndices[i];
+        if (cipherIndex >= 0) {
+            mCipherInfos.push(previous->mCipherInfos[cipherIndex]);
+            cipherIndex = mCipherInfos.size() - 1;
+        }
+        mSegmentURIOffsets.push(previous->mSegmentURIOffsets[i] - uriBase + uriOffset);
+        mSegmentDurationsUs.push(previous->mSegmentDurationsUs[i]);
+        mSegmentStartTimesUs.push(previous->mSegmentStartTimesUs[i] + startTimeDeltaUs);
+        mSegmentDiscontinuitySeqs.push(
+                previous->mSegmentDiscontinuitySeqs[i] + discontinuitySeqDelta);
+        mSegmentFlags.push(previous->mSegmentFlags[i]);
+        mSegmentRangeOffsets.push(previous->mSegmentRangeOffsets[i]);
+        mSegmentRangeLengths.push(previous->mSegmentRangeLengths[i]);
+        mSegmentCipherIndices.push(cipherIndex);
+    }
+
+    // pick up where the last copied segment left off
+    mDiscontinuityCount = mSegmentDiscontinuitySeqs.top() - mDiscontinuitySeq;
+    if (mSegmentFlags.top() & kSegmentByteRange) {
+        *segmentRangeOffset = mSegmentRangeOffsets.top() + mSegmentRangeLengths.top();
+    }
+
+    return end;
+}
+
 AString M3UParser::MediaGroup::Media::makeURL(const char *baseURL) const {
     AString out;
     CHECK(MakeURL(baseURL, mURI.c_str(), &out));
     return out;
 }
 
-status_t M3UParser::parse(const void *_data, size_t size) {
+status_t M3UParser::parse(
+        const void *_data, size_t size, const sp<M3UParser> &previous) {
     int32_t lineNo = 0;
 
+    // stream info of the next variant playlist item
     sp<AMessage> itemMeta;
 
+    // attributes of the next media playlist segment
+    bool hasSegmentDuration = false;
+    int64_t segmentDurationUs = 0;
+    uint8_t segmentFlags = 0;
+    uint64_t segmentRangeLength = 0, segmentRangeStart = 0;
+    sp<AMessage> cipherInfo;
+
     const char *data = (const char *)_data;
     size_t offset = 0;
     uint64_t segmentRangeOffset = 0;
@@ -614,7 +827,7 @@ status_t M3UParser::parse(const void *_data, size_t size) {
                 if (mIsVariantPlaylist) {
                     return ERROR_MALFORMED;
                 }
-                err = parseCipherInfo(line, &itemMeta, mBaseURI);
+                err = parseCipherInfo(line, &cipherInfo, mBaseURI);
             } else if (line.startsWith("#EXT-X-ENDLIST")) {
                 mIsComplete = true;
             } else if (line.startsWith("#EXT-X-PLAYLIST-TYPE:EVENT")) {
@@ -623,7 +836,8 @@ status_t M3UParser::parse(const void *_data, size_t size) {
                 if (mIsVariantPlaylist) {
                     return ERROR_MALFORMED;
                 }
-                err = parseMetaDataDuration(line, &itemMeta, "durationUs");
+                err = parseMetaDataDuration(line, &segmentDurationUs);
+                hasSegmentDuration = (err == OK);
             } else if (line.startsWith("#EXT-X-DISCONTINUITY-SEQUENCE")) {
                 if (mIsVariantPlaylist) {
                     return ERROR_MALFORMED;
@@ -640,13 +854,10 @@ status_t M3UParser::parse(const void *_data, size_t size) {
                 if (mIsVariantPlaylist) {
                     return ERROR_MALFORMED;
                 }
-                if (itemMeta == NULL) {
-                    itemMeta = new AMessage;
-                }
-                itemMeta->setInt32("discontinuity", true);
+                segmentFlags |= kSegmentDiscontinuity;
                 ++mDiscontinuityCount;
             } else if (line.startsWith("#EXT-X-STREAM-INF")) {
-                if (mMeta != NULL) {
+                if (mMeta != NULL || !mSegmentURIOffsets.isEmpty()) {
                     return ERROR_MALFORMED;
                 }
                 mIsVariantPlaylist = true;
@@ -660,12 +871,9 @@ status_t M3UParser::parse(const void *_data, size_t size) {
                 err = parseByteRange(line, segmentRangeOffset, &length, &offset);
 
                 if (err == OK) {
-                    if (itemMeta == NULL) {
-                        itemMeta = new AMessage;
-                    }
-
-                    itemMeta->setInt64("range-offset", offset);
-                    itemMeta->setInt64("range-length", length);
+                    segmentFlags |= kSegmentByteRange;
+                    segmentRangeStart = offset;
+                    segmentRangeLength = length;
 
                     segmentRangeOffset = offset + length;
                 }
@@ -679,27 +887,40 @@ status_t M3UParser::parse(const void *_data, size_t size) {
         }
 
         if (!line.startsWith("#")) {
-            if (itemMeta == NULL) {
-                ALOGV("itemMeta == NULL");
-                return ERROR_MALFORMED;
-            }
-            if (!mIsVariantPlaylist) {
-                int64_t durationUs;
-                if (!itemMeta->findInt64("durationUs", &durationUs)) {
+            if (mIsVariantPlaylist) {
+                if (itemMeta == NULL) {
+                    ALOGV("itemMeta == NULL");
                     return ERROR_MALFORMED;
                 }
-                itemMeta->setInt32("discontinuity-sequence",
-                        mDiscontinuitySeq + mDiscontinuityCount);
-            }
 
-            mItems.push();
-            Item *item = &mItems.editItemAt(mItems.size() - 1);
+                mItems.push();
+                Item *item = &mItems.editItemAt(mItems.size() - 1);
+
+                item->mURI = line;
+
+                item->mMeta = itemMeta;
+
+                itemMeta.clear();
+            } else {
+                if (!hasSegmentDuration) {
+                    return ERROR_MALFORMED;
+                }
 
-            item->mURI = line;
+                appendSegment(line.c_str(), line.size(), segmentDurationUs,
+                        segmentFlags, segmentRangeStart, segmentRangeLength,
+                        cipherInfo);
 
-            item->mMeta = itemMeta;
+                hasSegmentDuration = false;
+                segmentFlags = 0;
+                cipherInfo.clear();
 
-            itemMeta.clear();
+                if (mSegmentURIOffsets.size() == 1 && previous != NULL) {
+                    offset = copySegments(
+                            previous, data, size, offsetLF + 1, &segmentRangeOffset);
+                    ++lineNo;
+                    continue;
+                }
+            }
         }
 
         offset = offsetLF + 1;
@@ -722,7 +943,7 @@ status_t M3UParser::parse(const void *_data, size_t size) {
         if (mMeta != NULL) {
             mMeta->findInt32("media-sequence", &mFirstSeqNumber);
         }
-        mLastSeqNumber = mFirstSeqNumber + mItems.size() - 1;
+        mLastSeqNumber = mFirstSeqNumber + mSegmentURIOffsets.size() - 1;
     }
 
     for (size_t i = 0; i < mItems.size(); ++i) {
@@ -770,7 +991,7 @@ status_t M3UParser::parseMetaData(
 
 // static
 status_t M3UParser::parseMetaDataDuration(
-        const AString &line, sp<AMessage> *meta, const char *key) {
+        const AString &line, int64_t *durationUs) {
     ssize_t colonPos = line.find(":");
 
     if (colonPos < 0) {
@@ -784,10 +1005,7 @@ status_t M3UParser::parseMetaDataDuration(
         return err;
     }
 
-    if (meta->get() == NULL) {
-        *meta = new AMessage;
-    }
-    (*meta)->setInt64(key, (int64_t)(x * 1E6));
+    *durationUs = (int64_t)(x * 1E6);
 
     return OK;
 }
@@ -27,7 +27,11 @@
 namespace android {
 
 struct M3UParser : public RefBase {
-    M3UParser(const char *baseURI, const void *data, size_t size);
+    // If |previous| is an earlier version of the same media playlist, the
+    // segments the two have in common (by media sequence number) are copied
+    // from it instead of being parsed again.
+    M3UParser(const char *baseURI, const void *data, size_t size,
+              const sp<M3UParser> &previous = NULL);
 
     status_t initCheck() const;
 
@@ -45,6 +49,16 @@ struct M3UParser : public RefBase {
     size_t size();
     bool itemAt(size_t index, AString *uri, sp<AMessage> *meta = NULL);
 
+    // Media playlists only, cheaper than looking up the item meta.
+    int64_t getItemDurationUs(size_t index) const;
+    // sum of the durations of the items before |index|
+    int64_t getItemStartTimeUs(size_t index) const;
+    int32_t getItemDiscontinuitySeq(size_t index) const;
+    // the cipher info of the closest key tag with a method at or before
+    // |index|, NULL if none. Shared with the playlist, not to be modified.
+    sp<AMessage> getItemCipherInfo(size_t index) const;
+    int64_t getTotalDurationUs() const;
+
     void pickRandomMediaItems();
     status_t selectTrack(size_t index, bool select);
     size_t getTrackCount() const;
@@ -81,19 +95,50 @@ private:
     int32_t mDiscontinuityCount;
 
     sp<AMessage> mMeta;
+    // Variant playlist streams.
     Vector<Item> mItems;
     ssize_t mSelectedIndex;
 
+    enum SegmentFlags {
+        kSegmentDiscontinuity   = 1,
+        kSegmentByteRange       = 2,
+    };
+
+    // Media playlist segments, one entry each in the arrays below instead of
+    // an Item, as live playlists may hold thousands of them. itemAt() builds
+    // the meta when asked.
+    Vector<char> mSegmentURIData;           // NUL terminated, back to back
+    Vector<uint32_t> mSegmentURIOffsets;
+    Vector<int64_t> mSegmentDurationsUs;
+    Vector<int64_t> mSegmentStartTimesUs;
+    Vector<int32_t> mSegmentDiscontinuitySeqs;
+    Vector<uint8_t> mSegmentFlags;
+    Vector<uint64_t> mSegmentRangeOffsets;
+    Vector<uint64_t> mSegmentRangeLengths;
+    Vector<int32_t> mSegmentCipherIndices;  // into mCipherInfos, or -1
+    Vector<sp<AMessage> > mCipherInfos;
+
     // Media groups keyed by group ID.
     KeyedVector<AString, sp<MediaGroup> > mMediaGroups;
 
-    status_t parse(const void *data, size_t size);
+    status_t parse(const void *data, size_t size, const sp<M3UParser> &previous);
+
+    void appendSegment(
+            const char *uri, size_t uriLength, int64_t durationUs,
+            uint8_t flags, uint64_t rangeOffset, uint64_t rangeLength,
+            const sp<AMessage> &cipherInfo);
+
+    size_t copySegments(
+            const sp<M3UParser> &previous, const char *data, size_t size,
+            size_t offset, uint64_t *segmentRangeOffset);
+
+    AString makeSegmentURL(size_t index) const;
 
     static status_t parseMetaData(
             const AString &line, sp<AMessage> *meta, const char *key);
 
     static status_t parseMetaDataDuration(
-            const AString &line, sp<AMessage> *meta, const char *key);
+            const AString &line, int64_t *durationUs);
 
     status_t parseStreamInf(
             const AString &line, sp<AMessage> *meta) const;
@@ -23,6 +23,7 @@
 #include "HTTPDownloader.h"
 #include "LiveSession.h"
 #include "M3UParser.h"
+#include "SegmentPrefetcher.h"
 #include "include/ID3.h"
 #include "mpeg2ts/AnotherPacketSource.h"
 #include "mpeg2ts/HlsSampleDecryptor.h"
@@ -53,6 +54,10 @@ const int64_t PlaylistFetcher::kMinBufferedDurationUs = 30000000ll;
 const int64_t PlaylistFetcher::kMaxMonitorDelayUs = 3000000ll;
 // LCM of 188 (size of a TS packet) & 1k works well
 const int32_t PlaylistFetcher::kDownloadBlockSize = 47 * 1024;
+// Segments downloaded ahead of the current one, and how many bytes of them
+// may be held before the prefetcher waits for the fetcher to catch up.
+const int32_t PlaylistFetcher::kNumPrefetchSegments = 2;
+const size_t PlaylistFetcher::kMaxPrefetchBytes = 16 * 1024 * 1024;
 
 struct PlaylistFetcher::DownloadState : public RefBase {
     DownloadState();
@@ -140,6 +145,37 @@ void PlaylistFetcher::DownloadState::saveState(
     mLastSeqNumberInPlaylist = lastSeqNumberInPlaylist;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Segments are prefetched on an HTTP connection of their own.
+struct HTTPSegmentSource : public SegmentPrefetcher::Source {
+    explicit HTTPSegmentSource(const sp<HTTPDownloader> &downloader)
+        : mHTTPDownloader(downloader) {
+    }
+
+    virtual ssize_t fetchSegment(
+            const char *uri, int64_t rangeOffset, int64_t rangeLength, sp<ABuffer> *out) {
+        return mHTTPDownloader->fetchBlock(
+                uri, out, rangeOffset, rangeLength, 0 /* block_size */,
+                NULL /* actualURL */, true /* reconnect */);
+    }
+
+    virtual void disconnect() {
+        mHTTPDownloader->disconnect();
+    }
+
+    virtual void reconnect() {
+        mHTTPDownloader->reconnect();
+    }
+
+private:
+    sp<HTTPDownloader> mHTTPDownloader;
+
+    DISALLOW_EVIL_CONSTRUCTORS(HTTPSegmentSource);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 PlaylistFetcher::PlaylistFetcher(
         const sp<AMessage> &notify,
         const sp<LiveSession> &session,
@@ -177,12 +213,18 @@ PlaylistFetcher::PlaylistFetcher(
       mHasMetadata(false) {
     memset(mPlaylistHash, 0, sizeof(mPlaylistHash));
     mHTTPDownloader = mSession->getHTTPDownloader();
+    mPrefetcher = new SegmentPrefetcher(
+            new HTTPSegmentSource(mSession->getHTTPDownloader()),
+            kNumPrefetchSegments, kMaxPrefetchBytes);
 
     memset(mKeyData, 0, sizeof(mKeyData));
     memset(mAESInitVec, 0, sizeof(mAESInitVec));
 }
 
 PlaylistFetcher::~PlaylistFetcher() {
+    // The prefetcher thread exits on its own once its download, if any, is
+    // aborted; don't wait for it.
+    mPrefetcher->quit();
 }
 
 int32_t PlaylistFetcher::getFetcherID() const {
@@ -199,20 +241,7 @@ int64_t PlaylistFetcher::getSegmentStartTimeUs(int32_t seqNumber) const {
     CHECK_GE(seqNumber, firstSeqNumberInPlaylist);
     CHECK_LE(seqNumber, lastSeqNumberInPlaylist);
 
-    int64_t segmentStartUs = 0ll;
-    for (int32_t index = 0;
-            index < seqNumber - firstSeqNumberInPlaylist; ++index) {
-        sp<AMessage> itemMeta;
-        CHECK(mPlaylist->itemAt(
-                    index, NULL /* uri */, &itemMeta));
-
-        int64_t itemDurationUs;
-        CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-        segmentStartUs += itemDurationUs;
-    }
-
-    return segmentStartUs;
+    return mPlaylist->getItemStartTimeUs(seqNumber - firstSeqNumberInPlaylist);
 }
 
 int64_t PlaylistFetcher::getSegmentDurationUs(int32_t seqNumber) const {
@@ -225,15 +254,7 @@ int64_t PlaylistFetcher::getSegmentDurationUs(int32_t seqNumber) const {
     CHECK_GE(seqNumber, firstSeqNumberInPlaylist);
     CHECK_LE(seqNumber, lastSeqNumberInPlaylist);
 
-    int32_t index = seqNumber - firstSeqNumberInPlaylist;
-    sp<AMessage> itemMeta;
-    CHECK(mPlaylist->itemAt(
-                index, NULL /* uri */, &itemMeta));
-
-    int64_t itemDurationUs;
-    CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-    return itemDurationUs;
+    return mPlaylist->getItemDurationUs(seqNumber - firstSeqNumberInPlaylist);
 }
 
 int64_t PlaylistFetcher::delayUsToRefreshPlaylist() const {
@@ -257,13 +278,7 @@ int64_t PlaylistFetcher::delayUsToRefreshPlaylist() const {
         {
             size_t n = mPlaylist->size();
             if (n > 0) {
-                sp<AMessage> itemMeta;
-                CHECK(mPlaylist->itemAt(n - 1, NULL /* uri */, &itemMeta));
-
-                int64_t itemDurationUs;
-                CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-                minPlaylistAgeUs = itemDurationUs;
+                minPlaylistAgeUs = mPlaylist->getItemDurationUs(n - 1);
                 break;
             }
 
@@ -300,19 +315,10 @@ int64_t PlaylistFetcher::delayUsToRefreshPlaylist() const {
 status_t PlaylistFetcher::decryptBuffer(
         size_t playlistIndex, const sp<ABuffer> &buffer,
         bool first) {
-    sp<AMessage> itemMeta;
-    bool found = false;
+    // called for every block, the cipher info is looked up without building the item meta
+    sp<AMessage> itemMeta = mPlaylist->getItemCipherInfo(playlistIndex);
     AString method;
-
-    for (ssize_t i = playlistIndex; i >= 0; --i) {
-        AString uri;
-        CHECK(mPlaylist->itemAt(i, &uri, &itemMeta));
-
-        if (itemMeta->findString("cipher-method", &method)) {
-            found = true;
-            break;
-        }
-    }
+    bool found = itemMeta != NULL && itemMeta->findString("cipher-method", &method);
 
     // TODO: Revise this when we add support for KEYFORMAT
     // If method has changed (e.g., -> NONE); sufficient to check at the segment boundary
@@ -521,6 +527,7 @@ void PlaylistFetcher::setStoppingThreshold(float thresholdRatio, bool disconnect
     }
     if (disconnect) {
         mHTTPDownloader->disconnect();
+        mPrefetcher->disconnect();
     }
 }
 
@@ -531,9 +538,11 @@ void PlaylistFetcher::resetStoppingThreshold(bool disconnect) {
     }
     if (disconnect) {
         mHTTPDownloader->disconnect();
+        mPrefetcher->disconnect();
     } else {
         // allow reconnect
         mHTTPDownloader->reconnect();
+        mPrefetcher->reconnect();
     }
 }
 
@@ -775,6 +784,7 @@ status_t PlaylistFetcher::onStart(const sp<AMessage> &msg) {
         mSeqNumber = -1;
         mTimeChangeSignaled = false;
         mDownloadState->resetState();
+        mPrefetcher->clear();
     }
 
     postMonitorQueue();
@@ -802,6 +812,8 @@ void PlaylistFetcher::onStop(const sp<AMessage> &msg) {
     }
 
     mDownloadState->resetState();
+    mPrefetcher->clear();
+    mPrefetchedSegment.clear();
     mPacketSources.clear();
     mStreamTypeMask = 0;
 
@@ -923,7 +935,7 @@ status_t PlaylistFetcher::refreshPlaylist() {
     if (delayUsToRefreshPlaylist() <= 0) {
         bool unchanged;
         sp<M3UParser> playlist = mHTTPDownloader->fetchPlaylist(
-                mURI.c_str(), mPlaylistHash, &unchanged);
+                mURI.c_str(), mPlaylistHash, &unchanged, mPlaylist);
 
         if (playlist == NULL) {
             if (unchanged) {
@@ -1026,21 +1038,18 @@ void PlaylistFetcher::initSeqNumberForLiveStream(
     // start at least 3 target durations from the end.
     int64_t timeFromEnd = 0;
     size_t index = mPlaylist->size();
-    sp<AMessage> itemMeta;
-    int64_t itemDurationUs;
     int32_t targetDuration;
     if (mPlaylist->meta() != NULL
             && mPlaylist->meta()->findInt32("target-duration", &targetDuration)) {
         do {
-            --index;
-            if (!mPlaylist->itemAt(index, NULL /* uri */, &itemMeta)
-                    || !itemMeta->findInt64("durationUs", &itemDurationUs)) {
-                ALOGW("item or itemDurationUs missing");
+            if (index == 0) {
+                ALOGW("item missing");
                 mSeqNumber = lastSeqNumberInPlaylist - 3;
                 break;
             }
+            --index;
 
-            timeFromEnd += itemDurationUs;
+            timeFromEnd += mPlaylist->getItemDurationUs(index);
             mSeqNumber = firstSeqNumberInPlaylist + index;
         } while (timeFromEnd < targetDuration * 3E6 && index > 0);
     } else {
@@ -1321,6 +1330,7 @@ void PlaylistFetcher::onDownloadNext() {
     int32_t firstSeqNumberInPlaylist = 0;
     int32_t lastSeqNumberInPlaylist = 0;
     bool connectHTTP = true;
+    bool startSegment = true;
 
     if (mDownloadState->hasSavedState()) {
         mDownloadState->restoreState(
@@ -1330,7 +1340,9 @@ void PlaylistFetcher::onDownloadNext() {
                 tsBuffer,
                 firstSeqNumberInPlaylist,
                 lastSeqNumberInPlaylist);
-        connectHTTP = false;
+        // Nothing was read yet if the segment was waiting for the prefetcher.
+        startSegment = buffer == NULL;
+        connectHTTP = startSegment;
         FLOGV("resuming: '%s'", uri.c_str());
     } else {
         if (!initDownloadState(
@@ -1343,6 +1355,34 @@ void PlaylistFetcher::onDownloadNext() {
         FLOGV("fetching: '%s'", uri.c_str());
     }
 
+    if (startSegment) {
+        // Rather than block the looper on a segment still being prefetched,
+        // come back once its download completes.
+        sp<AMessage> notify = new AMessage(kWhatDownloadNext, this);
+        notify->setInt32("generation", mMonitorQueueGeneration);
+        int64_t downloadUs;
+        if (mPrefetcher->take(mSeqNumber, uri, notify, &mPrefetchedSegment, &downloadUs)
+                == WOULD_BLOCK) {
+            FLOGV("waiting for prefetched segment %d", mSeqNumber);
+            mDownloadState->saveState(
+                    uri,
+                    itemMeta,
+                    buffer,
+                    tsBuffer,
+                    firstSeqNumberInPlaylist,
+                    lastSeqNumberInPlaylist);
+            return;
+        }
+        if (mPrefetchedSegment != NULL) {
+            FLOGV("using prefetched segment %d (%zu bytes)",
+                    mSeqNumber, mPrefetchedSegment->size());
+            addBandwidthMeasurement(mPrefetchedSegment->size(), downloadUs);
+            prefetchSegments(firstSeqNumberInPlaylist, lastSeqNumberInPlaylist);
+        }
+        // Otherwise the next segments are prefetched once this one is
+        // downloaded, not to take bandwidth from it.
+    }
+
     int64_t range_offset, range_length;
     if (!itemMeta->findInt64("range-offset", &range_offset)
             || !itemMeta->findInt64("range-length", &range_length)) {
@@ -1355,9 +1395,13 @@ void PlaylistFetcher::onDownloadNext() {
     ssize_t bytesRead;
     do {
         int64_t startUs = ALooper::GetNowUs();
-        bytesRead = mHTTPDownloader->fetchBlock(
-                uri.c_str(), &buffer, range_offset, range_length, kDownloadBlockSize,
-                NULL /* actualURL */, connectHTTP);
+        if (mPrefetchedSegment != NULL) {
+            bytesRead = readPrefetchedBlock(&buffer);
+        } else {
+            bytesRead = mHTTPDownloader->fetchBlock(
+                    uri.c_str(), &buffer, range_offset, range_length, kDownloadBlockSize,
+                    NULL /* actualURL */, connectHTTP);
+        }
         int64_t delayUs = ALooper::GetNowUs() - startUs;
 
         if (bytesRead == ERROR_NOT_CONNECTED) {
@@ -1370,18 +1414,9 @@ void PlaylistFetcher::onDownloadNext() {
             return;
         }
 
-        // add sample for bandwidth estimation, excluding samples from subtitles (as
-        // its too small), or during startup/resumeUntil (when we could have more than
-        // one connection open which affects bandwidth)
-        if (!mStartup && mStopParams == NULL && bytesRead > 0
-                && (mStreamTypeMask
-                        & (LiveSession::STREAMTYPE_AUDIO
-                        | LiveSession::STREAMTYPE_VIDEO))) {
-            mSession->addBandwidthMeasurement(bytesRead, delayUs);
-            if (delayUs > 2000000ll) {
-                FLOGV("bytesRead %zd took %.2f seconds - abnormal bandwidth dip",
-                        bytesRead, (double)delayUs / 1.0e6);
-            }
+        // prefetched segments were measured as a whole when taken
+        if (mPrefetchedSegment == NULL) {
+            addBandwidthMeasurement(bytesRead, delayUs);
         }
 
         connectHTTP = false;
@@ -1462,6 +1497,10 @@ void PlaylistFetcher::onDownloadNext() {
         }
     } while (bytesRead != 0);
 
+    if (mPrefetchedSegment == NULL) {
+        prefetchSegments(firstSeqNumberInPlaylist, lastSeqNumberInPlaylist);
+    }
+
     if (bufferStartsWithTsSyncByte(buffer)) {
         // If we don't see a stream in the program table after fetching a full ts segment
         // mark it as nonexistent.
@@ -1527,6 +1566,7 @@ void PlaylistFetcher::onDownloadNext() {
     }
 
     ++mSeqNumber;
+    mPrefetchedSegment.clear();
 
     // if adapting, pause after found the next starting point
     if (mSeekMode != LiveSession::kSeekModeExactPosition && startUp != mStartup) {
@@ -1541,6 +1581,74 @@ void PlaylistFetcher::onDownloadNext() {
     }
 }
 
+void PlaylistFetcher::prefetchSegments(
+        int32_t firstSeqNumberInPlaylist, int32_t lastSeqNumberInPlaylist) {
+    // When resuming until a stopping point, the segments after the current one
+    // are likely not needed.
+    if (mStopParams != NULL || mPlaylist == NULL) {
+        return;
+    }
+
+    for (int32_t i = 1; i <= kNumPrefetchSegments; ++i) {
+        int32_t seqNumber = mSeqNumber + i;
+        if (seqNumber > lastSeqNumberInPlaylist) {
+            break;
+        }
+
+        AString uri;
+        sp<AMessage> itemMeta;
+        if (!mPlaylist->itemAt(seqNumber - firstSeqNumberInPlaylist, &uri, &itemMeta)) {
+            break;
+        }
+
+        int64_t rangeOffset, rangeLength;
+        if (!itemMeta->findInt64("range-offset", &rangeOffset)
+                || !itemMeta->findInt64("range-length", &rangeLength)) {
+            rangeOffset = 0;
+            rangeLength = -1;
+        }
+
+        if (!mPrefetcher->isRunning()) {
+            mPrefetcher->run("HLSPrefetcher");
+        }
+        mPrefetcher->prefetch(seqNumber, uri, rangeOffset, rangeLength);
+    }
+}
+
+// Makes the next block of the prefetched segment visible in buffer, the same
+// way HTTPDownloader::fetchBlock() would append it. Returns 0 at the end.
+ssize_t PlaylistFetcher::readPrefetchedBlock(sp<ABuffer> *buffer) {
+    if (*buffer == NULL) {
+        // The prefetched data is decrypted in place, mPrefetchedSegment keeps it alive.
+        *buffer = new ABuffer(mPrefetchedSegment->data(), mPrefetchedSegment->size());
+        (*buffer)->setRange(0, 0);
+    }
+
+    size_t size = (*buffer)->size();
+    size_t n = mPrefetchedSegment->size() - size;
+    if (n > (size_t)kDownloadBlockSize) {
+        n = kDownloadBlockSize;
+    }
+    (*buffer)->setRange(0, size + n);
+    return n;
+}
+
+void PlaylistFetcher::addBandwidthMeasurement(size_t numBytes, int64_t delayUs) {
+    // add sample for bandwidth estimation, excluding samples from subtitles (as
+    // its too small), or during startup/resumeUntil (when we could have more than
+    // one connection open which affects bandwidth)
+    if (!mStartup && mStopParams == NULL && numBytes > 0
+            && (mStreamTypeMask
+                    & (LiveSession::STREAMTYPE_AUDIO
+                    | LiveSession::STREAMTYPE_VIDEO))) {
+        mSession->addBandwidthMeasurement(numBytes, delayUs);
+        if (delayUs > 2000000ll) {
+            FLOGV("bytesRead %zu took %.2f seconds - abnormal bandwidth dip",
+                    numBytes, (double)delayUs / 1.0e6);
+        }
+    }
+}
+
 /*
  * returns true if we need to adjust mSeqNumber
  */
@@ -1571,26 +1679,14 @@ bool PlaylistFetcher::adjustSeqNumberWithAnchorTime(int64_t anchorTimeUs) {
         while (index > 0 && diffUs > maxDiffUs) {
             --index;
 
-            sp<AMessage> itemMeta;
-            CHECK(mPlaylist->itemAt(index, NULL /* uri */, &itemMeta));
-
-            int64_t itemDurationUs;
-            CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-            diffUs -= itemDurationUs;
+            diffUs -= mPlaylist->getItemDurationUs(index);
         }
     } else if (diffUs < minDiffUs) {
         while (index + 1 < (ssize_t) mPlaylist->size()
                 && diffUs < minDiffUs) {
             ++index;
 
-            sp<AMessage> itemMeta;
-            CHECK(mPlaylist->itemAt(index, NULL /* uri */, &itemMeta));
-
-            int64_t itemDurationUs;
-            CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-            diffUs += itemDurationUs;
+            diffUs += mPlaylist->getItemDurationUs(index);
         }
     }
 
@@ -1611,10 +1707,7 @@ int32_t PlaylistFetcher::getSeqNumberForDiscontinuity(size_t discontinuitySeq) c
 
     size_t index = 0;
     while (index < mPlaylist->size()) {
-        sp<AMessage> itemMeta;
-        CHECK(mPlaylist->itemAt( index, NULL /* uri */, &itemMeta));
-        size_t curDiscontinuitySeq;
-        CHECK(itemMeta->findInt32("discontinuity-sequence", (int32_t *)&curDiscontinuitySeq));
+        size_t curDiscontinuitySeq = mPlaylist->getItemDiscontinuitySeq(index);
         int32_t seqNumber = firstSeqNumberInPlaylist + index;
         if (curDiscontinuitySeq == discontinuitySeq) {
             return seqNumber;
@@ -1632,12 +1725,7 @@ int32_t PlaylistFetcher::getSeqNumberForTime(int64_t timeUs) const {
     size_t index = 0;
     int64_t segmentStartUs = 0;
     while (index < mPlaylist->size()) {
-        sp<AMessage> itemMeta;
-        CHECK(mPlaylist->itemAt(
-                    index, NULL /* uri */, &itemMeta));
-
-        int64_t itemDurationUs;
-        CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
+        int64_t itemDurationUs = mPlaylist->getItemDurationUs(index);
 
         if (timeUs < segmentStartUs + itemDurationUs) {
             break;
@@ -1726,15 +1814,13 @@ status_t PlaylistFetcher::extractAndQueueAccessUnitsFromTs(const sp<ABuffer> &bu
         mSampleAesKeyItemChanged = false;
     }
 
+    // Feed all the complete packets at once, the parser skips the PIDs it has
+    // no use for without parsing them.
     size_t offset = 0;
-    while (offset + 188 <= buffer->size()) {
-        status_t err = mTSParser->feedTSPacket(buffer->data() + offset, 188);
-
-        if (err != OK) {
-            return err;
-        }
-
-        offset += 188;
+    status_t feedErr = mTSParser->feedTSPackets(
+            buffer->data(), buffer->size() - buffer->size() % 188, NULL, &offset);
+    if (feedErr != OK) {
+        return feedErr;
     }
     // setRange to indicate consumed bytes.
     buffer->setRange(buffer->offset() + offset, buffer->size() - offset);
@@ -2208,17 +2294,7 @@ status_t PlaylistFetcher::extractAndQueueAccessUnits(
 }
 
 void PlaylistFetcher::updateDuration() {
-    int64_t durationUs = 0ll;
-    for (size_t index = 0; index < mPlaylist->size(); ++index) {
-        sp<AMessage> itemMeta;
-        CHECK(mPlaylist->itemAt(
-                    index, NULL /* uri */, &itemMeta));
-
-        int64_t itemDurationUs;
-        CHECK(itemMeta->findInt64("durationUs", &itemDurationUs));
-
-        durationUs += itemDurationUs;
-    }
+    int64_t durationUs = mPlaylist->getTotalDurationUs();
 
     sp<AMessage> msg = mNotify->dup();
     msg->setInt32("what", kWhatDurationUpdate);
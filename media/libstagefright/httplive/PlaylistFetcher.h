@@ -32,6 +32,7 @@ class DataSource;
 struct HTTPBase;
 struct LiveDataSource;
 struct M3UParser;
+struct SegmentPrefetcher;
 class String8;
 
 struct PlaylistFetcher : public AHandler {
@@ -109,6 +110,8 @@ private:
 
     static const int64_t kMaxMonitorDelayUs;
     static const int32_t kNumSkipFrames;
+    static const int32_t kNumPrefetchSegments;
+    static const size_t kMaxPrefetchBytes;
 
     static bool bufferStartsWithTsSyncByte(const sp<ABuffer>& buffer);
     static bool bufferStartsWithWebVTTMagicSequence(const sp<ABuffer>& buffer);
@@ -186,6 +189,12 @@ private:
 
     sp<DownloadState> mDownloadState;
 
+    // Downloads the segments after the current one in the background. If the
+    // current segment was prefetched, mPrefetchedSegment holds its data and
+    // onDownloadNext() reads its blocks from there instead of the network.
+    sp<SegmentPrefetcher> mPrefetcher;
+    sp<ABuffer> mPrefetchedSegment;
+
     bool mHasMetadata;
 
     // Set first to true if decrypting the first segment of a playlist segment. When
@@ -222,6 +231,9 @@ private:
     void onStop(const sp<AMessage> &msg);
     void onMonitorQueue();
     void onDownloadNext();
+    void prefetchSegments(int32_t firstSeqNumberInPlaylist, int32_t lastSeqNumberInPlaylist);
+    ssize_t readPrefetchedBlock(sp<ABuffer> *buffer);
+    void addBandwidthMeasurement(size_t numBytes, int64_t delayUs);
     void initSeqNumberForLiveStream(
             int32_t &firstSeqNumberInPlaylist,
             int32_t &lastSeqNumberInPlaylist);
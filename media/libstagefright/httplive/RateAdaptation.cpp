@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "RateAdaptation"
+#include <utils/Log.h>
+
+#include "RateAdaptation.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace android {
+
+// static
+sp<BandwidthEstimator> BandwidthEstimator::Create(const char *name) {
+    if (name != NULL && !strcmp(name, "ewma")) {
+        return new EWMABandwidthEstimator();
+    }
+    return new MovingAverageBandwidthEstimator();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MovingAverageBandwidthEstimator::MovingAverageBandwidthEstimator() :
+    mShortTermEstimate(0),
+    mHasNewSample(false),
+    mIsStable(true),
+    mTotalTransferTimeUs(0),
+    mTotalTransferBytes(0) {
+}
+
+void MovingAverageBandwidthEstimator::addBandwidthMeasurement(
+        size_t numBytes, int64_t delayUs, int64_t nowUs) {
+    AutoMutex autoLock(mLock);
+
+    BandwidthEntry entry;
+    entry.mTimestampUs = nowUs;
+    entry.mDelayUs = delayUs;
+    entry.mNumBytes = numBytes;
+    mTotalTransferTimeUs += delayUs;
+    mTotalTransferBytes += numBytes;
+    mBandwidthHistory.push_back(entry);
+    mHasNewSample = true;
+
+    // Remove no more than 10% of total transfer time at a time
+    // to avoid sudden jump on bandwidth estimation. There might
+    // be long blocking reads that takes up signification time,
+    // we have to keep a longer window in that case.
+    int64_t bandwidthHistoryWindowUs = mTotalTransferTimeUs * 9 / 10;
+    if (bandwidthHistoryWindowUs < kMinBandwidthHistoryWindowUs) {
+        bandwidthHistoryWindowUs = kMinBandwidthHistoryWindowUs;
+    } else if (bandwidthHistoryWindowUs > kMaxBandwidthHistoryWindowUs) {
+        bandwidthHistoryWindowUs = kMaxBandwidthHistoryWindowUs;
+    }
+    // trim old samples, keeping at least kMaxBandwidthHistoryItems samples,
+    // and total transfer time at least kMaxBandwidthHistoryWindowUs.
+    while (mBandwidthHistory.size() > kMinBandwidthHistoryItems) {
+        List<BandwidthEntry>::iterator it = mBandwidthHistory.begin();
+        // remove sample if either absolute age or total transfer time is
+        // over kMaxBandwidthHistoryWindowUs
+        if (nowUs - it->mTimestampUs < kMaxBandwidthHistoryAgeUs &&
+                mTotalTransferTimeUs - it->mDelayUs < bandwidthHistoryWindowUs) {
+            break;
+        }
+        mTotalTransferTimeUs -= it->mDelayUs;
+        mTotalTransferBytes -= it->mNumBytes;
+        mBandwidthHistory.erase(mBandwidthHistory.begin());
+    }
+}
+
+bool MovingAverageBandwidthEstimator::estimateBandwidth(
+        int32_t *bandwidthBps, bool *isStable, int32_t *shortTermBps) {
+    AutoMutex autoLock(mLock);
+
+    if (mBandwidthHistory.size() < 2) {
+        return false;
+    }
+
+    if (!mHasNewSample) {
+        *bandwidthBps = *(--mPrevEstimates.end());
+        if (isStable) {
+            *isStable = mIsStable;
+        }
+        if (shortTermBps) {
+            *shortTermBps = mShortTermEstimate;
+        }
+        return true;
+    }
+
+    *bandwidthBps = ((double)mTotalTransferBytes * 8E6 / mTotalTransferTimeUs);
+    mPrevEstimates.push_back(*bandwidthBps);
+    while (mPrevEstimates.size() > 3) {
+        mPrevEstimates.erase(mPrevEstimates.begin());
+    }
+    mHasNewSample = false;
+
+    int64_t totalTimeUs = 0;
+    size_t totalBytes = 0;
+    if (mBandwidthHistory.size() >= kShortTermBandwidthItems) {
+        List<BandwidthEntry>::iterator it = --mBandwidthHistory.end();
+        for (size_t i = 0; i < kShortTermBandwidthItems; i++, it--) {
+            totalTimeUs += it->mDelayUs;
+            totalBytes += it->mNumBytes;
+        }
+    }
+    mShortTermEstimate = totalTimeUs > 0 ?
+            (totalBytes * 8E6 / totalTimeUs) : *bandwidthBps;
+    if (shortTermBps) {
+        *shortTermBps = mShortTermEstimate;
+    }
+
+    int64_t minEstimate = -1, maxEstimate = -1;
+    List<int32_t>::iterator it;
+    for (it = mPrevEstimates.begin(); it != mPrevEstimates.end(); it++) {
+        int32_t estimate = *it;
+        if (minEstimate < 0 || minEstimate > estimate) {
+            minEstimate = estimate;
+        }
+        if (maxEstimate < 0 || maxEstimate < estimate) {
+            maxEstimate = estimate;
+        }
+    }
+    // consider it stable if long-term average is not jumping a lot
+    // and short-term average is not much lower than long-term average
+    mIsStable = (maxEstimate <= minEstimate * 4 / 3)
+            && mShortTermEstimate > minEstimate * 7 / 10;
+    if (isStable) {
+        *isStable = mIsStable;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+EWMABandwidthEstimator::EWMABandwidthEstimator() :
+    mNumSamples(0),
+    mFastBps(0.0),
+    mSlowBps(0.0),
+    mSlowVariance(0.0) {
+}
+
+void EWMABandwidthEstimator::addBandwidthMeasurement(
+        size_t numBytes, int64_t delayUs, int64_t /* nowUs */) {
+    if (delayUs <= 0) {
+        return;
+    }
+
+    AutoMutex autoLock(mLock);
+
+    double bps = numBytes * 8E6 / delayUs;
+    if (mNumSamples++ == 0) {
+        mFastBps = mSlowBps = bps;
+        mSlowVariance = 0.0;
+        return;
+    }
+
+    // a sample that took t to transfer weighs as much as t worth of smaller
+    // samples, e.g. alpha is 0.5 for a sample as long as the half life.
+    double fastAlpha = 1.0 - exp2(-(double)delayUs / kFastHalfLifeUs);
+    double slowAlpha = 1.0 - exp2(-(double)delayUs / kSlowHalfLifeUs);
+
+    mFastBps += fastAlpha * (bps - mFastBps);
+
+    double diff = bps - mSlowBps;
+    double increment = slowAlpha * diff;
+    mSlowBps += increment;
+    mSlowVariance = (1.0 - slowAlpha) * (mSlowVariance + diff * increment);
+}
+
+bool EWMABandwidthEstimator::estimateBandwidth(
+        int32_t *bandwidthBps, bool *isStable, int32_t *shortTermBps) {
+    AutoMutex autoLock(mLock);
+
+    if (mNumSamples < 2) {
+        return false;
+    }
+
+    *bandwidthBps = (int32_t)(mFastBps < mSlowBps ? mFastBps : mSlowBps);
+    if (shortTermBps) {
+        *shortTermBps = (int32_t)mFastBps;
+    }
+    if (isStable) {
+        *isStable = sqrt(mSlowVariance) <= kMaxStableDeviation * mSlowBps;
+    }
+    ALOGV("estimate %d bps: fast %.0f slow %.0f deviation %.0f",
+            *bandwidthBps, mFastBps, mSlowBps, sqrt(mSlowVariance));
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// static
+sp<ABRPolicy> ABRPolicy::Create(const char *name) {
+    if (name != NULL && !strcmp(name, "buffer")) {
+        return new BufferABRPolicy();
+    }
+    return new ThroughputABRPolicy();
+}
+
+// static
+const char *ABRPolicy::ReasonToString(SwitchReason reason) {
+    switch (reason) {
+        case REASON_NONE:           return "none";
+        case REASON_BANDWIDTH_UP:   return "bandwidth-up";
+        case REASON_BANDWIDTH_DOWN: return "bandwidth-down";
+        case REASON_BUFFER_UP:      return "buffer-up";
+        case REASON_BUFFER_DOWN:    return "buffer-down";
+        case REASON_FALLBACK:       return "fallback";
+        case REASON_FORCED:         return "forced";
+        default:                    return "unknown";
+    }
+}
+
+// static
+size_t ABRPolicy::GetLowestValidIndex(const Vector<Variant> &variants) {
+    for (size_t index = 0; index < variants.size(); index++) {
+        if (variants[index].mValid) {
+            return index;
+        }
+    }
+    // if variants are all blacklisted, return 0 and hope it's alive
+    return 0;
+}
+
+// static
+size_t ABRPolicy::GetIndexForBandwidth(
+        const Vector<Variant> &variants, int32_t bandwidthBps) {
+    // Pick the highest bandwidth stream that's not currently blacklisted
+    // below or equal to estimated bandwidth.
+    ssize_t index = variants.size() - 1;
+    ssize_t lowestBandwidth = GetLowestValidIndex(variants);
+    while (index > lowestBandwidth) {
+        // be conservative (70%) to avoid overestimating and immediately
+        // switching down again.
+        size_t adjustedBandwidthBps = bandwidthBps * 7 / 10;
+        const Variant &variant = variants[index];
+        if ((size_t)variant.mBandwidth <= adjustedBandwidthBps && variant.mValid) {
+            break;
+        }
+        --index;
+    }
+    return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ssize_t ThroughputABRPolicy::selectVariant(
+        const Vector<Variant> &variants, const State &state, SwitchReason *reason) {
+    *reason = REASON_NONE;
+
+    int32_t bandwidthBps = state.mBandwidthBps;
+    int32_t curBandwidth = variants[state.mCurIndex].mBandwidth;
+    // canSwithDown and canSwitchUp can't both be true.
+    // we only want to switch up when measured bw is 120% higher than current variant,
+    // and we only want to switch down when measured bw is below current variant.
+    bool canSwitchDown = state.mBufferLow
+            && (bandwidthBps < curBandwidth);
+    bool canSwitchUp = state.mBufferHigh
+            && (bandwidthBps > curBandwidth * 12 / 10);
+
+    if (!canSwitchDown && !canSwitchUp) {
+        return -1;
+    }
+
+    // bandwidth estimating has some delay, if we have to downswitch when
+    // it hasn't stabilized, use the short term to guess real bandwidth,
+    // since it may be dropping too fast.
+    // (note this doesn't apply to upswitch, always use longer average there)
+    if (!state.mIsStable && canSwitchDown) {
+        if (state.mShortTermBps < bandwidthBps) {
+            bandwidthBps = state.mShortTermBps;
+        }
+    }
+
+    size_t index = GetIndexForBandwidth(variants, bandwidthBps);
+
+    // it's possible that we're checking for canSwitchUp case, but the returned
+    // index is < mCurIndex, as GetIndexForBandwidth() only uses 70% of measured
+    // bw. In that case we don't want to do anything, since we have both enough
+    // buffer and enough bw.
+    if (canSwitchUp && index > state.mCurIndex) {
+        *reason = REASON_BANDWIDTH_UP;
+        return index;
+    }
+    if (canSwitchDown && index < state.mCurIndex) {
+        *reason = REASON_BANDWIDTH_DOWN;
+        return index;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ssize_t BufferABRPolicy::selectVariant(
+        const Vector<Variant> &variants, const State &state, SwitchReason *reason) {
+    *reason = REASON_NONE;
+
+    if (state.mSegmentDurationUs <= 0) {
+        return -1;
+    }
+
+    const size_t lowest = GetLowestValidIndex(variants);
+    const double minBandwidth = variants[lowest].mBandwidth > 0
+            ? variants[lowest].mBandwidth : 1;
+    const double maxUtility = log(variants[variants.size() - 1].mBandwidth / minBandwidth);
+
+    // buffer levels in segments
+    double bufferMax = (double)kMaxBufferUs / state.mSegmentDurationUs;
+    if (bufferMax < 2.0) {
+        bufferMax = 2.0;
+    }
+    const double buffer = (double)state.mBufferedDurationUs / state.mSegmentDurationUs;
+    const double v = (bufferMax - 1.0) / (maxUtility + kGammaP);
+
+    size_t best = lowest;
+    double bestScore = 0.0;
+    for (size_t i = lowest; i < variants.size(); ++i) {
+        if (!variants[i].mValid && i != lowest) {
+            continue;
+        }
+        double bandwidth = variants[i].mBandwidth > 0 ? variants[i].mBandwidth : 1;
+        double utility = log(bandwidth / minBandwidth);
+        double score = (v * (utility + kGammaP) - buffer) / bandwidth;
+        if (i == lowest || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+
+    ALOGV("buffer %.2f of %.2f segments: variant %zu (current %zu)",
+            buffer, bufferMax, best, state.mCurIndex);
+
+    if (best < state.mCurIndex) {
+        *reason = REASON_BUFFER_DOWN;
+        return best;
+    }
+    if (best > state.mCurIndex && state.mBufferHigh) {
+        size_t cap = GetIndexForBandwidth(variants, state.mBandwidthBps);
+        if (best > cap) {
+            best = cap;
+        }
+        if (best > state.mCurIndex) {
+            *reason = REASON_BUFFER_UP;
+            return best;
+        }
+    }
+    return -1;
+}
+
+}  // namespace android
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RATE_ADAPTATION_H_
+
+#define RATE_ADAPTATION_H_
+
+#include <media/stagefright/foundation/ABase.h>
+#include <utils/List.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// Rate adaptation for LiveSession, split in two pluggable parts: a bandwidth
+// estimator fed with download samples, and a policy picking the variant to
+// play from the estimate and the buffer level. Neither depends on LiveSession,
+// so that they can be exercised offline (see tests/ABRSimulator.cpp).
+
+struct BandwidthEstimator : public RefBase {
+    // Thread safe, fetchers add samples from their own looper.
+    virtual void addBandwidthMeasurement(
+            size_t numBytes, int64_t delayUs, int64_t nowUs) = 0;
+
+    // Returns false until there are enough samples for an estimate. isStable
+    // is false if the estimate is fluctuating, and shortTermBps reacts faster
+    // to changes than bandwidthBps.
+    virtual bool estimateBandwidth(
+            int32_t *bandwidthBps,
+            bool *isStable = NULL,
+            int32_t *shortTermBps = NULL) = 0;
+
+    virtual const char *name() const = 0;
+
+    // "average" (the default, also used for unknown names) or "ewma".
+    static sp<BandwidthEstimator> Create(const char *name);
+
+protected:
+    BandwidthEstimator() {}
+    virtual ~BandwidthEstimator() {}
+
+private:
+    DISALLOW_EVIL_CONSTRUCTORS(BandwidthEstimator);
+};
+
+// Average bandwidth over a window of recent samples, 5 to 30 seconds of
+// transfer time.
+struct MovingAverageBandwidthEstimator : public BandwidthEstimator {
+    MovingAverageBandwidthEstimator();
+
+    virtual void addBandwidthMeasurement(
+            size_t numBytes, int64_t delayUs, int64_t nowUs);
+    virtual bool estimateBandwidth(
+            int32_t *bandwidthBps,
+            bool *isStable = NULL,
+            int32_t *shortTermBps = NULL);
+    virtual const char *name() const { return "average"; }
+
+private:
+    // Bandwidth estimation parameters
+    static const int32_t kShortTermBandwidthItems = 3;
+    static const int32_t kMinBandwidthHistoryItems = 20;
+    static const int64_t kMinBandwidthHistoryWindowUs = 5000000ll; // 5 sec
+    static const int64_t kMaxBandwidthHistoryWindowUs = 30000000ll; // 30 sec
+    static const int64_t kMaxBandwidthHistoryAgeUs = 60000000ll; // 60 sec
+
+    struct BandwidthEntry {
+        int64_t mTimestampUs;
+        int64_t mDelayUs;
+        size_t mNumBytes;
+    };
+
+    Mutex mLock;
+    List<BandwidthEntry> mBandwidthHistory;
+    List<int32_t> mPrevEstimates;
+    int32_t mShortTermEstimate;
+    bool mHasNewSample;
+    bool mIsStable;
+    int64_t mTotalTransferTimeUs;
+    size_t mTotalTransferBytes;
+
+    DISALLOW_EVIL_CONSTRUCTORS(MovingAverageBandwidthEstimator);
+};
+
+// Exponentially weighted moving averages of the throughput, weighted by the
+// transfer time of each sample: a fast one as the short term estimate, and a
+// slow one whose variance decides stability. The estimate is the lower of the
+// two, so it drops quickly and recovers slowly.
+struct EWMABandwidthEstimator : public BandwidthEstimator {
+    EWMABandwidthEstimator();
+
+    virtual void addBandwidthMeasurement(
+            size_t numBytes, int64_t delayUs, int64_t nowUs);
+    virtual bool estimateBandwidth(
+            int32_t *bandwidthBps,
+            bool *isStable = NULL,
+            int32_t *shortTermBps = NULL);
+    virtual const char *name() const { return "ewma"; }
+
+private:
+    static const int64_t kFastHalfLifeUs = 2000000ll;
+    static const int64_t kSlowHalfLifeUs = 8000000ll;
+    // standard deviation over mean of the slow average above which the
+    // estimate is not stable
+    static constexpr double kMaxStableDeviation = 0.25;
+
+    Mutex mLock;
+    size_t mNumSamples;
+    double mFastBps;
+    double mSlowBps;
+    double mSlowVariance;
+
+    DISALLOW_EVIL_CONSTRUCTORS(EWMABandwidthEstimator);
+};
+
+struct ABRPolicy : public RefBase {
+    enum SwitchReason {
+        REASON_NONE,
+        REASON_BANDWIDTH_UP,    // buffer is high, measured bandwidth allows more
+        REASON_BANDWIDTH_DOWN,  // buffer is low, measured bandwidth is too low
+        REASON_BUFFER_UP,       // buffer level calls for a higher bitrate
+        REASON_BUFFER_DOWN,     // buffer level calls for a lower bitrate
+        REASON_FALLBACK,        // variant failed, fall back to a lower one
+        REASON_FORCED,          // variant forced by media.httplive.bw-index
+    };
+
+    struct Variant {
+        int32_t mBandwidth;
+        bool mValid;    // false if blacklisted after a failure
+    };
+
+    // What the policy decides from, sampled when LiveSession polls buffering.
+    struct State {
+        int32_t mBandwidthBps;
+        int32_t mShortTermBps;
+        bool mIsStable;
+        int64_t mBufferedDurationUs;    // lowest of the active streams
+        int64_t mSegmentDurationUs;     // target duration of the playlist
+        bool mBufferHigh;               // above the up switch mark
+        bool mBufferLow;                // below the down switch mark
+        size_t mCurIndex;
+    };
+
+    // A variant switch, as reported in the metrics.
+    struct Switch {
+        int64_t mTimeUs;
+        size_t mFromIndex;
+        size_t mToIndex;
+        SwitchReason mReason;
+        int32_t mBandwidthBps;
+        int64_t mBufferedDurationUs;
+    };
+
+    // Returns the variant to switch to, or -1 to stay on mCurIndex. Variants
+    // are sorted by increasing bandwidth; the lowest valid one is always a
+    // candidate, even if blacklisted ones are all there is.
+    virtual ssize_t selectVariant(
+            const Vector<Variant> &variants, const State &state,
+            SwitchReason *reason) = 0;
+
+    virtual const char *name() const = 0;
+
+    // "throughput" (the default, also used for unknown names) or "buffer".
+    static sp<ABRPolicy> Create(const char *name);
+
+    static const char *ReasonToString(SwitchReason reason);
+
+    // Highest valid variant whose bandwidth is at most 70% of bandwidthBps.
+    static size_t GetIndexForBandwidth(
+            const Vector<Variant> &variants, int32_t bandwidthBps);
+    static size_t GetLowestValidIndex(const Vector<Variant> &variants);
+
+protected:
+    ABRPolicy() {}
+    virtual ~ABRPolicy() {}
+
+private:
+    DISALLOW_EVIL_CONSTRUCTORS(ABRPolicy);
+};
+
+// Switches up when the buffer is high and the bandwidth is 120% of the current
+// variant, down when the buffer is low and the bandwidth below the current
+// variant, using the short term estimate if the bandwidth is not stable.
+struct ThroughputABRPolicy : public ABRPolicy {
+    ThroughputABRPolicy() {}
+
+    virtual ssize_t selectVariant(
+            const Vector<Variant> &variants, const State &state,
+            SwitchReason *reason);
+    virtual const char *name() const { return "throughput"; }
+};
+
+// BOLA (Spiteri et al., "BOLA: Near-Optimal Bitrate Adaptation for Online
+// Videos"): picks the variant maximizing (V * (utility + gamma) - Q) / size,
+// with Q the buffer level in segments and utility the log of the bitrate
+// relative to the lowest one, so the bitrate follows the buffer level. Up
+// switches are capped by the throughput, since a switch restarts fetching.
+struct BufferABRPolicy : public ABRPolicy {
+    BufferABRPolicy() {}
+
+    virtual ssize_t selectVariant(
+            const Vector<Variant> &variants, const State &state,
+            SwitchReason *reason);
+    virtual const char *name() const { return "buffer"; }
+
+private:
+    // buffer level the highest variant is picked at, as fetchers stop
+    // fetching above PlaylistFetcher::kMinBufferedDurationUs
+    static const int64_t kMaxBufferUs = 30000000ll;
+    // gamma * segment duration, favors rebuffering avoidance over bitrate
+    static constexpr double kGammaP = 5.0;
+};
+
+}  // namespace android
+
+#endif  // RATE_ADAPTATION_H_
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SegmentPrefetcher"
+#include <utils/Log.h>
+
+#include "SegmentPrefetcher.h"
+
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+
+namespace android {
+
+SegmentPrefetcher::SegmentPrefetcher(
+        const sp<Source> &source, size_t maxSegments, size_t maxBytes)
+    : Thread(false /* canCallJava */),
+      mSource(source),
+      mMaxSegments(maxSegments),
+      mMaxBytes(maxBytes),
+      mBytesPrefetched(0),
+      mGeneration(0) {
+}
+
+SegmentPrefetcher::~SegmentPrefetcher() {
+}
+
+void SegmentPrefetcher::prefetch(
+        int32_t seqNumber, const AString &uri,
+        int64_t rangeOffset, int64_t rangeLength) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mSegments.size() >= mMaxSegments
+            || (!mSegments.empty() && (*--mSegments.end()).mSeqNumber >= seqNumber)) {
+        return;
+    }
+
+    Segment segment;
+    segment.mSeqNumber = seqNumber;
+    segment.mURI = uri;
+    segment.mRangeOffset = rangeOffset;
+    segment.mRangeLength = rangeLength;
+    segment.mStarted = false;
+    segment.mDone = false;
+    segment.mDownloadUs = 0;
+    mSegments.push_back(segment);
+    mCondition.broadcast();
+}
+
+status_t SegmentPrefetcher::take(
+        int32_t seqNumber, const AString &uri, const sp<AMessage> &notify,
+        sp<ABuffer> *data, int64_t *downloadUs) {
+    Mutex::Autolock autoLock(mLock);
+    data->clear();
+
+    while (!mSegments.empty() && (*mSegments.begin()).mSeqNumber < seqNumber) {
+        List<Segment>::iterator it = mSegments.begin();
+        if ((*it).mData != NULL) {
+            mBytesPrefetched -= (*it).mData->size();
+        }
+        mSegments.erase(it);
+        mCondition.broadcast();
+    }
+
+    if (mSegments.empty() || (*mSegments.begin()).mSeqNumber != seqNumber) {
+        return OK;
+    }
+
+    List<Segment>::iterator it = mSegments.begin();
+    if ((*it).mStarted && !(*it).mDone) {
+        (*it).mNotify = notify;
+        return WOULD_BLOCK;
+    }
+
+    *downloadUs = (*it).mDownloadUs;
+    if ((*it).mData != NULL) {
+        mBytesPrefetched -= (*it).mData->size();
+        // the playlist may have changed since the segment was queued
+        if ((*it).mURI == uri) {
+            *data = (*it).mData;
+        }
+    }
+    mSegments.erase(it);
+    mCondition.broadcast();
+    return OK;
+}
+
+void SegmentPrefetcher::clear() {
+    Mutex::Autolock autoLock(mLock);
+    mSegments.clear();
+    mBytesPrefetched = 0;
+    ++mGeneration;
+    mCondition.broadcast();
+}
+
+void SegmentPrefetcher::disconnect() {
+    mSource->disconnect();
+}
+
+void SegmentPrefetcher::reconnect() {
+    mSource->reconnect();
+}
+
+void SegmentPrefetcher::quit() {
+    requestExit();
+    mSource->disconnect();
+    clear();
+}
+
+bool SegmentPrefetcher::threadLoop() {
+    Segment segment;
+    int32_t generation;
+    {
+        Mutex::Autolock autoLock(mLock);
+        for (;;) {
+            if (exitPending()) {
+                return false;
+            }
+            List<Segment>::iterator it = mSegments.begin();
+            while (it != mSegments.end() && (*it).mDone) {
+                ++it;
+            }
+            if (it != mSegments.end() && mBytesPrefetched < mMaxBytes) {
+                (*it).mStarted = true;
+                segment = *it;
+                break;
+            }
+            mCondition.wait(mLock);
+        }
+        generation = mGeneration;
+    }
+
+    ALOGV("prefetching segment %d: '%s'", segment.mSeqNumber, segment.mURI.c_str());
+
+    sp<ABuffer> data;
+    int64_t startUs = ALooper::GetNowUs();
+    ssize_t bytesRead = mSource->fetchSegment(
+            segment.mURI.c_str(), segment.mRangeOffset, segment.mRangeLength, &data);
+    int64_t downloadUs = ALooper::GetNowUs() - startUs;
+
+    if (bytesRead < 0) {
+        ALOGW("failed to prefetch segment %d: %zd", segment.mSeqNumber, bytesRead);
+        data.clear();
+    }
+
+    sp<AMessage> notify;
+    {
+        Mutex::Autolock autoLock(mLock);
+        if (generation == mGeneration) {
+            for (List<Segment>::iterator it = mSegments.begin();
+                    it != mSegments.end(); ++it) {
+                if ((*it).mSeqNumber == segment.mSeqNumber) {
+                    (*it).mDone = true;
+                    (*it).mData = data;
+                    (*it).mDownloadUs = downloadUs;
+                    if (data != NULL) {
+                        mBytesPrefetched += data->size();
+                    }
+                    notify = (*it).mNotify;
+                    (*it).mNotify.clear();
+                    break;
+                }
+            }
+        }
+        mCondition.broadcast();
+    }
+
+    if (notify != NULL) {
+        notify->post();
+    }
+    return true;
+}
+
+}  // namespace android
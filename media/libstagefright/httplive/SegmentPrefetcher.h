@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEGMENT_PREFETCHER_H_
+
+#define SEGMENT_PREFETCHER_H_
+
+#include <media/stagefright/foundation/ABase.h>
+#include <media/stagefright/foundation/AString.h>
+#include <utils/Errors.h>
+#include <utils/List.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+
+namespace android {
+
+struct ABuffer;
+struct AMessage;
+
+// Downloads queued segments one at a time, in order, on its own thread and
+// connection, so that the download of the next segments overlaps with the
+// decryption and extraction of the current one on the fetcher's looper.
+struct SegmentPrefetcher : public Thread {
+    // Where the segments are downloaded from. PlaylistFetcher gives the
+    // prefetcher an HTTPDownloader of its own.
+    struct Source : public RefBase {
+        // Returns the size of the segment, or an error.
+        virtual ssize_t fetchSegment(
+                const char *uri, int64_t rangeOffset, int64_t rangeLength,
+                sp<ABuffer> *out) = 0;
+        // Aborts the fetch in progress, and fails the next ones until
+        // reconnect() is called.
+        virtual void disconnect() = 0;
+        virtual void reconnect() = 0;
+    };
+
+    // At most maxSegments segments are queued, and no download starts while
+    // maxBytes of downloaded segments are held.
+    SegmentPrefetcher(const sp<Source> &source, size_t maxSegments, size_t maxBytes);
+
+    // Queues a segment for download, unless it is queued already or
+    // maxSegments segments are.
+    void prefetch(int32_t seqNumber, const AString &uri,
+            int64_t rangeOffset, int64_t rangeLength);
+
+    // Takes the data of a queued segment and drops the segments before it.
+    // Never waits for a download: returns WOULD_BLOCK if the segment is still
+    // being downloaded, and posts notify once the download completes, unless
+    // clear() is called first. Otherwise returns OK, with *data NULL if the
+    // segment was not queued, was not started, failed to download or was
+    // queued with another uri.
+    status_t take(int32_t seqNumber, const AString &uri, const sp<AMessage> &notify,
+            sp<ABuffer> *data, int64_t *downloadUs);
+
+    // Drops all segments. A download in progress completes but is discarded.
+    void clear();
+
+    void disconnect();
+    void reconnect();
+    void quit();
+
+protected:
+    virtual ~SegmentPrefetcher();
+
+private:
+    struct Segment {
+        int32_t mSeqNumber;
+        AString mURI;
+        int64_t mRangeOffset;
+        int64_t mRangeLength;
+        bool mStarted;
+        bool mDone;
+        sp<ABuffer> mData;  // NULL if the download failed
+        int64_t mDownloadUs;
+        sp<AMessage> mNotify;  // posted when done, if taken before
+    };
+
+    sp<Source> mSource;
+    const size_t mMaxSegments;
+    const size_t mMaxBytes;
+
+    Mutex mLock;
+    Condition mCondition;
+    List<Segment> mSegments;    // in sequence order
+    size_t mBytesPrefetched;    // of the segments done
+    int32_t mGeneration;
+
+    virtual bool threadLoop();
+
+    DISALLOW_EVIL_CONSTRUCTORS(SegmentPrefetcher);
+};
+
+}  // namespace android
+
+#endif  // SEGMENT_PREFETCHER_H_
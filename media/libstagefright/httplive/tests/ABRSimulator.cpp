@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a recorded network trace through a bandwidth estimator and an ABR
+// policy in virtual time, making the same decisions LiveSession makes when it
+// polls buffering, and reports startup delay, rebuffering and average bitrate.
+//
+// The trace is a text file of "<duration ms> <throughput kbps>" lines, looped
+// if playback outlasts it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "RateAdaptation.h"
+
+using namespace android;
+
+// same as LiveSession
+static const int64_t kUpSwitchMarkUs = 15000000ll;
+static const int64_t kDownSwitchMarkUs = 20000000ll;
+// PlaylistFetcher stops fetching above this
+static const int64_t kMaxBufferedDurationUs = 30000000ll;
+
+struct TraceEntry {
+    int64_t mDurationUs;
+    double mBps;
+};
+
+static void usage(const char *me) {
+    fprintf(stderr, "usage: %s [-b <bps,bps,...>] [-s <segment ms>]"
+                    " [-d <duration s>] [-r <rtt ms>] [-i <initial mark ms>]"
+                    " [-m <resume mark ms>] [-e <estimator>] [-p <policy>]"
+                    " [-v] <trace file>\n", me);
+    fprintf(stderr, "       -b variant bitrates, default 300000,800000,1500000,3000000\n");
+    fprintf(stderr, "       -s segment duration, default 6000\n");
+    fprintf(stderr, "       -d content duration, default 600\n");
+    fprintf(stderr, "       -r request latency added to each segment, default 0\n");
+    fprintf(stderr, "       -i buffer needed to start playback, default 1000\n");
+    fprintf(stderr, "       -m buffer needed to resume after rebuffering, default 5000\n");
+    fprintf(stderr, "       -e bandwidth estimator: average (default) or ewma\n");
+    fprintf(stderr, "       -p ABR policy: throughput (default) or buffer\n");
+    fprintf(stderr, "       -v print every segment\n");
+
+    exit(1);
+}
+
+static bool parseTrace(const char *path, std::vector<TraceEntry> *trace) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        long durationMs;
+        double kbps;
+        if (sscanf(line, "%ld %lf", &durationMs, &kbps) != 2) {
+            continue;
+        }
+        if (durationMs <= 0 || kbps < 0.0) {
+            continue;
+        }
+        TraceEntry entry;
+        entry.mDurationUs = durationMs * 1000ll;
+        entry.mBps = kbps * 1000.0;
+        trace->push_back(entry);
+    }
+    fclose(file);
+
+    double totalBits = 0.0;
+    for (size_t i = 0; i < trace->size(); ++i) {
+        totalBits += (*trace)[i].mBps * (*trace)[i].mDurationUs;
+    }
+    if (totalBits <= 0.0) {
+        fprintf(stderr, "no usable throughput in %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Time it takes to transfer numBytes starting at nowUs.
+static int64_t transferTimeUs(
+        const std::vector<TraceEntry> &trace, int64_t nowUs, size_t numBytes) {
+    int64_t traceDurationUs = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        traceDurationUs += trace[i].mDurationUs;
+    }
+
+    int64_t offsetUs = nowUs % traceDurationUs;
+    size_t index = 0;
+    while (offsetUs >= trace[index].mDurationUs) {
+        offsetUs -= trace[index].mDurationUs;
+        ++index;
+    }
+
+    double bitsLeft = numBytes * 8.0;
+    int64_t elapsedUs = 0;
+    for (;;) {
+        const TraceEntry &entry = trace[index];
+        int64_t availableUs = entry.mDurationUs - offsetUs;
+        double bits = entry.mBps * availableUs / 1E6;
+        if (bits >= bitsLeft) {
+            return elapsedUs + (int64_t)(bitsLeft * 1E6 / entry.mBps);
+        }
+        bitsLeft -= bits;
+        elapsedUs += availableUs;
+        offsetUs = 0;
+        index = (index + 1) % trace.size();
+    }
+}
+
+static bool parseBandwidths(const char *s, Vector<ABRPolicy::Variant> *variants) {
+    variants->clear();
+    while (*s != '\0') {
+        char *end;
+        long bps = strtol(s, &end, 10);
+        if (end == s || bps <= 0 || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        if (!variants->isEmpty() && bps <= variants->itemAt(variants->size() - 1).mBandwidth) {
+            fprintf(stderr, "bitrates must be increasing\n");
+            return false;
+        }
+        ABRPolicy::Variant variant;
+        variant.mBandwidth = bps;
+        variant.mValid = true;
+        variants->push(variant);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return !variants->isEmpty();
+}
+
+int main(int argc, char **argv) {
+    const char *me = argv[0];
+
+    Vector<ABRPolicy::Variant> variants;
+    parseBandwidths("300000,800000,1500000,3000000", &variants);
+    int64_t segmentDurationUs = 6000000ll;
+    int64_t contentDurationUs = 600000000ll;
+    int64_t rttUs = 0;
+    int64_t initialMarkUs = 1000000ll;
+    int64_t resumeMarkUs = 5000000ll;
+    const char *estimatorName = NULL;
+    const char *policyName = NULL;
+    bool verbose = false;
+
+    int res;
+    while ((res = getopt(argc, argv, "h?b:s:d:r:i:m:e:p:v")) >= 0) {
+        switch (res) {
+            case 'b':
+            {
+                if (!parseBandwidths(optarg, &variants)) {
+                    usage(me);
+                }
+                break;
+            }
+
+            case 's':
+            {
+                segmentDurationUs = atol(optarg) * 1000ll;
+                break;
+            }
+
+            case 'd':
+            {
+                contentDurationUs = atol(optarg) * 1000000ll;
+                break;
+            }
+
+            case 'r':
+            {
+                rttUs = atol(optarg) * 1000ll;
+                break;
+            }
+
+            case 'i':
+            {
+                initialMarkUs = atol(optarg) * 1000ll;
+                break;
+            }
+
+            case 'm':
+            {
+                resumeMarkUs = atol(optarg) * 1000ll;
+                break;
+            }
+
+            case 'e':
+            {
+                estimatorName = optarg;
+                break;
+            }
+
+            case 'p':
+            {
+                policyName = optarg;
+                break;
+            }
+
+            case 'v':
+            {
+                verbose = true;
+                break;
+            }
+
+            case '?':
+            case 'h':
+            default:
+            {
+                usage(me);
+            }
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1 || segmentDurationUs <= 0 || contentDurationUs <= 0 || rttUs < 0) {
+        usage(me);
+    }
+
+    std::vector<TraceEntry> trace;
+    if (!parseTrace(argv[0], &trace)) {
+        return 1;
+    }
+
+    sp<BandwidthEstimator> estimator = BandwidthEstimator::Create(estimatorName);
+    sp<ABRPolicy> policy = ABRPolicy::Create(policyName);
+
+    const int64_t upSwitchMarkUs =
+            kUpSwitchMarkUs < segmentDurationUs * 7 / 4
+                    ? kUpSwitchMarkUs : segmentDurationUs * 7 / 4;
+    const int64_t downSwitchMarkUs =
+            kDownSwitchMarkUs < segmentDurationUs * 9 / 4
+                    ? kDownSwitchMarkUs : segmentDurationUs * 9 / 4;
+
+    int64_t nowUs = 0;
+    int64_t bufferedUs = 0;
+    int64_t startupUs = -1;
+    int64_t rebufferUs = 0;
+    size_t numRebuffers = 0;
+    bool playing = false;
+    size_t curIndex = 0;
+    double totalBits = 0.0;
+    std::vector<ABRPolicy::Switch> switches;
+
+    size_t numSegments =
+            (contentDurationUs + segmentDurationUs - 1) / segmentDurationUs;
+    for (size_t seg = 0; seg < numSegments; ++seg) {
+        // fetchers pause while the buffer is full
+        if (playing && bufferedUs > kMaxBufferedDurationUs) {
+            int64_t idleUs = bufferedUs - kMaxBufferedDurationUs;
+            nowUs += idleUs;
+            bufferedUs -= idleUs;
+        }
+
+        int32_t bandwidth = variants[curIndex].mBandwidth;
+        size_t numBytes = (size_t)((double)bandwidth * segmentDurationUs / 8E6);
+        int64_t delayUs = rttUs + transferTimeUs(trace, nowUs + rttUs, numBytes);
+        nowUs += delayUs;
+        estimator->addBandwidthMeasurement(numBytes, delayUs, nowUs);
+
+        if (playing) {
+            if (bufferedUs >= delayUs) {
+                bufferedUs -= delayUs;
+            } else {
+                rebufferUs += delayUs - bufferedUs;
+                bufferedUs = 0;
+                playing = false;
+                ++numRebuffers;
+            }
+        } else if (startupUs >= 0) {
+            rebufferUs += delayUs;
+        }
+
+        bufferedUs += segmentDurationUs;
+        totalBits += (double)bandwidth * segmentDurationUs / 1E6;
+
+        if (!playing) {
+            int64_t markUs = (startupUs < 0) ? initialMarkUs : resumeMarkUs;
+            if (bufferedUs >= markUs || seg + 1 == numSegments) {
+                playing = true;
+                if (startupUs < 0) {
+                    startupUs = nowUs;
+                }
+            }
+        }
+
+        if (verbose) {
+            printf("%8.3f s: segment %zu at %d bps took %.3f s, buffered %.3f s%s\n",
+                    nowUs / 1E6, seg, bandwidth, delayUs / 1E6, bufferedUs / 1E6,
+                    playing ? "" : " (stalled)");
+        }
+
+        ABRPolicy::State state;
+        if (variants.size() < 2 || !estimator->estimateBandwidth(
+                &state.mBandwidthBps, &state.mIsStable, &state.mShortTermBps)) {
+            continue;
+        }
+        state.mBufferedDurationUs = bufferedUs;
+        state.mSegmentDurationUs = segmentDurationUs;
+        // LiveSession never switches up while preparing
+        state.mBufferHigh = playing && startupUs >= 0 && bufferedUs > upSwitchMarkUs;
+        state.mBufferLow = bufferedUs < downSwitchMarkUs;
+        state.mCurIndex = curIndex;
+
+        ABRPolicy::SwitchReason reason;
+        ssize_t index = policy->selectVariant(variants, state, &reason);
+        if (index >= 0 && (size_t)index != curIndex) {
+            ABRPolicy::Switch entry;
+            entry.mTimeUs = nowUs;
+            entry.mFromIndex = curIndex;
+            entry.mToIndex = index;
+            entry.mReason = reason;
+            entry.mBandwidthBps = state.mBandwidthBps;
+            entry.mBufferedDurationUs = bufferedUs;
+            switches.push_back(entry);
+            curIndex = index;
+        }
+    }
+    int64_t endUs = nowUs + bufferedUs;
+
+    printf("estimator %s, policy %s, %zu segments of %.3f s\n",
+            estimator->name(), policy->name(), numSegments, segmentDurationUs / 1E6);
+    for (size_t i = 0; i < switches.size(); ++i) {
+        const ABRPolicy::Switch &entry = switches[i];
+        printf("  %8.3f s: %d => %d bps (%s), estimated %d bps, buffered %.3f s\n",
+                entry.mTimeUs / 1E6,
+                variants[entry.mFromIndex].mBandwidth,
+                variants[entry.mToIndex].mBandwidth,
+                ABRPolicy::ReasonToString(entry.mReason),
+                entry.mBandwidthBps,
+                entry.mBufferedDurationUs / 1E6);
+    }
+    printf("startup:        %.3f s\n", startupUs / 1E6);
+    printf("rebuffering:    %.3f s in %zu stalls (%.2f%% of playback)\n",
+            rebufferUs / 1E6, numRebuffers,
+            100.0 * rebufferUs / (endUs - startupUs));
+    printf("average bitrate: %.0f bps\n", totalBits * 1E6 / (numSegments * segmentDurationUs));
+    printf("switches:       %zu\n", switches.size());
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SegmentPrefetcher_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include "../SegmentPrefetcher.h"
+
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <utils/threads.h>
+
+#include <unistd.h>
+
+namespace android {
+
+static const int64_t kSliceUs = 2000ll;
+
+// A link of fixed throughput shared by the sources using it, like the
+// connections of a fetcher and of its prefetcher to the same server.
+struct ThrottledLink : public RefBase {
+    ThrottledLink(int64_t bytesPerSecond, int64_t latencyUs)
+        : mBytesPerSecond(bytesPerSecond), mLatencyUs(latencyUs), mActive(0) {}
+
+    const int64_t mBytesPerSecond;
+    const int64_t mLatencyUs;
+
+    Mutex mLock;
+    int32_t mActive;
+};
+
+struct ThrottledSource : public SegmentPrefetcher::Source {
+    ThrottledSource(const sp<ThrottledLink> &link, size_t segmentSize)
+        : mLink(link), mSegmentSize(segmentSize), mConnected(true), mNumFetches(0) {}
+
+    virtual ssize_t fetchSegment(
+            const char * /* uri */, int64_t /* rangeOffset */, int64_t /* rangeLength */,
+            sp<ABuffer> *out) {
+        {
+            Mutex::Autolock autoLock(mLock);
+            ++mNumFetches;
+            mCondition.broadcast();
+        }
+        {
+            Mutex::Autolock autoLock(mLink->mLock);
+            ++mLink->mActive;
+        }
+        usleep(mLink->mLatencyUs);
+
+        double received = 0;
+        bool connected = true;
+        while (connected && received < mSegmentSize) {
+            usleep(kSliceUs);
+            Mutex::Autolock autoLock(mLink->mLock);
+            received += (double)mLink->mBytesPerSecond * kSliceUs / 1E6 / mLink->mActive;
+            connected = isConnected();
+        }
+        {
+            Mutex::Autolock autoLock(mLink->mLock);
+            --mLink->mActive;
+        }
+        if (!connected) {
+            return INVALID_OPERATION;
+        }
+        *out = new ABuffer(mSegmentSize);
+        return mSegmentSize;
+    }
+
+    virtual void disconnect() {
+        Mutex::Autolock autoLock(mLock);
+        mConnected = false;
+    }
+
+    virtual void reconnect() {
+        Mutex::Autolock autoLock(mLock);
+        mConnected = true;
+    }
+
+    bool isConnected() {
+        Mutex::Autolock autoLock(mLock);
+        return mConnected;
+    }
+
+    void waitForFetches(int32_t numFetches) {
+        Mutex::Autolock autoLock(mLock);
+        while (mNumFetches < numFetches) {
+            mCondition.wait(mLock);
+        }
+    }
+
+private:
+    sp<ThrottledLink> mLink;
+    size_t mSegmentSize;
+
+    Mutex mLock;
+    Condition mCondition;
+    bool mConnected;
+    int32_t mNumFetches;
+};
+
+// Stands in for the fetcher's looper, counting the notifications of the
+// prefetcher.
+struct NotifyHandler : public AHandler {
+    NotifyHandler() : mNumNotifications(0) {}
+
+    int32_t numNotifications() {
+        Mutex::Autolock autoLock(mLock);
+        return mNumNotifications;
+    }
+
+    bool waitForNotification(int32_t count, int64_t timeoutUs) {
+        Mutex::Autolock autoLock(mLock);
+        while (mNumNotifications < count) {
+            if (mCondition.waitRelative(mLock, timeoutUs * 1000ll) != OK) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+protected:
+    virtual void onMessageReceived(const sp<AMessage> & /* msg */) {
+        Mutex::Autolock autoLock(mLock);
+        ++mNumNotifications;
+        mCondition.broadcast();
+    }
+
+private:
+    Mutex mLock;
+    Condition mCondition;
+    int32_t mNumNotifications;
+};
+
+class SegmentPrefetcherTest : public ::testing::Test {
+public:
+    virtual void SetUp() {
+        mLooper = new ALooper;
+        mLooper->setName("SegmentPrefetcherTest");
+        mLooper->start();
+        mHandler = new NotifyHandler;
+        mLooper->registerHandler(mHandler);
+    }
+
+    virtual void TearDown() {
+        if (mPrefetcher != NULL) {
+            mPrefetcher->quit();
+            mPrefetcher->requestExitAndWait();
+        }
+        mLooper->unregisterHandler(mHandler->id());
+        mLooper->stop();
+    }
+
+protected:
+    void createPrefetcher(int64_t bytesPerSecond, size_t segmentSize) {
+        mLink = new ThrottledLink(bytesPerSecond, 0 /* latencyUs */);
+        mSource = new ThrottledSource(mLink, segmentSize);
+        mPrefetcher = new SegmentPrefetcher(mSource, 2 /* maxSegments */, 16 << 20);
+        mPrefetcher->run("SegmentPrefetcherTest");
+    }
+
+    static AString uriOf(int32_t seqNumber) {
+        return AStringPrintf("http://example.com/segment%d.ts", seqNumber);
+    }
+
+    sp<AMessage> notify() {
+        return new AMessage('pref', mHandler);
+    }
+
+    sp<ALooper> mLooper;
+    sp<NotifyHandler> mHandler;
+    sp<ThrottledLink> mLink;
+    sp<ThrottledSource> mSource;
+    sp<SegmentPrefetcher> mPrefetcher;
+};
+
+TEST_F(SegmentPrefetcherTest, TakeDoesNotWaitForTheDownload) {
+    // 300ms per segment
+    createPrefetcher(1000000, 300000);
+    mPrefetcher->prefetch(1, uriOf(1), 0, -1);
+    mSource->waitForFetches(1);
+
+    sp<ABuffer> data;
+    int64_t downloadUs;
+    int64_t startUs = ALooper::GetNowUs();
+    EXPECT_EQ(WOULD_BLOCK, mPrefetcher->take(1, uriOf(1), notify(), &data, &downloadUs));
+    EXPECT_LT(ALooper::GetNowUs() - startUs, 100000ll);
+    EXPECT_TRUE(data == NULL);
+
+    ASSERT_TRUE(mHandler->waitForNotification(1, 5000000ll));
+    EXPECT_EQ(OK, mPrefetcher->take(1, uriOf(1), notify(), &data, &downloadUs));
+    ASSERT_TRUE(data != NULL);
+    EXPECT_EQ(300000u, data->size());
+    EXPECT_GT(downloadUs, 0ll);
+    EXPECT_EQ(1, mHandler->numNotifications());
+}
+
+TEST_F(SegmentPrefetcherTest, TakeMissedSegments) {
+    createPrefetcher(10000000, 1000);
+    sp<ABuffer> data;
+    int64_t downloadUs;
+
+    // never queued
+    EXPECT_EQ(OK, mPrefetcher->take(1, uriOf(1), notify(), &data, &downloadUs));
+    EXPECT_TRUE(data == NULL);
+
+    // the playlist changed since the segment was queued
+    mPrefetcher->prefetch(2, uriOf(2), 0, -1);
+    mSource->waitForFetches(1);
+    do {
+        usleep(10000);
+    } while (mPrefetcher->take(2, uriOf(3), notify(), &data, &downloadUs) == WOULD_BLOCK);
+    EXPECT_TRUE(data == NULL);
+
+    // skipped segments are dropped
+    mPrefetcher->prefetch(3, uriOf(3), 0, -1);
+    mPrefetcher->prefetch(4, uriOf(4), 0, -1);
+    mSource->waitForFetches(3);
+    do {
+        usleep(10000);
+    } while (mPrefetcher->take(4, uriOf(4), notify(), &data, &downloadUs) == WOULD_BLOCK);
+    EXPECT_TRUE(data != NULL);
+    EXPECT_EQ(OK, mPrefetcher->take(3, uriOf(3), notify(), &data, &downloadUs));
+    EXPECT_TRUE(data == NULL);
+}
+
+TEST_F(SegmentPrefetcherTest, ClearDropsTheNotification) {
+    createPrefetcher(1000000, 200000);
+    mPrefetcher->prefetch(1, uriOf(1), 0, -1);
+    mSource->waitForFetches(1);
+
+    sp<ABuffer> data;
+    int64_t downloadUs;
+    EXPECT_EQ(WOULD_BLOCK, mPrefetcher->take(1, uriOf(1), notify(), &data, &downloadUs));
+    mPrefetcher->clear();
+
+    // as on seek, the download completes but nobody is told
+    EXPECT_FALSE(mHandler->waitForNotification(1, 500000ll));
+    EXPECT_EQ(OK, mPrefetcher->take(1, uriOf(1), notify(), &data, &downloadUs));
+    EXPECT_TRUE(data == NULL);
+}
+
+// Plays a stream over a throttled link the way PlaylistFetcher fetches it:
+// each segment is taken from the prefetcher, or downloaded on the fetcher's
+// own connection, then parsed. Playback starts once the first segment is
+// parsed, and rebuffers whenever the next segment is not parsed in time.
+struct PlaybackStats {
+    int64_t mStartupUs;
+    int64_t mRebufferUs;
+    int32_t mNumRebuffers;
+};
+
+static const int32_t kNumSegments = 12;
+static const int64_t kSegmentDurationUs = 200000ll;
+// takes 60% of the segment duration to download alone
+static const int64_t kLinkBytesPerSecond = 1000000ll;
+static const size_t kSegmentSize = 120000;
+static const int64_t kLinkLatencyUs = 10000ll;
+// and 60% to parse
+static const int64_t kParseUs = 120000ll;
+
+static PlaybackStats play(const sp<NotifyHandler> &handler, bool prefetch) {
+    sp<ThrottledLink> link = new ThrottledLink(kLinkBytesPerSecond, kLinkLatencyUs);
+    sp<ThrottledSource> fetcherSource = new ThrottledSource(link, kSegmentSize);
+    sp<SegmentPrefetcher> prefetcher = new SegmentPrefetcher(
+            new ThrottledSource(link, kSegmentSize), 2 /* maxSegments */, 16 << 20);
+    if (prefetch) {
+        prefetcher->run("SegmentPrefetcherTest");
+    }
+
+    PlaybackStats stats = { 0, 0, 0 };
+    int64_t startUs = ALooper::GetNowUs();
+    int64_t playbackStartUs = -1;
+    int32_t numNotifications = handler->numNotifications();
+    for (int32_t seqNumber = 0; seqNumber < kNumSegments; ++seqNumber) {
+        AString uri = AStringPrintf("http://example.com/segment%d.ts", seqNumber);
+        sp<ABuffer> data;
+        int64_t downloadUs;
+        // PlaylistFetcher returns to its looper until it is notified
+        while (prefetcher->take(seqNumber, uri, new AMessage('pref', handler),
+                &data, &downloadUs) == WOULD_BLOCK) {
+            handler->waitForNotification(++numNotifications, 5000000ll);
+        }
+        // the next segments are queued once the link is free of this one
+        if (data == NULL) {
+            fetcherSource->fetchSegment(uri.c_str(), 0, -1, &data);
+        }
+        if (prefetch) {
+            for (int32_t i = 1; i <= 2 && seqNumber + i < kNumSegments; ++i) {
+                prefetcher->prefetch(seqNumber + i, AStringPrintf(
+                        "http://example.com/segment%d.ts", seqNumber + i), 0, -1);
+            }
+        }
+        usleep(kParseUs);
+
+        int64_t nowUs = ALooper::GetNowUs();
+        if (playbackStartUs < 0) {
+            playbackStartUs = nowUs;
+            stats.mStartupUs = nowUs - startUs;
+            continue;
+        }
+        // when playback runs out of the segments parsed so far
+        int64_t deadlineUs = playbackStartUs + stats.mRebufferUs
+                + seqNumber * kSegmentDurationUs;
+        if (nowUs > deadlineUs) {
+            stats.mRebufferUs += nowUs - deadlineUs;
+            ++stats.mNumRebuffers;
+        }
+    }
+
+    prefetcher->quit();
+    if (prefetch) {
+        prefetcher->requestExitAndWait();
+    }
+    return stats;
+}
+
+TEST_F(SegmentPrefetcherTest, ThrottledPlayback) {
+    PlaybackStats sequential = play(mHandler, false /* prefetch */);
+    PlaybackStats prefetched = play(mHandler, true /* prefetch */);
+
+    RecordProperty("SequentialStartupUs", AStringPrintf("%lld",
+            (long long)sequential.mStartupUs).c_str());
+    RecordProperty("SequentialRebufferUs", AStringPrintf("%lld",
+            (long long)sequential.mRebufferUs).c_str());
+    RecordProperty("PrefetchedStartupUs", AStringPrintf("%lld",
+            (long long)prefetched.mStartupUs).c_str());
+    RecordProperty("PrefetchedRebufferUs", AStringPrintf("%lld",
+            (long long)prefetched.mRebufferUs).c_str());
+
+    // Downloading and parsing a segment takes longer than playing it, unless
+    // the download of the next segments overlaps with the parse.
+    EXPECT_GT(sequential.mNumRebuffers, kNumSegments / 2);
+    EXPECT_LT(prefetched.mRebufferUs, sequential.mRebufferUs / 2);
+    // the first segment is fetched directly either way, with the link to itself
+    EXPECT_LT(prefetched.mStartupUs, sequential.mStartupUs + kSegmentDurationUs / 4);
+}
+
+}  // namespace android
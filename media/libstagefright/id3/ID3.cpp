@@ -30,6 +30,13 @@ namespace android {
 
 static const size_t kMaxMetadataSize = 3 * 1024 * 1024;
 
+// Size of the reads of a tag that is read on demand, enough for the headers
+// of a run of text frames.
+static const size_t kWindowSize = 4096;
+
+// Enough for the mime type and the description of most pictures.
+static const size_t kPictureHeaderSize = 256;
+
 struct MemorySource : public DataSourceBase {
     MemorySource(const uint8_t *data, size_t size)
         : mData(data),
@@ -62,8 +69,14 @@ ID3::ID3(DataSourceBase *source, bool ignoreV1, off64_t offset)
       mSize(0),
       mFirstFrameOffset(0),
       mVersion(ID3_UNKNOWN),
-      mRawSize(0) {
-    mIsValid = parseV2(source, offset);
+      mRawSize(0),
+      mSource(NULL),
+      mDataOffset(0),
+      mWindow(NULL),
+      mWindowOffset(0),
+      mWindowSize(0),
+      mAlbumArt(NULL) {
+    mIsValid = parseV2(source, offset, true /* readOnDemand */);
 
     if (!mIsValid && !ignoreV1) {
         mIsValid = parseV1(source);
@@ -76,13 +89,19 @@ ID3::ID3(const uint8_t *data, size_t size, bool ignoreV1)
       mSize(0),
       mFirstFrameOffset(0),
       mVersion(ID3_UNKNOWN),
-      mRawSize(0) {
+      mRawSize(0),
+      mSource(NULL),
+      mDataOffset(0),
+      mWindow(NULL),
+      mWindowOffset(0),
+      mWindowSize(0),
+      mAlbumArt(NULL) {
     MemorySource *source = new (std::nothrow) MemorySource(data, size);
 
     if (source == NULL)
         return;
 
-    mIsValid = parseV2(source, 0);
+    mIsValid = parseV2(source, 0, false /* readOnDemand */);
 
     if (!mIsValid && !ignoreV1) {
         mIsValid = parseV1(source);
@@ -95,6 +114,10 @@ ID3::~ID3() {
         free(mData);
         mData = NULL;
     }
+    free(mWindow);
+    mWindow = NULL;
+    free(mAlbumArt);
+    mAlbumArt = NULL;
 }
 
 bool ID3::isValid() const {
@@ -119,7 +142,22 @@ bool ID3::ParseSyncsafeInteger(const uint8_t encoded[4], size_t *x) {
     return true;
 }
 
-bool ID3::parseV2(DataSourceBase *source, off64_t offset) {
+bool ID3::parseV2(DataSourceBase *source, off64_t offset, bool readOnDemand) {
+    if (parseV2_l(source, offset, readOnDemand)) {
+        indexFrames();
+        return true;
+    }
+
+    free(mData);
+    mData = NULL;
+    free(mWindow);
+    mWindow = NULL;
+    mSource = NULL;
+
+    return false;
+}
+
+bool ID3::parseV2_l(DataSourceBase *source, off64_t offset, bool readOnDemand) {
 struct id3_header {
     char id[3];
     uint8_t version_major;
@@ -180,84 +218,93 @@ struct id3_header {
         return false;
     }
 
-    mData = (uint8_t *)malloc(size);
-
-    if (mData == NULL) {
-        return false;
-    }
-
     mSize = size;
     mRawSize = mSize + sizeof(header);
 
-    if (source->readAt(offset + sizeof(header), mData, mSize) != (ssize_t)mSize) {
-        free(mData);
-        mData = NULL;
+    // Unless the tag has to be unsynchronized, only read the frames from the
+    // source when they are asked for, rather than copying all of it, album
+    // art included.
+    if (readOnDemand && (header.version_major == 4 || !(header.flags & 0x80))) {
+        // It has to be all there, as when it's read at once.
+        uint8_t last;
+        if (source->readAt(offset + mRawSize - 1, &last, 1) == 1) {
+            mWindow = (uint8_t *)malloc(kWindowSize);
+            if (mWindow == NULL) {
+                return false;
+            }
+            mSource = source;
+            mDataOffset = offset + sizeof(header);
 
-        return false;
+            if (header.version_major == 4 && !isSynchronizedV2_4()) {
+                free(mWindow);
+                mWindow = NULL;
+                mSource = NULL;
+            }
+        }
     }
 
-    if (header.version_major == 4) {
-        void *copy = malloc(size);
-        if (copy == NULL) {
-            free(mData);
-            mData = NULL;
-            ALOGE("b/24623447, no more memory");
+    if (mSource == NULL) {
+        mData = (uint8_t *)malloc(size);
+
+        if (mData == NULL) {
             return false;
         }
 
-        memcpy(copy, mData, size);
+        if (source->readAt(offset + sizeof(header), mData, mSize) != (ssize_t)mSize) {
+            return false;
+        }
+
+        if (header.version_major == 4) {
+            void *copy = malloc(size);
+            if (copy == NULL) {
+                ALOGE("b/24623447, no more memory");
+                return false;
+            }
 
-        bool success = removeUnsynchronizationV2_4(false /* iTunesHack */);
-        if (!success) {
-            memcpy(mData, copy, size);
-            mSize = size;
+            memcpy(copy, mData, size);
 
-            success = removeUnsynchronizationV2_4(true /* iTunesHack */);
+            bool success = removeUnsynchronizationV2_4(false /* iTunesHack */);
+            if (!success) {
+                memcpy(mData, copy, size);
+                mSize = size;
 
-            if (success) {
-                ALOGV("Had to apply the iTunes hack to parse this ID3 tag");
+                success = removeUnsynchronizationV2_4(true /* iTunesHack */);
+
+                if (success) {
+                    ALOGV("Had to apply the iTunes hack to parse this ID3 tag");
+                }
             }
-        }
 
-        free(copy);
-        copy = NULL;
+            free(copy);
+            copy = NULL;
 
-        if (!success) {
-            free(mData);
-            mData = NULL;
+            if (!success) {
+                return false;
+            }
+        } else if (header.flags & 0x80) {
+            ALOGV("removing unsynchronization");
 
-            return false;
+            removeUnsynchronization();
         }
-    } else if (header.flags & 0x80) {
-        ALOGV("removing unsynchronization");
-
-        removeUnsynchronization();
     }
 
     mFirstFrameOffset = 0;
     if (header.version_major == 3 && (header.flags & 0x40)) {
         // Version 2.3 has an optional extended header.
 
-        if (mSize < 4) {
-            free(mData);
-            mData = NULL;
-
+        uint8_t extendedHeader[10];
+        if (mSize < 4 || !readTag(0, extendedHeader, 4)) {
             return false;
         }
 
-        size_t extendedHeaderSize = U32_AT(&mData[0]);
+        size_t extendedHeaderSize = U32_AT(&extendedHeader[0]);
         if (extendedHeaderSize > SIZE_MAX - 4) {
-            free(mData);
-            mData = NULL;
             ALOGE("b/24623447, extendedHeaderSize is too large");
             return false;
         }
         extendedHeaderSize += 4;
 
         if (extendedHeaderSize > mSize) {
-            free(mData);
-            mData = NULL;
-
             return false;
         }
 
@@ -265,18 +312,18 @@ struct id3_header {
 
         uint16_t extendedFlags = 0;
         if (extendedHeaderSize >= 6) {
-            extendedFlags = U16_AT(&mData[4]);
+            if (!readTag(0, extendedHeader, extendedHeaderSize >= 10 ? 10 : 6)) {
+                return false;
+            }
+            extendedFlags = U16_AT(&extendedHeader[4]);
 
             if (extendedHeaderSize >= 10) {
-                size_t paddingSize = U32_AT(&mData[6]);
+                size_t paddingSize = U32_AT(&extendedHeader[6]);
 
                 if (paddingSize > SIZE_MAX - mFirstFrameOffset) {
                     ALOGE("b/24623447, paddingSize is too large");
                 }
                 if (paddingSize > mSize - mFirstFrameOffset) {
-                    free(mData);
-                    mData = NULL;
-
                     return false;
                 }
 
@@ -291,25 +338,17 @@ struct id3_header {
         // Version 2.4 has an optional extended header, that's different
         // from Version 2.3's...
 
-        if (mSize < 4) {
-            free(mData);
-            mData = NULL;
-
+        uint8_t extendedHeader[4];
+        if (mSize < 4 || !readTag(0, extendedHeader, 4)) {
             return false;
         }
 
         size_t ext_size;
-        if (!ParseSyncsafeInteger(mData, &ext_size)) {
-            free(mData);
-            mData = NULL;
-
+        if (!ParseSyncsafeInteger(extendedHeader, &ext_size)) {
             return false;
         }
 
         if (ext_size < 6 || ext_size > mSize) {
-            free(mData);
-            mData = NULL;
-
             return false;
         }
 
@@ -328,6 +367,142 @@ struct id3_header {
     return true;
 }
 
+bool ID3::readTag(size_t offset, void *data, size_t size) const {
+    if (offset > mSize || size > mSize - offset) {
+        return false;
+    }
+
+    if (mData != NULL) {
+        memcpy(data, &mData[offset], size);
+        return true;
+    }
+
+    if (size > kWindowSize) {
+        return mSource->readAt(mDataOffset + offset, data, size) == (ssize_t)size;
+    }
+
+    if (offset < mWindowOffset || offset - mWindowOffset + size > mWindowSize) {
+        size_t length = (mSize - offset < kWindowSize) ? mSize - offset : kWindowSize;
+
+        mWindowSize = 0;
+        if (mSource->readAt(mDataOffset + offset, mWindow, length) != (ssize_t)length) {
+            return false;
+        }
+        mWindowOffset = offset;
+        mWindowSize = length;
+    }
+
+    memcpy(data, &mWindow[offset - mWindowOffset], size);
+    return true;
+}
+
+// Whether removeUnsynchronizationV2_4() would leave the tag untouched, that
+// is no frame needs to be unsynchronized or stripped of its data length
+// indicator, and the sizes are syncsafe.
+bool ID3::isSynchronizedV2_4() const {
+    size_t offset = 0;
+    while (mSize >= 10 && offset <= mSize - 10) {
+        uint8_t header[10];
+        if (!readTag(offset, header, sizeof(header))) {
+            return false;
+        }
+
+        if (!memcmp(header, "\0\0\0\0", 4)) {
+            break;
+        }
+
+        size_t dataSize;
+        if (!ParseSyncsafeInteger(&header[4], &dataSize)
+                || dataSize > mSize - 10 - offset) {
+            return false;
+        }
+
+        if (U16_AT(&header[8]) & 3) {
+            return false;
+        }
+
+        offset += 10 + dataSize;
+    }
+
+    return true;
+}
+
+void ID3::indexFrames() {
+    const size_t idLength = (mVersion == ID3_V2_2) ? 3 : 4;
+    const size_t headerLength = (mVersion == ID3_V2_2) ? 6 : 10;
+
+    size_t offset = mFirstFrameOffset;
+    for (;;) {
+        uint8_t header[10];
+        if (offset + headerLength > mSize || !readTag(offset, header, headerLength)) {
+            return;
+        }
+
+        if (!memcmp(header, "\0\0\0\0", idLength)) {
+            return;
+        }
+
+        size_t frameSize;
+        if (mVersion == ID3_V2_2) {
+            frameSize = (header[3] << 16) | (header[4] << 8) | header[5];
+        } else if (mVersion == ID3_V2_4) {
+            if (!ParseSyncsafeInteger(&header[4], &frameSize)) {
+                return;
+            }
+        } else {
+            frameSize = U32_AT(&header[4]);
+        }
+
+        if (frameSize == 0) {
+            return;
+        }
+
+        // Prevent integer overflow when adding
+        if (SIZE_MAX - headerLength <= frameSize) {
+            return;
+        }
+
+        frameSize += headerLength; // add tag id, size field and flags
+
+        // Prevent integer overflow in validation
+        if (SIZE_MAX - offset <= frameSize) {
+            return;
+        }
+
+        if (offset + frameSize > mSize) {
+            ALOGV("partial frame at offset %zu (size = %zu, bytes-remaining = %zu)",
+                offset, frameSize, mSize - offset - headerLength);
+            return;
+        }
+
+        if (mVersion != ID3_V2_2) {
+            uint16_t flags = U16_AT(&header[8]);
+
+            if ((mVersion == ID3_V2_4 && (flags & 0x000c))
+                || (mVersion == ID3_V2_3 && (flags & 0x00c0))) {
+                // Compression or encryption are not supported at this time.
+                // Per-frame unsynchronization and data-length indicator
+                // have already been taken care of.
+
+                ALOGV("Skipping unsupported frame (compression, encryption "
+                     "or per-frame unsynchronization flagged");
+
+                offset += frameSize;
+                continue;
+            }
+        }
+
+        Frame frame;
+        memcpy(frame.mID, header, idLength);
+        frame.mID[idLength] = '\0';
+        frame.mOffset = offset;
+        frame.mSize = frameSize;
+        mFrames.push_back(frame);
+
+        offset += frameSize;
+    }
+}
+
 void ID3::removeUnsynchronization() {
 
     // This file has "unsynchronization", so we have to replace occurrences
@@ -441,7 +616,9 @@ ID3::Iterator::Iterator(const ID3 &parent, const char *id)
     : mParent(parent),
       mID(NULL),
       mOffset(mParent.mFirstFrameOffset),
+      mIndex(0),
       mFrameData(NULL),
+      mBuffer(NULL),
       mFrameSize(0) {
     if (id) {
         mID = strdup(id);
@@ -455,18 +632,24 @@ ID3::Iterator::~Iterator() {
         free(mID);
         mID = NULL;
     }
+    free(mBuffer);
+    mBuffer = NULL;
 }
 
 bool ID3::Iterator::done() const {
-    return mFrameData == NULL;
+    return mFrameSize == 0;
 }
 
 void ID3::Iterator::next() {
-    if (mFrameData == NULL) {
+    if (done()) {
         return;
     }
 
-    mOffset += mFrameSize;
+    if (mParent.mVersion == ID3_V1 || mParent.mVersion == ID3_V1_1) {
+        mOffset += mFrameSize;
+    } else {
+        ++mIndex;
+    }
 
     findFrame();
 }
@@ -474,14 +657,13 @@ void ID3::Iterator::next() {
 void ID3::Iterator::getID(String8 *id) const {
     id->setTo("");
 
-    if (mFrameData == NULL) {
+    if (done()) {
         return;
     }
 
-    if (mParent.mVersion == ID3_V2_2) {
-        id->setTo((const char *)&mParent.mData[mOffset], 3);
-    } else if (mParent.mVersion == ID3_V2_3 || mParent.mVersion == ID3_V2_4) {
-        id->setTo((const char *)&mParent.mData[mOffset], 4);
+    if (mParent.mVersion == ID3_V2_2
+            || mParent.mVersion == ID3_V2_3 || mParent.mVersion == ID3_V2_4) {
+        id->setTo(mParent.mFrames[mIndex].mID);
     } else {
         CHECK(mParent.mVersion == ID3_V1 || mParent.mVersion == ID3_V1_1);
 
@@ -529,10 +711,11 @@ void ID3::Iterator::getString(String8 *id, String8 *comment) const {
 void ID3::Iterator::getstring(String8 *id, bool otherdata) const {
     id->setTo("");
 
-    const uint8_t *frameData = mFrameData;
-    if (frameData == NULL) {
+    const uint8_t *start = getFrameData();
+    if (start == NULL) {
         return;
     }
+    const uint8_t *frameData = start;
 
     uint8_t encoding = *frameData;
 
@@ -564,7 +747,7 @@ void ID3::Iterator::getstring(String8 *id, bool otherdata) const {
         frameData += 4;
         int32_t i = n - 4;
         while(--i >= 0 && *++frameData != 0) ;
-        int skipped = (frameData - mFrameData);
+        int skipped = (frameData - start);
         if (skipped >= (int)n) {
             return;
         }
@@ -670,7 +853,7 @@ void ID3::Iterator::getstring(String8 *id, bool otherdata) const {
 const uint8_t *ID3::Iterator::getData(size_t *length) const {
     *length = 0;
 
-    if (mFrameData == NULL) {
+    if (done()) {
         return NULL;
     }
 
@@ -679,7 +862,28 @@ const uint8_t *ID3::Iterator::getData(size_t *length) const {
         return NULL;
     }
 
-    *length = mFrameSize - getHeaderLength();
+    const uint8_t *frameData = getFrameData();
+    if (frameData != NULL) {
+        *length = mFrameSize - getHeaderLength();
+    }
+
+    return frameData;
+}
+
+const uint8_t *ID3::Iterator::getFrameData() const {
+    if (mFrameData == NULL && !done()) {
+        size_t headerLength = getHeaderLength();
+        size_t size = mFrameSize - headerLength;
+
+        mBuffer = (uint8_t *)malloc(size);
+        if (mBuffer != NULL && mParent.readTag(mOffset + headerLength, mBuffer, size)) {
+            mFrameData = mBuffer;
+        } else {
+            ALOGE("failed to read the frame at offset %zu", mOffset);
+            free(mBuffer);
+            mBuffer = NULL;
+        }
+    }
 
     return mFrameData;
 }
@@ -696,169 +900,76 @@ size_t ID3::Iterator::getHeaderLength() const {
 }
 
 void ID3::Iterator::findFrame() {
-    for (;;) {
-        mFrameData = NULL;
-        mFrameSize = 0;
-
-        if (mParent.mVersion == ID3_V2_2) {
-            if (mOffset + 6 > mParent.mSize) {
-                return;
-            }
-
-            if (!memcmp(&mParent.mData[mOffset], "\0\0\0", 3)) {
+    free(mBuffer);
+    mBuffer = NULL;
+    mFrameData = NULL;
+    mFrameSize = 0;
+
+    if (mParent.mVersion == ID3_V2_2
+            || mParent.mVersion == ID3_V2_3 || mParent.mVersion == ID3_V2_4) {
+        for (; mIndex < mParent.mFrames.size(); ++mIndex) {
+            const Frame &frame = mParent.mFrames[mIndex];
+
+            if (!mID || !strcmp(frame.mID, mID)) {
+                mOffset = frame.mOffset;
+                mFrameSize = frame.mSize;
+                if (mParent.mData != NULL) {
+                    mFrameData = &mParent.mData[mOffset + getHeaderLength()];
+                }
                 return;
             }
+        }
+        return;
+    }
 
-            mFrameSize =
-                (mParent.mData[mOffset + 3] << 16)
-                | (mParent.mData[mOffset + 4] << 8)
-                | mParent.mData[mOffset + 5];
+    CHECK(mParent.mVersion == ID3_V1 || mParent.mVersion == ID3_V1_1);
 
-            if (mFrameSize == 0) {
-                return;
-            }
-            mFrameSize += 6; // add tag id and size field
-
-            // Prevent integer overflow in validation
-            if (SIZE_MAX - mOffset <= mFrameSize) {
-                return;
-            }
+    for (;;) {
+        mFrameData = NULL;
+        mFrameSize = 0;
 
-            if (mOffset + mFrameSize > mParent.mSize) {
-                ALOGV("partial frame at offset %zu (size = %zu, bytes-remaining = %zu)",
-                    mOffset, mFrameSize, mParent.mSize - mOffset - (size_t)6);
-                return;
-            }
+        if (mOffset >= mParent.mSize) {
+            return;
+        }
 
-            mFrameData = &mParent.mData[mOffset + 6];
+        mFrameData = &mParent.mData[mOffset];
 
-            if (!mID) {
+        switch (mOffset) {
+            case 3:
+            case 33:
+            case 63:
+                mFrameSize = 30;
                 break;
-            }
-
-            char id[4];
-            memcpy(id, &mParent.mData[mOffset], 3);
-            id[3] = '\0';
-
-            if (!strcmp(id, mID)) {
+            case 93:
+                mFrameSize = 4;
                 break;
-            }
-        } else if (mParent.mVersion == ID3_V2_3
-                || mParent.mVersion == ID3_V2_4) {
-            if (mOffset + 10 > mParent.mSize) {
-                return;
-            }
-
-            if (!memcmp(&mParent.mData[mOffset], "\0\0\0\0", 4)) {
-                return;
-            }
-
-            size_t baseSize = 0;
-            if (mParent.mVersion == ID3_V2_4) {
-                if (!ParseSyncsafeInteger(
-                            &mParent.mData[mOffset + 4], &baseSize)) {
-                    return;
+            case 97:
+                if (mParent.mVersion == ID3_V1) {
+                    mFrameSize = 30;
+                } else {
+                    mFrameSize = 29;
                 }
-            } else {
-                baseSize = U32_AT(&mParent.mData[mOffset + 4]);
-            }
-
-            if (baseSize == 0) {
-                return;
-            }
-
-            // Prevent integer overflow when adding
-            if (SIZE_MAX - 10 <= baseSize) {
-                return;
-            }
-
-            mFrameSize = 10 + baseSize; // add tag id, size field and flags
-
-            // Prevent integer overflow in validation
-            if (SIZE_MAX - mOffset <= mFrameSize) {
-                return;
-            }
-
-            if (mOffset + mFrameSize > mParent.mSize) {
-                ALOGV("partial frame at offset %zu (size = %zu, bytes-remaining = %zu)",
-                    mOffset, mFrameSize, mParent.mSize - mOffset - (size_t)10);
-                return;
-            }
-
-            uint16_t flags = U16_AT(&mParent.mData[mOffset + 8]);
-
-            if ((mParent.mVersion == ID3_V2_4 && (flags & 0x000c))
-                || (mParent.mVersion == ID3_V2_3 && (flags & 0x00c0))) {
-                // Compression or encryption are not supported at this time.
-                // Per-frame unsynchronization and data-length indicator
-                // have already been taken care of.
-
-                ALOGV("Skipping unsupported frame (compression, encryption "
-                     "or per-frame unsynchronization flagged");
-
-                mOffset += mFrameSize;
-                continue;
-            }
-
-            mFrameData = &mParent.mData[mOffset + 10];
-
-            if (!mID) {
                 break;
-            }
-
-            char id[5];
-            memcpy(id, &mParent.mData[mOffset], 4);
-            id[4] = '\0';
-
-            if (!strcmp(id, mID)) {
+            case 126:
+                mFrameSize = 1;
                 break;
-            }
-        } else {
-            CHECK(mParent.mVersion == ID3_V1 || mParent.mVersion == ID3_V1_1);
-
-            if (mOffset >= mParent.mSize) {
-                return;
-            }
-
-            mFrameData = &mParent.mData[mOffset];
-
-            switch (mOffset) {
-                case 3:
-                case 33:
-                case 63:
-                    mFrameSize = 30;
-                    break;
-                case 93:
-                    mFrameSize = 4;
-                    break;
-                case 97:
-                    if (mParent.mVersion == ID3_V1) {
-                        mFrameSize = 30;
-                    } else {
-                        mFrameSize = 29;
-                    }
-                    break;
-                case 126:
-                    mFrameSize = 1;
-                    break;
-                case 127:
-                    mFrameSize = 1;
-                    break;
-                default:
-                    CHECK(!"Should not be here, invalid offset.");
-                    break;
-            }
-
-            if (!mID) {
+            case 127:
+                mFrameSize = 1;
                 break;
-            }
+            default:
+                CHECK(!"Should not be here, invalid offset.");
+                break;
+        }
+
+        if (!mID) {
+            break;
+        }
 
-            String8 id;
-            getID(&id);
+        String8 id;
+        getID(&id);
 
-            if (id == mID) {
-                break;
-            }
+        if (id == mID) {
+            break;
         }
 
         mOffset += mFrameSize;
@@ -882,99 +993,160 @@ static size_t StringSize(const uint8_t *start, size_t limit, uint8_t encoding) {
     return n;
 }
 
-const void *
-ID3::getAlbumArt(size_t *length, String8 *mime) const {
-    *length = 0;
-    mime->setTo("");
+// Finds where the picture starts in an APIC frame, or a PIC frame for ID3V2.2,
+// of which only the first "available" bytes are in data. Fails if the fields
+// before the picture don't end within them.
+static bool FindPicture(
+        bool isV2_2, const uint8_t *data, size_t available, size_t size,
+        size_t *consumed, String8 *mime) {
+    if (!isV2_2) {
+        uint8_t encoding = data[0];
+        size_t offset = 1;
+
+        // *always* in an 8-bit encoding
+        size_t mimeLen = StringSize(&data[offset], available - offset, 0x00);
+        if (mimeLen > available - offset) {
+            return false;
+        }
+        mime->setTo((const char *)&data[offset]);
+        offset += mimeLen;
 
-    Iterator it(
-            *this,
-            (mVersion == ID3_V2_3 || mVersion == ID3_V2_4) ? "APIC" : "PIC");
+        offset++;
+        if (offset >= size || offset >= available) {
+            return false;
+        }
 
-    while (!it.done()) {
-        size_t size;
-        const uint8_t *data = it.getData(&size);
-        if (!data) {
-            return NULL;
+        size_t descLen = StringSize(&data[offset], available - offset, encoding);
+        if (descLen > available - offset) {
+            return false;
         }
+        offset += descLen;
 
-        if (mVersion == ID3_V2_3 || mVersion == ID3_V2_4) {
-            uint8_t encoding = data[0];
-            size_t consumed = 1;
+        if (offset >= size) {
+            return false;
+        }
 
-            // *always* in an 8-bit encoding
-            size_t mimeLen = StringSize(&data[consumed], size - consumed, 0x00);
-            if (mimeLen > size - consumed) {
-                ALOGW("bogus album art size: mime");
-                return NULL;
-            }
-            mime->setTo((const char *)&data[consumed]);
-            consumed += mimeLen;
-
-#if 0
-            uint8_t picType = data[consumed];
-            if (picType != 0x03) {
-                // Front Cover Art
-                it.next();
-                continue;
-            }
-#endif
+        *consumed = offset;
+        return true;
+    }
 
-            consumed++;
-            if (consumed >= size) {
-                ALOGW("bogus album art size: pic type");
-                return NULL;
-            }
+    uint8_t encoding = data[0];
 
-            size_t descLen = StringSize(&data[consumed], size - consumed, encoding);
-            consumed += descLen;
+    if (size <= 5 || available <= 5) {
+        return false;
+    }
 
-            if (consumed >= size) {
-                ALOGW("bogus album art size: description");
-                return NULL;
-            }
+    if (!memcmp(&data[1], "PNG", 3)) {
+        mime->setTo("image/png");
+    } else if (!memcmp(&data[1], "JPG", 3)) {
+        mime->setTo("image/jpeg");
+    } else if (!memcmp(&data[1], "-->", 3)) {
+        mime->setTo("text/plain");
+    } else {
+        return false;
+    }
 
-            *length = size - consumed;
+    size_t descLen = StringSize(&data[5], available - 5, encoding);
+    if (descLen > available - 5) {
+        return false;
+    }
 
-            return &data[consumed];
-        } else {
-            uint8_t encoding = data[0];
+    *consumed = 5 + descLen;
+    return true;
+}
 
-            if (size <= 5) {
-                return NULL;
-            }
+// offset is where the picture is in the tag.
+bool ID3::findAlbumArt(size_t *offset, size_t *length, String8 *mime) const {
+    *length = 0;
+    mime->setTo("");
 
-            if (!memcmp(&data[1], "PNG", 3)) {
-                mime->setTo("image/png");
-            } else if (!memcmp(&data[1], "JPG", 3)) {
-                mime->setTo("image/jpeg");
-            } else if (!memcmp(&data[1], "-->", 3)) {
-                mime->setTo("text/plain");
-            } else {
-                return NULL;
-            }
+    const char *id = (mVersion == ID3_V2_3 || mVersion == ID3_V2_4) ? "APIC" : "PIC";
+    size_t index = 0;
+    while (index < mFrames.size() && strcmp(mFrames[index].mID, id)) {
+        ++index;
+    }
+    if (index == mFrames.size()) {
+        return false;
+    }
 
-#if 0
-            uint8_t picType = data[4];
-            if (picType != 0x03) {
-                // Front Cover Art
-                it.next();
-                continue;
+    bool isV2_2 = (mVersion == ID3_V2_2);
+    size_t headerLength = isV2_2 ? 6 : 10;
+    size_t dataOffset = mFrames[index].mOffset + headerLength;
+    size_t size = mFrames[index].mSize - headerLength;
+    size_t consumed;
+
+    if (mData != NULL) {
+        if (!FindPicture(isV2_2, &mData[dataOffset], size, size, &consumed, mime)) {
+            ALOGW("bogus album art");
+            return false;
+        }
+    } else {
+        // Only read the fields before the picture, unless they're unusually
+        // long.
+        uint8_t header[kPictureHeaderSize];
+        size_t available = (size < sizeof(header)) ? size : sizeof(header);
+        if (!readTag(dataOffset, header, available)) {
+            return false;
+        }
+
+        if (!FindPicture(isV2_2, header, available, size, &consumed, mime)) {
+            if (available == size) {
+                ALOGW("bogus album art");
+                return false;
             }
-#endif
 
-            size_t descLen = StringSize(&data[5], size - 5, encoding);
-            if (descLen > size - 5) {
-                return NULL;
+            uint8_t *data = (uint8_t *)malloc(size);
+            bool found = data != NULL && readTag(dataOffset, data, size)
+                    && FindPicture(isV2_2, data, size, size, &consumed, mime);
+            free(data);
+            if (!found) {
+                ALOGW("bogus album art");
+                return false;
             }
+        }
+    }
+
+    *offset = dataOffset + consumed;
+    *length = size - consumed;
+    return true;
+}
 
-            *length = size - 5 - descLen;
+const void *
+ID3::getAlbumArt(size_t *length, String8 *mime) const {
+    size_t offset;
+    if (!findAlbumArt(&offset, length, mime)) {
+        *length = 0;
+        return NULL;
+    }
 
-            return &data[5 + descLen];
-        }
+    if (mData != NULL) {
+        return &mData[offset];
+    }
+
+    free(mAlbumArt);
+    mAlbumArt = (uint8_t *)malloc(*length);
+    if (mAlbumArt == NULL || !readTag(offset, mAlbumArt, *length)) {
+        free(mAlbumArt);
+        mAlbumArt = NULL;
+        *length = 0;
+        return NULL;
     }
 
-    return NULL;
+    return mAlbumArt;
+}
+
+bool ID3::getAlbumArtRange(off64_t *offset, size_t *length, String8 *mime) const {
+    if (mSource == NULL) {
+        return false;
+    }
+
+    size_t tagOffset;
+    if (!findAlbumArt(&tagOffset, length, mime)) {
+        return false;
+    }
+
+    *offset = mDataOffset + tagOffset;
+    return true;
 }
 
 bool ID3::parseV1(DataSourceBase *source) {
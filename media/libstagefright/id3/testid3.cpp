@@ -105,6 +105,11 @@ void scanFile(const char *path) {
                    mime.string());
 
             hexdump(data, dataSize > 128 ? 128 : dataSize);
+
+            off64_t offset;
+            if (tag.getAlbumArtRange(&offset, &dataSize, &mime)) {
+                printf("album art at offset %lld\n", (long long)offset);
+            }
         }
     }
 }
@@ -77,7 +77,14 @@ protected:
             int64_t timeUs,
             bool *done) = 0;
 
+    // Runs the decoder until onOutputReceived() reports done.
+    virtual status_t extractInternal();
+
+    const AString &componentName() const    { return mComponentName; }
     sp<MetaData> trackMeta()     const      { return mTrackMeta; }
+    sp<IMediaSource> source()    const      { return mSource; }
+    sp<MediaCodec> decoder()     const      { return mDecoder; }
+    MediaSource::ReadOptions *readOptions() { return &mReadOptions; }
     OMX_COLOR_FORMATTYPE dstFormat() const  { return mDstFormat; }
     int32_t dstBpp()             const      { return mDstBpp; }
 
@@ -98,8 +105,6 @@ private:
     bool mHaveMoreInputs;
     bool mFirstSample;
 
-    status_t extractInternal();
-
     DISALLOW_EVIL_CONSTRUCTORS(FrameDecoder);
 };
 
@@ -147,7 +152,14 @@ struct ImageDecoder : public FrameDecoder {
             const sp<MetaData> &trackMeta,
             const sp<IMediaSource> &source);
 
+    // Decodes only the tiles intersecting |region| into a frame of the size of
+    // |region|, whose left edge is rounded down to an even column. Used instead
+    // of extractFrame(), once per decoder.
+    sp<IMemory> extractRegion(const FrameRect &region);
+
 protected:
+    virtual status_t extractInternal() override;
+
     virtual sp<AMessage> onGetFormatAndSeekOptions(
             int64_t frameTimeUs,
             size_t numFrames,
@@ -169,6 +181,9 @@ protected:
             bool *done) override;
 
 private:
+    struct TileInput;
+    struct TileDecoder;
+
     VideoFrame *mFrame;
     int32_t mWidth;
     int32_t mHeight;
@@ -178,6 +193,21 @@ private:
     int32_t mTileHeight;
     int32_t mTilesDecoded;
     int32_t mTargetTiles;
+    // When extracting rows of tiles one at a time, the frame only holds the
+    // current row and is reused for the next one.
+    bool mSliceMode;
+
+    // Grid images are decoded on up to mNumDecoders codec instances at once
+    // when the whole picture is extracted at once.
+    sp<AMessage> mVideoFormat;
+    int32_t mNumDecoders;
+    bool mDecodeTilesInParallel;
+
+    status_t decodeTiles(const FrameRect &region, sp<IMemory> *frameMem);
+    status_t convertTile(
+            const sp<MediaCodecBuffer> &tileBuffer,
+            const sp<AMessage> &outputFormat,
+            int32_t tileIndex, const FrameRect &region);
 };
 
 }  // namespace android
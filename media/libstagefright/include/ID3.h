@@ -19,6 +19,7 @@
 #define ID3_H_
 
 #include <utils/RefBase.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -35,6 +36,9 @@ struct ID3 {
         ID3_V2_4,
     };
 
+    // Unless the tag has to be unsynchronized, its frames are only indexed
+    // and read from the source when asked for, so the source has to outlive
+    // the ID3 and its iterators.
     explicit ID3(DataSourceBase *source, bool ignoreV1 = false, off64_t offset = 0);
     ID3(const uint8_t *data, size_t size, bool ignoreV1 = false);
     ~ID3();
@@ -43,8 +47,14 @@ struct ID3 {
 
     Version version() const;
 
+    // The returned data is valid until the next call or the destruction of
+    // the ID3.
     const void *getAlbumArt(size_t *length, String8 *mime) const;
 
+    // Where the album art is in the source, without reading it. Only works
+    // for tags read on demand from a source.
+    bool getAlbumArtRange(off64_t *offset, size_t *length, String8 *mime) const;
+
     struct Iterator {
         Iterator(const ID3 &parent, const char *id);
         ~Iterator();
@@ -52,6 +62,8 @@ struct ID3 {
         bool done() const;
         void getID(String8 *id) const;
         void getString(String8 *s, String8 *ss = NULL) const;
+        // The returned data is valid until next() or the destruction of the
+        // iterator.
         const uint8_t *getData(size_t *length) const;
         void next();
 
@@ -59,13 +71,18 @@ struct ID3 {
         const ID3 &mParent;
         char *mID;
         size_t mOffset;
+        // index of the frame in mParent.mFrames, for ID3V2 tags
+        size_t mIndex;
 
-        const uint8_t *mFrameData;
+        // read on first use when the tag is not in memory
+        mutable const uint8_t *mFrameData;
+        mutable uint8_t *mBuffer;
         size_t mFrameSize;
 
         void findFrame();
 
         size_t getHeaderLength() const;
+        const uint8_t *getFrameData() const;
         void getstring(String8 *s, bool secondhalf) const;
 
         Iterator(const Iterator &);
@@ -75,7 +92,16 @@ struct ID3 {
     size_t rawSize() const { return mRawSize; }
 
 private:
+    struct Frame {
+        char mID[5];
+        // offset of the frame header in the tag
+        size_t mOffset;
+        // size including the header
+        size_t mSize;
+    };
+
     bool mIsValid;
+    // the tag, unless it is read on demand from mSource
     uint8_t *mData;
     size_t mSize;
     size_t mFirstFrameOffset;
@@ -85,8 +111,26 @@ private:
     // only valid for IDV2+
     size_t mRawSize;
 
+    DataSourceBase *mSource;
+    // offset of the tag in mSource, past its header
+    off64_t mDataOffset;
+    // the last part of the tag read from mSource, most frames are small
+    // enough to be read from it
+    mutable uint8_t *mWindow;
+    mutable size_t mWindowOffset;
+    mutable size_t mWindowSize;
+    mutable uint8_t *mAlbumArt;
+
+    // the supported frames of an ID3V2 tag
+    Vector<Frame> mFrames;
+
     bool parseV1(DataSourceBase *source);
-    bool parseV2(DataSourceBase *source, off64_t offset);
+    bool parseV2(DataSourceBase *source, off64_t offset, bool readOnDemand);
+    bool parseV2_l(DataSourceBase *source, off64_t offset, bool readOnDemand);
+    bool readTag(size_t offset, void *data, size_t size) const;
+    bool isSynchronizedV2_4() const;
+    void indexFrames();
+    bool findAlbumArt(size_t *offset, size_t *length, String8 *mime) const;
     void removeUnsynchronization();
     bool removeUnsynchronizationV2_4(bool iTunesHack);
 
@@ -20,6 +20,7 @@
 
 #include <media/IMediaExtractor.h>
 #include <media/MediaMetadataRetrieverInterface.h>
+#include <media/stagefright/foundation/AString.h>
 
 #include <utils/KeyedVector.h>
 
@@ -48,6 +49,8 @@ struct StagefrightMetadataRetriever : public MediaMetadataRetrieverBase {
             int index, int colorFormat, bool metaOnly, bool thumbnail);
     virtual sp<IMemory> getImageRectAtIndex(
             int index, int colorFormat, int left, int top, int right, int bottom);
+    virtual sp<IMemory> getImageRoiAtIndex(
+            int index, int colorFormat, int left, int top, int right, int bottom);
     virtual status_t getFrameAtIndex(
             std::vector<sp<IMemory> >* frames,
             int frameIndex, int numFrames, int colorFormat, bool metaOnly);
@@ -58,6 +61,10 @@ struct StagefrightMetadataRetriever : public MediaMetadataRetrieverBase {
 private:
     sp<DataSource> mSource;
     sp<IMediaExtractor> mExtractor;
+    // mExtractor was created in metadata only mode, and has to be replaced
+    // before reading any samples.
+    bool mMetadataOnly;
+    AString mMime;
 
     bool mParsedMetaData;
     KeyedVector<int, String8> mMetaData;
@@ -65,6 +72,11 @@ private:
 
     sp<ImageDecoder> mImageDecoder;
     int mLastImageIndex;
+
+    // Creates mExtractor in metadata only mode, until the first frame or
+    // image is requested.
+    status_t createMetadataExtractor(const char *mime);
+    status_t ensureFullExtractor();
     void parseMetaData();
     // Delete album art and clear metadata.
     void clearMetadata();
@@ -73,7 +85,8 @@ private:
             int64_t timeUs, int numFrames, int option, int colorFormat, bool metaOnly,
             sp<IMemory>* outFrame, std::vector<sp<IMemory> >* outFrames);
     virtual sp<IMemory> getImageInternal(
-            int index, int colorFormat, bool metaOnly, bool thumbnail, FrameRect* rect);
+            int index, int colorFormat, bool metaOnly, bool thumbnail, FrameRect* rect,
+            const FrameRect* roi = NULL);
 
     StagefrightMetadataRetriever(const StagefrightMetadataRetriever &);
 
@@ -19,6 +19,10 @@
 #define MPEG4_WRITER_H_
 
 #include <stdio.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <vector>
 
 #include <media/stagefright/MediaWriter.h>
 #include <utils/List.h>
@@ -229,6 +233,57 @@ private:
     // Actually write the given chunk to the file.
     void writeChunkToFile(Chunk* chunk);
 
+    // Sample data staged for the next flushSamples_l(), in file order: either a range of
+    // a sample buffer, or a NAL length prefix / exif header offset kept in mPrefixes
+    // (by offset, as the vector may grow).
+    struct StagedData {
+        const uint8_t *mData;   // NULL for a prefix
+        size_t mPrefixOffset;
+        size_t mSize;
+    };
+    struct WriteBatch {
+        int mFd;
+        off64_t mOffset;                    // where mData goes in the file
+        size_t mSize;
+        std::vector<StagedData> mData;
+        std::vector<uint8_t> mPrefixes;
+        List<MediaBuffer *> mBuffers;       // released once mData is written
+
+        WriteBatch() : mFd(-1), mOffset(0), mSize(0) {}
+    };
+    WriteBatch mStaged;
+
+    // The sample data is written by a separate I/O thread, so that the writer thread can
+    // prepare the next chunk, and the track threads keep buffering chunks, while the file
+    // system is busy. At most mIoBudgetBytes of staged data are queued; the writer thread
+    // waits for room beyond that. With a budget of 0, the data is written synchronously.
+    size_t mIoBudgetBytes;
+    size_t mIoQueuedBytes;                  // protected by mIoLock
+    List<WriteBatch *> mIoQueue;            // protected by mIoLock
+    bool mIoDone;                           // protected by mIoLock
+    bool mIoThreadStarted;
+    pthread_t mIoThread;
+    Mutex mIoLock;
+    Condition mIoQueueCondition;            // signal that a batch was queued
+    Condition mIoSpaceCondition;            // signal that a batch was written
+
+    status_t startIoThread();
+    // waits for the queued batches to be written
+    void stopIoThread();
+    static void *IoThreadWrapper(void *me);
+    void ioThreadFunc();
+    void writeBatch(WriteBatch *batch);
+
+    // Latency of each batch write, i.e. of writing a chunk (or a sample when there is a
+    // single track): bucket i counts the writes that took less than 2^i ms, the last
+    // bucket those that took longer.
+    enum {
+        kNumWriteLatencyBuckets = 10,
+    };
+    std::atomic<uint32_t> mWriteLatencyHistogram[kNumWriteLatencyBuckets];
+    std::atomic<int64_t> mMaxWriteLatencyUs;
+    std::atomic<int64_t> mWriteBytes;
+
     // Adjust other track media clock (presumably wall clock)
     // based on audio track media clock with the drift time.
     int64_t mDriftTimeUs;
@@ -255,9 +310,14 @@ private:
     void initInternal(int fd, bool isFirstSession);
 
     // Acquire lock before calling these methods
+    // The sample data is only staged by addSample_l(); flushSamples_l() hands it over to
+    // the I/O thread, along with the sample buffers, which are released once written.
     off64_t addSample_l(MediaBuffer *buffer, bool usePrefix, bool isExif, size_t *bytesWritten);
     void addLengthPrefixedSample_l(MediaBuffer *buffer);
     void addMultipleLengthPrefixedSamples_l(MediaBuffer *buffer);
+    void stageSampleData_l(const void *data, size_t size);
+    void stageSamplePrefix_l(const void *prefix, size_t size);
+    void flushSamples_l(List<MediaBuffer *> *buffers);
     uint16_t addProperty_l(const ItemProperty &);
     uint16_t addItem_l(const ItemInfo &);
     void addRefs_l(uint16_t itemId, const ItemRefs &);
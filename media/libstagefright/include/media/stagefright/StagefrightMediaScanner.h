@@ -20,6 +20,13 @@
 
 #include <media/mediascanner.h>
 
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 namespace android {
 
 struct StagefrightMediaScanner : public MediaScanner {
@@ -32,10 +39,31 @@ struct StagefrightMediaScanner : public MediaScanner {
 
     virtual MediaAlbumArt *extractAlbumArt(int fd);
 
+protected:
+    // Prefetched files are processed on up to media.scanner.extractors
+    // threads, into a client recording the tags, which processFile() then
+    // replays into the actual client.
+    virtual void prefetchFile(const char *path);
+    virtual void releaseFile(const char *path);
+
 private:
+    struct PrefetchedFile;
+    struct RecordingClient;
+
     StagefrightMediaScanner(const StagefrightMediaScanner &);
     StagefrightMediaScanner &operator=(const StagefrightMediaScanner &);
 
+    Mutex mLock;
+    Condition mCondition;
+    size_t mMaxExtractors;
+    std::vector<std::thread> mExtractors;
+    bool mStopping;
+    std::deque<std::shared_ptr<PrefetchedFile>> mPending;
+    std::unordered_map<std::string, std::shared_ptr<PrefetchedFile>> mPrefetched;
+
+    void releaseFile_l(const char *path);
+    void extractorLoop();
+
     MediaScanResult processFileInternal(
             const char *path, const char *mimeType,
             MediaScannerClient &client);
@@ -116,6 +116,9 @@ struct ATSParser::Program : public RefBase {
 
     void signalNewSampleAesKey(const sp<AMessage> &keyItem);
 
+    // Set the elementary stream PIDs of this program in pids.
+    void getStreamPIDs(std::bitset<0x2000> *pids) const;
+
 private:
     struct StreamInfo {
         unsigned mType;
@@ -713,6 +716,12 @@ void ATSParser::Program::updateCasSessions() {
     }
 }
 
+void ATSParser::Program::getStreamPIDs(std::bitset<0x2000> *pids) const {
+    for (size_t i = 0; i < mStreams.size(); ++i) {
+        pids->set(mStreams.valueAt(i)->pid());
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 static const size_t kInitialStreamBufferSize = 192 * 1024;
 
@@ -1659,6 +1668,7 @@ void ATSParser::Stream::setCasInfo(
 
 ATSParser::ATSParser(uint32_t flags)
     : mFlags(flags),
+      mSelectedPIDsValid(false),
       mAbsoluteTimeAnchorUs(-1ll),
       mTimeOffsetValid(false),
       mTimeOffsetUs(0ll),
@@ -1683,6 +1693,75 @@ status_t ATSParser::feedTSPacket(const void *data, size_t size,
     return parseTS(&br, event);
 }
 
+status_t ATSParser::feedTSPackets(const void *data, size_t size,
+        SyncEvent *event, size_t *bytesFed) {
+    if (bytesFed != NULL) {
+        *bytesFed = 0;
+    }
+    if (size % kTSPacketSize != 0) {
+        ALOGE("Wrong TS packets size %zu", size);
+        return BAD_VALUE;
+    }
+
+    const uint8_t *packet = (const uint8_t *)data;
+    const off64_t startOffset = (event != NULL) ? event->getOffset() : 0;
+    status_t err = OK;
+    size_t offset = 0;
+    while (offset < size) {
+        if (!mSelectedPIDsValid) {
+            updateSelectedPIDs();
+        }
+
+        // Skip packets that parseTS() would not do anything with, counting
+        // them the way it does.
+        const uint8_t *p = &packet[offset];
+        offset += kTSPacketSize;
+        if (p[0] == 0x47) {
+            if (p[1] & 0x80) {
+                // transport_error_indicator set: ignored, and not counted.
+                continue;
+            }
+            // Unselected PIDs (including null packets) are only counted,
+            // unless they carry a PCR.
+            unsigned PID = ((p[1] & 0x1f) << 8) | p[2];
+            bool hasAdaptationField = (p[3] & 0x20) != 0;
+            bool hasPCR = hasAdaptationField && p[4] > 0 && (p[5] & 0x10);
+            if (!mSelectedPIDs[PID] && !hasPCR) {
+                ++mNumTSPacketsParsed;
+                continue;
+            }
+        }
+
+        if (event != NULL) {
+            *event = SyncEvent(startOffset + offset - kTSPacketSize);
+        }
+        ABitReader br(p, kTSPacketSize);
+        err = parseTS(&br, event);
+        if (err != OK || (event != NULL && event->hasReturnedData())) {
+            break;
+        }
+    }
+
+    if (bytesFed != NULL) {
+        *bytesFed = offset;
+    }
+    return err;
+}
+
+void ATSParser::updateSelectedPIDs() {
+    mSelectedPIDs.reset();
+    for (size_t i = 0; i < mPSISections.size(); ++i) {
+        mSelectedPIDs.set(mPSISections.keyAt(i));
+    }
+    for (size_t i = 0; i < mPrograms.size(); ++i) {
+        mPrograms.itemAt(i)->getStreamPIDs(&mSelectedPIDs);
+    }
+    for (uint32_t pid : mCasManager->getCAPids()) {
+        mSelectedPIDs.set(pid);
+    }
+    mSelectedPIDsValid = true;
+}
+
 status_t ATSParser::setMediaCas(const sp<ICas> &cas) {
     status_t err = mCasManager->setMediaCas(cas);
     if (err != OK) {
@@ -1858,6 +1937,7 @@ status_t ATSParser::parsePID(
         if (!section->isCRCOkay()) {
             return BAD_VALUE;
         }
+        mSelectedPIDsValid = false;
         ABitReader sectionBits(section->data(), section->size());
 
         if (PID == 0) {
@@ -26,6 +26,7 @@
 #include <utils/KeyedVector.h>
 #include <utils/Vector.h>
 #include <utils/RefBase.h>
+#include <bitset>
 #include <vector>
 
 namespace android {
@@ -121,6 +122,17 @@ struct ATSParser : public RefBase {
     status_t feedTSPacket(
             const void *data, size_t size, SyncEvent *event = NULL);
 
+    // Feed consecutive TS packets, size must be a multiple of the packet size.
+    // Packets on PIDs the parser has no use for (so far) are skipped without
+    // being parsed. If event is not NULL, it goes in with the start offset of
+    // the first packet and feeding stops after the packet that initializes it,
+    // see feedTSPacket(). Feeding also stops after a packet that fails to
+    // parse, whose error is returned. |*bytesFed|, if not NULL, is the number
+    // of bytes fed either way.
+    status_t feedTSPackets(
+            const void *data, size_t size, SyncEvent *event = NULL,
+            size_t *bytesFed = NULL);
+
     void signalDiscontinuity(
             DiscontinuityType type, const sp<AMessage> &extra);
 
@@ -182,6 +194,12 @@ private:
     // Keyed by PID
     KeyedVector<unsigned, sp<PSISection> > mPSISections;
 
+    // PIDs that parsePID() hands to a PSI section, a stream or the CasManager,
+    // indexed by PID. Only valid if mSelectedPIDsValid, which is cleared
+    // whenever a PSI section is parsed, as that is what changes them.
+    std::bitset<0x2000> mSelectedPIDs;
+    bool mSelectedPIDsValid;
+
     int64_t mAbsoluteTimeAnchorUs;
 
     bool mTimeOffsetValid;
@@ -220,6 +238,8 @@ private:
 
     void updatePCR(unsigned PID, uint64_t PCR, uint64_t byteOffsetFromStart);
 
+    void updateSelectedPIDs();
+
     uint64_t mPCR[2];
     uint64_t mPCRBytes[2];
     int64_t mSystemTimeUs[2];
@@ -49,6 +49,8 @@ struct ATSParser::CasManager : public RefBase {
 
     bool isCAPid(unsigned pid);
 
+    const std::set<uint32_t> &getCAPids() const { return mCAPidSet; }
+
     bool parsePID(ABitReader *br, unsigned pid);
 
 private:
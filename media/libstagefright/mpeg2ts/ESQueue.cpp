@@ -42,6 +42,11 @@ ElementaryStreamQueue::ElementaryStreamQueue(Mode mode, uint32_t flags)
     : mMode(mode),
       mFlags(flags),
       mEOSReached(false),
+      mH264ScanOffset(0),
+      mH264TotalSize(0),
+      mH264SEICount(0),
+      mH264FoundSlice(false),
+      mH264FoundIDR(false),
       mCASystemId(0),
       mAUIndex(0) {
 
@@ -63,6 +68,7 @@ void ElementaryStreamQueue::clear(bool clearFormat) {
     }
 
     mRangeInfos.clear();
+    resetH264Scan();
 
     if (mScrambledBuffer != NULL) {
         mScrambledBuffer->setRange(0, 0);
@@ -76,6 +82,19 @@ void ElementaryStreamQueue::clear(bool clearFormat) {
     mEOSReached = false;
 }
 
+void ElementaryStreamQueue::consumeData(size_t size) {
+    mBuffer->setRange(mBuffer->offset() + size, mBuffer->size() - size);
+}
+
+void ElementaryStreamQueue::resetH264Scan() {
+    mH264NALs.clear();
+    mH264ScanOffset = 0;
+    mH264TotalSize = 0;
+    mH264SEICount = 0;
+    mH264FoundSlice = false;
+    mH264FoundIDR = false;
+}
+
 bool ElementaryStreamQueue::isScrambled() const {
     return (mFlags & kFlag_ScrambledData) != 0;
 }
@@ -291,15 +310,8 @@ status_t ElementaryStreamQueue::appendData(
 #else
                 uint8_t *ptr = (uint8_t *)data;
 
-                ssize_t startOffset = -1;
-                for (size_t i = 0; i + 2 < size; ++i) {
-                    if (!memcmp("\x00\x00\x01", &ptr[i], 3)) {
-                        startOffset = i;
-                        break;
-                    }
-                }
-
-                if (startOffset < 0) {
+                ssize_t startOffset = findStartCodePrefix(ptr, size);
+                if ((size_t)startOffset == size) {
                     return ERROR_MALFORMED;
                 }
 
@@ -324,15 +336,8 @@ status_t ElementaryStreamQueue::appendData(
 #else
                 uint8_t *ptr = (uint8_t *)data;
 
-                ssize_t startOffset = -1;
-                for (size_t i = 0; i + 2 < size; ++i) {
-                    if (!memcmp("\x00\x00\x01", &ptr[i], 3)) {
-                        startOffset = i;
-                        break;
-                    }
-                }
-
-                if (startOffset < 0) {
+                ssize_t startOffset = findStartCodePrefix(ptr, size);
+                if ((size_t)startOffset == size) {
                     return ERROR_MALFORMED;
                 }
 
@@ -470,10 +475,16 @@ status_t ElementaryStreamQueue::appendData(
         }
 
         mBuffer = buffer;
+    } else if (mBuffer->offset() + neededSize > mBuffer->capacity()) {
+        // Out of room at the end: move the unconsumed data back to the start. Consumed
+        // data is only reclaimed here, about once per buffer's worth of data rather than
+        // once per access unit.
+        memmove(mBuffer->base(), mBuffer->data(), mBuffer->size());
+        mBuffer->setRange(0, mBuffer->size());
     }
 
     memcpy(mBuffer->data() + mBuffer->size(), data, size);
-    mBuffer->setRange(0, mBuffer->size() + size);
+    mBuffer->setRange(mBuffer->offset(), mBuffer->size() + size);
 
     RangeInfo info;
     info.mLength = size;
@@ -626,11 +637,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnit() {
         memcpy(accessUnit->data(), mBuffer->data(), info.mLength);
         accessUnit->meta()->setInt64("timeUs", info.mTimestampUs);
 
-        memmove(mBuffer->data(),
-                mBuffer->data() + info.mLength,
-                mBuffer->size() - info.mLength);
-
-        mBuffer->setRange(0, mBuffer->size() - info.mLength);
+        consumeData(info.mLength);
 
         if (mFormat == NULL) {
             mFormat = new MetaData;
@@ -720,12 +727,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitAC3() {
     accessUnit->meta()->setInt64("timeUs", timeUs);
     accessUnit->meta()->setInt32("isSync", 1);
 
-    memmove(
-            mBuffer->data(),
-            mBuffer->data() + syncStartPos + payloadSize,
-            mBuffer->size() - syncStartPos - payloadSize);
-
-    mBuffer->setRange(0, mBuffer->size() - syncStartPos - payloadSize);
+    consumeData(syncStartPos + payloadSize);
 
     return accessUnit;
 }
@@ -788,12 +790,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitPCMAudio() {
         ptr[i] = ntohs(ptr[i]);
     }
 
-    memmove(
-            mBuffer->data(),
-            mBuffer->data() + 4 + payloadSize,
-            mBuffer->size() - 4 - payloadSize);
-
-    mBuffer->setRange(0, mBuffer->size() - 4 - payloadSize);
+    consumeData(4 + payloadSize);
 
     return accessUnit;
 }
@@ -951,9 +948,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitAAC() {
     sp<ABuffer> accessUnit = new ABuffer(offset);
     memcpy(accessUnit->data(), mBuffer->data(), offset);
 
-    memmove(mBuffer->data(), mBuffer->data() + offset,
-            mBuffer->size() - offset);
-    mBuffer->setRange(0, mBuffer->size() - offset);
+    consumeData(offset);
 
     accessUnit->meta()->setInt64("timeUs", timeUs);
     accessUnit->meta()->setInt32("isSync", 1);
@@ -1025,23 +1020,25 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
         return dequeueScrambledAccessUnit();
     }
 
-    const uint8_t *data = mBuffer->data();
-
-    size_t size = mBuffer->size();
-    Vector<NALPosition> nals;
+    // Resume after the NAL units parsed by the previous calls, if any.
+    const uint8_t *data = mBuffer->data() + mH264ScanOffset;
+    size_t size = mBuffer->size() - mH264ScanOffset;
+    Vector<NALPosition> &nals = mH264NALs;
 
-    size_t totalSize = 0;
-    size_t seiCount = 0;
+    size_t &totalSize = mH264TotalSize;
+    size_t &seiCount = mH264SEICount;
 
     status_t err;
     const uint8_t *nalStart;
     size_t nalSize;
-    bool foundSlice = false;
-    bool foundIDR = false;
+    bool &foundSlice = mH264FoundSlice;
+    bool &foundIDR = mH264FoundIDR;
 
-    ALOGV("dequeueAccessUnit_H264[%d] %p/%zu", mAUIndex, data, size);
+    ALOGV("dequeueAccessUnit_H264[%d] %p/%zu from %zu",
+            mAUIndex, mBuffer->data(), mBuffer->size(), mH264ScanOffset);
 
     while ((err = getNextNALUnit(&data, &size, &nalStart, &nalSize)) == OK) {
+        mH264ScanOffset = data - mBuffer->data();
         if (nalSize == 0) continue;
 
         unsigned nalType = nalStart[0] & 0x1f;
@@ -1102,6 +1099,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
                 if (nalType == 6 && pos.nalSize > 0) {
                     if (seiIndex >= sei->size() / sizeof(NALPosition)) {
                         ALOGE("Wrong seiIndex");
+                        resetH264Scan();
                         return NULL;
                     }
                     NALPosition &seiPos = ((NALPosition *)sei->data())[seiIndex++];
@@ -1153,11 +1151,11 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
             const NALPosition &pos = nals.itemAt(nals.size() - 1);
             size_t nextScan = pos.nalOffset + pos.nalSize;
 
-            memmove(mBuffer->data(),
-                    mBuffer->data() + nextScan,
-                    mBuffer->size() - nextScan);
+            consumeData(nextScan);
 
-            mBuffer->setRange(0, mBuffer->size() - nextScan);
+            // The next call parses again from the NAL unit that flushed this access unit.
+            bool isSync = foundIDR;
+            resetH264Scan();
 
             int64_t timeUs = fetchTimestamp(nextScan);
             if (timeUs < 0ll) {
@@ -1166,7 +1164,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
             }
 
             accessUnit->meta()->setInt64("timeUs", timeUs);
-            if (foundIDR) {
+            if (isSync) {
                 accessUnit->meta()->setInt32("isSync", 1);
             }
 
@@ -1186,9 +1184,8 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
                 accessUnit->setRange(0, adjustedSize);
             }
 
-            ALOGV("dequeueAccessUnitH264[%d]: AU %p(%zu) dstOffset:%zu, nals:%zu, totalSize:%zu ",
-                    mAUIndex, accessUnit->data(), accessUnit->size(),
-                    dstOffset, nals.size(), totalSize);
+            ALOGV("dequeueAccessUnitH264[%d]: AU %p(%zu) dstOffset:%zu",
+                    mAUIndex, accessUnit->data(), accessUnit->size(), dstOffset);
             mAUIndex++;
 
             return accessUnit;
@@ -1204,6 +1201,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
     }
     if (err != (status_t)-EAGAIN) {
         ALOGE("Unexpeted err");
+        resetH264Scan();
         return NULL;
     }
 
@@ -1238,11 +1236,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGAudio() {
     sp<ABuffer> accessUnit = new ABuffer(frameSize);
     memcpy(accessUnit->data(), data, frameSize);
 
-    memmove(mBuffer->data(),
-            mBuffer->data() + frameSize,
-            mBuffer->size() - frameSize);
-
-    mBuffer->setRange(0, mBuffer->size() - frameSize);
+    consumeData(frameSize);
 
     int64_t timeUs = fetchTimestamp(frameSize);
     if (timeUs < 0ll) {
@@ -1356,23 +1350,18 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
     bool isClosedGop = false;
     bool brokenLink = false;
 
-    size_t offset = 0;
+    size_t offset = findStartCodePrefix(data, size);
     while (offset + 3 < size) {
-        if (memcmp(&data[offset], "\x00\x00\x01", 3)) {
-            ++offset;
-            continue;
-        }
-
         pprevStartCode = prevStartCode;
         prevStartCode = currentStartCode;
         currentStartCode = data[offset + 3];
 
         if (currentStartCode == 0xb3 && mFormat == NULL) {
-            memmove(mBuffer->data(), mBuffer->data() + offset, size - offset);
+            consumeData(offset);
+            data = mBuffer->data();
             size -= offset;
             (void)fetchTimestamp(offset);
             offset = 0;
-            mBuffer->setRange(0, size);
         }
 
         if ((prevStartCode == 0xb3 && currentStartCode != 0xb5)
@@ -1401,11 +1390,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
                 sp<ABuffer> csd = new ABuffer(offset);
                 memcpy(csd->data(), data, offset);
 
-                memmove(mBuffer->data(),
-                        mBuffer->data() + offset,
-                        mBuffer->size() - offset);
-
-                mBuffer->setRange(0, mBuffer->size() - offset);
+                consumeData(offset);
                 size -= offset;
                 (void)fetchTimestamp(offset);
                 offset = 0;
@@ -1444,11 +1429,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
                 sp<ABuffer> accessUnit = new ABuffer(offset);
                 memcpy(accessUnit->data(), data, offset);
 
-                memmove(mBuffer->data(),
-                        mBuffer->data() + offset,
-                        mBuffer->size() - offset);
-
-                mBuffer->setRange(0, mBuffer->size() - offset);
+                consumeData(offset);
 
                 int64_t timeUs = fetchTimestamp(offset);
                 if (timeUs < 0ll) {
@@ -1485,7 +1466,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
             }
         }
 
-        ++offset;
+        offset += 1 + findStartCodePrefix(&data[offset + 1], size - offset - 1);
     }
 
     return NULL;
@@ -1505,13 +1486,9 @@ static ssize_t getNextChunkSize(
         return -EAGAIN;
     }
 
-    size_t offset = 4;
-    while (offset + 2 < size) {
-        if (!memcmp(&data[offset], kStartCode, 3)) {
-            return offset;
-        }
-
-        ++offset;
+    size_t offset = 4 + findStartCodePrefix(&data[4], size - 4);
+    if (offset < size) {
+        return offset;
     }
 
     return -EAGAIN;
@@ -1643,9 +1620,9 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEG4Video() {
                     sp<ABuffer> accessUnit = new ABuffer(offset);
                     memcpy(accessUnit->data(), data, offset);
 
-                    memmove(data, &data[offset], size - offset);
+                    consumeData(offset);
+                    data = mBuffer->data();
                     size -= offset;
-                    mBuffer->setRange(0, size);
 
                     int64_t timeUs = fetchTimestamp(offset);
                     if (timeUs < 0ll) {
@@ -1681,10 +1658,10 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEG4Video() {
 
         if (discard) {
             (void)fetchTimestamp(offset);
-            memmove(data, &data[offset], size - offset);
+            consumeData(offset);
+            data = mBuffer->data();
             size -= offset;
             offset = 0;
-            mBuffer->setRange(0, size);
         } else {
             offset += chunkSize;
         }
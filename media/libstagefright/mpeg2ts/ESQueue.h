@@ -20,8 +20,10 @@
 
 #include <media/stagefright/foundation/ABase.h>
 #include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/foundation/avc_utils.h>
 #include <utils/Errors.h>
 #include <utils/List.h>
+#include <utils/Vector.h>
 #include <utils/RefBase.h>
 #include <vector>
 
@@ -96,9 +98,21 @@ private:
     uint32_t mFlags;
     bool mEOSReached;
 
+    // Consumed data is dropped by moving the start of mBuffer's range forward rather than
+    // by moving the data left; appendData() compacts the buffer when it runs out of room.
     sp<ABuffer> mBuffer;
     List<RangeInfo> mRangeInfos;
 
+    // What dequeueAccessUnitH264() parsed of an incomplete access unit, so that the
+    // next call resumes from mH264ScanOffset in mBuffer instead of parsing the same
+    // NAL units again. Offsets are relative to mBuffer->data().
+    Vector<NALPosition> mH264NALs;
+    size_t mH264ScanOffset;
+    size_t mH264TotalSize;
+    size_t mH264SEICount;
+    bool mH264FoundSlice;
+    bool mH264FoundIDR;
+
     sp<ABuffer> mScrambledBuffer;
     List<ScrambledRangeInfo> mScrambledRangeInfos;
     int32_t mCASystemId;
@@ -113,6 +127,10 @@ private:
         return (mFlags & kFlag_SampleEncryptedData) != 0;
     }
 
+    // drops |size| bytes from the front of mBuffer
+    void consumeData(size_t size);
+    void resetH264Scan();
+
     sp<ABuffer> dequeueAccessUnitH264();
     sp<ABuffer> dequeueAccessUnitAAC();
     sp<ABuffer> dequeueAccessUnitAC3();
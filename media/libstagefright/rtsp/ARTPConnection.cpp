@@ -31,12 +31,21 @@
 #include <media/stagefright/foundation/hexdump.h>
 
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 namespace android {
 
 static const size_t kMaxUDPSize = 1500;
 
+// Datagrams fetched per recvmmsg() call, each into a slot large enough for any
+// UDP payload. A connection starts with one slot and doubles them whenever a
+// batch fills them all, so only busy streams pay for the larger batches.
+static const size_t kMaxReceiveBatchSize = 16;
+static const size_t kReceiveSlotSize = 65536;
+
+static const int kMaxPollEvents = 16;
+
 static uint16_t u16at(const uint8_t *data) {
     return data[0] << 8 | data[1];
 }
@@ -50,7 +59,7 @@ static uint64_t u64at(const uint8_t *data) {
 }
 
 // static
-const int64_t ARTPConnection::kSelectTimeoutUs = 1000ll;
+const int64_t ARTPConnection::kPollTimeoutUs = 1000ll;
 
 struct ARTPConnection::StreamInfo {
     int mRTPSocket;
@@ -69,11 +78,16 @@ struct ARTPConnection::StreamInfo {
 
 ARTPConnection::ARTPConnection(uint32_t flags)
     : mFlags(flags),
+      mReceiveBatchSize(1),
       mPollEventPending(false),
       mLastReceiverReportTimeUs(-1) {
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_GE(mEpollFd, 0);
 }
 
 ARTPConnection::~ARTPConnection() {
+    close(mEpollFd);
+    mEpollFd = -1;
 }
 
 void ARTPConnection::addStream(
@@ -206,10 +220,35 @@ void ARTPConnection::onAddStream(const sp<AMessage> &msg) {
     memset(&info->mRemoteRTCPAddr, 0, sizeof(info->mRemoteRTCPAddr));
 
     if (!injected) {
+        int sockets[2] = { info->mRTPSocket, info->mRTCPSocket };
+        for (size_t i = 0; i < 2; ++i) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = sockets[i];
+
+            if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, sockets[i], &ev) < 0) {
+                ALOGE("failed to poll socket %d (%s)",
+                      sockets[i], strerror(errno));
+            }
+        }
+
         postPollEvent();
     }
 }
 
+List<ARTPConnection::StreamInfo>::iterator ARTPConnection::eraseStream(
+        List<StreamInfo>::iterator it) {
+    if (!it->mIsInjected) {
+        // The owner may have closed the sockets already, which removed them
+        // from the epoll set.
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, it->mRTPSocket, NULL);
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, it->mRTCPSocket, NULL);
+    }
+
+    return mStreams.erase(it);
+}
+
 void ARTPConnection::onRemoveStream(const sp<AMessage> &msg) {
     int32_t rtpSocket, rtcpSocket;
     CHECK(msg->findInt32("rtp-socket", &rtpSocket));
@@ -225,7 +264,7 @@ void ARTPConnection::onRemoveStream(const sp<AMessage> &msg) {
         return;
     }
 
-    mStreams.erase(it);
+    eraseStream(it);
 }
 
 void ARTPConnection::postPollEvent() {
@@ -246,62 +285,48 @@ void ARTPConnection::onPollStreams() {
         return;
     }
 
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = kSelectTimeoutUs;
-
-    fd_set rs;
-    FD_ZERO(&rs);
-
-    int maxSocket = -1;
+    bool hasPolledStreams = false;
     for (List<StreamInfo>::iterator it = mStreams.begin();
          it != mStreams.end(); ++it) {
-        if ((*it).mIsInjected) {
-            continue;
-        }
-
-        FD_SET(it->mRTPSocket, &rs);
-        FD_SET(it->mRTCPSocket, &rs);
-
-        if (it->mRTPSocket > maxSocket) {
-            maxSocket = it->mRTPSocket;
-        }
-        if (it->mRTCPSocket > maxSocket) {
-            maxSocket = it->mRTCPSocket;
+        if (!it->mIsInjected) {
+            hasPolledStreams = true;
+            break;
         }
     }
 
-    if (maxSocket == -1) {
+    if (!hasPolledStreams) {
         return;
     }
 
-    int res = select(maxSocket + 1, &rs, NULL, NULL, &tv);
+    struct epoll_event events[kMaxPollEvents];
+    int res;
+    do {
+        res = epoll_wait(
+                mEpollFd, events, kMaxPollEvents, kPollTimeoutUs / 1000ll);
+    } while (res < 0 && errno == EINTR);
+
+    for (int i = 0; i < res; ++i) {
+        int fd = events[i].data.fd;
 
-    if (res > 0) {
         List<StreamInfo>::iterator it = mStreams.begin();
-        while (it != mStreams.end()) {
-            if ((*it).mIsInjected) {
-                ++it;
-                continue;
-            }
+        while (it != mStreams.end()
+                && (it->mIsInjected
+                    || (it->mRTPSocket != fd && it->mRTCPSocket != fd))) {
+            ++it;
+        }
 
-            status_t err = OK;
-            if (FD_ISSET(it->mRTPSocket, &rs)) {
-                err = receive(&*it, true);
-            }
-            if (err == OK && FD_ISSET(it->mRTCPSocket, &rs)) {
-                err = receive(&*it, false);
-            }
+        if (it == mStreams.end()) {
+            // erased by an earlier event
+            continue;
+        }
 
-            if (err == -ECONNRESET) {
-                // socket failure, this stream is dead, Jim.
+        status_t err = receive(&*it, fd == it->mRTPSocket);
 
-                ALOGW("failed to receive RTP/RTCP datagram.");
-                it = mStreams.erase(it);
-                continue;
-            }
+        if (err == -ECONNRESET) {
+            // socket failure, this stream is dead, Jim.
 
-            ++it;
+            ALOGW("failed to receive RTP/RTCP datagram.");
+            eraseStream(it);
         }
     }
 
@@ -352,7 +377,7 @@ void ARTPConnection::onPollStreams() {
                     ALOGW("failed to send RTCP receiver report (%s).",
                          n == 0 ? "connection gone" : strerror(errno));
 
-                    it = mStreams.erase(it);
+                    it = eraseStream(it);
                     continue;
                 }
 
@@ -375,36 +400,77 @@ status_t ARTPConnection::receive(StreamInfo *s, bool receiveRTP) {
 
     CHECK(!s->mIsInjected);
 
-    sp<ABuffer> buffer = new ABuffer(65536);
+    if (mReceiveBuffer == NULL) {
+        mReceiveBuffer = new ABuffer(mReceiveBatchSize * kReceiveSlotSize);
+    }
+
+    // The remote address is only needed for the first RTCP packet, it is
+    // where receiver reports go.
+    bool wantsRemoteAddr = !receiveRTP && s->mNumRTCPPacketsReceived == 0;
+
+    struct sockaddr_in remoteAddr;
+    struct iovec iovs[kMaxReceiveBatchSize];
+    struct mmsghdr msgs[kMaxReceiveBatchSize];
 
-    socklen_t remoteAddrLen =
-        (!receiveRTP && s->mNumRTCPPacketsReceived == 0)
-            ? sizeof(s->mRemoteRTCPAddr) : 0;
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < mReceiveBatchSize; ++i) {
+        iovs[i].iov_base = mReceiveBuffer->base() + i * kReceiveSlotSize;
+        iovs[i].iov_len = kReceiveSlotSize;
 
-    ssize_t nbytes;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (wantsRemoteAddr) {
+        msgs[0].msg_hdr.msg_name = &remoteAddr;
+        msgs[0].msg_hdr.msg_namelen = sizeof(remoteAddr);
+    }
+
+    int n;
     do {
-        nbytes = recvfrom(
-            receiveRTP ? s->mRTPSocket : s->mRTCPSocket,
-            buffer->data(),
-            buffer->capacity(),
-            0,
-            remoteAddrLen > 0 ? (struct sockaddr *)&s->mRemoteRTCPAddr : NULL,
-            remoteAddrLen > 0 ? &remoteAddrLen : NULL);
-    } while (nbytes < 0 && errno == EINTR);
+        n = recvmmsg(
+                receiveRTP ? s->mRTPSocket : s->mRTCPSocket,
+                msgs, mReceiveBatchSize, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
 
-    if (nbytes <= 0) {
-        return -ECONNRESET;
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? OK : -ECONNRESET;
     }
 
-    buffer->setRange(0, nbytes);
+    if (n > 0 && wantsRemoteAddr) {
+        s->mRemoteRTCPAddr = remoteAddr;
+    }
 
-    // ALOGI("received %d bytes.", buffer->size());
+    status_t err = OK;
+    for (int i = 0; i < n; ++i) {
+        size_t nbytes = msgs[i].msg_len;
 
-    status_t err;
-    if (receiveRTP) {
-        err = parseRTP(s, buffer);
-    } else {
-        err = parseRTCP(s, buffer);
+        if (nbytes == 0) {
+            // an empty datagram, the ones after it are still good
+            continue;
+        }
+
+        // Copy out so that queued packets don't each pin a 64k slot.
+        sp<ABuffer> buffer = new ABuffer(nbytes);
+        memcpy(buffer->data(), iovs[i].iov_base, nbytes);
+
+        // ALOGI("received %d bytes.", buffer->size());
+
+        status_t parseErr;
+        if (receiveRTP) {
+            parseErr = parseRTP(s, buffer);
+        } else {
+            parseErr = parseRTCP(s, buffer);
+        }
+        if (err == OK) {
+            err = parseErr;
+        }
+    }
+
+    if ((size_t)n == mReceiveBatchSize && mReceiveBatchSize < kMaxReceiveBatchSize) {
+        // the socket had more queued, reallocated on the next receive
+        mReceiveBatchSize *= 2;
+        mReceiveBuffer.clear();
     }
 
     return err;
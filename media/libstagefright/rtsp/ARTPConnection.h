@@ -62,13 +62,21 @@ private:
         kWhatInjectPacket,
     };
 
-    static const int64_t kSelectTimeoutUs;
+    static const int64_t kPollTimeoutUs;
 
     uint32_t mFlags;
 
     struct StreamInfo;
     List<StreamInfo> mStreams;
 
+    // RTP and RTCP sockets of the non injected streams.
+    int mEpollFd;
+
+    // Scratch space for batched receives, allocated on first use and grown
+    // with the batches.
+    size_t mReceiveBatchSize;
+    sp<ABuffer> mReceiveBuffer;
+
     bool mPollEventPending;
     int64_t mLastReceiverReportTimeUs;
 
@@ -78,6 +86,8 @@ private:
     void onInjectPacket(const sp<AMessage> &msg);
     void onSendReceiverReports();
 
+    List<StreamInfo>::iterator eraseStream(List<StreamInfo>::iterator it);
+
     status_t receive(StreamInfo *info, bool receiveRTP);
 
     status_t parseRTP(StreamInfo *info, const sp<ABuffer> &buffer);
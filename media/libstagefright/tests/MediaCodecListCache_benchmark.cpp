@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares what a process creating a local MediaCodecList pays at startup:
+// parsing the media_codecs xml files, against checking and loading the binary
+// cache of the list. The cache is written from the list of this device to a
+// scratch path first.
+//
+// usage: codec_list_cache_benchmark [-n iterations] [-o cache path]
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "MediaCodecListCache_benchmark"
+#include <utils/Log.h>
+
+#include "MediaCodecListCache.h"
+
+#include <media/IMediaCodecList.h>
+#include <media/MediaCodecInfo.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/MediaCodecList.h>
+#include <media/stagefright/xmlparser/MediaCodecsXmlParser.h>
+#include <utils/SystemClock.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace android;
+
+int main(int argc, char **argv) {
+    int iterations = 20;
+    const char *cachePath = "/data/local/tmp/media_codecs_cache.bin";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'o': cachePath = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-o cache path]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    sp<IMediaCodecList> list = MediaCodecList::getLocalInstance();
+    if (list == nullptr) {
+        fprintf(stderr, "failed to build the codec list\n");
+        return 1;
+    }
+    std::vector<sp<MediaCodecInfo>> infos;
+    for (size_t i = 0; i < list->countCodecs(); ++i) {
+        infos.push_back(list->getCodecInfo(i));
+    }
+
+    const char *profilingResults = MediaCodecsXmlParser::defaultProfilingResultsXmlPath;
+    // the builders only need to be the same for storing and loading here
+    const char *buildersKey = "omx;plugin;";
+    uint64_t checksum = MediaCodecListCache::ComputeInputsChecksum(
+            MediaCodecsXmlParser::defaultSearchDirs, profilingResults, buildersKey);
+    status_t err = MediaCodecListCache::Store(
+            cachePath, checksum, list->getGlobalSettings(), infos);
+    if (err != OK) {
+        fprintf(stderr, "failed to write %s (%d)\n", cachePath, err);
+        return 1;
+    }
+
+    int64_t startUs = elapsedRealtimeNano() / 1000;
+    for (int i = 0; i < iterations; ++i) {
+        MediaCodecsXmlParser parser;
+        if (parser.getParsingStatus() != OK) {
+            fprintf(stderr, "failed to parse the codec xml files\n");
+            return 1;
+        }
+    }
+    int64_t parseUs = (elapsedRealtimeNano() / 1000 - startUs) / iterations;
+
+    startUs = elapsedRealtimeNano() / 1000;
+    for (int i = 0; i < iterations; ++i) {
+        sp<AMessage> settings;
+        std::vector<sp<MediaCodecInfo>> loaded;
+        err = MediaCodecListCache::Load(
+                cachePath,
+                MediaCodecListCache::ComputeInputsChecksum(
+                        MediaCodecsXmlParser::defaultSearchDirs, profilingResults,
+                        buildersKey),
+                &settings, &loaded);
+        if (err != OK || loaded.size() != infos.size()) {
+            fprintf(stderr, "failed to load %s (%d)\n", cachePath, err);
+            return 1;
+        }
+    }
+    int64_t loadUs = (elapsedRealtimeNano() / 1000 - startUs) / iterations;
+
+    printf("codecs: %zu\n", infos.size());
+    printf("xml parse: %lld us\n", (long long)parseUs);
+    printf("cache load: %lld us (checksum included)\n", (long long)loadUs);
+
+    unlink(cachePath);
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "MediaCodecListCache_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include "MediaCodecListCache.h"
+
+#include <cutils/properties.h>
+#include <media/IMediaCodecList.h>
+#include <media/MediaCodecInfo.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/MediaCodecList.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+
+static const char kBuildersKey[] = "omx;plugin;";
+
+class MediaCodecListCacheTest : public ::testing::Test {
+public:
+    virtual void SetUp() {
+        char dir[] = "/data/local/tmp/codec_list_cache.XXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != nullptr);
+        mDir = dir;
+        mCachePath = mDir + "/cache.bin";
+        mXmlDir = mDir + "/etc";
+        ASSERT_EQ(0, mkdir(mXmlDir.c_str(), 0700));
+        mSearchDirs[0] = mXmlDir.c_str();
+        mSearchDirs[1] = nullptr;
+        mProfilingResults = mDir + "/media_codecs_performance.xml";
+
+        writeFile(mXmlDir + "/media_codecs.xml", "<MediaCodecs />\n");
+
+        sp<IMediaCodecList> list = MediaCodecList::getLocalInstance();
+        ASSERT_TRUE(list != nullptr);
+        mGlobalSettings = list->getGlobalSettings();
+        for (size_t i = 0; i < list->countCodecs(); ++i) {
+            mCodecInfos.push_back(list->getCodecInfo(i));
+        }
+    }
+
+    virtual void TearDown() {
+        unlink(mCachePath.c_str());
+        unlink(mProfilingResults.c_str());
+        unlink((mXmlDir + "/media_codecs.xml").c_str());
+        unlink((mXmlDir + "/media_codecs_extra.xml").c_str());
+        rmdir(mXmlDir.c_str());
+        rmdir(mDir.c_str());
+    }
+
+protected:
+    static void writeFile(const std::string &path, const std::string &contents) {
+        FILE *file = fopen(path.c_str(), "w");
+        ASSERT_TRUE(file != nullptr);
+        fputs(contents.c_str(), file);
+        fclose(file);
+    }
+
+    uint64_t checksum(const char *buildersKey = kBuildersKey) {
+        return MediaCodecListCache::ComputeInputsChecksum(
+                mSearchDirs, mProfilingResults.c_str(), buildersKey);
+    }
+
+    status_t load(uint64_t inputsChecksum) {
+        sp<AMessage> settings;
+        std::vector<sp<MediaCodecInfo>> infos;
+        status_t err = MediaCodecListCache::Load(
+                mCachePath.c_str(), inputsChecksum, &settings, &infos);
+        if (err == OK) {
+            EXPECT_TRUE(settings != nullptr);
+            EXPECT_EQ(mCodecInfos.size(), infos.size());
+            for (size_t i = 0; i < infos.size() && i < mCodecInfos.size(); ++i) {
+                EXPECT_STREQ(mCodecInfos[i]->getCodecName(), infos[i]->getCodecName());
+            }
+        }
+        return err;
+    }
+
+    void store(uint64_t inputsChecksum) {
+        ASSERT_EQ(OK, MediaCodecListCache::Store(
+                mCachePath.c_str(), inputsChecksum, mGlobalSettings, mCodecInfos));
+    }
+
+    std::string mDir;
+    std::string mCachePath;
+    std::string mXmlDir;
+    const char *mSearchDirs[2];
+    std::string mProfilingResults;
+    sp<AMessage> mGlobalSettings;
+    std::vector<sp<MediaCodecInfo>> mCodecInfos;
+};
+
+TEST_F(MediaCodecListCacheTest, StoreAndLoad) {
+    EXPECT_EQ(NAME_NOT_FOUND, load(checksum()));
+
+    store(checksum());
+    EXPECT_EQ(OK, load(checksum()));
+}
+
+TEST_F(MediaCodecListCacheTest, StaleCache) {
+    uint64_t original = checksum();
+    store(original);
+
+    // any of the inputs changing makes the cache stale
+    writeFile(mXmlDir + "/media_codecs.xml", "<MediaCodecs>\n</MediaCodecs>\n");
+    EXPECT_NE(original, checksum());
+    EXPECT_EQ(BAD_VALUE, load(checksum()));
+
+    writeFile(mXmlDir + "/media_codecs.xml", "<MediaCodecs />\n");
+    EXPECT_EQ(original, checksum());
+    writeFile(mXmlDir + "/media_codecs_extra.xml", "<Included />\n");
+    EXPECT_NE(original, checksum());
+    unlink((mXmlDir + "/media_codecs_extra.xml").c_str());
+
+    writeFile(mProfilingResults, "<MediaCodecs />\n");
+    EXPECT_NE(original, checksum());
+    unlink(mProfilingResults.c_str());
+
+    // the OMX builder is left out when the plugin provides the input surface
+    EXPECT_NE(original, checksum("plugin;"));
+
+    char rank[PROPERTY_VALUE_MAX];
+    property_get("debug.stagefright.omx_default_rank", rank, "");
+    property_set("debug.stagefright.omx_default_rank", strcmp(rank, "512") ? "512" : "256");
+    uint64_t ranked = checksum();
+    property_set("debug.stagefright.omx_default_rank", rank);
+    EXPECT_NE(original, ranked);
+
+    EXPECT_EQ(original, checksum());
+    EXPECT_EQ(OK, load(original));
+}
+
+TEST_F(MediaCodecListCacheTest, CorruptedCache) {
+    store(checksum());
+
+    struct stat st;
+    ASSERT_EQ(0, stat(mCachePath.c_str(), &st));
+    ASSERT_GT(st.st_size, 40);  // past the 32 byte header
+
+    // a flipped byte in the codec infos
+    int fd = open(mCachePath.c_str(), O_RDWR | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    uint8_t byte;
+    ASSERT_EQ(1, pread(fd, &byte, 1, st.st_size - 8));
+    byte ^= 0x55;
+    ASSERT_EQ(1, pwrite(fd, &byte, 1, st.st_size - 8));
+    close(fd);
+    EXPECT_EQ(BAD_VALUE, load(checksum()));
+
+    // a truncated file
+    store(checksum());
+    ASSERT_EQ(0, truncate(mCachePath.c_str(), st.st_size / 2));
+    EXPECT_EQ(BAD_VALUE, load(checksum()));
+
+    // shorter than the header
+    ASSERT_EQ(0, truncate(mCachePath.c_str(), 8));
+    EXPECT_EQ(BAD_VALUE, load(checksum()));
+
+    // not a cache at all
+    writeFile(mCachePath, std::string(st.st_size, 'x'));
+    EXPECT_EQ(BAD_VALUE, load(checksum()));
+
+    // and a good cache replaces it
+    store(checksum());
+    EXPECT_EQ(OK, load(checksum()));
+}
+
+} // namespace android
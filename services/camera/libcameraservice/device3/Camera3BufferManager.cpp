@@ -18,6 +18,11 @@
 #define LOG_TAG "Camera3-BufferManager"
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 
+#include <inttypes.h>
+
+#include <algorithm>
+#include <vector>
+
 #include <gui/ISurfaceComposer.h>
 #include <private/gui/ComposerService.h>
 #include <utils/Log.h>
@@ -69,13 +74,14 @@ status_t Camera3BufferManager::registerStream(wp<Camera3OutputStream>& stream,
         return INVALID_OPERATION;
     }
 
-    Mutex::Autolock l(mLock);
+    RWLock::AutoWLock l(mLock);
 
     // Check if this stream was registered with different stream set ID, if so, error out.
-    for (size_t i = 0; i < mStreamSetMap.size(); i++) {
-        ssize_t streamIdx = mStreamSetMap[i].streamInfoMap.indexOfKey(streamId);
-        if (streamIdx != NAME_NOT_FOUND &&
-            mStreamSetMap[i].streamInfoMap[streamIdx].streamSetId != streamInfo.streamSetId) {
+    for (const auto& setEntry : mStreamSetMap) {
+        const StreamStateMap& stateMap = setEntry.second->streamStateMap;
+        auto stateIt = stateMap.find(streamId);
+        if (stateIt != stateMap.end() &&
+            stateIt->second.info.streamSetId != streamInfo.streamSetId) {
             ALOGE("%s: It is illegal to register the same stream id with different stream set",
                     __FUNCTION__);
             return BAD_VALUE;
@@ -83,31 +89,27 @@ status_t Camera3BufferManager::registerStream(wp<Camera3OutputStream>& stream,
     }
     // Check if there is an existing stream set registered; if not, create one; otherwise, add this
     // stream info to the existing stream set entry.
-    ssize_t setIdx = mStreamSetMap.indexOfKey(streamSetId);
-    if (setIdx == NAME_NOT_FOUND) {
+    sp<StreamSet>& currentStreamSet = mStreamSetMap[streamSetId];
+    if (currentStreamSet == nullptr) {
         ALOGV("%s: stream set %d is not registered to stream set map yet, create it.",
                 __FUNCTION__, streamSetId);
-        // Create stream info map, then add to mStreamsetMap.
-        StreamSet newStreamSet;
-        setIdx = mStreamSetMap.add(streamSetId, newStreamSet);
+        currentStreamSet = new StreamSet();
     }
     // Update stream set map and water mark.
-    StreamSet& currentStreamSet = mStreamSetMap.editValueAt(setIdx);
-    ssize_t streamIdx = currentStreamSet.streamInfoMap.indexOfKey(streamId);
-    if (streamIdx != NAME_NOT_FOUND) {
+    Mutex::Autolock sl(currentStreamSet->lock);
+    if (currentStreamSet->streamStateMap.count(streamId) != 0) {
         ALOGW("%s: stream %d was already registered with stream set %d",
                 __FUNCTION__, streamId, streamSetId);
         return OK;
     }
-    currentStreamSet.streamInfoMap.add(streamId, streamInfo);
-    currentStreamSet.handoutBufferCountMap.add(streamId, 0);
-    currentStreamSet.attachedBufferCountMap.add(streamId, 0);
-    mStreamMap.add(streamId, stream);
+    StreamState& streamState = currentStreamSet->streamStateMap[streamId];
+    streamState.info = streamInfo;
+    streamState.stream = stream;
 
     // The max allowed buffer count should be the max of buffer count of each stream inside a stream
     // set.
-    if (streamInfo.totalBufferCount > currentStreamSet.maxAllowedBufferCount) {
-       currentStreamSet.maxAllowedBufferCount = streamInfo.totalBufferCount;
+    if (streamInfo.totalBufferCount > currentStreamSet->maxAllowedBufferCount) {
+       currentStreamSet->maxAllowedBufferCount = streamInfo.totalBufferCount;
     }
 
     return OK;
@@ -116,80 +118,88 @@ status_t Camera3BufferManager::registerStream(wp<Camera3OutputStream>& stream,
 status_t Camera3BufferManager::unregisterStream(int streamId, int streamSetId) {
     ATRACE_CALL();
 
-    Mutex::Autolock l(mLock);
+    RWLock::AutoWLock l(mLock);
     ALOGV("%s: unregister stream %d with stream set %d", __FUNCTION__,
             streamId, streamSetId);
 
-    if (!checkIfStreamRegisteredLocked(streamId, streamSetId)){
+    auto setIt = mStreamSetMap.find(streamSetId);
+    sp<StreamSet> currentSet = (setIt != mStreamSetMap.end()) ? setIt->second : nullptr;
+    if (currentSet == nullptr) {
+        ALOGE("%s: stream %d with set id %d wasn't properly registered to this buffer manager!",
+                __FUNCTION__, streamId, streamSetId);
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock sl(currentSet->lock);
+    if (!checkIfStreamRegisteredLocked(*currentSet, streamId, streamSetId)){
         ALOGE("%s: stream %d with set id %d wasn't properly registered to this buffer manager!",
                 __FUNCTION__, streamId, streamSetId);
         return BAD_VALUE;
     }
 
     // De-list all the buffers associated with this stream first.
-    StreamSet& currentSet = mStreamSetMap.editValueFor(streamSetId);
-    BufferCountMap& handOutBufferCounts = currentSet.handoutBufferCountMap;
-    BufferCountMap& attachedBufferCounts = currentSet.attachedBufferCountMap;
-    InfoMap& infoMap = currentSet.streamInfoMap;
-    handOutBufferCounts.removeItem(streamId);
-    attachedBufferCounts.removeItem(streamId);
-
-    // Remove the stream info from info map and recalculate the buffer count water mark.
-    infoMap.removeItem(streamId);
-    currentSet.maxAllowedBufferCount = 0;
-    for (size_t i = 0; i < infoMap.size(); i++) {
-        if (infoMap[i].totalBufferCount > currentSet.maxAllowedBufferCount) {
-            currentSet.maxAllowedBufferCount = infoMap[i].totalBufferCount;
+    StreamStateMap& stateMap = currentSet->streamStateMap;
+    auto stateIt = stateMap.find(streamId);
+    currentSet->totalHandoutBufferCount -= stateIt->second.handoutBufferCount;
+    currentSet->totalAttachedBufferCount -= stateIt->second.attachedBufferCount;
+
+    // Remove the stream state and recalculate the buffer count water mark.
+    stateMap.erase(stateIt);
+    currentSet->maxAllowedBufferCount = 0;
+    for (const auto& stateEntry : stateMap) {
+        if (stateEntry.second.info.totalBufferCount > currentSet->maxAllowedBufferCount) {
+            currentSet->maxAllowedBufferCount = stateEntry.second.info.totalBufferCount;
         }
     }
-    mStreamMap.removeItem(streamId);
 
     // Lazy solution: when a stream is unregistered, the streams will be reconfigured, reset
     // the water mark and let it grow again.
-    currentSet.allocatedBufferWaterMark = 0;
+    currentSet->allocatedBufferWaterMark = 0;
 
     // Remove this stream set if all its streams have been removed.
-    if (handOutBufferCounts.size() == 0 && infoMap.size() == 0) {
-        mStreamSetMap.removeItem(streamSetId);
+    if (stateMap.size() == 0) {
+        mStreamSetMap.erase(setIt);
     }
 
     return OK;
 }
 
 void Camera3BufferManager::notifyBufferRemoved(int streamId, int streamSetId) {
-    Mutex::Autolock l(mLock);
-    StreamSet &streamSet = mStreamSetMap.editValueFor(streamSetId);
-    size_t& attachedBufferCount =
-            streamSet.attachedBufferCountMap.editValueFor(streamId);
-    attachedBufferCount--;
+    sp<StreamSet> streamSet = getStreamSet(streamSetId);
+    if (streamSet == nullptr) {
+        return;
+    }
+
+    Mutex::Autolock l(streamSet->lock);
+    auto stateIt = streamSet->streamStateMap.find(streamId);
+    if (stateIt == streamSet->streamStateMap.end()) {
+        ALOGV("%s: stream %d is not registered to stream set %d", __FUNCTION__,
+                streamId, streamSetId);
+        return;
+    }
+    stateIt->second.attachedBufferCount--;
+    streamSet->totalAttachedBufferCount--;
 }
 
 status_t Camera3BufferManager::checkAndFreeBufferOnOtherStreamsLocked(
-        int streamId, int streamSetId) {
-    StreamId firstOtherStreamId = CAMERA3_STREAM_ID_INVALID;
-    StreamSet &streamSet = mStreamSetMap.editValueFor(streamSetId);
-    if (streamSet.streamInfoMap.size() == 1) {
+        StreamSet& streamSet, int streamId, int streamSetId) {
+    if (streamSet.streamStateMap.size() == 1) {
         ALOGV("StreamSet %d has no other stream available to free", streamSetId);
         return OK;
     }
 
-    bool freeBufferIsAttached = false;
-    for (size_t i = 0; i < streamSet.streamInfoMap.size(); i++) {
-        firstOtherStreamId = streamSet.streamInfoMap[i].streamId;
-        if (firstOtherStreamId != streamId) {
-
-            size_t otherBufferCount  =
-                    streamSet.handoutBufferCountMap.valueFor(firstOtherStreamId);
-            size_t otherAttachedBufferCount =
-                    streamSet.attachedBufferCountMap.valueFor(firstOtherStreamId);
-            if (otherAttachedBufferCount > otherBufferCount) {
-                freeBufferIsAttached = true;
-                break;
-            }
+    // Pick the other stream with the lowest ID that has a free buffer attached.
+    StreamId firstOtherStreamId = CAMERA3_STREAM_ID_INVALID;
+    for (const auto& stateEntry : streamSet.streamStateMap) {
+        const StreamState& otherState = stateEntry.second;
+        if (stateEntry.first != streamId &&
+                otherState.attachedBufferCount > otherState.handoutBufferCount &&
+                (firstOtherStreamId == CAMERA3_STREAM_ID_INVALID ||
+                        stateEntry.first < firstOtherStreamId)) {
+            firstOtherStreamId = stateEntry.first;
         }
-        firstOtherStreamId = CAMERA3_STREAM_ID_INVALID;
     }
-    if (firstOtherStreamId == CAMERA3_STREAM_ID_INVALID || !freeBufferIsAttached) {
+    if (firstOtherStreamId == CAMERA3_STREAM_ID_INVALID) {
         ALOGV("StreamSet %d has no buffer available to free", streamSetId);
         return OK;
     }
@@ -197,14 +207,10 @@ status_t Camera3BufferManager::checkAndFreeBufferOnOtherStreamsLocked(
 
     // This will drop the reference to one free buffer, which will effectively free one
     // buffer (from the free buffer list) for the inactive streams.
-    size_t totalAllocatedBufferCount = 0;
-    for (size_t i = 0; i < streamSet.attachedBufferCountMap.size(); i++) {
-        totalAllocatedBufferCount += streamSet.attachedBufferCountMap[i];
-    }
-    if (totalAllocatedBufferCount > streamSet.allocatedBufferWaterMark) {
+    if (streamSet.totalAttachedBufferCount > streamSet.allocatedBufferWaterMark) {
         ALOGV("Stream %d: Freeing buffer: detach", firstOtherStreamId);
         sp<Camera3OutputStream> stream =
-                mStreamMap.valueFor(firstOtherStreamId).promote();
+                streamSet.streamStateMap.at(firstOtherStreamId).stream.promote();
         if (stream == nullptr) {
             ALOGE("%s: unable to promote stream %d to detach buffer", __FUNCTION__,
                     firstOtherStreamId);
@@ -218,18 +224,19 @@ status_t Camera3BufferManager::checkAndFreeBufferOnOtherStreamsLocked(
         // release, or acquire a new buffer.
         bool bufferFreed = false;
         {
-            mLock.unlock();
+            streamSet.lock.unlock();
             sp<GraphicBuffer> buffer;
             stream->detachBuffer(&buffer, /*fenceFd*/ nullptr);
-            mLock.lock();
+            streamSet.lock.lock();
             if (buffer.get() != nullptr) {
                 bufferFreed = true;
             }
         }
-        if (bufferFreed) {
-            size_t& otherAttachedBufferCount =
-                    streamSet.attachedBufferCountMap.editValueFor(firstOtherStreamId);
-            otherAttachedBufferCount--;
+        // The stream may have been unregistered while the lock was released.
+        auto stateIt = streamSet.streamStateMap.find(firstOtherStreamId);
+        if (bufferFreed && stateIt != streamSet.streamStateMap.end()) {
+            stateIt->second.attachedBufferCount--;
+            streamSet.totalAttachedBufferCount--;
         }
     }
 
@@ -240,37 +247,65 @@ status_t Camera3BufferManager::getBufferForStream(int streamId, int streamSetId,
         sp<GraphicBuffer>* gb, int* fenceFd) {
     ATRACE_CALL();
 
-    Mutex::Autolock l(mLock);
+    nsecs_t startTime = systemTime(SYSTEM_TIME_MONOTONIC);
     ALOGV("%s: get buffer for stream %d with stream set %d", __FUNCTION__,
             streamId, streamSetId);
 
-    if (!checkIfStreamRegisteredLocked(streamId, streamSetId)) {
+    sp<StreamSet> streamSet = getStreamSet(streamSetId);
+    if (streamSet == nullptr) {
+        ALOGE("%s: stream %d is not registered with stream set %d yet!!!",
+                __FUNCTION__, streamId, streamSetId);
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock l(streamSet->lock);
+    nsecs_t lockWaitTime = systemTime(SYSTEM_TIME_MONOTONIC) - startTime;
+
+    status_t res = getBufferForStreamLocked(*streamSet, streamId, streamSetId, gb, fenceFd);
+
+    // Account the call to the stream, if it is still registered.
+    auto stateIt = streamSet->streamStateMap.find(streamId);
+    if (stateIt != streamSet->streamStateMap.end()) {
+        StreamState& state = stateIt->second;
+        nsecs_t getBufferTime = systemTime(SYSTEM_TIME_MONOTONIC) - startTime;
+        state.getBufferCount++;
+        state.totalGetBufferTime += getBufferTime;
+        state.maxGetBufferTime = std::max(state.maxGetBufferTime, getBufferTime);
+        state.totalLockWaitTime += lockWaitTime;
+        state.maxLockWaitTime = std::max(state.maxLockWaitTime, lockWaitTime);
+    }
+
+    return res;
+}
+
+status_t Camera3BufferManager::getBufferForStreamLocked(StreamSet& streamSet, int streamId,
+        int streamSetId, sp<GraphicBuffer>* gb, int* fenceFd) {
+    if (!checkIfStreamRegisteredLocked(streamSet, streamId, streamSetId)) {
         ALOGE("%s: stream %d is not registered with stream set %d yet!!!",
                 __FUNCTION__, streamId, streamSetId);
         return BAD_VALUE;
     }
 
-    StreamSet &streamSet = mStreamSetMap.editValueFor(streamSetId);
-    BufferCountMap& handOutBufferCounts = streamSet.handoutBufferCountMap;
-    size_t& bufferCount = handOutBufferCounts.editValueFor(streamId);
+    StreamState& streamState = streamSet.streamStateMap.at(streamId);
+    size_t& bufferCount = streamState.handoutBufferCount;
     if (bufferCount >= streamSet.maxAllowedBufferCount) {
         ALOGE("%s: bufferCount (%zu) exceeds the max allowed buffer count (%zu) of this stream set",
                 __FUNCTION__, bufferCount, streamSet.maxAllowedBufferCount);
         return INVALID_OPERATION;
     }
 
-    BufferCountMap& attachedBufferCounts = streamSet.attachedBufferCountMap;
-    size_t& attachedBufferCount = attachedBufferCounts.editValueFor(streamId);
+    size_t& attachedBufferCount = streamState.attachedBufferCount;
     if (attachedBufferCount > bufferCount) {
         // We've already attached more buffers to this stream than we currently have
         // outstanding, so have the stream just use an already-attached buffer
         bufferCount++;
+        streamSet.totalHandoutBufferCount++;
         return ALREADY_EXISTS;
     }
     ALOGV("Stream %d set %d: Get buffer for stream: Allocate new", streamId, streamSetId);
 
     if (mGrallocVersion < HARDWARE_DEVICE_API_VERSION(1,0)) {
-        const StreamInfo& info = streamSet.streamInfoMap.valueFor(streamId);
+        const StreamInfo& info = streamState.info;
         GraphicBufferEntry buffer;
         buffer.fenceFd = -1;
         buffer.graphicBuffer = new GraphicBuffer(
@@ -292,6 +327,8 @@ status_t Camera3BufferManager::getBufferForStream(int streamId, int streamSetId,
         // Increase the hand-out and attached buffer counts for tracking purposes.
         bufferCount++;
         attachedBufferCount++;
+        streamSet.totalHandoutBufferCount++;
+        streamSet.totalAttachedBufferCount++;
         // Update the water mark to be the max hand-out buffer count + 1. An additional buffer is
         // added to reduce the chance of buffer allocation during stream steady state, especially
         // for cases where one stream is active, the other stream may request some buffers randomly.
@@ -308,13 +345,13 @@ status_t Camera3BufferManager::getBufferForStream(int streamId, int streamSetId,
         // in returnBufferForStream() if we want to free buffer more quickly.
         // TODO: probably should find out all the inactive stream IDs, and free the firstly found
         // buffers for them.
-        res = checkAndFreeBufferOnOtherStreamsLocked(streamId, streamSetId);
+        res = checkAndFreeBufferOnOtherStreamsLocked(streamSet, streamId, streamSetId);
         if (res != OK) {
             return res;
         }
         // Since we just allocated one new buffer above, try free one more buffer from other streams
         // to prevent total buffer count from growing
-        res = checkAndFreeBufferOnOtherStreamsLocked(streamId, streamSetId);
+        res = checkAndFreeBufferOnOtherStreamsLocked(streamSet, streamId, streamSetId);
         if (res != OK) {
             return res;
         }
@@ -335,49 +372,52 @@ status_t Camera3BufferManager::onBufferReleased(
         return BAD_VALUE;
     }
 
-    Mutex::Autolock l(mLock);
     ALOGV("Stream %d set %d: Buffer released", streamId, streamSetId);
     *shouldFreeBuffer = false;
 
-    if (!checkIfStreamRegisteredLocked(streamId, streamSetId)){
+    sp<StreamSet> streamSet = getStreamSet(streamSetId);
+    if (streamSet == nullptr) {
+        ALOGV("%s: signaling buffer release for an already unregistered stream "
+                "(stream %d with set id %d)", __FUNCTION__, streamId, streamSetId);
+        return OK;
+    }
+
+    Mutex::Autolock l(streamSet->lock);
+    if (!checkIfStreamRegisteredLocked(*streamSet, streamId, streamSetId)){
         ALOGV("%s: signaling buffer release for an already unregistered stream "
                 "(stream %d with set id %d)", __FUNCTION__, streamId, streamSetId);
         return OK;
     }
 
     if (mGrallocVersion < HARDWARE_DEVICE_API_VERSION(1,0)) {
-        StreamSet& streamSet = mStreamSetMap.editValueFor(streamSetId);
-        BufferCountMap& handOutBufferCounts = streamSet.handoutBufferCountMap;
-        size_t& bufferCount = handOutBufferCounts.editValueFor(streamId);
+        StreamState& streamState = streamSet->streamStateMap.at(streamId);
+        size_t& bufferCount = streamState.handoutBufferCount;
         bufferCount--;
+        streamSet->totalHandoutBufferCount--;
         ALOGV("%s: Stream %d set %d: Buffer count now %zu", __FUNCTION__, streamId, streamSetId,
                 bufferCount);
 
-        size_t totalAllocatedBufferCount = 0;
-        size_t totalHandOutBufferCount = 0;
-        for (size_t i = 0; i < streamSet.attachedBufferCountMap.size(); i++) {
-            totalAllocatedBufferCount += streamSet.attachedBufferCountMap[i];
-            totalHandOutBufferCount += streamSet.handoutBufferCountMap[i];
-        }
+        size_t totalAllocatedBufferCount = streamSet->totalAttachedBufferCount;
+        size_t totalHandOutBufferCount = streamSet->totalHandoutBufferCount;
 
         size_t newWaterMark = totalHandOutBufferCount + BUFFER_WATERMARK_DEC_THRESHOLD;
         if (totalAllocatedBufferCount > newWaterMark &&
-                    streamSet.allocatedBufferWaterMark > newWaterMark) {
+                    streamSet->allocatedBufferWaterMark > newWaterMark) {
             // BufferManager got more than enough buffers, so decrease watermark
             // to trigger more buffers free operation.
-            streamSet.allocatedBufferWaterMark = newWaterMark;
+            streamSet->allocatedBufferWaterMark = newWaterMark;
             ALOGV("%s: Stream %d set %d: watermark--; now %zu",
-                    __FUNCTION__, streamId, streamSetId, streamSet.allocatedBufferWaterMark);
+                    __FUNCTION__, streamId, streamSetId, streamSet->allocatedBufferWaterMark);
         }
 
-        size_t attachedBufferCount = streamSet.attachedBufferCountMap.valueFor(streamId);
+        size_t attachedBufferCount = streamState.attachedBufferCount;
         if (attachedBufferCount <= bufferCount) {
             ALOGV("%s: stream %d has no buffer available to free.", __FUNCTION__, streamId);
         }
 
         bool freeBufferIsAttached = (attachedBufferCount > bufferCount);
         if (freeBufferIsAttached &&
-                totalAllocatedBufferCount > streamSet.allocatedBufferWaterMark &&
+                totalAllocatedBufferCount > streamSet->allocatedBufferWaterMark &&
                 attachedBufferCount > bufferCount + BUFFER_FREE_THRESHOLD) {
             ALOGV("%s: free a buffer from stream %d", __FUNCTION__, streamId);
             *shouldFreeBuffer = true;
@@ -392,22 +432,27 @@ status_t Camera3BufferManager::onBufferReleased(
 
 status_t Camera3BufferManager::onBuffersRemoved(int streamId, int streamSetId, size_t count) {
     ATRACE_CALL();
-    Mutex::Autolock l(mLock);
 
     ALOGV("Stream %d set %d: Buffer removed", streamId, streamSetId);
 
-    if (!checkIfStreamRegisteredLocked(streamId, streamSetId)){
+    sp<StreamSet> streamSet = getStreamSet(streamSetId);
+    if (streamSet == nullptr) {
+        ALOGV("%s: signaling buffer removal for an already unregistered stream "
+                "(stream %d with set id %d)", __FUNCTION__, streamId, streamSetId);
+        return OK;
+    }
+
+    Mutex::Autolock l(streamSet->lock);
+    if (!checkIfStreamRegisteredLocked(*streamSet, streamId, streamSetId)){
         ALOGV("%s: signaling buffer removal for an already unregistered stream "
                 "(stream %d with set id %d)", __FUNCTION__, streamId, streamSetId);
         return OK;
     }
 
     if (mGrallocVersion < HARDWARE_DEVICE_API_VERSION(1,0)) {
-        StreamSet& streamSet = mStreamSetMap.editValueFor(streamSetId);
-        BufferCountMap& handOutBufferCounts = streamSet.handoutBufferCountMap;
-        size_t& totalHandoutCount = handOutBufferCounts.editValueFor(streamId);
-        BufferCountMap& attachedBufferCounts = streamSet.attachedBufferCountMap;
-        size_t& totalAttachedCount = attachedBufferCounts.editValueFor(streamId);
+        StreamState& streamState = streamSet->streamStateMap.at(streamId);
+        size_t& totalHandoutCount = streamState.handoutBufferCount;
+        size_t& totalAttachedCount = streamState.attachedBufferCount;
 
         if (count > totalHandoutCount) {
             ALOGE("%s: Removed buffer count %zu greater than current handout count %zu",
@@ -422,6 +467,8 @@ status_t Camera3BufferManager::onBuffersRemoved(int streamId, int streamSetId, s
 
         totalHandoutCount -= count;
         totalAttachedCount -= count;
+        streamSet->totalHandoutBufferCount -= count;
+        streamSet->totalAttachedBufferCount -= count;
         ALOGV("%s: Stream %d set %d: Buffer count now %zu, attached buffer count now %zu",
                 __FUNCTION__, streamId, streamSetId, totalHandoutCount, totalAttachedCount);
     } else {
@@ -433,53 +480,79 @@ status_t Camera3BufferManager::onBuffersRemoved(int streamId, int streamSetId, s
 }
 
 void Camera3BufferManager::dump(int fd, const Vector<String16>& args) const {
-    Mutex::Autolock l(mLock);
+    RWLock::AutoRLock l(mLock);
 
     (void) args;
     String8 lines;
     lines.appendFormat("      Total stream sets: %zu\n", mStreamSetMap.size());
-    for (size_t i = 0; i < mStreamSetMap.size(); i++) {
-        lines.appendFormat("        Stream set %d has below streams:\n", mStreamSetMap.keyAt(i));
-        for (size_t j = 0; j < mStreamSetMap[i].streamInfoMap.size(); j++) {
-            lines.appendFormat("          Stream %d\n", mStreamSetMap[i].streamInfoMap[j].streamId);
+
+    // List stream sets and streams in ID order
+    std::vector<StreamSetId> streamSetIds;
+    for (const auto& setEntry : mStreamSetMap) {
+        streamSetIds.push_back(setEntry.first);
+    }
+    std::sort(streamSetIds.begin(), streamSetIds.end());
+
+    for (StreamSetId streamSetId : streamSetIds) {
+        const sp<StreamSet>& streamSet = mStreamSetMap.at(streamSetId);
+        Mutex::Autolock sl(streamSet->lock);
+
+        std::vector<StreamId> streamIds;
+        for (const auto& stateEntry : streamSet->streamStateMap) {
+            streamIds.push_back(stateEntry.first);
+        }
+        std::sort(streamIds.begin(), streamIds.end());
+
+        lines.appendFormat("        Stream set %d has below streams:\n", streamSetId);
+        for (StreamId streamId : streamIds) {
+            lines.appendFormat("          Stream %d\n", streamId);
         }
         lines.appendFormat("          Stream set max allowed buffer count: %zu\n",
-                mStreamSetMap[i].maxAllowedBufferCount);
+                streamSet->maxAllowedBufferCount);
         lines.appendFormat("          Stream set buffer count water mark: %zu\n",
-                mStreamSetMap[i].allocatedBufferWaterMark);
+                streamSet->allocatedBufferWaterMark);
         lines.appendFormat("          Handout buffer counts:\n");
-        for (size_t m = 0; m < mStreamSetMap[i].handoutBufferCountMap.size(); m++) {
-            int streamId = mStreamSetMap[i].handoutBufferCountMap.keyAt(m);
-            size_t bufferCount = mStreamSetMap[i].handoutBufferCountMap.valueAt(m);
+        for (StreamId streamId : streamIds) {
             lines.appendFormat("            stream id: %d, buffer count: %zu.\n",
-                    streamId, bufferCount);
+                    streamId, streamSet->streamStateMap.at(streamId).handoutBufferCount);
         }
         lines.appendFormat("          Attached buffer counts:\n");
-        for (size_t m = 0; m < mStreamSetMap[i].attachedBufferCountMap.size(); m++) {
-            int streamId = mStreamSetMap[i].attachedBufferCountMap.keyAt(m);
-            size_t bufferCount = mStreamSetMap[i].attachedBufferCountMap.valueAt(m);
+        for (StreamId streamId : streamIds) {
             lines.appendFormat("            stream id: %d, attached buffer count: %zu.\n",
-                    streamId, bufferCount);
+                    streamId, streamSet->streamStateMap.at(streamId).attachedBufferCount);
+        }
+        lines.appendFormat("          Get buffer times (avg/max us):\n");
+        for (StreamId streamId : streamIds) {
+            const StreamState& state = streamSet->streamStateMap.at(streamId);
+            nsecs_t calls = std::max<nsecs_t>(state.getBufferCount, 1);
+            lines.appendFormat("            stream id: %d, calls: %zu, total: %" PRId64 "/%" PRId64
+                    ", lock wait: %" PRId64 "/%" PRId64 ".\n", streamId, state.getBufferCount,
+                    ns2us(state.totalGetBufferTime / calls), ns2us(state.maxGetBufferTime),
+                    ns2us(state.totalLockWaitTime / calls), ns2us(state.maxLockWaitTime));
         }
     }
     write(fd, lines.string(), lines.size());
 }
 
-bool Camera3BufferManager::checkIfStreamRegisteredLocked(int streamId, int streamSetId) const {
-    ssize_t setIdx = mStreamSetMap.indexOfKey(streamSetId);
-    if (setIdx == NAME_NOT_FOUND) {
+sp<Camera3BufferManager::StreamSet> Camera3BufferManager::getStreamSet(int streamSetId) const {
+    RWLock::AutoRLock l(mLock);
+    auto setIt = mStreamSetMap.find(streamSetId);
+    if (setIt == mStreamSetMap.end()) {
         ALOGV("%s: stream set %d is not registered to stream set map yet!",
                 __FUNCTION__, streamSetId);
-        return false;
+        return nullptr;
     }
+    return setIt->second;
+}
 
-    ssize_t streamIdx = mStreamSetMap.valueAt(setIdx).streamInfoMap.indexOfKey(streamId);
-    if (streamIdx == NAME_NOT_FOUND) {
+bool Camera3BufferManager::checkIfStreamRegisteredLocked(const StreamSet& streamSet,
+        int streamId, int streamSetId) const {
+    if (streamSet.streamStateMap.count(streamId) == 0) {
         ALOGV("%s: stream %d is not registered to stream info map yet!", __FUNCTION__, streamId);
         return false;
     }
 
-    size_t bufferWaterMark = mStreamSetMap[setIdx].maxAllowedBufferCount;
+    size_t bufferWaterMark = streamSet.maxAllowedBufferCount;
     if (bufferWaterMark == 0 || bufferWaterMark > kMaxBufferCount) {
         ALOGW("%s: stream %d with stream set %d is not registered correctly to stream set map,"
                 " as the water mark (%zu) is wrong!",
@@ -19,9 +19,12 @@
 
 #include <list>
 #include <algorithm>
+#include <unordered_map>
 #include <ui/GraphicBuffer.h>
 #include <utils/RefBase.h>
 #include <utils/KeyedVector.h>
+#include <utils/RWLock.h>
+#include <utils/Timers.h>
 #include "Camera3OutputStream.h"
 
 namespace android {
@@ -41,6 +44,9 @@ class Camera3OutputStream;
  * In doing so, it reduces the memory footprint unless it is already minimal without impacting
  * performance.
  *
+ * Stream sets are independent of each other, so each one has its own lock; streams of different
+ * stream sets never wait on each other, and only registration changes take the lock of the stream
+ * set map for writing.
  */
 class Camera3BufferManager: public virtual RefBase {
 public:
@@ -174,7 +180,8 @@ public:
     void notifyBufferRemoved(int streamId, int streamSetId);
 
     /**
-     * Dump the buffer manager statistics.
+     * Dump the buffer manager statistics, including how long each stream waited in
+     * getBufferForStream().
      */
     void     dump(int fd, const Vector<String16> &args) const;
 
@@ -191,11 +198,6 @@ private:
     // (BUFFER_FREE_THRESHOLD + steady state handout buffer count) buffers.
     static const int BUFFER_FREE_THRESHOLD = 3;
 
-    /**
-     * Lock to synchronize the access to the methods of this class.
-     */
-    mutable Mutex mLock;
-
     static const size_t kMaxBufferCount = BufferQueueDefs::NUM_BUFFER_SLOTS;
 
     struct GraphicBufferEntry {
@@ -219,22 +221,54 @@ private:
     typedef std::list<BufferEntry> BufferList;
 
     /**
-     * Stream info map (indexed by stream ID) tracks all the streams registered to a particular
-     * stream set.
+     * Stream state tracks the stream info, buffer counts and getBufferForStream() statistics of a
+     * stream registered to a stream set.
      */
-    typedef KeyedVector<StreamId, StreamInfo> InfoMap;
+    struct StreamState {
+        StreamInfo info;
+        wp<Camera3OutputStream> stream;
+        /**
+         * The count of the buffers that were handed out to this stream.
+         */
+        size_t handoutBufferCount;
+        /**
+         * The count of the buffers that are attached to this stream.
+         * An attached buffer may be free or handed out
+         */
+        size_t attachedBufferCount;
+
+        /**
+         * Time spent in getBufferForStream() calls for this stream, and the part of it spent
+         * waiting for the stream set lock.
+         */
+        size_t getBufferCount;
+        nsecs_t totalGetBufferTime;
+        nsecs_t maxGetBufferTime;
+        nsecs_t totalLockWaitTime;
+        nsecs_t maxLockWaitTime;
+
+        StreamState() : handoutBufferCount(0), attachedBufferCount(0), getBufferCount(0),
+                totalGetBufferTime(0), maxGetBufferTime(0), totalLockWaitTime(0),
+                maxLockWaitTime(0) {}
+    };
 
     /**
-     * Stream set buffer count map (indexed by stream ID) tracks all buffer counts of the streams
-     * registered to a particular stream set.
+     * Stream state map (indexed by stream ID) tracks all the streams registered to a particular
+     * stream set.
      */
-    typedef KeyedVector<StreamId, size_t> BufferCountMap;
+    typedef std::unordered_map<StreamId, StreamState> StreamStateMap;
 
     /**
-     * StreamSet keeps track of the stream info, free buffer list and hand-out buffer counts for
-     * each stream set.
+     * StreamSet keeps track of the stream states and the buffer counts for each stream set.
      */
-    struct StreamSet {
+    struct StreamSet : public LightRefBase<StreamSet> {
+        /**
+         * Lock to synchronize the access to this stream set. Streams are only added to or removed
+         * from streamStateMap with both this lock and mLock (for writing) held, so the streams of a
+         * set can be looked up with either of them held.
+         */
+        Mutex lock;
+
         /**
          * Stream set buffer count water mark representing the max number of allocated buffers
          * (hand-out buffers + free buffers) count for each stream set. For a given stream set, when
@@ -264,47 +298,67 @@ private:
         size_t maxAllowedBufferCount;
 
         /**
-         * The stream info for all streams in this set
-         */
-        InfoMap streamInfoMap;
-        /**
-         * The count of the buffers that were handed out to the streams of this set.
+         * Sums of the hand-out and attached buffer counts of all streams in this set, kept up to
+         * date with the per-stream counts.
          */
-        BufferCountMap handoutBufferCountMap;
+        size_t totalHandoutBufferCount;
+        size_t totalAttachedBufferCount;
+
         /**
-         * The count of the buffers that are attached to the streams of this set.
-         * An attached buffer may be free or handed out
+         * The state of all streams in this set
          */
-        BufferCountMap attachedBufferCountMap;
+        StreamStateMap streamStateMap;
 
         StreamSet() {
             allocatedBufferWaterMark = 0;
             maxAllowedBufferCount = 0;
+            totalHandoutBufferCount = 0;
+            totalAttachedBufferCount = 0;
         }
     };
 
+    /**
+     * Lock to synchronize the access to the stream set map. Held for reading to look up a stream
+     * set, and for writing to register or unregister streams.
+     */
+    mutable RWLock mLock;
+
     /**
      * Stream set map managed by this buffer manager.
      */
     typedef int StreamSetId;
-    KeyedVector<StreamSetId, StreamSet> mStreamSetMap;
-    KeyedVector<StreamId, wp<Camera3OutputStream>> mStreamMap;
+    std::unordered_map<StreamSetId, sp<StreamSet>> mStreamSetMap;
 
     // TODO: There is no easy way to query the Gralloc version in this code yet, we have different
     // code paths for different Gralloc versions, hardcode something here for now.
     const uint32_t mGrallocVersion = GRALLOC_DEVICE_API_VERSION_0_1;
 
+    /**
+     * Look up a stream set by ID, or return null if there is none. Takes mLock for reading; the
+     * registration of the stream must then be checked with the lock of the stream set held.
+     */
+    sp<StreamSet> getStreamSet(int streamSetId) const;
+
     /**
      * Check if this stream was successfully registered already. This method needs to be called with
-     * mLock held.
+     * the lock of the stream set held.
+     */
+    bool checkIfStreamRegisteredLocked(const StreamSet& streamSet, int streamId,
+            int streamSetId) const;
+
+    /**
+     * Implementation of getBufferForStream(), called with the lock of the stream set held.
      */
-    bool checkIfStreamRegisteredLocked(int streamId, int streamSetId) const;
+    status_t getBufferForStreamLocked(StreamSet& streamSet, int streamId, int streamSetId,
+            sp<GraphicBuffer>* gb, int* fenceFd);
 
     /**
      * Check if other streams in the stream set has extra buffer available to be freed, and
-     * free one if so.
+     * free one if so. This method needs to be called with the lock of the stream set held, and
+     * releases it while detaching the buffer.
      */
-    status_t checkAndFreeBufferOnOtherStreamsLocked(int streamId, int streamSetId);
+    status_t checkAndFreeBufferOnOtherStreamsLocked(StreamSet& streamSet, int streamId,
+            int streamSetId);
 };
 
 } // namespace camera3
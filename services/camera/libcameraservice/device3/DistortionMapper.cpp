@@ -55,7 +55,8 @@ constexpr std::array<uint32_t, 2> DistortionMapper::kResultPointsToCorrectNoClam
 };
 
 
-DistortionMapper::DistortionMapper() : mValidMapping(false), mValidGrids(false) {
+DistortionMapper::DistortionMapper() : mValidMapping(false), mValidGrids(false),
+        mValidLookupGrid(false), mLookupGridEnabled(true) {
 }
 
 bool DistortionMapper::isDistortionSupported(const CameraMetadata &result) {
@@ -234,54 +235,103 @@ status_t DistortionMapper::mapRawToCorrected(int32_t *coordPairs, int coordCount
         if (res != OK) return res;
     }
 
-    for (int i = 0; i < coordCount * 2; i += 2) {
-        const GridQuad *quad = findEnclosingQuad(coordPairs + i, mDistortedGrid);
-        if (quad == nullptr) {
-            ALOGE("Raw to corrected mapping failure: No quad found for (%d, %d)",
-                    *(coordPairs + i), *(coordPairs + i + 1));
-            return INVALID_OPERATION;
-        }
-        ALOGV("src xy: %d, %d, enclosing quad: (%f, %f), (%f, %f), (%f, %f), (%f, %f)",
-                coordPairs[i], coordPairs[i+1],
-                quad->coords[0], quad->coords[1],
-                quad->coords[2], quad->coords[3],
-                quad->coords[4], quad->coords[5],
-                quad->coords[6], quad->coords[7]);
-
-        const GridQuad *corrQuad = quad->src;
-        if (corrQuad == nullptr) {
-            ALOGE("Raw to corrected mapping failure: No src quad found");
-            return INVALID_OPERATION;
-        }
-        ALOGV("              corr quad: (%f, %f), (%f, %f), (%f, %f), (%f, %f)",
-                corrQuad->coords[0], corrQuad->coords[1],
-                corrQuad->coords[2], corrQuad->coords[3],
-                corrQuad->coords[4], corrQuad->coords[5],
-                corrQuad->coords[6], corrQuad->coords[7]);
+    float corrected[kLookupBatchSize * 2];
+    for (int batch = 0; batch < coordCount; batch += kLookupBatchSize) {
+        int32_t *batchPairs = coordPairs + batch * 2;
+        int batchCount = coordCount - batch < kLookupBatchSize ?
+                coordCount - batch : kLookupBatchSize;
 
-        float u = calculateUorV(coordPairs + i, *quad, /*calculateU*/ true);
-        float v = calculateUorV(coordPairs + i, *quad, /*calculateU*/ false);
+        if (mLookupGridEnabled && mValidLookupGrid) {
+            mapRawToCorrectedLookup(batchPairs, batchCount, corrected);
+        } else {
+            std::fill(corrected, corrected + batchCount * 2, NAN);
+        }
 
-        ALOGV("uv: %f, %f", u, v);
+        for (int i = 0; i < batchCount * 2; i += 2) {
+            float corrX = corrected[i];
+            float corrY = corrected[i + 1];
+            if (std::isnan(corrX)) {
+                // Not covered by the lookup grid
+                status_t res = mapRawToCorrectedWithQuads(batchPairs + i, &corrX, &corrY);
+                if (res != OK) return res;
+            }
 
-        // Interpolate along top edge of corrected quad (which are axis-aligned) for x
-        float corrX = corrQuad->coords[0] + u * (corrQuad->coords[2] - corrQuad->coords[0]);
-        // Interpolate along left edge of corrected quad (which are axis-aligned) for y
-        float corrY = corrQuad->coords[1] + v * (corrQuad->coords[7] - corrQuad->coords[1]);
+            // Clamp to within active array
+            if (clamp) {
+                corrX = std::min(mActiveWidth - 1, std::max(0.f, corrX));
+                corrY = std::min(mActiveHeight - 1, std::max(0.f, corrY));
+            }
 
-        // Clamp to within active array
-        if (clamp) {
-            corrX = std::min(mActiveWidth - 1, std::max(0.f, corrX));
-            corrY = std::min(mActiveHeight - 1, std::max(0.f, corrY));
+            batchPairs[i] = static_cast<int32_t>(std::round(corrX));
+            batchPairs[i + 1] = static_cast<int32_t>(std::round(corrY));
         }
+    }
 
-        coordPairs[i] = static_cast<int32_t>(std::round(corrX));
-        coordPairs[i + 1] = static_cast<int32_t>(std::round(corrY));
+    return OK;
+}
+
+status_t DistortionMapper::mapRawToCorrectedWithQuads(const int32_t pt[2],
+        float *corrX, float *corrY) const {
+    const GridQuad *quad = findEnclosingQuad(pt, mDistortedGrid);
+    if (quad == nullptr) {
+        ALOGE("Raw to corrected mapping failure: No quad found for (%d, %d)",
+                pt[0], pt[1]);
+        return INVALID_OPERATION;
     }
+    ALOGV("src xy: %d, %d, enclosing quad: (%f, %f), (%f, %f), (%f, %f), (%f, %f)",
+            pt[0], pt[1],
+            quad->coords[0], quad->coords[1],
+            quad->coords[2], quad->coords[3],
+            quad->coords[4], quad->coords[5],
+            quad->coords[6], quad->coords[7]);
+
+    const GridQuad *corrQuad = quad->src;
+    if (corrQuad == nullptr) {
+        ALOGE("Raw to corrected mapping failure: No src quad found");
+        return INVALID_OPERATION;
+    }
+    ALOGV("              corr quad: (%f, %f), (%f, %f), (%f, %f), (%f, %f)",
+            corrQuad->coords[0], corrQuad->coords[1],
+            corrQuad->coords[2], corrQuad->coords[3],
+            corrQuad->coords[4], corrQuad->coords[5],
+            corrQuad->coords[6], corrQuad->coords[7]);
+
+    float u = calculateUorV(pt, *quad, /*calculateU*/ true);
+    float v = calculateUorV(pt, *quad, /*calculateU*/ false);
+
+    ALOGV("uv: %f, %f", u, v);
+
+    // Interpolate along top edge of corrected quad (which are axis-aligned) for x
+    *corrX = corrQuad->coords[0] + u * (corrQuad->coords[2] - corrQuad->coords[0]);
+    // Interpolate along left edge of corrected quad (which are axis-aligned) for y
+    *corrY = corrQuad->coords[1] + v * (corrQuad->coords[7] - corrQuad->coords[1]);
 
     return OK;
 }
 
+void DistortionMapper::mapRawToCorrectedLookup(const int32_t *coordPairs, int coordCount,
+        float *corrected) const {
+    // Branch-free apart from the validity selects, so that the compiler can unroll and
+    // vectorize the arithmetic; only the grid point loads remain scalar.
+    const float cellsX = static_cast<float>(mLookupCellsX);
+    const float cellsY = static_cast<float>(mLookupCellsY);
+    for (int i = 0; i < coordCount * 2; i += 2) {
+        float gx = (coordPairs[i] - mLookupOriginX) * mLookupInvSpacingX;
+        float gy = (coordPairs[i + 1] - mLookupOriginY) * mLookupInvSpacingY;
+        bool inside = gx >= 0 && gx < cellsX && gy >= 0 && gy < cellsY;
+        // Interpolate within the grid regardless, and discard the result if outside or in a
+        // cell over the error bound
+        gx = inside ? gx : 0.f;
+        gy = inside ? gy : 0.f;
+        size_t cell = static_cast<size_t>(gy) * mLookupCellsX + static_cast<size_t>(gx);
+        inside = inside && mLookupCellValid[cell];
+        float corrX, corrY;
+        interpolateLookup(gx, gy, &corrX, &corrY);
+        corrected[i] = inside ? corrX : NAN;
+        corrected[i + 1] = inside ? corrY : NAN;
+    }
+}
+
 status_t DistortionMapper::mapRawToCorrectedSimple(int32_t *coordPairs, int coordCount,
         bool clamp) const {
     if (!mValidMapping) return INVALID_OPERATION;
@@ -328,6 +378,10 @@ status_t DistortionMapper::mapRawRectToCorrected(int32_t *rects, int rectCount,
     return OK;
 }
 
+void DistortionMapper::setLookupGridEnabled(bool enabled) {
+    mLookupGridEnabled = enabled;
+}
+
 status_t DistortionMapper::mapCorrectedToRaw(int32_t *coordPairs, int coordCount, bool clamp,
         bool simple) const {
     return mapCorrectedToRawImpl(coordPairs, coordCount, clamp, simple);
@@ -446,10 +500,179 @@ status_t DistortionMapper::buildGrids() {
         }
     }
 
+    buildLookupGrid();
+
     mValidGrids = true;
     return OK;
 }
 
+void DistortionMapper::buildLookupGrid() {
+    mValidLookupGrid = false;
+
+    // Covers the pre-correction active array only; the mapping is strongly curved in the
+    // margins of the quad grids, and raw points there are rare enough to map through quads
+    float gridWidth = mArrayWidth;
+    float gridHeight = mArrayHeight;
+    mLookupOriginX = 0;
+    mLookupOriginY = 0;
+
+    const double activeCx = mCx - mArrayDiffX;
+    const double activeCy = mCy - mArrayDiffY;
+
+    for (size_t cells = kLookupGridMinCells; cells <= kLookupGridMaxCells; cells *= 2) {
+        mLookupCellsX = cells;
+        mLookupCellsY = cells;
+        double spacingX = gridWidth / cells;
+        double spacingY = gridHeight / cells;
+        mLookupInvSpacingX = static_cast<float>(1 / spacingX);
+        mLookupInvSpacingY = static_cast<float>(1 / spacingY);
+
+        // Solve for the corrected point of each grid point, starting from the solution for
+        // the previous point of the row, or of the row above for the first one.
+        const size_t stride = cells + 1;
+        mLookupGrid.resize(stride * stride * 2);
+        bool solved = true;
+        double rowX = 0, rowY = 0;
+        for (size_t j = 0; j < stride && solved; j++) {
+            double rawY = mLookupOriginY + j * spacingY;
+            double x = rowX, y = rowY;
+            for (size_t i = 0; i < stride; i++) {
+                double rawX = mLookupOriginX + i * spacingX;
+                // Move to normalized space from pre-correction active array space
+                double yd = (rawY - mCy) / mFy;
+                double xd = (rawX - mCx - mS * yd) / mFx;
+                if (i == 0 && j == 0) {
+                    x = xd;
+                    y = yd;
+                }
+                if (!undistortNormalized(xd, yd, &x, &y)) {
+                    ALOGV("%s: No inverse for raw point (%f, %f)", __FUNCTION__, rawX, rawY);
+                    solved = false;
+                    break;
+                }
+                if (i == 0) {
+                    rowX = x;
+                    rowY = y;
+                }
+                // Move to active array space
+                float *point = &mLookupGrid[(j * stride + i) * 2];
+                point[0] = static_cast<float>(mFx * x + mS * y + activeCx);
+                point[1] = static_cast<float>(mFy * y + activeCy);
+            }
+        }
+        if (!solved) break;
+
+        // Check the interpolation error at the center and edge midpoints of each cell, by
+        // mapping the interpolated corrected point back through the model
+        mLookupCellValid.assign(cells * cells, 1);
+        size_t invalidCells = 0;
+        float maxErrorSq = 0;
+        for (size_t j = 0; j < cells; j++) {
+            for (size_t i = 0; i < cells; i++) {
+                const float samples[5][2] = {
+                    { i + 0.5f, j + 0.5f },
+                    { i + 0.5f, static_cast<float>(j) },
+                    { i + 0.5f, j + 1.f },
+                    { static_cast<float>(i), j + 0.5f },
+                    { i + 1.f, j + 0.5f },
+                };
+                float cellErrorSq = 0;
+                for (const auto& sample : samples) {
+                    float corrX, corrY;
+                    interpolateLookup(sample[0], sample[1], &corrX, &corrY);
+                    double rawX, rawY;
+                    mapCorrectedToRawExact(corrX, corrY, &rawX, &rawY);
+                    double errX = rawX - (mLookupOriginX + sample[0] * spacingX);
+                    double errY = rawY - (mLookupOriginY + sample[1] * spacingY);
+                    cellErrorSq = std::max(cellErrorSq,
+                            static_cast<float>(errX * errX + errY * errY));
+                }
+                if (cellErrorSq > kLookupGridMaxError * kLookupGridMaxError) {
+                    mLookupCellValid[j * cells + i] = 0;
+                    invalidCells++;
+                }
+                maxErrorSq = std::max(maxErrorSq, cellErrorSq);
+            }
+        }
+        ALOGV("%s: %zux%zu cells, max error %f pixels, %zu cells over bound", __FUNCTION__,
+                cells, cells, std::sqrt(maxErrorSq), invalidCells);
+
+        // Refine while any cell is over the bound; at the finest size, points in the cells
+        // still over it are mapped through the quad grids instead.
+        if (invalidCells == 0 || cells * 2 > kLookupGridMaxCells) {
+            mValidLookupGrid = invalidCells < cells * cells;
+            if (mValidLookupGrid) return;
+            break;
+        }
+    }
+
+    ALOGV("%s: No usable lookup grid, using quad grids", __FUNCTION__);
+    mLookupGrid.clear();
+    mLookupCellValid.clear();
+}
+
+void DistortionMapper::interpolateLookup(float gx, float gy, float *corrX, float *corrY) const {
+    size_t cellX = std::min(static_cast<size_t>(gx), mLookupCellsX - 1);
+    size_t cellY = std::min(static_cast<size_t>(gy), mLookupCellsY - 1);
+    float fx = gx - cellX;
+    float fy = gy - cellY;
+    const size_t stride = (mLookupCellsX + 1) * 2;
+    const float *p00 = mLookupGrid.data() + cellY * stride + cellX * 2;
+    const float *p01 = p00 + stride;
+
+    float topX = p00[0] + fx * (p00[2] - p00[0]);
+    float topY = p00[1] + fx * (p00[3] - p00[1]);
+    float bottomX = p01[0] + fx * (p01[2] - p01[0]);
+    float bottomY = p01[1] + fx * (p01[3] - p01[1]);
+    *corrX = topX + fy * (bottomX - topX);
+    *corrY = topY + fy * (bottomY - topY);
+}
+
+void DistortionMapper::distortNormalized(double x, double y, double *xd, double *yd,
+        double *jacobian) const {
+    double rSq = x * x + y * y;
+    double Fr = 1 + (mK[0] * rSq) + (mK[1] * rSq * rSq) + (mK[2] * rSq * rSq * rSq);
+    *xd = x * Fr + (mK[3] * 2 * x * y) + mK[4] * (rSq + 2 * x * x);
+    *yd = y * Fr + (mK[4] * 2 * x * y) + mK[3] * (rSq + 2 * y * y);
+    if (jacobian != nullptr) {
+        // dFr/d(rSq)
+        double dFr = mK[0] + 2 * mK[1] * rSq + 3 * mK[2] * rSq * rSq;
+        jacobian[0] = Fr + 2 * x * x * dFr + 2 * mK[3] * y + 6 * mK[4] * x;
+        jacobian[1] = 2 * x * y * dFr + 2 * mK[3] * x + 2 * mK[4] * y;
+        jacobian[2] = 2 * x * y * dFr + 2 * mK[4] * y + 2 * mK[3] * x;
+        jacobian[3] = Fr + 2 * y * y * dFr + 2 * mK[4] * x + 6 * mK[3] * y;
+    }
+}
+
+bool DistortionMapper::undistortNormalized(double xd, double yd, double *x, double *y) const {
+    for (int i = 0; i < kMaxInverseIterations; i++) {
+        double fx, fy, j[4];
+        distortNormalized(*x, *y, &fx, &fy, j);
+        double det = j[0] * j[3] - j[1] * j[2];
+        if (!(det > 0)) return false;
+
+        double ex = fx - xd;
+        double ey = fy - yd;
+        if (ex * ex + ey * ey < kInverseToleranceSq) return true;
+
+        *x -= (j[3] * ex - j[1] * ey) / det;
+        *y -= (j[0] * ey - j[2] * ex) / det;
+    }
+    return false;
+}
+
+void DistortionMapper::mapCorrectedToRawExact(double x, double y,
+        double *rawX, double *rawY) const {
+    double activeCx = mCx - mArrayDiffX;
+    double activeCy = mCy - mArrayDiffY;
+    double ywi = (y - activeCy) / mFy;
+    double xwi = (x - activeCx - mS * ywi) / mFx;
+    double xc, yc;
+    distortNormalized(xwi, ywi, &xc, &yc, /*jacobian*/nullptr);
+    *rawX = mFx * xc + mS * yc + mCx;
+    *rawY = mFy * yc + mCy;
+}
+
 const DistortionMapper::GridQuad* DistortionMapper::findEnclosingQuad(
         const int32_t pt[2], const std::vector<GridQuad>& grid) {
     const float x = pt[0];
@@ -20,6 +20,7 @@
 #include <utils/Errors.h>
 #include <array>
 #include <mutex>
+#include <vector>
 
 #include "camera/CameraMetadata.h"
 
@@ -115,6 +116,14 @@ class DistortionMapper {
     status_t mapCorrectedRectToRaw(int32_t *rects, int rectCount, bool clamp,
             bool simple = true) const;
 
+    /**
+     * Enable or disable the lookup grid for non-simple raw to corrected mapping.
+     * When disabled, and for points outside of the pre-correction active array or where
+     * the grid misses its error bound, points are mapped through the quad grids instead.
+     * Enabled by default.
+     */
+    void setLookupGridEnabled(bool enabled);
+
     struct GridQuad {
         // Source grid quad, or null
         const GridQuad *src;
@@ -150,6 +159,22 @@ class DistortionMapper {
     // Fuzziness for float inequality tests
     constexpr static float kFloatFuzz = 1e-4;
 
+    // The lookup grid samples the exact raw to corrected mapping at evenly spaced raw
+    // coordinates across the pre-correction active array, and is interpolated bilinearly.
+    // It starts with kLookupGridMinCells cells in each dimension and is refined until the
+    // interpolation error, measured against the distortion model between grid points, is
+    // at most kLookupGridMaxError pixels in every cell, or up to kLookupGridMaxCells; cells
+    // still over the bound then are left to the quad grids.
+    constexpr static size_t kLookupGridMinCells = 16;
+    constexpr static size_t kLookupGridMaxCells = 128;
+    constexpr static float kLookupGridMaxError = 0.2f;
+    // Number of points mapped through the lookup grid per batch
+    constexpr static int kLookupBatchSize = 64;
+    // Newton iteration limit and convergence threshold (in normalized coordinates, squared)
+    // when inverting the distortion model for lookup grid points
+    constexpr static int kMaxInverseIterations = 20;
+    constexpr static double kInverseToleranceSq = 1e-18;
+
     // Metadata key lists to correct
 
     // Both capture request and result
@@ -177,9 +202,40 @@ class DistortionMapper {
     // Utility to create reverse mapping grids
     status_t buildGrids();
 
+    // Map one raw point to corrected coordinates through the quad grids
+    status_t mapRawToCorrectedWithQuads(const int32_t pt[2], float *corrX, float *corrY) const;
+
+    // Utility to create the lookup grid; leaves mValidLookupGrid false if no cell of it
+    // meets the error bound
+    void buildLookupGrid();
+
+    // Map a batch of raw points through the lookup grid. Points outside of the grid or in
+    // cells over the error bound are set to NaN.
+    void mapRawToCorrectedLookup(const int32_t *coordPairs, int coordCount,
+            float *corrected) const;
+
+    // Bilinear interpolation of the lookup grid at grid coordinates (gx, gy), which must be
+    // within [0, mLookupCellsX] x [0, mLookupCellsY]
+    void interpolateLookup(float gx, float gy, float *corrX, float *corrY) const;
+
+    // Apply the distortion model to a normalized point, optionally also returning its
+    // Jacobian as {dxd/dx, dxd/dy, dyd/dx, dyd/dy}
+    void distortNormalized(double x, double y, double *xd, double *yd,
+            double *jacobian) const;
+
+    // Invert the distortion model for a normalized point by Newton iteration, starting
+    // from (*x, *y). Returns false if it does not converge to an orientation-preserving
+    // solution
+    bool undistortNormalized(double xd, double yd, double *x, double *y) const;
+
+    // Exact corrected to raw mapping, in double precision
+    void mapCorrectedToRawExact(double x, double y, double *rawX, double *rawY) const;
+
 
     bool mValidMapping;
     bool mValidGrids;
+    bool mValidLookupGrid;
+    bool mLookupGridEnabled;
 
     // intrisic parameters, in pixels
     float mFx, mFy, mCx, mCy, mS;
@@ -198,6 +254,15 @@ class DistortionMapper {
     std::vector<GridQuad> mCorrectedGrid;
     std::vector<GridQuad> mDistortedGrid;
 
+    // Lookup grid geometry, in pre-correction active array coordinates
+    size_t mLookupCellsX, mLookupCellsY;
+    float mLookupOriginX, mLookupOriginY;
+    float mLookupInvSpacingX, mLookupInvSpacingY;
+    // Corrected (x, y) for each lookup grid point, row by row
+    std::vector<float> mLookupGrid;
+    // Whether each lookup grid cell is within the error bound, row by row
+    std::vector<uint8_t> mLookupCellValid;
+
 }; // class DistortionMapper
 
 } // namespace camera3
@@ -41,9 +41,14 @@ RingBufferConsumer::RingBufferConsumer(const sp<IGraphicBufferConsumer>& consume
         uint64_t consumerUsage,
         int bufferCount) :
     ConsumerBase(consumer),
+    mBufferItems(bufferCount > 0 ? bufferCount : 1),
     mBufferCount(bufferCount),
     mLatestTimestamp(0)
 {
+    for (std::atomic<int>& pinCount : mPinCounts) {
+        pinCount = 0;
+    }
+
     mConsumer->setConsumerUsageBits(consumerUsage);
     mConsumer->setMaxAcquiredBufferCount(bufferCount);
 
@@ -66,24 +71,22 @@ sp<PinnedBufferItem> RingBufferConsumer::pinSelectedBuffer(
     sp<PinnedBufferItem> pinnedBuffer;
 
     {
-        List<RingBufferItem>::iterator it, end, accIt;
         BufferInfo acc, cur;
         BufferInfo* accPtr = NULL;
+        size_t accIndex = 0;
 
         Mutex::Autolock _l(mMutex);
 
-        for (it = mBufferItemList.begin(), end = mBufferItemList.end();
-             it != end;
-             ++it) {
+        for (size_t i = 0; i < mBufferItems.size(); ++i) {
 
-            const RingBufferItem& item = *it;
+            const BufferItem& item = mBufferItems[i];
 
             cur.mCrop = item.mCrop;
             cur.mTransform = item.mTransform;
             cur.mScalingMode = item.mScalingMode;
             cur.mTimestamp = item.mTimestamp;
             cur.mFrameNumber = item.mFrameNumber;
-            cur.mPinned = item.mPinCount > 0;
+            cur.mPinned = getPinCount(item.mSlot) > 0;
 
             int ret = filter.compare(accPtr, &cur);
 
@@ -92,7 +95,7 @@ sp<PinnedBufferItem> RingBufferConsumer::pinSelectedBuffer(
             } else if (ret > 0) {
                 acc = cur;
                 accPtr = &acc;
-                accIt = it;
+                accIndex = i;
             } // else acc = acc
         }
 
@@ -100,23 +103,70 @@ sp<PinnedBufferItem> RingBufferConsumer::pinSelectedBuffer(
             return NULL;
         }
 
-        pinnedBuffer = new PinnedBufferItem(this, *accIt);
-        pinBufferLocked(pinnedBuffer->getBufferItem());
+        pinnedBuffer = pinBufferLocked(accIndex);
 
     } // end scope of mMutex autolock
 
     if (waitForFence) {
-        status_t err = pinnedBuffer->getBufferItem().mFence->waitForever(
-                "RingBufferConsumer::pinSelectedBuffer");
-        if (err != OK) {
-            BI_LOGE("Failed to wait for fence of acquired buffer: %s (%d)",
-                    strerror(-err), err);
+        waitForPinnedBufferFence(pinnedBuffer);
+    }
+
+    return pinnedBuffer;
+}
+
+sp<PinnedBufferItem> RingBufferConsumer::pinLatestBuffer(bool waitForFence) {
+
+    sp<PinnedBufferItem> pinnedBuffer;
+
+    {
+        Mutex::Autolock _l(mMutex);
+
+        if (mBufferItems.empty()) {
+            return NULL;
+        }
+
+        pinnedBuffer = pinBufferLocked(mBufferItems.size() - 1);
+    }
+
+    if (waitForFence) {
+        waitForPinnedBufferFence(pinnedBuffer);
+    }
+
+    return pinnedBuffer;
+}
+
+sp<PinnedBufferItem> RingBufferConsumer::pinBufferByTimestamp(nsecs_t timestamp,
+        bool waitForFence) {
+
+    sp<PinnedBufferItem> pinnedBuffer;
+
+    {
+        Mutex::Autolock _l(mMutex);
+
+        ssize_t index = mBufferItems.findClosest(timestamp);
+        if (index < 0) {
+            return NULL;
         }
+
+        pinnedBuffer = pinBufferLocked(index);
+    }
+
+    if (waitForFence) {
+        waitForPinnedBufferFence(pinnedBuffer);
     }
 
     return pinnedBuffer;
 }
 
+void RingBufferConsumer::waitForPinnedBufferFence(const sp<PinnedBufferItem>& pinnedBuffer) {
+    status_t err = pinnedBuffer->getBufferItem().mFence->waitForever(
+            "RingBufferConsumer::pinBuffer");
+    if (err != OK) {
+        BI_LOGE("Failed to wait for fence of acquired buffer: %s (%d)",
+                strerror(-err), err);
+    }
+}
+
 status_t RingBufferConsumer::clear() {
 
     status_t err;
@@ -125,7 +175,7 @@ status_t RingBufferConsumer::clear() {
     BI_LOGV("%s", __FUNCTION__);
 
     // Avoid annoying log warnings by returning early
-    if (mBufferItemList.size() == 0) {
+    if (mBufferItems.empty()) {
         return OK;
     }
 
@@ -134,7 +184,7 @@ status_t RingBufferConsumer::clear() {
         err = releaseOldestBufferLocked(&pinnedFrames);
 
         if (err == NO_BUFFER_AVAILABLE) {
-            assert(pinnedFrames == mBufferItemList.size());
+            assert(pinnedFrames == mBufferItems.size());
             break;
         }
 
@@ -155,45 +205,34 @@ status_t RingBufferConsumer::clear() {
 
 nsecs_t RingBufferConsumer::getLatestTimestamp() {
     Mutex::Autolock _l(mMutex);
-    if (mBufferItemList.size() == 0) {
+    if (mBufferItems.empty()) {
         return 0;
     }
     return mLatestTimestamp;
 }
 
-void RingBufferConsumer::pinBufferLocked(const BufferItem& item) {
-    List<RingBufferItem>::iterator it, end;
+sp<PinnedBufferItem> RingBufferConsumer::pinBufferLocked(size_t index) {
+    const BufferItem& item = mBufferItems[index];
 
-    for (it = mBufferItemList.begin(), end = mBufferItemList.end();
-         it != end;
-         ++it) {
+    mPinCounts[item.mSlot]++;
 
-        RingBufferItem& find = *it;
-        if (item.mGraphicBuffer == find.mGraphicBuffer) {
-            find.mPinCount++;
-            break;
-        }
-    }
+    BI_LOGV("Pinned buffer (frame %" PRIu64 ", timestamp %" PRId64 ")",
+            item.mFrameNumber, item.mTimestamp);
 
-    if (it == end) {
-        BI_LOGE("Failed to pin buffer (timestamp %" PRId64 ", framenumber %" PRIu64 ")",
-                 item.mTimestamp, item.mFrameNumber);
-    } else {
-        BI_LOGV("Pinned buffer (frame %" PRIu64 ", timestamp %" PRId64 ")",
-                item.mFrameNumber, item.mTimestamp);
+    return new PinnedBufferItem(this, item);
+}
+
+int RingBufferConsumer::getPinCount(int slot) const {
+    if (slot < 0 || slot >= BufferQueue::NUM_BUFFER_SLOTS) {
+        return 0;
     }
+    return mPinCounts[slot];
 }
 
 status_t RingBufferConsumer::releaseOldestBufferLocked(size_t* pinnedFrames) {
     status_t err = OK;
 
-    List<RingBufferItem>::iterator it, end, accIt;
-
-    it = mBufferItemList.begin();
-    end = mBufferItemList.end();
-    accIt = end;
-
-    if (it == end) {
+    if (mBufferItems.empty()) {
         /**
          * This is fine. We really care about being able to acquire a buffer
          * successfully after this function completes, not about it releasing
@@ -204,24 +243,29 @@ status_t RingBufferConsumer::releaseOldestBufferLocked(size_t* pinnedFrames) {
         return NOT_ENOUGH_DATA;
     }
 
-    for (; it != end; ++it) {
-        RingBufferItem& find = *it;
+    // The ring buffer is ordered by timestamp, the oldest non-pinned buffer
+    // is the first one. Pinned buffers after it only need to be counted if
+    // the caller asked for it.
+    size_t index, size = mBufferItems.size();
+    for (index = 0; index < size; ++index) {
+        if (getPinCount(mBufferItems[index].mSlot) == 0) {
+            break;
+        }
+        if (pinnedFrames != NULL) {
+            ++(*pinnedFrames);
+        }
+    }
 
-        if (find.mPinCount > 0) {
-            if (pinnedFrames != NULL) {
+    if (pinnedFrames != NULL) {
+        for (size_t i = index + 1; i < size; ++i) {
+            if (getPinCount(mBufferItems[i].mSlot) > 0) {
                 ++(*pinnedFrames);
             }
-            // Filter out pinned frame when searching for buffer to release
-            continue;
-        }
-
-        if (find.mTimestamp < accIt->mTimestamp || accIt == end) {
-            accIt = it;
         }
     }
 
-    if (accIt != end) {
-        RingBufferItem& item = *accIt;
+    if (index < size) {
+        BufferItem& item = mBufferItems[index];
 
         // In case the object was never pinned, pass the acquire fence
         // back to the release fence. If the fence was already waited on,
@@ -256,7 +300,7 @@ status_t RingBufferConsumer::releaseOldestBufferLocked(size_t* pinnedFrames) {
         BI_LOGV("Buffer timestamp %" PRId64 ", frame %" PRIu64 " evicted",
                 item.mTimestamp, item.mFrameNumber);
 
-        mBufferItemList.erase(accIt);
+        mBufferItems.erase(index);
     } else {
         BI_LOGW("All buffers pinned, could not find any to release");
         return NO_BUFFER_AVAILABLE;
@@ -275,7 +319,7 @@ void RingBufferConsumer::onFrameAvailable(const BufferItem& item) {
         /**
          * Release oldest frame
          */
-        if (mBufferItemList.size() >= (size_t)mBufferCount) {
+        if (mBufferItems.full()) {
             err = releaseOldestBufferLocked(/*pinnedFrames*/NULL);
             assert(err != NOT_ENOUGH_DATA);
 
@@ -288,73 +332,80 @@ void RingBufferConsumer::onFrameAvailable(const BufferItem& item) {
             // we could've locked but didn't because there was no space
         }
 
-        RingBufferItem& item = *mBufferItemList.insert(mBufferItemList.end(),
-                                                       RingBufferItem());
-
         /**
          * Acquire new frame
          */
-        err = acquireBufferLocked(&item, 0);
+        BufferItem newItem;
+        err = acquireBufferLocked(&newItem, 0);
         if (err != OK) {
             if (err != NO_BUFFER_AVAILABLE) {
                 BI_LOGE("Error acquiring buffer: %s (%d)", strerror(err), err);
             }
-
-            mBufferItemList.erase(--mBufferItemList.end());
             return;
         }
 
-        BI_LOGV("New buffer acquired (timestamp %" PRId64 "), "
-                "buffer items %zu out of %d",
-                item.mTimestamp,
-                mBufferItemList.size(), mBufferCount);
-
-        if (item.mTimestamp < mLatestTimestamp) {
+        if (newItem.mTimestamp < mLatestTimestamp) {
             BI_LOGE("Timestamp  decreases from %" PRId64 " to %" PRId64,
-                    mLatestTimestamp, item.mTimestamp);
+                    mLatestTimestamp, newItem.mTimestamp);
         }
 
-        mLatestTimestamp = item.mTimestamp;
+        mLatestTimestamp = newItem.mTimestamp;
 
-        item.mGraphicBuffer = mSlots[item.mSlot].mGraphicBuffer;
+        newItem.mGraphicBuffer = mSlots[newItem.mSlot].mGraphicBuffer;
+
+        // Appended in O(1), unless the timestamp went backwards
+        ssize_t index = mBufferItems.insert(newItem);
+        assert(index >= 0);
+
+        BI_LOGV("New buffer acquired (timestamp %" PRId64 "), "
+                "buffer items %zu out of %d, at %zd",
+                newItem.mTimestamp,
+                mBufferItems.size(), mBufferCount, index);
     } // end of mMutex lock
 
     ConsumerBase::onFrameAvailable(item);
 }
 
-void RingBufferConsumer::unpinBuffer(const BufferItem& item) {
-    Mutex::Autolock _l(mMutex);
-
-    List<RingBufferItem>::iterator it, end, accIt;
-
-    for (it = mBufferItemList.begin(), end = mBufferItemList.end();
-         it != end;
-         ++it) {
+void RingBufferConsumer::unpinBuffer(const BufferItem& item,
+        const sp<Fence>& acquireFence) {
+    int slot = item.mSlot;
+    if (slot < 0 || slot >= BufferQueue::NUM_BUFFER_SLOTS) {
+        // This should never happen. If it happens, we have a bug.
+        ALOGE("%s: Failed to unpin buffer in slot %d (timestamp %" PRId64 ")",
+                __FUNCTION__, slot, item.mTimestamp);
+        return;
+    }
 
-        RingBufferItem& find = *it;
-        if (item.mGraphicBuffer == find.mGraphicBuffer) {
-            status_t res = addReleaseFenceLocked(item.mSlot,
-                    item.mGraphicBuffer, item.mFence);
+    int pinCount;
+    if (item.mFence != acquireFence) {
+        // The fence was replaced while the buffer was pinned. It has to be
+        // merged into the release fence before the buffer can be evicted.
+        Mutex::Autolock _l(mMutex);
 
-            if (res != OK) {
-                BI_LOGE("Failed to add release fence to buffer "
-                        "(timestamp %" PRId64 ", framenumber %" PRIu64,
-                        item.mTimestamp, item.mFrameNumber);
-                return;
-            }
+        status_t res = addReleaseFenceLocked(slot,
+                item.mGraphicBuffer, item.mFence);
 
-            find.mPinCount--;
-            break;
+        if (res != OK) {
+            BI_LOGE("Failed to add release fence to buffer "
+                    "(timestamp %" PRId64 ", framenumber %" PRIu64,
+                    item.mTimestamp, item.mFrameNumber);
+            return;
         }
+
+        pinCount = --mPinCounts[slot];
+    } else {
+        // The acquire fence is passed back to the release fence on eviction
+        // already, no need to take the lock.
+        pinCount = --mPinCounts[slot];
     }
 
-    if (it == end) {
+    if (pinCount < 0) {
         // This should never happen. If it happens, we have a bug.
-        BI_LOGE("Failed to unpin buffer (timestamp %" PRId64 ", framenumber %" PRIu64 ")",
-                 item.mTimestamp, item.mFrameNumber);
+        ALOGE("%s: Failed to unpin buffer (timestamp %" PRId64 ", framenumber %" PRIu64 ")",
+                __FUNCTION__, item.mTimestamp, item.mFrameNumber);
     } else {
-        BI_LOGV("Unpinned buffer (timestamp %" PRId64 ", framenumber %" PRIu64 ")",
-                 item.mTimestamp, item.mFrameNumber);
+        ALOGV("%s: Unpinned buffer (timestamp %" PRId64 ", framenumber %" PRIu64 ")",
+                __FUNCTION__, item.mTimestamp, item.mFrameNumber);
     }
 }
 
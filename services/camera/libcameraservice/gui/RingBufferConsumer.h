@@ -20,8 +20,9 @@
 #include <gui/BufferItem.h>
 #include <gui/ConsumerBase.h>
 #include <gui/BufferQueue.h>
+#include <gui/TimestampRing.h>
 
-#include <utils/List.h>
+#include <atomic>
 
 #define ANDROID_GRAPHICS_RINGBUFFERCONSUMER_JNI_ID "mRingBufferConsumer"
 
@@ -42,6 +43,12 @@ class String8;
  *
  * Note that the 'oldest' buffer is the one with the smallest timestamp.
  *
+ * The buffer items are kept in a ring of bufferCount entries ordered by
+ * timestamp, so pinning the latest buffer is O(1) and pinning a buffer by
+ * timestamp is a binary search, whatever the depth of the ring. Pin counts are
+ * atomic, and unpinning a buffer only takes the consumer lock if its fence has
+ * to be merged into the release fence.
+ *
  * Edge cases:
  *  - If ringbuffer is not full, no drops occur when a buffer is produced.
  *  - If all the buffers get filled or pinned then there will be no empty
@@ -120,13 +127,14 @@ class RingBufferConsumer : public ConsumerBase,
         PinnedBufferItem(wp<RingBufferConsumer> consumer,
                          const BufferItem& item) :
                 mConsumer(consumer),
-                mBufferItem(item) {
+                mBufferItem(item),
+                mAcquireFence(item.mFence) {
         }
 
         ~PinnedBufferItem() {
             sp<RingBufferConsumer> consumer = mConsumer.promote();
             if (consumer != NULL) {
-                consumer->unpinBuffer(mBufferItem);
+                consumer->unpinBuffer(mBufferItem, mAcquireFence);
             }
         }
 
@@ -140,6 +148,8 @@ class RingBufferConsumer : public ConsumerBase,
       private:
         wp<RingBufferConsumer> mConsumer;
         BufferItem             mBufferItem;
+        // Fence of the buffer when it was pinned
+        sp<Fence>              mAcquireFence;
     };
 
     // Find a buffer using the filter, then pin it before returning it.
@@ -150,9 +160,24 @@ class RingBufferConsumer : public ConsumerBase,
     //
     // Pinning will ensure that the buffer will not be dropped when a new
     // frame is available.
+    //
+    // This scans the whole ring buffer; prefer pinLatestBuffer or
+    // pinBufferByTimestamp when they fit.
     sp<PinnedBufferItem> pinSelectedBuffer(const RingBufferComparator& filter,
                                            bool waitForFence = true);
 
+    // Pin the buffer with the latest timestamp. Returns NULL if the ring
+    // buffer is empty.
+    sp<PinnedBufferItem> pinLatestBuffer(bool waitForFence = true);
+
+    // Pin the buffer best matching the timestamp, in order of preference:
+    //  1) The buffer with that timestamp.
+    //  2) The buffer with the closest lower timestamp.
+    //  3) The buffer with the closest higher timestamp.
+    // Returns NULL if the ring buffer is empty.
+    sp<PinnedBufferItem> pinBufferByTimestamp(nsecs_t timestamp,
+                                              bool waitForFence = true);
+
     // Release all the non-pinned buffers in the ring buffer
     status_t clear();
 
@@ -164,23 +189,25 @@ class RingBufferConsumer : public ConsumerBase,
     // Override ConsumerBase::onFrameAvailable
     virtual void onFrameAvailable(const BufferItem& item);
 
-    void pinBufferLocked(const BufferItem& item);
-    void unpinBuffer(const BufferItem& item);
+    // Pin the index-th oldest buffer of the ring buffer
+    sp<PinnedBufferItem> pinBufferLocked(size_t index);
+    void waitForPinnedBufferFence(const sp<PinnedBufferItem>& pinnedBuffer);
+    void unpinBuffer(const BufferItem& item, const sp<Fence>& acquireFence);
+    int getPinCount(int slot) const;
 
     // Releases oldest buffer. Returns NO_BUFFER_AVAILABLE
     // if all the buffers were pinned.
     // Returns NOT_ENOUGH_DATA if list was empty.
     status_t releaseOldestBufferLocked(size_t* pinnedFrames);
 
-    struct RingBufferItem : public BufferItem {
-        RingBufferItem() : BufferItem(), mPinCount(0) {}
-        int mPinCount;
-    };
-
-    // List of acquired buffers in our ring buffer
-    List<RingBufferItem>       mBufferItemList;
+    // Acquired buffers in our ring buffer, oldest first
+    TimestampRing<BufferItem>  mBufferItems;
     const int                  mBufferCount;
 
+    // Pin count of the buffer acquired in each slot. Only read and written
+    // while the slot is part of the ring buffer.
+    std::atomic<int>           mPinCounts[BufferQueue::NUM_BUFFER_SLOTS];
+
     // Timestamp of latest buffer
     nsecs_t mLatestTimestamp;
 };
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_TIMESTAMPRING_H
+#define ANDROID_GUI_TIMESTAMPRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+namespace android {
+
+/**
+ * A fixed capacity ring of items kept in increasing order of their mTimestamp
+ * field, oldest first.
+ *
+ * Items are expected to arrive in timestamp order, so inserting the newest
+ * item and removing the oldest one are O(1), and looking up an item by
+ * timestamp is a binary search. An item arriving out of order, or removed from
+ * the middle of the ring, shifts the items after it.
+ *
+ * Not thread safe; RingBufferConsumer guards it with its own mutex.
+ */
+template <typename T>
+class TimestampRing {
+  public:
+    explicit TimestampRing(size_t capacity) :
+            mItems(capacity),
+            mHead(0),
+            mSize(0) {
+    }
+
+    size_t capacity() const { return mItems.size(); }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    bool full() const { return mSize == mItems.size(); }
+
+    // The i-th oldest item, 0 <= i < size()
+    T& operator[](size_t i) { return mItems[physical(i)]; }
+    const T& operator[](size_t i) const { return mItems[physical(i)]; }
+
+    // Insert the item at its place in timestamp order, after any item with the
+    // same timestamp. Returns its index, or -1 if the ring is full.
+    ssize_t insert(const T& item) {
+        if (full()) {
+            return -1;
+        }
+        size_t index = upperBound(item.mTimestamp);
+        for (size_t i = mSize; i > index; --i) {
+            mItems[physical(i)] = mItems[physical(i - 1)];
+        }
+        mItems[physical(index)] = item;
+        mSize++;
+        return index;
+    }
+
+    // Remove the i-th oldest item. The freed entry is reset so that it doesn't
+    // hold on to the item's resources.
+    void erase(size_t i) {
+        if (i >= mSize) {
+            return;
+        }
+        if (i == 0) {
+            mItems[mHead] = T();
+            mHead = physical(1);
+        } else {
+            for (; i + 1 < mSize; ++i) {
+                mItems[physical(i)] = mItems[physical(i + 1)];
+            }
+            mItems[physical(mSize - 1)] = T();
+        }
+        mSize--;
+    }
+
+    void clear() {
+        while (!empty()) {
+            erase(0);
+        }
+    }
+
+    // Index of the first item with a timestamp greater than the given one, or
+    // size() if there's none.
+    size_t upperBound(int64_t timestamp) const {
+        size_t lo = 0, hi = mSize;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if ((*this)[mid].mTimestamp <= timestamp) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Index of the item best matching the timestamp: an exact match if any,
+    // otherwise the newest older item, otherwise the oldest (and so closest)
+    // newer item. Returns -1 if the ring is empty.
+    ssize_t findClosest(int64_t timestamp) const {
+        if (empty()) {
+            return -1;
+        }
+        size_t index = upperBound(timestamp);
+        return (index > 0) ? index - 1 : 0;
+    }
+
+  private:
+    size_t physical(size_t i) const {
+        size_t p = mHead + i;
+        return (p >= mItems.size()) ? p - mItems.size() : p;
+    }
+
+    std::vector<T> mItems;
+    // Position of the oldest item in mItems
+    size_t mHead;
+    size_t mSize;
+};
+
+} // namespace android
+
+#endif // ANDROID_GUI_TIMESTAMPRING_H
@@ -41,3 +41,19 @@ LOCAL_MODULE:= cameraservice_test
 LOCAL_MODULE_TAGS := tests
 
 include $(BUILD_NATIVE_TEST)
+
+# The ring buffer logic of RingBufferConsumer has no device dependencies, so its
+# test and lookup benchmark also run on the host.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= TimestampRingTest.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libbase
+
+LOCAL_CFLAGS += -Wall -Wextra -Werror
+
+LOCAL_MODULE:= cameraservice_timestamp_ring_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -277,7 +277,7 @@ void RandomTransformTest(::testing::Test *test,
 
 // Test a realistic distortion function with matching calibration values, enforcing
 // clamping.
-TEST(DistortionMapperTest, DISABLED_SmallTransform) {
+TEST(DistortionMapperTest, SmallTransform) {
     int32_t activeArray[] = {0, 8, 3278, 2450};
     int32_t preCorrectionActiveArray[] = {0, 0, 3280, 2464};
 
@@ -318,6 +318,79 @@ TEST(DistortionMapperTest, LargeTransform) {
     RandomTransformTest(this, testActiveArray, m, /*clamp*/false, /*simple*/false);
 }
 
+// Same as LargeTransform, but mapping raw to corrected through the quad grids only, for
+// comparison of accuracy and timing against the lookup grid
+TEST(DistortionMapperTest, LargeTransformNoLookupGrid) {
+    float bigDistortion[] = {0.1, -0.003, 0.004, 0.02, 0.01};
+
+    DistortionMapper m;
+    setupTestMapper(&m, bigDistortion, testICal,
+            /*activeArray*/testActiveArray,
+            /*preCorrectionActiveArray*/testPreCorrActiveArray);
+    m.setLookupGridEnabled(false);
+
+    RandomTransformTest(this, testActiveArray, m, /*clamp*/false, /*simple*/false);
+}
+
+// Time raw to corrected mapping with and without the lookup grid on the same points, and
+// check that both agree to within a pixel in each dimension
+TEST(DistortionMapperTest, LookupGridBenchmark) {
+    status_t res;
+    float bigDistortion[] = {0.1, -0.003, 0.004, 0.02, 0.01};
+
+    DistortionMapper m;
+    setupTestMapper(&m, bigDistortion, testICal,
+            /*activeArray*/testActiveArray,
+            /*preCorrectionActiveArray*/testPreCorrActiveArray);
+
+    unsigned int seed = 1234;
+    const size_t coordCount = 1e5;
+    std::default_random_engine gen(seed);
+    std::uniform_int_distribution<int> x_dist(0, testPreCorrActiveArray[2] - 1);
+    std::uniform_int_distribution<int> y_dist(0, testPreCorrActiveArray[3] - 1);
+
+    std::vector<int32_t> rawCoords(coordCount * 2);
+    for (size_t i = 0; i < rawCoords.size(); i += 2) {
+        rawCoords[i] = x_dist(gen);
+        rawCoords[i + 1] = y_dist(gen);
+    }
+
+    // Builds the grids outside of the timed sections
+    int32_t warmup[2] = {0, 0};
+    ASSERT_EQ(m.mapRawToCorrected(warmup, 1, /*clamp*/false, /*simple*/false), OK);
+
+    auto quadCoords = rawCoords;
+    m.setLookupGridEnabled(false);
+    base::Timer quadTimer;
+    res = m.mapRawToCorrected(quadCoords.data(), coordCount, /*clamp*/false, /*simple*/false);
+    auto quadDuration = quadTimer.duration();
+    ASSERT_EQ(res, OK);
+
+    auto lookupCoords = rawCoords;
+    m.setLookupGridEnabled(true);
+    base::Timer lookupTimer;
+    res = m.mapRawToCorrected(lookupCoords.data(), coordCount, /*clamp*/false, /*simple*/false);
+    auto lookupDuration = lookupTimer.duration();
+    ASSERT_EQ(res, OK);
+
+    for (size_t i = 0; i < rawCoords.size(); i += 2) {
+        EXPECT_LE(std::abs(lookupCoords[i] - quadCoords[i]), 1) << "(" << rawCoords[i] <<
+                "," << rawCoords[i + 1] << ")";
+        EXPECT_LE(std::abs(lookupCoords[i + 1] - quadCoords[i + 1]), 1) << "(" <<
+                rawCoords[i] << "," << rawCoords[i + 1] << ")";
+    }
+
+    using usDuration = std::chrono::duration<double, std::micro>;
+    float quadPerCoordUs = (std::chrono::duration_cast<usDuration>(quadDuration) /
+            coordCount).count();
+    float lookupPerCoordUs = (std::chrono::duration_cast<usDuration>(lookupDuration) /
+            coordCount).count();
+    RecordProperty("QuadRawToCorrectedDurationPerCoordUs",
+            base::StringPrintf("%f", quadPerCoordUs));
+    RecordProperty("LookupRawToCorrectedDurationPerCoordUs",
+            base::StringPrintf("%f", lookupPerCoordUs));
+}
+
 // Compare against values calculated by OpenCV
 // undistortPoints() method, which is the same as mapRawToCorrected
 // Ignore clamping
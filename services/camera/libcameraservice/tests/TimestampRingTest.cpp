@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "TimestampRingTest"
+
+#include <memory>
+#include <random>
+
+#include <gtest/gtest.h>
+#include <android-base/stringprintf.h>
+#include <android-base/chrono_utils.h>
+
+#include "../gui/TimestampRing.h"
+
+using namespace android;
+
+// Stands in for the BufferItems of RingBufferConsumer; the buffer handle
+// tracks whether the ring still holds on to an evicted item.
+struct MockBufferItem {
+    int64_t mTimestamp = 0;
+    uint64_t mFrameNumber = 0;
+    int mSlot = -1;
+    std::shared_ptr<int> mGraphicBuffer;
+};
+
+// A camera stream at 30fps with some jitter on the timestamps
+class MockBufferStream {
+  public:
+    explicit MockBufferStream(unsigned int seed) : mGen(seed), mJitter(-500000, 500000) {}
+
+    MockBufferItem next() {
+        MockBufferItem item;
+        item.mFrameNumber = mFrameNumber++;
+        item.mTimestamp = static_cast<int64_t>(item.mFrameNumber) * kFrameDurationNs +
+                mJitter(mGen);
+        item.mSlot = item.mFrameNumber % 64;
+        item.mGraphicBuffer = std::make_shared<int>(item.mSlot);
+        return item;
+    }
+
+    static const int64_t kFrameDurationNs = 33333333;
+
+  private:
+    std::default_random_engine mGen;
+    std::uniform_int_distribution<int64_t> mJitter;
+    uint64_t mFrameNumber = 0;
+};
+
+// Selection of a ZSL buffer as done by scanning the whole ring: exact match,
+// else closest lower timestamp, else closest higher timestamp.
+ssize_t linearFindClosest(const TimestampRing<MockBufferItem>& ring, int64_t timestamp) {
+    ssize_t best = -1;
+    for (size_t i = 0; i < ring.size(); ++i) {
+        int64_t t = ring[i].mTimestamp;
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        int64_t b = ring[best].mTimestamp;
+        if (b == timestamp) {
+            continue;
+        }
+        if (t == timestamp) {
+            best = i;
+        } else if (t < timestamp && (b > timestamp || t > b)) {
+            best = i;
+        } else if (t > timestamp && b > timestamp && t < b) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Keeps the ring full the way RingBufferConsumer does, dropping the oldest
+// buffer when a new one comes in.
+void pushEvictingOldest(TimestampRing<MockBufferItem>* ring, const MockBufferItem& item) {
+    if (ring->full()) {
+        ring->erase(0);
+    }
+    ring->insert(item);
+}
+
+TEST(TimestampRingTest, KeepsTimestampOrder) {
+    TimestampRing<MockBufferItem> ring(4);
+    MockBufferStream stream(1234);
+
+    EXPECT_TRUE(ring.empty());
+    EXPECT_EQ(ring.findClosest(0), -1);
+
+    std::vector<MockBufferItem> items;
+    for (int i = 0; i < 10; ++i) {
+        items.push_back(stream.next());
+        pushEvictingOldest(&ring, items.back());
+    }
+
+    ASSERT_TRUE(ring.full());
+    for (size_t i = 0; i < ring.size(); ++i) {
+        EXPECT_EQ(ring[i].mFrameNumber, items[items.size() - ring.size() + i].mFrameNumber);
+    }
+
+    MockBufferItem extra = stream.next();
+    EXPECT_EQ(ring.insert(extra), -1);
+}
+
+TEST(TimestampRingTest, InsertOutOfOrder) {
+    TimestampRing<MockBufferItem> ring(8);
+    const int64_t timestamps[] = { 100, 300, 200, 500, 50, 400 };
+    for (int64_t t : timestamps) {
+        MockBufferItem item;
+        item.mTimestamp = t;
+        ASSERT_GE(ring.insert(item), 0);
+    }
+
+    ASSERT_EQ(ring.size(), 6u);
+    for (size_t i = 1; i < ring.size(); ++i) {
+        EXPECT_LT(ring[i - 1].mTimestamp, ring[i].mTimestamp);
+    }
+}
+
+TEST(TimestampRingTest, EraseReleasesItem) {
+    TimestampRing<MockBufferItem> ring(4);
+    MockBufferStream stream(1234);
+
+    std::vector<MockBufferItem> items;
+    for (int i = 0; i < 4; ++i) {
+        items.push_back(stream.next());
+        ring.insert(items.back());
+    }
+
+    // From the middle, as when the oldest buffers are pinned
+    ring.erase(1);
+    EXPECT_EQ(items[1].mGraphicBuffer.use_count(), 1);
+    ASSERT_EQ(ring.size(), 3u);
+    EXPECT_EQ(ring[0].mFrameNumber, items[0].mFrameNumber);
+    EXPECT_EQ(ring[1].mFrameNumber, items[2].mFrameNumber);
+    EXPECT_EQ(ring[2].mFrameNumber, items[3].mFrameNumber);
+
+    ring.erase(0);
+    EXPECT_EQ(items[0].mGraphicBuffer.use_count(), 1);
+
+    ring.clear();
+    EXPECT_TRUE(ring.empty());
+    for (const MockBufferItem& item : items) {
+        EXPECT_EQ(item.mGraphicBuffer.use_count(), 1);
+    }
+}
+
+TEST(TimestampRingTest, FindClosest) {
+    TimestampRing<MockBufferItem> ring(3);
+    const int64_t timestamps[] = { 100, 200, 300 };
+    for (int64_t t : timestamps) {
+        MockBufferItem item;
+        item.mTimestamp = t;
+        ring.insert(item);
+    }
+
+    EXPECT_EQ(ring.findClosest(200), 1);   // exact
+    EXPECT_EQ(ring.findClosest(250), 1);   // closest lower
+    EXPECT_EQ(ring.findClosest(1000), 2);  // closest lower
+    EXPECT_EQ(ring.findClosest(50), 0);    // closest higher
+}
+
+TEST(TimestampRingTest, FindClosestMatchesLinearScan) {
+    TimestampRing<MockBufferItem> ring(16);
+    MockBufferStream stream(5678);
+    std::default_random_engine gen(42);
+
+    for (int i = 0; i < 1000; ++i) {
+        pushEvictingOldest(&ring, stream.next());
+        // Drop a buffer from the middle now and then, as when the oldest
+        // buffers are pinned
+        if (i % 7 == 0 && ring.size() > 2) {
+            ring.erase(std::uniform_int_distribution<size_t>(1, ring.size() - 2)(gen));
+        }
+
+        int64_t first = ring[0].mTimestamp;
+        int64_t last = ring[ring.size() - 1].mTimestamp;
+        std::uniform_int_distribution<int64_t> needle(first - MockBufferStream::kFrameDurationNs,
+                last + MockBufferStream::kFrameDurationNs);
+        int64_t timestamps[] = { first, last, ring[ring.size() / 2].mTimestamp, needle(gen) };
+        for (int64_t t : timestamps) {
+            ASSERT_EQ(ring.findClosest(t), linearFindClosest(ring, t)) << "timestamp " << t;
+        }
+    }
+}
+
+TEST(TimestampRingTest, LookupBenchmark) {
+    const size_t depths[] = { 4, 16, 64, 256 };
+    const size_t lookupCount = 100000;
+
+    for (size_t depth : depths) {
+        TimestampRing<MockBufferItem> ring(depth);
+        MockBufferStream stream(1234);
+        for (size_t i = 0; i < depth * 2; ++i) {
+            pushEvictingOldest(&ring, stream.next());
+        }
+
+        // ZSL looks up the timestamp of a recent frame
+        std::default_random_engine gen(42);
+        std::uniform_int_distribution<size_t> pick(0, depth - 1);
+        std::vector<int64_t> timestamps(lookupCount);
+        for (int64_t& t : timestamps) {
+            t = ring[pick(gen)].mTimestamp;
+        }
+
+        size_t linearSum = 0;
+        base::Timer linearTimer;
+        for (int64_t t : timestamps) {
+            linearSum += linearFindClosest(ring, t);
+        }
+        auto linearDuration = linearTimer.duration();
+
+        size_t indexedSum = 0;
+        base::Timer indexedTimer;
+        for (int64_t t : timestamps) {
+            indexedSum += ring.findClosest(t);
+        }
+        auto indexedDuration = indexedTimer.duration();
+
+        EXPECT_EQ(linearSum, indexedSum);
+
+        using usDuration = std::chrono::duration<double, std::micro>;
+        float linearPerLookupUs = (std::chrono::duration_cast<usDuration>(linearDuration) /
+                lookupCount).count();
+        float indexedPerLookupUs = (std::chrono::duration_cast<usDuration>(indexedDuration) /
+                lookupCount).count();
+        RecordProperty(base::StringPrintf("LinearLookupDepth%zuUs", depth),
+                base::StringPrintf("%f", linearPerLookupUs));
+        RecordProperty(base::StringPrintf("IndexedLookupDepth%zuUs", depth),
+                base::StringPrintf("%f", indexedPerLookupUs));
+    }
+}
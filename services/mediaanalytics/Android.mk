@@ -6,7 +6,8 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
     main_mediametrics.cpp              \
-    MediaAnalyticsService.cpp
+    MediaAnalyticsService.cpp          \
+    MediaAnalyticsRecordStore.cpp
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils                   \
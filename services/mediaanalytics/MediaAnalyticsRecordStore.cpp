@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "MediaAnalyticsRecordStore"
+#include <utils/Log.h>
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "MediaAnalyticsRecordStore.h"
+
+namespace android {
+
+MediaAnalyticsRecordStore::MediaAnalyticsRecordStore(size_t capacityBytes)
+        : mCapacity(capacityBytes),
+          mTail(0),
+          mBytesUsed(0),
+          mFirstSeq(0),
+          mEvictedCount(0) {
+}
+
+int64_t MediaAnalyticsRecordStore::append(
+        const std::string &key, nsecs_t timestamp, const uint8_t *data, size_t size) {
+    if (size == 0 || size > mCapacity) {
+        return -1;
+    }
+    if (mBuffer == nullptr) {
+        // not value initialized: pages are only committed as records reach them
+        mBuffer.reset(new uint8_t[mCapacity]);
+    }
+
+    // Records are contiguous. Live bytes go from the oldest record to mTail, possibly wrapping
+    // around the end of the buffer; a record that does not fit before the end starts over at 0.
+    size_t offset;
+    for (;;) {
+        if (mEntries.empty()) {
+            offset = 0;
+            break;
+        }
+        const size_t head = mEntries.front().offset;
+        if (head < mTail) {
+            if (mTail + size <= mCapacity) {
+                offset = mTail;
+                break;
+            }
+            if (size <= head) {
+                offset = 0;
+                break;
+            }
+        } else if (mTail + size <= head) {
+            offset = mTail;
+            break;
+        }
+        evictOldest();
+        mEvictedCount++;
+    }
+
+    memcpy(&mBuffer[offset], data, size);
+    mTail = offset + size;
+    mBytesUsed += size;
+
+    const int64_t seq = nextSeq();
+    const size_t keyId = keyIdFor(key);
+    mEntries.push_back({offset, size, timestamp, keyId});
+    mKeys[keyId].seqs.push_back(seq);
+    return seq;
+}
+
+size_t MediaAnalyticsRecordStore::expire(nsecs_t when) {
+    size_t expired = 0;
+    while (!mEntries.empty() && mEntries.front().timestamp < when) {
+        evictOldest();
+        expired++;
+    }
+    return expired;
+}
+
+void MediaAnalyticsRecordStore::clear() {
+    while (!mEntries.empty()) {
+        evictOldest();
+    }
+}
+
+int64_t MediaAnalyticsRecordStore::forEach(int64_t sinceSeq, nsecs_t sinceTime,
+        const std::string &key, const Visitor &visitor) const {
+    const int64_t firstSeq = std::max(sinceSeq, mFirstSeq);
+    if (key.empty()) {
+        for (int64_t seq = firstSeq; seq < nextSeq(); seq++) {
+            const Entry &entry = mEntries[seq - mFirstSeq];
+            if (entry.timestamp < sinceTime) {
+                continue;
+            }
+            if (!visitor(seq, entry.timestamp, mKeys[entry.keyId].key,
+                    &mBuffer[entry.offset], entry.size)) {
+                return seq + 1;
+            }
+        }
+        return nextSeq();
+    }
+
+    auto it = mKeyIds.find(key);
+    if (it == mKeyIds.end()) {
+        return nextSeq();
+    }
+    const std::deque<int64_t> &seqs = mKeys[it->second].seqs;
+    for (auto seqIt = std::lower_bound(seqs.begin(), seqs.end(), firstSeq);
+            seqIt != seqs.end(); ++seqIt) {
+        const Entry &entry = mEntries[*seqIt - mFirstSeq];
+        if (entry.timestamp < sinceTime) {
+            continue;
+        }
+        if (!visitor(*seqIt, entry.timestamp, key, &mBuffer[entry.offset], entry.size)) {
+            return *seqIt + 1;
+        }
+    }
+    return nextSeq();
+}
+
+void MediaAnalyticsRecordStore::evictOldest() {
+    const Entry &entry = mEntries.front();
+    // per key sequence numbers are in order, so the oldest record is first in its key index too
+    KeyIndex &keyIndex = mKeys[entry.keyId];
+    keyIndex.seqs.pop_front();
+    if (keyIndex.seqs.empty()) {
+        // keys come and go with the clients, only those with records are kept
+        ALOGV("dropping key '%s' id %zu", keyIndex.key.c_str(), entry.keyId);
+        mKeyIds.erase(keyIndex.key);
+        keyIndex.key.clear();
+        keyIndex.key.shrink_to_fit();
+        mFreeKeyIds.push_back(entry.keyId);
+    }
+    mBytesUsed -= entry.size;
+    mEntries.pop_front();
+    mFirstSeq++;
+    if (mEntries.empty()) {
+        mTail = 0;
+    }
+}
+
+size_t MediaAnalyticsRecordStore::keyIdFor(const std::string &key) {
+    auto it = mKeyIds.find(key);
+    if (it != mKeyIds.end()) {
+        return it->second;
+    }
+    size_t keyId;
+    if (!mFreeKeyIds.empty()) {
+        keyId = mFreeKeyIds.back();
+        mFreeKeyIds.pop_back();
+        mKeys[keyId].key = key;
+    } else {
+        keyId = mKeys.size();
+        mKeys.push_back({key, {}});
+    }
+    mKeyIds.emplace(key, keyId);
+    ALOGV("new key '%s' id %zu", key.c_str(), keyId);
+    return keyId;
+}
+
+} // namespace android
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MEDIAANALYTICSRECORDSTORE_H
+#define ANDROID_MEDIAANALYTICSRECORDSTORE_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// Fixed size, in-memory store of serialized records, oldest first.
+//
+// Records are opaque byte strings kept back to back in a single ring buffer; the oldest records
+// are evicted when a new one does not fit, so memory is bounded by bytes rather than by record
+// count. Every record gets a sequence number, increasing by one per record since the store was
+// created, so a reader can resume where it left off. Records are also indexed by key, so reading
+// the records of one key does not visit the others.
+//
+// Not thread safe, the caller serializes access.
+class MediaAnalyticsRecordStore {
+public:
+    // Called for each record visited, in sequence order. Data is only valid during the call.
+    // Return false to stop the visit.
+    typedef std::function<bool(int64_t seq, nsecs_t timestamp, const std::string &key,
+            const uint8_t *data, size_t size)> Visitor;
+
+    explicit MediaAnalyticsRecordStore(size_t capacityBytes);
+
+    // Copies the record in the store, evicting the oldest records as needed.
+    // Returns the sequence number of the record, or -1 if it is larger than the store.
+    int64_t append(const std::string &key, nsecs_t timestamp, const uint8_t *data, size_t size);
+
+    // Evicts records with a timestamp older than 'when', from the oldest until the first more
+    // recent one. Returns the number of records evicted.
+    size_t expire(nsecs_t when);
+
+    // Evicts all records, sequence numbers keep increasing.
+    void clear();
+
+    // Visits the records with a sequence number >= 'sinceSeq' and a timestamp >= 'sinceTime',
+    // restricted to 'key' unless it is empty. Returns the sequence number to pass next time to
+    // only see the records not visited yet.
+    int64_t forEach(int64_t sinceSeq, nsecs_t sinceTime, const std::string &key,
+            const Visitor &visitor) const;
+
+    size_t count() const { return mEntries.size(); }
+    size_t bytesUsed() const { return mBytesUsed; }
+    size_t capacity() const { return mCapacity; }
+    // the sequence number of the oldest record retained, or of the next record if empty
+    int64_t firstSeq() const { return mFirstSeq; }
+    int64_t nextSeq() const { return mFirstSeq + mEntries.size(); }
+    // records evicted to make room for new ones (not counting expire() and clear())
+    int64_t evictedCount() const { return mEvictedCount; }
+
+private:
+    struct Entry {
+        size_t offset;      // in mBuffer
+        size_t size;
+        nsecs_t timestamp;
+        size_t keyId;       // in mKeys
+    };
+
+    struct KeyIndex {
+        std::string key;
+        std::deque<int64_t> seqs;   // records with this key, oldest first
+    };
+
+    void evictOldest();
+    size_t keyIdFor(const std::string &key);
+
+    const size_t mCapacity;
+    std::unique_ptr<uint8_t[]> mBuffer;     // allocated on first append
+    size_t mTail;                           // where the last record ends
+    size_t mBytesUsed;                      // payload bytes, excluding padding at wrap points
+
+    std::deque<Entry> mEntries;             // mEntries[i] has sequence number mFirstSeq + i
+    int64_t mFirstSeq;
+    int64_t mEvictedCount;
+
+    std::vector<KeyIndex> mKeys;            // by key id, empty when free
+    std::map<std::string, size_t> mKeyIds;  // keys with records retained
+    std::vector<size_t> mFreeKeyIds;        // reused before growing mKeys
+};
+
+} // namespace android
+
+#endif // ANDROID_MEDIAANALYTICSRECORDSTORE_H
@@ -31,6 +31,8 @@
 #include <string.h>
 #include <pwd.h>
 
+#include <vector>
+
 #include <cutils/atomic.h>
 #include <cutils/properties.h> // for property_get
 
@@ -42,6 +44,7 @@
 #include <binder/IServiceManager.h>
 #include <binder/MemoryHeapBase.h>
 #include <binder/MemoryBase.h>
+#include <binder/Parcel.h>
 #include <gui/Surface.h>
 #include <utils/Errors.h>  // for status_t
 #include <utils/List.h>
@@ -79,12 +82,19 @@ namespace android {
     using namespace android::base;
     using namespace android::content::pm;
 
-// individual records kept in memory: age or count
-// age: <= 36 hours (1.5 days)
-// count: hard limit of # records
-// (0 for either of these disables that threshold)
+// individual records kept in memory: age or size
+// age: <= 36 hours (1.5 days) (0 disables that threshold)
+// size: hard limit of the serialized records, the oldest are discarded first
 static const nsecs_t kMaxRecordAgeNs =  36 * 3600 * (1000*1000*1000ll);
-static const int kMaxRecords    = 0;
+static const size_t kMaxRecordBytes = 2 * 1024 * 1024;
+
+// -binary output of dump(), in host byte order:
+//   header:  uint32_t magic, uint32_t version
+//   records: int64_t seq, int64_t timestamp, uint32_t size, then 'size' bytes of the
+//            record as written by MediaAnalyticsItem::writeToParcel()
+//   end:     int64_t seq, int64_t 0, uint32_t 0; seq is what to pass to -seq next time
+static const uint32_t kBinaryDumpMagic = 0x4d414231; // 'MAB1'
+static const uint32_t kBinaryDumpVersion = 1;
 
 static const char *kServiceName = "media.metrics";
 
@@ -94,8 +104,8 @@ void MediaAnalyticsService::instantiate() {
 }
 
 MediaAnalyticsService::MediaAnalyticsService()
-        : mMaxRecords(kMaxRecords),
-          mMaxRecordAgeNs(kMaxRecordAgeNs),
+        : mMaxRecordAgeNs(kMaxRecordAgeNs),
+          mStore(kMaxRecordBytes),
           mDumpProto(MediaAnalyticsItem::PROTO_V1),
           mDumpProtoDefault(MediaAnalyticsItem::PROTO_V1) {
 
@@ -105,7 +115,6 @@ MediaAnalyticsService::MediaAnalyticsService()
     mItemsFinalized = 0;
     mItemsDiscarded = 0;
     mItemsDiscardedExpire = 0;
-    mItemsDiscardedCount = 0;
 
     mLastSessionID = 0;
     // recover any persistency we set up
@@ -114,14 +123,6 @@ MediaAnalyticsService::MediaAnalyticsService()
 
 MediaAnalyticsService::~MediaAnalyticsService() {
         ALOGD("MediaAnalyticsService destroyed");
-
-    while (mItems.size() > 0) {
-        MediaAnalyticsItem * oitem = *(mItems.begin());
-        mItems.erase(mItems.begin());
-        delete oitem;
-        mItemsDiscarded++;
-        mItemsDiscardedCount++;
-    }
 }
 
 
@@ -250,6 +251,10 @@ status_t MediaAnalyticsService::dump(int fd, const Vector<String16>& args)
     String16 helpOption("-help");
     String16 onlyOption("-only");
     std::string only;
+    String16 seqOption("-seq");
+    int64_t seq_since = 0;
+    String16 binaryOption("-binary");
+    bool binary = false;
     int n = args.size();
 
     for (int i = 0; i < n; i++) {
@@ -298,6 +303,19 @@ status_t MediaAnalyticsService::dump(int fd, const Vector<String16>& args)
                 String8 value(args[i]);
                 only = value.string();
             }
+        } else if (args[i] == seqOption) {
+            i++;
+            if (i < n) {
+                String8 value(args[i]);
+                char *endp;
+                const char *p = value.string();
+                seq_since = strtoll(p, &endp, 10);
+                if (endp == p || *endp != '\0' || seq_since < 0) {
+                    seq_since = 0;
+                }
+            }
+        } else if (args[i] == binaryOption) {
+            binary = true;
         } else if (args[i] == helpOption) {
             result.append("Recognized parameters:\n");
             result.append("-help        this help message\n");
@@ -306,6 +324,8 @@ status_t MediaAnalyticsService::dump(int fd, const Vector<String16>& args)
             result.append("-only X      process records for component X\n");
             result.append("-since X     include records since X\n");
             result.append("             (X is milliseconds since the UNIX epoch)\n");
+            result.append("-seq X       include records with sequence number X and later\n");
+            result.append("-binary      emit records in binary, without headers\n");
             write(fd, result.string(), result.size());
             return NO_ERROR;
         }
@@ -316,29 +336,30 @@ status_t MediaAnalyticsService::dump(int fd, const Vector<String16>& args)
 
     mDumpProto = chosenProto;
 
-    // we ALWAYS dump this piece
-    snprintf(buffer, SIZE, "Dump of the %s process:\n", kServiceName);
-    result.append(buffer);
-
-    dumpHeaders(result, ts_since);
+    if (binary) {
+        dumpBinary(fd, ts_since, seq_since, only.c_str());
+    } else {
+        // we ALWAYS dump this piece
+        snprintf(buffer, SIZE, "Dump of the %s process:\n", kServiceName);
+        result.append(buffer);
 
-    dumpRecent(result, ts_since, only.c_str());
+        dumpHeaders(result, ts_since);
 
+        dumpRecent(result, ts_since, seq_since, only.c_str());
+    }
 
     if (clear) {
         // remove everything from the finalized queue
-        while (mItems.size() > 0) {
-            MediaAnalyticsItem * oitem = *(mItems.begin());
-            mItems.erase(mItems.begin());
-            delete oitem;
-            mItemsDiscarded++;
-        }
+        mItemsDiscarded += mStore.count();
+        mStore.clear();
 
         // shall we clear the summary data too?
 
     }
 
-    write(fd, result.string(), result.size());
+    if (!binary) {
+        write(fd, result.string(), result.size());
+    }
     return NO_ERROR;
 }
 
@@ -366,8 +387,14 @@ void MediaAnalyticsService::dumpHeaders(String8 &result, nsecs_t ts_since)
     result.append(buffer);
     snprintf(buffer, SIZE,
         "Records Discarded: %8" PRId64
-            " (by Count: %" PRId64 " by Expiration: %" PRId64 ")\n",
-         mItemsDiscarded, mItemsDiscardedCount, mItemsDiscardedExpire);
+            " (by Size: %" PRId64 " by Expiration: %" PRId64 ")\n",
+         mItemsDiscarded, mStore.evictedCount(), mItemsDiscardedExpire);
+    result.append(buffer);
+    snprintf(buffer, SIZE,
+        "Records Retained: %8zu (%zu of %zu bytes) Sequence: first %" PRId64
+            " next %" PRId64 "\n",
+        mStore.count(), mStore.bytesUsed(), mStore.capacity(),
+        mStore.firstSeq(), mStore.nextSeq());
     result.append(buffer);
     if (ts_since != 0) {
         snprintf(buffer, SIZE,
@@ -378,7 +405,8 @@ void MediaAnalyticsService::dumpHeaders(String8 &result, nsecs_t ts_since)
 }
 
 // the recent, detailed queues
-void MediaAnalyticsService::dumpRecent(String8 &result, nsecs_t ts_since, const char * only)
+void MediaAnalyticsService::dumpRecent(String8 &result, nsecs_t ts_since, int64_t seq_since,
+        const char * only)
 {
     const size_t SIZE = 512;
     char buffer[SIZE];
@@ -390,7 +418,7 @@ void MediaAnalyticsService::dumpRecent(String8 &result, nsecs_t ts_since, const
     // show the recently recorded records
     snprintf(buffer, sizeof(buffer), "\nFinalized Metrics (oldest first):\n");
     result.append(buffer);
-    result.append(this->dumpQueue(ts_since, only));
+    result.append(this->dumpQueue(ts_since, seq_since, only));
 
     // show who is connected and injecting records?
     // talk about # records fed to the 'readers'
@@ -399,83 +427,104 @@ void MediaAnalyticsService::dumpRecent(String8 &result, nsecs_t ts_since, const
 
 // caller has locked mLock...
 String8 MediaAnalyticsService::dumpQueue() {
-    return dumpQueue((nsecs_t) 0, NULL);
+    return dumpQueue((nsecs_t) 0, 0, NULL);
 }
 
-String8 MediaAnalyticsService::dumpQueue(nsecs_t ts_since, const char * only) {
+String8 MediaAnalyticsService::dumpQueue(nsecs_t ts_since, int64_t seq_since, const char * only) {
     String8 result;
-    int slot = 0;
 
-    if (mItems.empty()) {
+    if (mStore.count() == 0) {
             result.append("empty\n");
     } else {
-        List<MediaAnalyticsItem *>::iterator it = mItems.begin();
-        for (; it != mItems.end(); it++) {
-            nsecs_t when = (*it)->getTimestamp();
-            if (when < ts_since) {
-                continue;
-            }
-            if (only != NULL &&
-                strcmp(only, (*it)->getKey().c_str()) != 0) {
-                ALOGV("Omit '%s', it's not '%s'", (*it)->getKey().c_str(), only);
-                continue;
-            }
-            std::string entry = (*it)->toString(mDumpProto);
-            result.appendFormat("%5d: %s\n", slot, entry.c_str());
-            slot++;
-        }
+        // records are prefixed with their sequence number, see -seq
+        mStore.forEach(seq_since, ts_since, only != NULL ? only : "",
+                [&](int64_t seq, nsecs_t, const std::string &, const uint8_t *data, size_t size) {
+            Parcel parcel;
+            parcel.setData(data, size);
+            MediaAnalyticsItem item;
+            item.readFromParcel(parcel);
+            std::string entry = item.toString(mDumpProto);
+            result.appendFormat("%5" PRId64 ": %s\n", seq, entry.c_str());
+            return true;
+        });
     }
 
     return result;
 }
 
+// caller has locked mLock...
+// Records are written straight from the store, batched to limit the number of writes.
+void MediaAnalyticsService::dumpBinary(int fd, nsecs_t ts_since, int64_t seq_since,
+        const char * only) {
+    struct __attribute__((packed)) RecordHeader {
+        int64_t seq;
+        int64_t timestamp;
+        uint32_t size;
+    };
+    const size_t kBatchSize = 64 * 1024;
+    std::vector<uint8_t> batch;
+    batch.reserve(kBatchSize);
+    auto append = [&](const void *data, size_t size) {
+        if (batch.size() + size > kBatchSize && !batch.empty()) {
+            write(fd, batch.data(), batch.size());
+            batch.clear();
+        }
+        if (size > kBatchSize) {
+            write(fd, data, size);
+        } else {
+            const uint8_t *bytes = (const uint8_t *) data;
+            batch.insert(batch.end(), bytes, bytes + size);
+        }
+    };
+
+    const uint32_t header[] = { kBinaryDumpMagic, kBinaryDumpVersion };
+    append(header, sizeof(header));
+    const int64_t next = mStore.forEach(seq_since, ts_since, only != NULL ? only : "",
+            [&](int64_t seq, nsecs_t timestamp, const std::string &, const uint8_t *data,
+                    size_t size) {
+        const RecordHeader record = { seq, timestamp, (uint32_t) size };
+        append(&record, sizeof(record));
+        append(data, size);
+        return true;
+    });
+    const RecordHeader end = { next, 0, 0 };
+    append(&end, sizeof(end));
+    write(fd, batch.data(), batch.size());
+}
+
 //
 // Our Cheap in-core, non-persistent records management.
 
 // insert appropriately into queue
 void MediaAnalyticsService::saveItem(MediaAnalyticsItem * item)
 {
+    // serialize outside of the lock
+    Parcel parcel;
+    item->writeToParcel(&parcel);
 
     Mutex::Autolock _l(mLock);
     // mutex between insertion and dumping the contents
 
     // we want to dump 'in FIFO order', so insert at the end
-    mItems.push_back(item);
-
-    // keep removing old records the front until we're in-bounds (count)
-    if (mMaxRecords > 0) {
-        while (mItems.size() > (size_t) mMaxRecords) {
-            MediaAnalyticsItem * oitem = *(mItems.begin());
-            if (oitem == item) {
-                break;
-            }
-            mItems.erase(mItems.begin());
-            delete oitem;
-            mItemsDiscarded++;
-            mItemsDiscardedCount++;
-        }
+    // the store discards the oldest records until the new one fits
+    const int64_t evicted = mStore.evictedCount();
+    if (mStore.append(item->getKey(), item->getTimestamp(),
+            parcel.data(), parcel.dataSize()) < 0) {
+        ALOGW("discarding record of %zu bytes for key %s",
+                parcel.dataSize(), item->getKey().c_str());
+        mItemsDiscarded++;
     }
+    mItemsDiscarded += mStore.evictedCount() - evicted;
+    delete item;
 
-    // keep removing old records the front until we're in-bounds (count)
+    // keep removing old records the front until we're in-bounds (age)
     // NB: expired entries aren't removed until the next insertion, which could be a while
     if (mMaxRecordAgeNs > 0) {
         nsecs_t now = systemTime(SYSTEM_TIME_REALTIME);
-        while (mItems.size() > 0) {
-            MediaAnalyticsItem * oitem = *(mItems.begin());
-            nsecs_t when = oitem->getTimestamp();
-            if (oitem == item) {
-                break;
-            }
-            // careful about timejumps too
-            if ((now > when) && (now-when) <= mMaxRecordAgeNs) {
-                // this (and the rest) are recent enough to keep
-                break;
-            }
-            mItems.erase(mItems.begin());
-            delete oitem;
-            mItemsDiscarded++;
-            mItemsDiscardedExpire++;
-        }
+        // careful about timejumps too: records from the future are kept
+        const size_t expired = mStore.expire(now - mMaxRecordAgeNs);
+        mItemsDiscarded += expired;
+        mItemsDiscardedExpire += expired;
     }
 }
 
@@ -28,6 +28,8 @@
 
 #include <media/IMediaAnalyticsService.h>
 
+#include "MediaAnalyticsRecordStore.h"
+
 namespace android {
 
 class MediaAnalyticsService : public BnMediaAnalyticsService
@@ -52,7 +54,6 @@ class MediaAnalyticsService : public BnMediaAnalyticsService
     int64_t mItemsFinalized;
     int64_t mItemsDiscarded;
     int64_t mItemsDiscardedExpire;
-    int64_t mItemsDiscardedCount;
     MediaAnalyticsItem::SessionID_t mLastSessionID;
 
     // partitioned a bit so we don't over serialize
@@ -61,8 +62,7 @@ class MediaAnalyticsService : public BnMediaAnalyticsService
     mutable Mutex           mLock_mappings;
 
     // limit how many records we'll retain
-    // by count (in each queue (open, finalized))
-    int32_t mMaxRecords;
+    // by size (of the serialized records), see mStore
     // by time (none older than this long agan
     nsecs_t mMaxRecordAgeNs;
     //
@@ -75,19 +75,20 @@ class MediaAnalyticsService : public BnMediaAnalyticsService
     bool contentValid(MediaAnalyticsItem *item, bool isTrusted);
     bool rateLimited(MediaAnalyticsItem *);
 
-    // (oldest at front) so it prints nicely for dumpsys
-    List<MediaAnalyticsItem *> mItems;
+    // serialized records (oldest at front) so it prints nicely for dumpsys
+    MediaAnalyticsRecordStore mStore;
     void saveItem(MediaAnalyticsItem *);
 
     // support for generating output
     int mDumpProto;
     int mDumpProtoDefault;
     String8 dumpQueue();
-    String8 dumpQueue(nsecs_t, const char *only);
+    String8 dumpQueue(nsecs_t, int64_t seq_since, const char *only);
 
     void dumpHeaders(String8 &result, nsecs_t ts_since);
     void dumpSummaries(String8 &result, nsecs_t ts_since, const char * only);
-    void dumpRecent(String8 &result, nsecs_t ts_since, const char * only);
+    void dumpRecent(String8 &result, nsecs_t ts_since, int64_t seq_since, const char * only);
+    void dumpBinary(int fd, nsecs_t ts_since, int64_t seq_since, const char * only);
 
     // mapping uids to package names
     struct UidToPkgMap {
@@ -131,6 +131,16 @@ status_t MediaLogService::dump(int fd, const Vector<String16>& args __unused)
                 }
             }
             mLock.unlock();
+        } else if (!strcmp(arg0.string(), "--raw")) {
+            // binary dump of the merged entries, to be analyzed offline with nblog_replay
+            // the author names come from mMerger, whose readers are added under mLock
+            if (!dumpTryLock(mLock)) {
+                ALOGW("%s", kDeadlockedString);
+                return NO_ERROR;
+            }
+            mMergeReader.dumpRaw(fd);
+            mLock.unlock();
+            return NO_ERROR;
         }
     }
     mMergeReader.dump(fd);